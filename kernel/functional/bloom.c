@@ -32,17 +32,13 @@
 static bool
 bloom_src(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
+	const struct iphdr *ip = pfq_ip_hdr(b);
+
+	if (ip != NULL)
 	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
 		unsigned int mask;
 		char *mem;
 
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return false;
-
 		mem = get_arg1(char *, args);
         	mask = get_arg0(unsigned int, args);
 
@@ -60,17 +56,13 @@ bloom_src(arguments_t args, SkBuff b)
 static bool
 bloom_dst(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
+	const struct iphdr *ip = pfq_ip_hdr(b);
+
+	if (ip != NULL)
 	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
 		unsigned int mask;
 		char *mem;
 
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return false;
-
 		mem = get_arg1(char *, args);
         	mask = get_arg0(unsigned int, args);
 
@@ -87,17 +79,13 @@ bloom_dst(arguments_t args, SkBuff b)
 static bool
 bloom(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
+	const struct iphdr *ip = pfq_ip_hdr(b);
+
+	if (ip != NULL)
 	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
 		unsigned int mask;
 		char *mem;
 
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return false;
-
 		mem  = get_arg1(char *, args);
         	mask = get_arg0(unsigned int, args);
 
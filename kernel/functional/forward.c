@@ -29,6 +29,7 @@
 #include <pf_q-transmit.h>
 #include <pf_q-module.h>
 #include <pf_q-global.h>
+#include <pf_q-rx-pool.h>
 
 
 #include "forward.h"
@@ -56,7 +57,7 @@ forwardIO(arguments_t args, SkBuff b)
                 return Pass(b);
 	}
 
-	nskb = skb_clone(b.skb, GFP_ATOMIC);
+	nskb = pfq_rx_pool_skb_share(b.skb, true);
 	if (!nskb) {
                 if (printk_ratelimit())
         		printk(KERN_INFO "[PFQ/lang] forward pfq_xmit %s: no memory!\n", dev->name);
@@ -130,40 +130,37 @@ log_buff(arguments_t args, SkBuff b)
 static Action_SkBuff
 log_packet(arguments_t args, SkBuff b)
 {
+	const struct iphdr *ip;
+
 	if (!printk_ratelimit())
 		return Pass(b);
 
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
+	ip = pfq_ip_hdr(b);
+	if (ip != NULL)
 	{
-		struct iphdr _iph;
-		const struct iphdr *ip;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
-		if (ip == NULL)
-			return Pass(b);
+		const struct udphdr *udp;
+		const struct tcphdr *tcp;
 
-		switch(ip->protocol)
-		{
-		case IPPROTO_UDP: {
-			struct udphdr _udph; const struct udphdr *udp;
-			udp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(struct udphdr), &_udph);
-			if (udp == NULL)
-				return Pass(b);
+		if ((udp = pfq_udp_hdr(b))) {
 
 			printk(KERN_INFO "[PFQ/lang] IP %pI4.%d > %pI4.%d: UDP\n", &ip->saddr, ntohs(udp->source),
 						         		      &ip->daddr, ntohs(udp->dest));
 			return Pass(b);
 		}
-		case IPPROTO_TCP: {
-			struct tcphdr _tcph; const struct tcphdr *tcp;
-			tcp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(struct tcphdr), &_tcph);
-			if (tcp == NULL)
-				return Pass(b);
+
+		if ((tcp = pfq_tcp_hdr(b))) {
 
 			printk(KERN_INFO "[PFQ/lang] IP %pI4.%d > %pI4.%d: TCP\n", &ip->saddr, ntohs(tcp->source),
 									      &ip->daddr, ntohs(tcp->dest));
 			return Pass(b);
 		}
+
+		switch(ip->protocol)
+		{
+		case IPPROTO_UDP:
+		case IPPROTO_TCP:
+			return Pass(b);  /* truncated */
+
 		case IPPROTO_ICMP: {
 
 			printk(KERN_INFO "[PFQ/lang] IP %pI4 > %pI4: ICMP\n", &ip->saddr, &ip->daddr);
@@ -185,6 +182,16 @@ log_packet(arguments_t args, SkBuff b)
 }
 
 
+static Action_SkBuff
+snap(arguments_t args, SkBuff b)
+{
+	const int len = get_arg(int, args);
+
+	PFQ_CB(b.skb)->snaplen = len > 0 ? len : 0;
+	return Pass(b);
+}
+
+
 static Action_SkBuff
 inv(arguments_t args, SkBuff b)
 {
@@ -230,6 +237,7 @@ struct pfq_function_descr misc_functions[] = {
         { "log_msg",  	"String -> SkBuff -> Action SkBuff", 		log_msg 	},
         { "log_buff",   "SkBuff -> Action SkBuff", 			log_buff 	},
         { "log_packet", "SkBuff -> Action SkBuff", 			log_packet	},
+        { "snap", 	"CInt -> SkBuff -> Action SkBuff",     		snap 		},
 
         { "inv", 	"(SkBuff -> Action SkBuff) -> SkBuff -> Action SkBuff",     				inv },
         { "par", 	"(SkBuff -> Action SkBuff) -> (SkBuff -> Action SkBuff) -> SkBuff -> Action SkBuff",    par },
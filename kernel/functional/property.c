@@ -34,94 +34,54 @@
 static uint64_t
 ip_tos(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
+	const struct iphdr *ip = pfq_ip_hdr(b);
+	if (ip == NULL)
+		return NOTHING;
 
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		return JUST(ip->tos);
-	}
-
-        return NOTHING;
+	return JUST(ip->tos);
 }
 
 
 static uint64_t
 ip_tot_len(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		return JUST(ntohs(ip->tot_len));
-	}
+	const struct iphdr *ip = pfq_ip_hdr(b);
+	if (ip == NULL)
+		return NOTHING;
 
-        return NOTHING;
+	return JUST(ntohs(ip->tot_len));
 }
 
 
 static uint64_t
 ip_id(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
+	const struct iphdr *ip = pfq_ip_hdr(b);
+	if (ip == NULL)
+		return NOTHING;
 
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		return JUST(ntohs(ip->id));
-	}
-
-        return NOTHING;
+	return JUST(ntohs(ip->id));
 }
 
 
 static uint64_t
 ip_ttl(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
+	const struct iphdr *ip = pfq_ip_hdr(b);
+	if (ip == NULL)
+		return NOTHING;
 
-		return JUST(ip->ttl);
-	}
-
-        return NOTHING;
+	return JUST(ip->ttl);
 }
 
 static uint64_t
 ip_frag(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		return JUST(ntohs(ip->frag_off));
-	}
+	const struct iphdr *ip = pfq_ip_hdr(b);
+	if (ip == NULL)
+		return NOTHING;
 
-        return NOTHING;
+	return JUST(ntohs(ip->frag_off));
 }
 
 
@@ -132,86 +92,32 @@ ip_frag(arguments_t args, SkBuff b)
 static uint64_t
 tcp_source(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct tcphdr _tcp;
-		const struct tcphdr *tcp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_TCP)
-                        return NOTHING;
+	const struct tcphdr *tcp = pfq_tcp_hdr(b);
+	if (tcp == NULL)
+		return NOTHING;
 
-		tcp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_tcp), &_tcp);
-		if (tcp == NULL)
-			return NOTHING;
-
-		return JUST(ntohs(tcp->source));
-	}
-
-        return NOTHING;
+	return JUST(ntohs(tcp->source));
 }
 
 
 static uint64_t
 tcp_dest(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct tcphdr _tcp;
-		const struct tcphdr *tcp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_TCP)
-                        return NOTHING;
-
-		tcp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_tcp), &_tcp);
-		if (tcp == NULL)
-			return NOTHING;
+	const struct tcphdr *tcp = pfq_tcp_hdr(b);
+	if (tcp == NULL)
+		return NOTHING;
 
-		return JUST(ntohs(tcp->dest));
-	}
-
-        return NOTHING;
+	return JUST(ntohs(tcp->dest));
 }
 
 static uint64_t
 tcp_hdrlen_(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct tcphdr _tcp;
-		const struct tcphdr *tcp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_TCP)
-                        return NOTHING;
-
-		tcp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_tcp), &_tcp);
-		if (tcp == NULL)
-			return NOTHING;
-
-		return JUST(tcp->doff * 4);
-	}
+	const struct tcphdr *tcp = pfq_tcp_hdr(b);
+	if (tcp == NULL)
+		return NOTHING;
 
-        return NOTHING;
+	return JUST(tcp->doff * 4);
 }
 
 /****************************************************************
@@ -221,144 +127,54 @@ tcp_hdrlen_(arguments_t args, SkBuff b)
 static uint64_t
 udp_source(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
+	const struct udphdr *udp = pfq_udp_hdr(b);
+	if (udp == NULL)
+		return NOTHING;
 
-		struct udphdr _udp;
-		const struct udphdr *udp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_TCP)
-                        return NOTHING;
-
-		udp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
-		if (udp == NULL)
-			return NOTHING;
-
-		return JUST(ntohs(udp->source));
-	}
-
-        return NOTHING;
+	return JUST(ntohs(udp->source));
 }
 
 
 static uint64_t
 udp_dest(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct udphdr _udp;
-		const struct udphdr *udp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
+	const struct udphdr *udp = pfq_udp_hdr(b);
+	if (udp == NULL)
+		return NOTHING;
 
-		if (ip->protocol != IPPROTO_TCP)
-                        return NOTHING;
-
-		udp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
-		if (udp == NULL)
-			return NOTHING;
-
-		return JUST(ntohs(udp->dest));
-	}
-
-        return NOTHING;
+	return JUST(ntohs(udp->dest));
 }
 
 static uint64_t
 udp_len(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct udphdr _udp;
-		const struct udphdr *udp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_TCP)
-                        return NOTHING;
+	const struct udphdr *udp = pfq_udp_hdr(b);
+	if (udp == NULL)
+		return NOTHING;
 
-		udp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
-		if (udp == NULL)
-			return NOTHING;
-
-		return JUST(ntohs(udp->len));
-	}
-
-        return NOTHING;
+	return JUST(ntohs(udp->len));
 }
 
 
 static uint64_t
 icmp_type(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct icmphdr _icmp;
-		const struct icmphdr *icmp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_ICMP)
-                        return NOTHING;
-
-		icmp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_icmp), &_icmp);
-		if (icmp == NULL)
-			return NOTHING;
+	const struct icmphdr *icmp = pfq_icmp_hdr(b);
+	if (icmp == NULL)
+		return NOTHING;
 
-		return JUST(icmp->type);
-	}
-
-        return NOTHING;
+	return JUST(icmp->type);
 }
 
 
 static uint64_t
 icmp_code(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct icmphdr _icmp;
-		const struct icmphdr *icmp;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return NOTHING;
-
-		if (ip->protocol != IPPROTO_ICMP)
-                        return NOTHING;
-
-		icmp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_icmp), &_icmp);
-		if (icmp == NULL)
-			return NOTHING;
-
-		return JUST(icmp->code);
-	}
+	const struct icmphdr *icmp = pfq_icmp_hdr(b);
+	if (icmp == NULL)
+		return NOTHING;
 
-        return NOTHING;
+	return JUST(icmp->code);
 }
 
 
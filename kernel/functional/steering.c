@@ -26,6 +26,7 @@
 #include <linux/swab.h>
 
 #include <pf_q-module.h>
+#include <pf_q-hash.h>
 
 
 static Action_SkBuff
@@ -79,22 +80,12 @@ steering_vlan_id(arguments_t args, SkBuff b)
 static Action_SkBuff
 steering_ip(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-		__be32 hash;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return Drop(b);
+	const struct iphdr *ip = pfq_ip_hdr(b);
 
-		hash = ip->saddr ^ ip->daddr;
+	if (ip == NULL)
+		return Drop(b);
 
-        	return Steering(b, *(uint32_t *)&hash);
-	}
-
-        return Drop(b);
+	return Steering(b, pfq_hash_ip(ip->saddr, ip->daddr));
 }
 
 
@@ -126,23 +117,18 @@ steering_net(arguments_t args, SkBuff b)
 	__be32 mask    = get_arg1(__be32, args);
 	__be32 submask = get_arg2(__be32, args);
 
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
+	const struct iphdr *ip = pfq_ip_hdr(b);
+
+	if (ip == NULL)
+		return Drop(b);
+
+	if ((ip->saddr & mask) == addr)
+	{
+		return Steering(b, __swab32(ntohl(ip->saddr & submask)));
+	}
+	if ((ip->daddr & mask) == addr)
 	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return Drop(b);
-
-		if ((ip->saddr & mask) == addr)
-		{
-        		return Steering(b, __swab32(ntohl(ip->saddr & submask)));
-		}
-		if ((ip->daddr & mask) == addr)
-		{
-        		return Steering(b, __swab32(ntohl(ip->daddr & submask)));
-		}
+		return Steering(b, __swab32(ntohl(ip->daddr & submask)));
 	}
 
         return Drop(b);
@@ -152,62 +138,34 @@ steering_net(arguments_t args, SkBuff b)
 static Action_SkBuff
 steering_flow(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IP))
-	{
-		struct iphdr _iph;
-    		const struct iphdr *ip;
-
-		struct udphdr _udp;
-		const struct udphdr *udp;
-               	__be32 hash;
+	const struct pfq_flow *flow = pfq_flow(b);
 
-		ip = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_iph), &_iph);
- 		if (ip == NULL)
-                        return Drop(b);
+	if (flow == NULL)
+		return Drop(b);
 
-		if (ip->protocol != IPPROTO_UDP &&
-		    ip->protocol != IPPROTO_TCP)
-                        return Drop(b);
+	if (flow->proto != IPPROTO_UDP &&
+	    flow->proto != IPPROTO_TCP)
+		return Drop(b);
 
-		udp = skb_header_pointer(b.skb, b.skb->mac_len + (ip->ihl<<2), sizeof(_udp), &_udp);
-		if (udp == NULL)
-			return Drop(b);  /* broken */
+	/* the fragments of a datagram have no ports: they are steered
+	 * by addresses only, all to the same endpoint */
 
-		hash = ip->saddr ^ ip->daddr ^ (__force __be32)udp->source ^ (__force __be32)udp->dest;
+	if (!pfq_has_headers(b, Q_HDR_PORTS) && !pfq_has_headers(b, Q_HDR_FRAG))
+		return Drop(b);  /* broken */
 
-        	return Steering(b, *(uint32_t *)&hash);
-	}
-
-        return Drop(b);
+	return Steering(b, pfq_hash_flow(flow->saddr, flow->daddr, flow->source, flow->dest));
 }
 
 
 static Action_SkBuff
 steering_ip6(arguments_t args, SkBuff b)
 {
-	if (eth_hdr(b.skb)->h_proto == __constant_htons(ETH_P_IPV6))
-	{
-		struct ipv6hdr _ip6h;
-    		const struct ipv6hdr *ip6;
-		__be32 hash;
-
-		ip6 = skb_header_pointer(b.skb, b.skb->mac_len, sizeof(_ip6h), &_ip6h);
- 		if (ip6 == NULL)
-                        return Drop(b);
-
-		hash = ip6->saddr.in6_u.u6_addr32[0] ^
-		       ip6->saddr.in6_u.u6_addr32[1] ^
-		       ip6->saddr.in6_u.u6_addr32[2] ^
-		       ip6->saddr.in6_u.u6_addr32[3] ^
-		       ip6->daddr.in6_u.u6_addr32[0] ^
-		       ip6->daddr.in6_u.u6_addr32[1] ^
-		       ip6->daddr.in6_u.u6_addr32[2] ^
-		       ip6->daddr.in6_u.u6_addr32[3];
-
-		return Steering(b, *(uint32_t *)&hash);
-	}
+	const struct ipv6hdr *ip6 = pfq_ip6_hdr(b);
 
-        return Drop(b);
+	if (ip6 == NULL)
+		return Drop(b);
+
+	return Steering(b, pfq_hash_ip6(&ip6->saddr, &ip6->daddr));
 }
 
 
@@ -63,15 +63,34 @@ static inline void smp_mb()  { mb();      }
 static inline void smp_rmb() { barrier(); }
 static inline void smp_wmb() { barrier(); }
 
+static inline void cpu_relax() { asm volatile ("pause" ::: "memory"); }
+
 
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
+
+/* wait strategy of read, when the rx queue is empty */
+
+#define Q_WAIT_SPIN             0       /* busy-poll the queue, up to the timeout */
+#define Q_WAIT_HYBRID           1       /* busy-poll for a spin budget (ns), then ppoll */
+#define Q_WAIT_BLOCK            2       /* ppoll */
+#define Q_WAIT_NONE             3       /* return at once, the queue may be empty */
+
+/* spinning is opt-in: read does not wait unless compiled with PFQ_USE_POLL */
+
+#ifdef PFQ_USE_POLL
+#define Q_WAIT_DEFAULT          Q_WAIT_BLOCK
+#else
+#define Q_WAIT_DEFAULT          Q_WAIT_NONE
+#endif
+
 #endif /* __KERNEL__ */
 
 #define Q_MAX_COUNTERS           	64
 #define Q_MAX_PERSISTENT 		1024
 #define Q_MAX_TX_QUEUES 		4
+#define Q_MAX_RX_SEGMENTS 		16
 
 /* Common header */
 
@@ -115,10 +134,41 @@ struct pfq_pkthdr
 
 
 
+/* zero-copy rx: the slot carries the position of the packet in the pool */
+
+struct pfq_pkthdr_frame
+{
+        uint32_t    index;      /* frame index */
+        uint32_t    offset;     /* offset of the packet in the frame */
+};
+
+
 struct pfq_pkthdr_tx
 {
 	uint16_t len;
 	uint16_t res;
+	uint32_t res1;
+	uint64_t tstamp;	/* departure time (CLOCK_MONOTONIC, nsec): 0 = as soon as possible */
+};
+
+
+/* Tx kernel threads: counters of the polling loop */
+
+struct pfq_tx_thread_stats
+{
+        unsigned long long busy;        /* loops with packets to transmit */
+        unsigned long long idle;        /* loops on an empty queue */
+        unsigned long long wakeup;      /* sleeps ended by the doorbell */
+};
+
+
+/* paced Tx: error of the inter-departure times with respect to the timestamps */
+
+struct pfq_tx_pace_stats
+{
+        unsigned long long paced;       /* packets transmitted at their departure time */
+        unsigned long long jitter;      /* sum of the inter-departure errors (nsec, absolute) */
+        unsigned long long jitter_max;  /* max inter-departure error (nsec, absolute) */
 };
 
 
@@ -132,10 +182,29 @@ struct pfq_tx_queue_hdr
 
         struct
         {
-                volatile unsigned int index;
+                volatile unsigned int index;    /* zero-copy Tx: completion index (slots released by the driver) */
                 unsigned int cache;
         } consumer __attribute__((aligned(64)));
 
+        struct
+        {
+                volatile unsigned int asleep;   /* doorbell: the Tx thread waits for a flush */
+                struct pfq_tx_thread_stats stats;
+        } thread __attribute__((aligned(64)));
+
+        struct
+        {
+                unsigned long long last_tstamp;         /* of the last packet paced (kernel) */
+                unsigned long long last_departure;
+                struct pfq_tx_pace_stats stats;
+        } pace __attribute__((aligned(64)));
+
+        struct
+        {
+                volatile unsigned long long iter;       /* iterations completed (kernel) */
+                volatile unsigned int active;           /* the slots are being looped */
+        } loop __attribute__((aligned(64)));
+
         unsigned int size_mask;        /* number of slots */
         unsigned int max_len;          /* max length of packet */
         unsigned int size;             /* number of slots (power of two) */
@@ -150,6 +219,18 @@ struct pfq_rx_queue_hdr
         unsigned int            size;       /* number of slots */
         unsigned int            slot_size;  /* sizeof(pfq_pkthdr) + max_len + sizeof(skb_shinfo) */
 
+        unsigned int            rings;      /* number of per-cpu sub-rings (0 = double buffer) */
+        unsigned int            ring_size;  /* number of slots of a sub-ring (power of two) */
+        unsigned int            ring_mem;   /* bytes of a sub-ring, header included */
+
+        unsigned int            segments;   /* number of rx segments (2 = double buffer) */
+        volatile unsigned int   released;   /* segments returned by user space */
+        volatile unsigned int   seg[Q_MAX_RX_SEGMENTS];  /* index and length of the segments closed by the kernel */
+
+        uint32_t                tsc_khz;    /* raw tsc timestamps: calibration (0 = not available) */
+        uint64_t                tsc_base;   /* tsc at ns_base */
+        uint64_t                ns_base;    /* realtime (ns) at the enable of the socket */
+
 } __attribute__((aligned(64)));
 
 
@@ -163,12 +244,46 @@ struct pfq_queue_hdr
 {
         struct pfq_rx_queue_hdr rx;
         struct pfq_tx_queue_hdr tx[Q_MAX_TX_QUEUES];
+        struct pfq_tx_queue_hdr completion;  /* zero-copy rx: frames returned by user space (uint32_t) */
 };
 
 
+#ifndef __KERNEL__
+
+/* raw tsc timestamps: convert a tsc into realtime (ns), by the calibration of the rx queue.
+ * A tsc taken before the calibration (e.g. on another cpu) is converted backwards. */
+
+static inline uint64_t
+pfq_rx_tsc_delta_ns(struct pfq_rx_queue_hdr const *rx, uint64_t delta)
+{
+        return delta / rx->tsc_khz * 1000000 + delta % rx->tsc_khz * 1000000 / rx->tsc_khz;
+}
+
+static inline uint64_t
+pfq_rx_tsc_to_ns(struct pfq_rx_queue_hdr const *rx, uint64_t tsc)
+{
+        uint64_t ns;
+
+        if (tsc >= rx->tsc_base)
+                return rx->ns_base + pfq_rx_tsc_delta_ns(rx, tsc - rx->tsc_base);
+
+        ns = pfq_rx_tsc_delta_ns(rx, rx->tsc_base - tsc);
+        return ns < rx->ns_base ? rx->ns_base - ns : 0;
+}
+
+#endif
+
+
 /* slots size... */
 
 #define MPDB_QUEUE_SLOT_SIZE(x)    ALIGN(sizeof(struct pfq_pkthdr) + x, 64)
+#define MPDB_QUEUE_FRAME_SLOT_SIZE ALIGN(sizeof(struct pfq_pkthdr) + sizeof(struct pfq_pkthdr_frame), 64)
+
+/* packed rx queue: the length of the queue is in blocks, each packet takes the blocks it needs */
+
+#define MPDB_QUEUE_BLOCK                64
+#define MPDB_QUEUE_PACKED_SLOT_SIZE(caplen) \
+        ((sizeof(struct pfq_pkthdr) + (caplen) + MPDB_QUEUE_BLOCK - 1) & ~(size_t)(MPDB_QUEUE_BLOCK - 1))
 #define SPSC_QUEUE_SLOT_SIZE(x)    ALIGN(sizeof(struct pfq_pkthdr_tx) + x, 64)
 
 
@@ -179,6 +294,16 @@ unsigned int pfq_spsc_next_index(struct pfq_tx_queue_hdr *q, unsigned int n)
 }
 
 
+/* slots in use: the producer always leaves one slot free, so that a full
+ * ring (size - 1 slots) is never mistaken for an empty one */
+
+static inline
+unsigned int pfq_spsc_len(struct pfq_tx_queue_hdr const *q)
+{
+        return (q->producer.index - q->consumer.index) & q->size_mask;
+}
+
+
 /* producer */
 
 static inline
@@ -275,6 +400,21 @@ void pfq_spsc_read_commit(struct pfq_tx_queue_hdr *q)
    +                             +                             +                            +
    | <------+ queue rx  +------> |  <----+ queue rx +------>   |  <----+ queue tx +------>  |  <----+ queue tx +------>
    +                             +                             +                            +
+
+   With a packed rx queue, the slots have variable length (MPDB_QUEUE_PACKED_SLOT_SIZE(caplen)), and
+   the length of the queue (rx.data) is expressed in blocks of MPDB_QUEUE_BLOCK bytes.
+
+   With a rx pool (zero-copy rx), the rx slots carry a pfq_pkthdr_frame in place of the packet, and the
+   queue tx are followed by the completion ring, where user space returns the frames to the kernel.
+
+   With per-cpu rx rings, the memory of the two rx queues is split in rx.rings sub-rings of rx.ring_mem
+   bytes, one per online cpu. Each sub-ring is a single-producer ring (the cpu that delivers the packets):
+   a pfq_tx_queue_hdr followed by rx.ring_size slots. The producer index is published once per batch.
+
+   With more than two rx segments, the rx memory holds rx.segments queues of rx.size slots, and the
+   segment of index i is (i % rx.segments). When the segment being filled is full, the kernel closes it
+   (its index and length are stored in rx.seg) and moves to the next one, provided that user space has
+   returned it: the segments of index in [rx.released, index of rx.data) are owned by user space.
    */
 
 
@@ -298,6 +438,7 @@ void pfq_spsc_read_commit(struct pfq_tx_queue_hdr *q)
 #define Q_SO_GROUP_VLAN_FILT_TOGGLE 	13      /* enable/disable VLAN filters */
 #define Q_SO_GROUP_VLAN_FILT        	14      /* enable/disable VLAN ID filters */
 #define Q_SO_GROUP_FUNCTION     	15
+#define Q_SO_GROUP_FUNCTIONS     	18      /* load computations of multiple groups */
 
 #define Q_SO_EGRESS_BIND         	16
 #define Q_SO_EGRESS_UNBIND         	17
@@ -320,6 +461,18 @@ void pfq_spsc_read_commit(struct pfq_tx_queue_hdr *q)
 #define Q_SO_TX_UNBIND 			34
 #define Q_SO_TX_FLUSH			35
 
+#define Q_SO_SET_RX_POOL		36      /* zero-copy rx: register a user page pool */
+#define Q_SO_SET_RX_PACKED		37      /* variable-length rx slots */
+#define Q_SO_SET_RX_RINGS		38      /* per-cpu rx sub-rings */
+#define Q_SO_SET_RX_WAKEUP		39      /* wakeup coalescing and eventfd */
+#define Q_SO_SET_RX_SEGMENTS		40      /* number of rx segments */
+#define Q_SO_GROUP_SNAPLEN		41      /* per-group, per-class capture length */
+#define Q_SO_SET_SHMEM_NODE		42      /* NUMA node of the shared memory (-1 = auto) */
+#define Q_SO_GET_SHMEM_NODE		43
+#define Q_SO_SET_TX_ZEROCOPY		44      /* transmit from the Tx queues without copy */
+#define Q_SO_SET_TX_ENGINE		45      /* shared per-core Tx engines instead of per-queue threads */
+#define Q_SO_TX_LOOP			46      /* transmit the slots of a Tx queue repeatedly (struct pfq_tx_loop) */
+
 
 /* general placeholders */
 
@@ -335,6 +488,8 @@ void pfq_spsc_read_commit(struct pfq_tx_queue_hdr *q)
 
 #define Q_TSTAMP_OFF          0       /* default */
 #define Q_TSTAMP_ON           1
+#define Q_TSTAMP_TSC          2       /* raw tsc, read per packet (tstamp.tv64) */
+#define Q_TSTAMP_TSC_BATCH    3       /* raw tsc, read once per batch (tstamp.tv64) */
 
 /* vlan */
 
@@ -412,6 +567,36 @@ struct pfq_vlan_toggle
         int toggle;
 };
 
+struct pfq_group_snaplen
+{
+        int gid;
+        unsigned long class_mask;
+        int snaplen;            /* 0 = caplen of the socket */
+};
+
+/* Tx loop: the next slots enqueued are transmitted count times (-1 = forever,
+ * 0 = stop the loop), then released. Per packet rewrites (IPv4/UDP, checksums
+ * updated) use the sequence number of the packet: iteration * slots + slot */
+
+#define Q_TX_LOOP_IP_ID         (1 << 0)        /* ip id + seq */
+#define Q_TX_LOOP_SADDR         (1 << 1)        /* saddr + seq % saddr_range */
+#define Q_TX_LOOP_DADDR         (1 << 2)        /* daddr + seq % daddr_range */
+#define Q_TX_LOOP_SPORT         (1 << 3)        /* sport + seq % sport_range (udp) */
+#define Q_TX_LOOP_DPORT         (1 << 4)        /* dport + seq % dport_range (udp) */
+
+struct pfq_tx_loop
+{
+        int queue;                      /* Tx queue */
+        int flags;                      /* Q_TX_LOOP_ rewrites */
+        long long count;
+        unsigned int slots;             /* slots looped, the next ones enqueued */
+
+        uint32_t saddr, saddr_range;    /* host byte order */
+        uint32_t daddr, daddr_range;
+        uint16_t sport, sport_range;
+        uint16_t dport, dport_range;
+};
+
 struct pfq_binding
 {
         union {
@@ -436,6 +621,12 @@ struct pfq_group_computation
         struct pfq_computation_descr __user *prog;
 };
 
+struct pfq_group_computations
+{
+        size_t size;
+        struct pfq_group_computation __user *comp;
+};
+
 
 struct pfq_group_context
 {
@@ -445,6 +636,31 @@ struct pfq_group_context
         int level;
 };
 
+/* zero-copy rx: user memory where packets are received */
+
+#define Q_RX_POOL_HEADROOM      128     /* frame headroom (direct-capture drivers) */
+
+struct pfq_rx_pool_descr
+{
+        void __user *   addr;           /* page aligned */
+        size_t          size;           /* bytes */
+        size_t          frame_size;     /* power of two, 2048 up to PAGE_SIZE */
+        int             if_index;       /* device of direct-capture driver, or Q_ANY_DEVICE */
+        int             hw_queue;
+};
+
+
+/* rx wakeup coalescing: the waiters (poll and eventfd) are notified when the queue
+   holds 'packets' packets, or at most 'usecs' microseconds after the first packet */
+
+struct pfq_rx_wakeup
+{
+        int             packets;        /* 1 = at the first packet (default) */
+        int             usecs;          /* 0 = no deadline */
+        int             eventfd;        /* eventfd to signal, or -1 */
+};
+
+
 /* pfq_fprog: per-group sock_fprog */
 
 struct pfq_fprog
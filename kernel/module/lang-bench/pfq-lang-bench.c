@@ -0,0 +1,296 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+/*
+ * PFQ/lang microbenchmark: runs a batch of synthetic UDP/IPv4 skbs through
+ * a computation, both per packet (pfq_run) and a batch at a time
+ * (pfq_run_batch), and prints the average cost per packet in TSC cycles.
+ *
+ * Only functions with no arguments and signature "SkBuff -> Action SkBuff"
+ * that do not forward packets (filters, steering, ...) can be used.
+ *
+ * insmod pfq-lang-bench.ko pipeline=ip,steer_ip batch=32 rounds=100000
+ * insmod pfq-lang-bench.ko pipeline=ip,udp,steer_flow,steer_ip  (parse cache)
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/timex.h>
+#include <linux/sched.h>
+
+#include <linux/pf_q.h>
+
+#include "../../pf_q-module.h"
+#include "../../pf_q-engine.h"
+#include "../../pf_q-symtable.h"
+
+
+MODULE_LICENSE("GPL");
+
+
+static char *pipeline = "ip,steer_ip";
+static int batch      = 32;
+static int rounds     = 100000;
+
+module_param(pipeline, charp, 0444);
+module_param(batch,    int,   0444);
+module_param(rounds,   int,   0444);
+
+MODULE_PARM_DESC(pipeline, " Comma separated list of functions (default=ip,steer_ip)");
+MODULE_PARM_DESC(batch,    " Number of packets per batch (default=32)");
+MODULE_PARM_DESC(rounds,   " Number of rounds (default=100000)");
+
+
+#define BENCH_MAX_FUNS 	16
+
+
+static struct pfq_computation_tree *
+bench_computation(const char *descr)
+{
+	struct pfq_computation_tree *comp;
+	char *str, *ptr, *symbol;
+	size_t n = 0;
+
+	comp = kzalloc(sizeof(struct pfq_computation_tree) + BENCH_MAX_FUNS * sizeof(struct pfq_functional_node), GFP_KERNEL);
+	str  = kstrdup(descr, GFP_KERNEL);
+	if (comp == NULL || str == NULL)
+		goto error;
+
+	ptr = str;
+
+	while ((symbol = strsep(&ptr, ",")) != NULL)
+	{
+		struct symtable_entry *entry;
+
+		if (*symbol == '\0')
+			continue;
+
+		if (n == BENCH_MAX_FUNS) {
+			printk(KERN_INFO "[PFQ] bench: too many functions!\n");
+			goto error;
+		}
+
+		entry = pfq_symtable_search(&pfq_lang_functions, symbol);
+		if (entry == NULL) {
+			printk(KERN_INFO "[PFQ] bench: '%s' no such function!\n", symbol);
+			goto error;
+		}
+
+		if (strcmp(entry->signature, "SkBuff -> Action SkBuff") != 0 || entry->init) {
+			printk(KERN_INFO "[PFQ] bench: '%s' :: %s not supported!\n", symbol, entry->signature);
+			goto error;
+		}
+
+		comp->node[n].fun.ptr = entry->function;
+		if (n > 0)
+			comp->node[n-1].next = &comp->node[n];
+		n++;
+	}
+
+	if (n == 0) {
+		printk(KERN_INFO "[PFQ] bench: empty pipeline!\n");
+		goto error;
+	}
+
+	comp->size = comp->length = n;
+	comp->entry_point = &comp->node[0];
+
+	kfree(str);
+	return comp;
+
+error:
+	kfree(str);
+	kfree(comp);
+	return NULL;
+}
+
+
+static struct sk_buff *
+bench_skb(int n)
+{
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	struct iphdr *ip;
+	struct udphdr *udp;
+
+	skb = alloc_skb(128, GFP_KERNEL);
+	if (skb == NULL)
+		return NULL;
+
+	skb_reserve(skb, NET_IP_ALIGN);
+
+	eth = (struct ethhdr *)skb_put(skb, ETH_HLEN);
+	ip  = (struct iphdr *)skb_put(skb, sizeof(struct iphdr));
+	udp = (struct udphdr *)skb_put(skb, sizeof(struct udphdr) + 18);
+
+	memset(skb->data, 0, skb->len);
+
+	eth->h_proto = htons(ETH_P_IP);
+
+	ip->version  = 4;
+	ip->ihl      = 5;
+	ip->ttl      = 64;
+	ip->protocol = IPPROTO_UDP;
+	ip->tot_len  = htons(skb->len - ETH_HLEN);
+	ip->saddr    = htonl(0x0a000000 | n);
+	ip->daddr    = htonl(0x0a010001);
+
+	udp->source  = htons(1024 + n);
+	udp->dest    = htons(5000);
+	udp->len     = htons(sizeof(struct udphdr) + 18);
+
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->mac_len  = ETH_HLEN;
+	skb->protocol = htons(ETH_P_IP);
+
+	return skb;
+}
+
+
+static void
+bench_monad_reset(struct pfq_monad *monad, size_t len)
+{
+	size_t n;
+
+	for(n = 0; n < len; n++)
+	{
+		monad[n].fanout.class_mask = Q_CLASS_DEFAULT;
+		monad[n].fanout.type       = fanout_copy;
+		monad[n].state             = 0;
+		monad[n].group             = NULL;
+		monad[n].headers.flags     = 0;
+	}
+}
+
+
+static int __init usr_init_module(void)
+{
+	struct pfq_computation_tree *comp;
+	struct pfq_monad *monad;
+	struct sk_buff **skbs;
+	SkBuff *buff;
+	uint64_t scalar = 0, vector = 0;
+	unsigned long live = 0;
+	int n, r, ret = -ENOMEM;
+
+	if (batch <= 0 || batch > Q_SKBUFF_SHORT_BATCH || rounds <= 0) {
+		printk(KERN_INFO "[PFQ] bench: batch=%d rounds=%d not allowed: valid range (0,%zu]!\n", batch, rounds, Q_SKBUFF_SHORT_BATCH);
+		return -EINVAL;
+	}
+
+	comp = bench_computation(pipeline);
+	if (comp == NULL)
+		return -EINVAL;
+
+	skbs  = kzalloc(sizeof(struct sk_buff *) * batch, GFP_KERNEL);
+	buff  = kzalloc(sizeof(SkBuff) * batch, GFP_KERNEL);
+	monad = kzalloc(sizeof(struct pfq_monad) * batch, GFP_KERNEL);
+	if (!skbs || !buff || !monad)
+		goto out;
+
+	for(n = 0; n < batch; n++)
+	{
+		skbs[n] = bench_skb(n);
+		if (skbs[n] == NULL)
+			goto out;
+
+		PFQ_CB(skbs[n])->monad = &monad[n];
+	}
+
+	for(r = 0; r < rounds; r++)
+	{
+		cycles_t start, stop;
+
+		/* per packet... */
+
+		bench_monad_reset(monad, batch);
+
+		preempt_disable();
+		start = get_cycles();
+
+		for(n = 0; n < batch; n++)
+		{
+			buff[n].skb = skbs[n];
+			pfq_run(comp, buff[n]);
+		}
+
+		stop = get_cycles();
+		preempt_enable();
+
+		scalar += stop - start;
+
+		/* batch at a time... */
+
+		bench_monad_reset(monad, batch);
+
+		preempt_disable();
+		start = get_cycles();
+
+		for(n = 0; n < batch; n++)
+			buff[n].skb = skbs[n];
+
+		live = pfq_run_batch(comp, buff, monad, batch == BITS_PER_LONG ? ~0UL : (1UL << batch) - 1);
+
+		stop = get_cycles();
+		preempt_enable();
+
+		vector += stop - start;
+
+		cond_resched();
+	}
+
+	printk(KERN_INFO "[PFQ] bench: pipeline=%s batch=%d rounds=%d live=%d\n", pipeline, batch, rounds, hweight_long(live));
+	printk(KERN_INFO "[PFQ] bench: per-packet:  %llu_tsc/pkt\n", scalar / ((uint64_t)rounds * batch));
+	printk(KERN_INFO "[PFQ] bench: vector:      %llu_tsc/pkt\n", vector / ((uint64_t)rounds * batch));
+
+	ret = 0;
+out:
+	if (skbs) {
+		for(n = 0; n < batch; n++)
+			kfree_skb(skbs[n]);
+	}
+
+	kfree(monad);
+	kfree(buff);
+	kfree(skbs);
+	kfree(comp);
+	return ret;
+}
+
+
+static void __exit usr_exit_module(void)
+{
+}
+
+
+module_init(usr_init_module);
+module_exit(usr_exit_module);
+
@@ -0,0 +1,384 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+/*
+ * PFQ capture microbenchmark: enqueues batches of synthetic packets into an
+ * rx queue, for different values of caplen, and prints the bytes captured
+ * per TSC cycle in three modes:
+ *
+ *  copy:   packets copied into the slots of the queue (default mode);
+ *  pool:   packets copied into the frames of a rx pool (zero-copy rx, fallback);
+ *  zcopy:  packets received into the frames of the pool (direct-capture driver).
+ *
+ * and the TSC cycles per packet (copy mode, caplen=64) for each timestamp mode:
+ * off, precise (the timestamp of pfq_receive included), raw tsc per packet and
+ * raw tsc per batch.
+ *
+ * insmod pfq-rx-bench.ko batch=32 rounds=100000 len=1514
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/timex.h>
+#include <linux/sched.h>
+
+#include <net/net_namespace.h>
+
+#include <linux/pf_q.h>
+
+#include "../../pf_q-sock.h"
+#include "../../pf_q-skbuff-batch.h"
+#include "../../pf_q-shared-queue.h"
+#include "../../pf_q-rx-pool.h"
+
+
+MODULE_LICENSE("GPL");
+
+
+static int batch  = 32;
+static int rounds = 100000;
+static int len    = 1514;
+
+module_param(batch,  int, 0444);
+module_param(rounds, int, 0444);
+module_param(len,    int, 0444);
+
+MODULE_PARM_DESC(batch,  " Number of packets per batch (default=32)");
+MODULE_PARM_DESC(rounds, " Number of rounds (default=100000)");
+MODULE_PARM_DESC(len,    " Length of packets (default=1514)");
+
+
+#define BENCH_FRAME_SIZE	2048
+
+static const size_t bench_caplen[] = { 64, 128, 256, 512, 1024, 1514 };
+
+enum bench_mode { bench_copy, bench_pool, bench_zcopy };
+
+static const char *bench_mode_name[] = { "copy", "pool", "zcopy" };
+
+static const char *bench_tstamp_name[] = { "off", "precise", "tsc", "tsc-batch" };
+
+
+struct bench
+{
+	struct net_device	*dev;
+	struct pfq_rx_queue_hdr	 rx_queue;
+	struct pfq_rx_opt	 ro;
+
+	struct page	       **pages;
+	size_t			 npages;
+	struct pfq_rx_pool	*pool;
+
+	struct pfq_skbuff_batch *skbs;		/* regular packets */
+	struct pfq_skbuff_batch *zskbs;		/* packets in the frames of the pool */
+};
+
+
+static void
+bench_fill(struct sk_buff *skb, struct net_device *dev)
+{
+	struct ethhdr *eth = (struct ethhdr *)skb->data;
+
+	memset(skb->data, 0x5a, skb_headlen(skb));
+
+	eth->h_proto = htons(ETH_P_IP);
+
+	skb_reset_mac_header(skb);
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_IP);
+}
+
+
+static struct pfq_skbuff_batch *
+bench_batch_alloc(void)
+{
+	return kzalloc(sizeof(struct pfq_skbuff_batch) + batch * sizeof(struct sk_buff *), GFP_KERNEL);
+}
+
+
+static int
+bench_setup(struct bench *b)
+{
+	int n;
+
+	b->dev = dev_get_by_name(&init_net, "lo");
+	if (b->dev == NULL)
+		return -ENODEV;
+
+	/* pool: a frame per packet, for both the pool and zcopy modes */
+
+	b->npages = DIV_ROUND_UP(2 * batch * BENCH_FRAME_SIZE, PAGE_SIZE);
+	b->pages  = kzalloc(b->npages * sizeof(struct page *), GFP_KERNEL);
+	if (b->pages == NULL)
+		return -ENOMEM;
+
+	for(n = 0; n < b->npages; n++)
+	{
+		b->pages[n] = alloc_page(GFP_KERNEL);
+		if (b->pages[n] == NULL)
+			return -ENOMEM;
+	}
+
+	b->pool = pfq_rx_pool_create_pages(b->pages, b->npages, BENCH_FRAME_SIZE);
+	if (b->pool == NULL)
+		return -ENOMEM;
+
+	if (pfq_rx_pool_bind(b->pool, b->dev->ifindex, 0) < 0)
+		return -EBUSY;
+
+	/* rx queue (both the halves of the double buffer) */
+
+	b->ro.base_addr = vmalloc(2 * batch * MPDB_QUEUE_SLOT_SIZE(len));
+	if (b->ro.base_addr == NULL)
+		return -ENOMEM;
+
+	b->ro.queue_size = batch;
+	b->ro.segments = 2;
+	b->ro.tstamp = Q_TSTAMP_OFF;
+	init_waitqueue_head(&b->ro.waitqueue);
+
+	atomic_long_set(&b->ro.queue_hdr, (long)&b->rx_queue);
+
+	/* packets */
+
+	b->skbs  = bench_batch_alloc();
+	b->zskbs = bench_batch_alloc();
+	if (!b->skbs || !b->zskbs)
+		return -ENOMEM;
+
+	for(n = 0; n < batch; n++)
+	{
+		struct sk_buff *skb;
+		struct page *page;
+		unsigned int offset;
+
+		skb = alloc_skb(len + NET_IP_ALIGN, GFP_KERNEL);
+		if (skb == NULL)
+			return -ENOMEM;
+
+		skb_reserve(skb, NET_IP_ALIGN);
+		skb_put(skb, len);
+		bench_fill(skb, b->dev);
+		b->skbs->queue[b->skbs->len++] = skb;
+
+		if (pfq_rx_pool_alloc_frame(b->dev, 0, &page, &offset) < 0)
+			return -ENOMEM;
+
+		skb = pfq_rx_pool_build_skb(b->dev, 0, page, offset, len);
+		if (skb == NULL)
+			return -ENOMEM;
+
+		bench_fill(skb, b->dev);
+		b->zskbs->queue[b->zskbs->len++] = skb;
+	}
+
+	return 0;
+}
+
+
+static void
+bench_teardown(struct bench *b)
+{
+	size_t n;
+
+	if (b->skbs) {
+		for(n = 0; n < b->skbs->len; n++)
+			kfree_skb(b->skbs->queue[n]);
+	}
+
+	if (b->zskbs) {
+		for(n = 0; n < b->zskbs->len; n++)
+			kfree_skb(b->zskbs->queue[n]);
+	}
+
+	kfree(b->zskbs);
+	kfree(b->skbs);
+
+	vfree(b->ro.base_addr);
+
+	pfq_rx_pool_destroy(b->pool);
+
+	if (b->pages) {
+		for(n = 0; n < b->npages; n++)
+			if (b->pages[n])
+				__free_page(b->pages[n]);
+	}
+
+	kfree(b->pages);
+
+	if (b->dev)
+		dev_put(b->dev);
+}
+
+
+/* act as user space: give the frames back to the pool (or to the driver) */
+
+static void
+bench_consume(struct bench *b, enum bench_mode mode, size_t sent)
+{
+	size_t n;
+
+	for(n = 0; n < sent; n++)
+	{
+		struct pfq_pkthdr *hdr = (struct pfq_pkthdr *)((char *)b->ro.base_addr + n * b->ro.slot_size);
+		struct pfq_pkthdr_frame *fd = (struct pfq_pkthdr_frame *)(hdr + 1);
+
+		if (mode == bench_pool)
+			pfq_rx_pool_put(b->pool, &fd->index, 1);
+		else if (mode == bench_zcopy)
+			b->pool->state[fd->index] = pfq_frame_driver;
+	}
+
+	b->rx_queue.data = 0;
+}
+
+
+static uint64_t
+bench_run(struct bench *b, enum bench_mode mode, size_t caplen, size_t *bytes)
+{
+	struct pfq_skbuff_batch *skbs = mode == bench_zcopy ? b->zskbs : b->skbs;
+	unsigned long long mask = batch == BITS_PER_LONG ? ~0ULL : (1ULL << batch) - 1;
+	uint64_t cycles = 0;
+	int r;
+
+	b->ro.caplen    = caplen;
+	b->ro.pool      = mode == bench_copy ? NULL : b->pool;
+	b->ro.slot_size = mode == bench_copy ? MPDB_QUEUE_SLOT_SIZE(caplen) : MPDB_QUEUE_FRAME_SLOT_SIZE;
+
+	b->rx_queue.data = 0;
+	*bytes = 0;
+
+	for(r = 0; r < rounds; r++)
+	{
+		cycles_t start, stop;
+		size_t sent, n;
+
+		if (b->ro.tstamp == Q_TSTAMP_ON) {
+			for(n = 0; n < skbs->len; n++)
+				skbs->queue[n]->tstamp.tv64 = 0;
+		}
+
+		preempt_disable();
+		start = get_cycles();
+
+		/* as pfq_receive does, when a socket requires the timestamps */
+
+		if (b->ro.tstamp == Q_TSTAMP_ON) {
+			for(n = 0; n < skbs->len; n++)
+				__net_timestamp(skbs->queue[n]);
+		}
+
+		sent = pfq_mpdb_enqueue_batch(&b->ro, skbs, mask, batch, 0);
+
+		stop = get_cycles();
+		preempt_enable();
+
+		cycles += stop - start;
+		*bytes += sent * min_t(size_t, caplen, len);
+
+		bench_consume(b, mode, sent);
+
+		if ((r & 1023) == 0)
+			cond_resched();
+	}
+
+	return cycles;
+}
+
+
+static int __init usr_init_module(void)
+{
+	struct bench *b;
+	size_t n, m;
+	int ret;
+
+	if (batch <= 0 || batch > Q_SKBUFF_SHORT_BATCH || rounds <= 0 || len < ETH_HLEN || len > 1514) {
+		printk(KERN_INFO "[PFQ] rx-bench: batch=%d rounds=%d len=%d not allowed!\n", batch, rounds, len);
+		return -EINVAL;
+	}
+
+	b = kzalloc(sizeof(struct bench), GFP_KERNEL);
+	if (b == NULL)
+		return -ENOMEM;
+
+	ret = bench_setup(b);
+	if (ret < 0) {
+		printk(KERN_INFO "[PFQ] rx-bench: setup error (%d)!\n", ret);
+		goto out;
+	}
+
+	printk(KERN_INFO "[PFQ] rx-bench: batch=%d rounds=%d len=%d\n", batch, rounds, len);
+
+	for(n = 0; n < ARRAY_SIZE(bench_caplen); n++)
+	{
+		for(m = bench_copy; m <= bench_zcopy; m++)
+		{
+			size_t bytes;
+			uint64_t cycles = bench_run(b, m, bench_caplen[n], &bytes);
+
+			printk(KERN_INFO "[PFQ] rx-bench: caplen=%4zu %-5s %llu.%02llu bytes/cycle (%llu_tsc/pkt)\n",
+			       bench_caplen[n], bench_mode_name[m],
+			       bytes / cycles, (bytes * 100 / cycles) % 100,
+			       cycles / ((uint64_t)rounds * batch));
+		}
+	}
+
+	for(m = Q_TSTAMP_OFF; m <= Q_TSTAMP_TSC_BATCH; m++)
+	{
+		size_t bytes;
+		uint64_t cycles;
+
+		if (m >= Q_TSTAMP_TSC && !pfq_tsc_khz())
+			break;
+
+		b->ro.tstamp = m;
+		cycles = bench_run(b, bench_copy, 64, &bytes);
+
+		printk(KERN_INFO "[PFQ] rx-bench: tstamp=%-9s %llu_tsc/pkt\n",
+		       bench_tstamp_name[m], cycles / ((uint64_t)rounds * batch));
+	}
+
+	b->ro.tstamp = Q_TSTAMP_OFF;
+
+out:
+	bench_teardown(b);
+	kfree(b);
+	return ret;
+}
+
+
+static void __exit usr_exit_module(void)
+{
+}
+
+
+module_init(usr_init_module);
+module_exit(usr_exit_module);
+
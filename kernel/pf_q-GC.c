@@ -34,6 +34,8 @@ void gc_reset(struct gc_data *gc)
 		gc_log_init(&gc->log[n]);
 	}
 	gc->pool.len = 0;
+	gc->fwd.num = 0;
+	gc->fwd.cnt_total = 0;
 }
 
 
@@ -114,46 +116,31 @@ gc_copy_buff(struct gc_data *gc, struct gc_buff orig)
 }
 
 
-inline void
-__gc_add_dev_to_targets(struct net_device *dev, struct gc_fwd_targets *ts)
+/* the forwarding list of a device/hw queue */
+
+struct gc_fwd_list *
+gc_get_fwd_list(struct gc_data *gc, struct net_device *dev, int hw_queue)
 {
+	struct gc_fwd_targets *ts = &gc->fwd;
 	size_t n = 0;
 
 	for(; n < ts->num; ++n)
 	{
-        	if (dev == ts->dev[n]) {
-        		ts->cnt[n]++;
-        		ts->cnt_total++;
-        		return;
-		}
+        	if (dev == ts->list[n].dev && hw_queue == ts->list[n].hw_queue)
+        		return &ts->list[n];
 	}
 
-	if (n < Q_GC_LOG_QUEUE_LEN) {
-		ts->dev[n] = dev;
-		ts->cnt[n] = 1;
-		ts->cnt_total++;
-		ts->num++;
-	}
-	else
+	if (n == Q_GC_LOG_QUEUE_LEN) {
 		printk(KERN_INFO "[PFQ] GC: forward pool exhausted!\n");
-}
-
-
-void
-gc_get_fwd_targets(struct gc_data *gc, struct gc_fwd_targets *ts)
-{
-	size_t n, i;
+		return NULL;
+	}
 
-	ts->num = 0;
-        ts->cnt_total = 0;
+	ts->list[n].dev      = dev;
+	ts->list[n].hw_queue = hw_queue;
+	ts->list[n].len      = 0;
+	ts->num++;
 
-	for(n = 0; n < gc->pool.len; ++n)
-	{
-		for(i = 0; i < gc->log[n].num_devs; i++)
-		{
-         		__gc_add_dev_to_targets(gc->log[n].dev[i], ts);
-		}
-	}
+	return &ts->list[n];
 }
 
 
@@ -53,17 +53,26 @@ typedef struct gc_buff SkBuff;
 
 struct gc_log
 {
-	struct net_device * dev[Q_GC_LOG_QUEUE_LEN];
 	size_t num_devs;
 	size_t to_kernel;
 	size_t xmit_todo;
 };
 
 
+/* packets of the pool to forward to a device/hw queue (by index, in order) */
+
+struct gc_fwd_list
+{
+	struct net_device * dev;
+	int hw_queue;
+	size_t len;
+	u8 index[Q_GC_POOL_QUEUE_LEN];
+};
+
+
 struct gc_fwd_targets
 {
-	struct net_device * dev[Q_GC_LOG_QUEUE_LEN];
-	size_t cnt [Q_GC_LOG_QUEUE_LEN];
+	struct gc_fwd_list list[Q_GC_LOG_QUEUE_LEN];
 	size_t cnt_total;
 	size_t num;
 };
@@ -80,6 +89,7 @@ struct gc_data
 {
 	struct gc_log   	log[Q_GC_POOL_QUEUE_LEN];
 	struct gc_queue_buff 	pool;
+	struct gc_fwd_targets	fwd;		/* built by the lazy xmit annotations */
 };
 
 
@@ -92,20 +102,7 @@ extern struct gc_buff pfq_make_buff(struct sk_buff *skb);
 extern struct gc_buff pfq_alloc_buff(size_t size);
 extern struct gc_buff pfq_copy_buff(struct gc_buff buff);
 
-extern void gc_get_fwd_targets(struct gc_data *gc, struct gc_fwd_targets *ts);
-
-
-static inline bool
-gc_count_dev_in_log(struct net_device *dev, struct gc_log *log)
-{
-	size_t n, ret = 0;
-	for(n = 0; n < log->num_devs; n++)
-	{
-		if (dev == log->dev[n])
-			ret++;
-	}
-	return ret;
-}
+extern struct gc_fwd_list *gc_get_fwd_list(struct gc_data *gc, struct net_device *dev, int hw_queue);
 
 
 static inline
@@ -30,6 +30,7 @@
 #include <pf_q-sparse.h>
 #include <pf_q-transmit.h>
 #include <pf_q-endpoint.h>
+#include <pf_q-netdev.h>
 
 
 static inline
@@ -66,8 +67,14 @@ size_t copy_to_dev_gcbs(struct pfq_sock *so, struct gc_queue_buff *gcbs, unsigne
 
 	if (so->egress_index) {
 
-               	dev = dev_get_by_index(&init_net, so->egress_index);
+		/* the device bound is held by the socket: the rx batch runs with
+		 * bh disabled, which keeps it alive up to the lazy xmit */
+
+		rcu_read_lock();
+
+               	dev = rcu_dereference(so->egress_dev);
                	if (dev == NULL) {
+			rcu_read_unlock();
 			if (printk_ratelimit())
                         	printk(KERN_INFO "[PFQ] egress endpoint not existing (%d)\n", so->egress_index);
                         return false;
@@ -75,7 +82,7 @@ size_t copy_to_dev_gcbs(struct pfq_sock *so, struct gc_queue_buff *gcbs, unsigne
 
  		sent = pfq_queue_lazy_xmit_by_mask(gcbs, mask, dev, so->egress_queue);
 
-                dev_put(dev);
+		rcu_read_unlock();
 		return sent;
 	}
 
@@ -32,7 +32,7 @@
 #include <pf_q-module.h>
 #include <pf_q-symtable.h>
 #include <pf_q-signature.h>
-#include <pf_q-engine.h>
+#include <pf_q-bitops.h>
 
 #include <functional/headers.h>
 
@@ -60,6 +60,57 @@ pfq_signature_by_user_symbol(const char __user *symb)
 }
 
 
+/*
+ * Resolve the symbols of a computation descriptor: each symbol is copied from
+ * user-space and looked up once. The returned table (one entry per function)
+ * is used by both pfq_check_computation_descr and pfq_computation_rtlink,
+ * and must be released with kfree. The caller holds the symtable lock
+ * (pfq_symtable_lock) until the computation is installed.
+ */
+
+struct symtable_entry **
+pfq_computation_resolve(struct pfq_computation_descr const *descr)
+{
+	struct symtable_entry **symtab;
+	char symbol[Q_FUN_SYMB_LEN];
+	size_t n;
+
+	symtab = kmalloc(sizeof(struct symtable_entry *) * (descr->size ? descr->size : 1), GFP_KERNEL);
+	if (symtab == NULL) {
+		pr_devel("[PFQ] computation_resolve: out of memory!\n");
+		return NULL;
+	}
+
+	for(n = 0; n < descr->size; n++)
+	{
+		long len;
+
+		if (descr->fun[n].symbol == NULL) {
+			printk(KERN_INFO "[PFQ] %zu: NULL symbol!\n", n);
+			goto error;
+		}
+
+		len = strncpy_from_user(symbol, descr->fun[n].symbol, sizeof(symbol));
+		if (len < 0 || len == sizeof(symbol)) {
+			pr_devel("[PFQ] %zu: computation_resolve: bad symbol!\n", n);
+			goto error;
+		}
+
+		symtab[n] = __pfq_symtable_search(&pfq_lang_functions, symbol);
+		if (symtab[n] == NULL) {
+			printk(KERN_INFO "[PFQ] resolve_symbol: '%s' no such function!\n", symbol);
+			goto error;
+		}
+	}
+
+	return symtab;
+
+error:
+	kfree(symtab);
+	return NULL;
+}
+
+
 static void *
 pod_memory_get(void **ptr, size_t size)
 {
@@ -122,45 +173,74 @@ strdup_user(const char __user *str)
 
 
 static inline Action_SkBuff
-pfq_apply(struct pfq_functional *call, SkBuff b)
+pfq_bind(SkBuff b, struct pfq_computation_tree *prg)
 {
-	function_t fun = { call };
+        struct pfq_functional_node *node = prg->node,
+        			   *end  = prg->node + prg->length;
 
-	return EVAL_FUNCTION(fun, b);
-}
+        /* the monad is shared by all the functions of the computation:
+         * it is not required to reload it after each step...
+         */
 
+        fanout_t *a = &PFQ_CB(b.skb)->monad->fanout;
 
-static inline Action_SkBuff
-pfq_bind(SkBuff b, struct pfq_computation_tree *prg)
-{
-        struct pfq_functional_node *node = prg->entry_point;
-
-        while (node)
+        for(; node != end; node++)
         {
-                fanout_t *a;
+		function_t fun = { &node->fun };
 
-                b = pfq_apply(&node->fun, b).value;
-                if (b.skb == NULL)
+                b = EVAL_FUNCTION(fun, b).value;
+                if (b.skb == NULL || is_drop(*a))
                         return Pass(b);
+        }
+
+        return Pass(b);
+}
 
-                a = &PFQ_CB(b.skb)->monad->fanout;
 
-                if (is_drop(*a))
-                        return Pass(b);
+/*
+ * Batch-at-a-time evaluation: each function of the monadic chain is applied
+ * to all the live packets (bits of the mask) before moving to the next one.
+ * monad[n] is the monad of buff[n]. A packet leaves the live mask when it is
+ * dropped or when a function returns a NULL skb. buff[] is updated in place;
+ * the mask of the packets that survive the computation is returned.
+ */
 
-                node = node->next;
+unsigned long
+pfq_run_batch(struct pfq_computation_tree *prg, SkBuff *buff, struct pfq_monad *monad, unsigned long live)
+{
+        struct pfq_functional_node *node = prg->node,
+        			   *end  = prg->node + prg->length;
+
+        for(; node != end && live; node++)
+        {
+		function_t fun = { &node->fun };
+		unsigned long bit;
+
+		pfq_bitwise_foreach(live, bit,
+		{
+			int n = pfq_ctz(bit);
+
+			buff[n] = EVAL_FUNCTION(fun, buff[n]).value;
+			if (buff[n].skb == NULL || is_drop(monad[n].fanout))
+				live &= ~bit;
+		})
         }
 
-        return Pass(b);
+        return live;
 }
 
 
+#ifdef PFQ_LANG_PROFILE
+static DEFINE_PER_CPU(uint64_t, pfq_lang_nrun);
+static DEFINE_PER_CPU(uint64_t, pfq_lang_total);
+#endif
+
+
 Action_SkBuff
 pfq_run(struct pfq_computation_tree *prg, SkBuff b)
 {
 #ifdef PFQ_LANG_PROFILE
-	static uint64_t nrun, total;
-	uint64_t stop, start;
+	uint64_t stop, start, nrun, total;
 #endif
 
 #ifdef PFQ_LANG_PROFILE
@@ -176,10 +256,12 @@ pfq_run(struct pfq_computation_tree *prg, SkBuff b)
 #ifdef PFQ_LANG_PROFILE
 
 	stop = get_cycles();
-	total += (stop-start);
 
-	if ((nrun++ % 1048576) == 0)
-		printk(KERN_INFO "[PFQ] PFQ/lang run: %llu_tsc.\n", total/nrun);
+	total = __this_cpu_add_return(pfq_lang_total, stop-start);
+	nrun  = __this_cpu_inc_return(pfq_lang_nrun);
+
+	if ((nrun % 1048576) == 0)
+		printk(KERN_INFO "[PFQ|%d] PFQ/lang run: %llu_tsc (%zu functions).\n", smp_processor_id(), total/nrun, prg->length);
 
 	return b;
 #endif
@@ -190,7 +272,9 @@ pfq_run(struct pfq_computation_tree *prg, SkBuff b)
 struct pfq_computation_tree *
 pfq_computation_alloc (struct pfq_computation_descr const *descr)
 {
-        struct pfq_computation_tree * c = kzalloc(sizeof(size_t) + descr->size * sizeof(struct pfq_functional_node), GFP_KERNEL);
+        struct pfq_computation_tree * c = kzalloc(sizeof(struct pfq_computation_tree) + descr->size * sizeof(struct pfq_functional_node), GFP_KERNEL);
+        if (c == NULL)
+        	return NULL;
         c->size = descr->size;
         return c;
 }
@@ -250,17 +334,12 @@ pfq_number_of_arguments(struct pfq_functional_descr const *fun)
 
 
 static bool
-function_signature_match(struct pfq_functional_descr const *fun, string_view_t fullsig, size_t index)
+function_signature_match(struct pfq_functional_descr const *fun, struct symtable_entry const *entry, string_view_t fullsig, size_t index)
 {
-	const char *signature = pfq_signature_by_user_symbol(fun->symbol);
+	const char *signature = entry->signature;
 	string_view_t sig;
 	size_t nargs;
 
-	if (!signature) {
-		pr_devel("[PFQ] %zu: signature_matches: strdup_user error!\n", index);
-		return false;
-	}
-
 	nargs = pfq_number_of_arguments(fun);
 
 	sig = pfq_signature_bind(make_string_view(signature), nargs);
@@ -340,7 +419,7 @@ check_argument_descr(struct pfq_functional_arg_descr const *arg, string_view_t e
 
 
 int
-pfq_check_computation_descr(struct pfq_computation_descr const *descr)
+pfq_check_computation_descr(struct pfq_computation_descr const *descr, struct symtable_entry * const *symtab)
 {
         size_t entry_point = descr->entry_point, n;
 
@@ -367,19 +446,15 @@ pfq_check_computation_descr(struct pfq_computation_descr const *descr)
 
 		nargs = pfq_number_of_arguments(fun);
 
-		/* get the signature */
+		/* get the signature (resolved) */
 
-		signature = pfq_signature_by_user_symbol(fun->symbol);
-		if (!signature) {
-                	printk(KERN_INFO "[PFQ] resolve_signature_by_symbol: '%s' no such function!\n", fun->symbol);
-			return -EPERM;
-		}
+		signature = symtab[n]->signature;
 
 		/* check for valid signature/entry_point */
 
 		if (n == entry_point || fun->next != -1 ) {  /* next != -1 means monadic function! */
 
-			if (!function_signature_match(fun, make_string_view("SkBuff -> Action SkBuff"), n)) {
+			if (!function_signature_match(fun, symtab[n], make_string_view("SkBuff -> Action SkBuff"), n)) {
 				pr_devel("[PFQ] %zu: %s: invalid signature!\n", n, signature);
 				return -EPERM;
 			}
@@ -405,7 +480,7 @@ pfq_check_computation_descr(struct pfq_computation_descr const *descr)
 					return -EPERM;
 				}
 
-				if (!function_signature_match(&descr->fun[x], sarg, x)) {
+				if (!function_signature_match(&descr->fun[x], symtab[x], sarg, x)) {
 					pr_devel("[PFQ] %zu: %s: invalid argument(%d): expected signature " SVIEW_FMT "!\n", n, signature, i, SVIEW_ARG(sarg));
 					return -EPERM;
 				}
@@ -423,33 +498,6 @@ pfq_check_computation_descr(struct pfq_computation_descr const *descr)
 }
 
 
-static void *
-resolve_user_symbol(struct list_head *cat, const char __user *symb, const char **signature, init_ptr_t *init, fini_ptr_t *fini)
-{
-	struct symtable_entry *entry;
-        const char *symbol;
-
-        symbol = strdup_user(symb);
-        if (symbol == NULL) {
-                pr_devel("[PFQ] resove_symbol: strdup!\n");
-                return NULL;
-        }
-
-        entry = pfq_symtable_search(cat, symbol);
-        if (entry == NULL) {
-                printk(KERN_INFO "[PFQ] resolve_symbol: '%s' no such function!\n", symbol);
-                return NULL;
-        }
-
-        *signature = entry->signature;
-	*init = entry->init;
-	*fini = entry->fini;
-
-        kfree(symbol);
-        return entry->function;
-}
-
-
 int
 pfq_computation_init(struct pfq_computation_tree *comp)
 {
@@ -492,65 +540,138 @@ pfq_computation_fini(struct pfq_computation_tree *comp)
 
 
 static struct pfq_functional_node *
-get_functional_by_index(struct pfq_computation_descr const *descr, struct pfq_computation_tree *comp, int index)
+get_functional_by_index(struct pfq_computation_descr const *descr, struct pfq_computation_tree *comp, int const *slot, int index)
 {
         if (index >= 0 && index < descr->size) {
-                return &comp->node[index];
+                return &comp->node[slot[index]];
         }
 
 	return NULL;
 }
 
 
+/*
+ * Compute the execution plan: slot[n] is the position of the n-th function
+ * of the descriptor in comp->node[]. The monadic chain is laid out first, in
+ * execution order, followed by the functions used as arguments and by the
+ * unreachable ones (that still need to be initialized/finalized).
+ * Returns the length of the monadic chain.
+ */
+
+static size_t
+computation_plan(struct pfq_computation_descr const *descr, int *slot, int *order)
+{
+	size_t n, k, pos = 0, length;
+	ptrdiff_t x;
+
+	for(n = 0; n < descr->size; n++)
+		slot[n] = -1;
+
+	/* monadic chain... (loops are broken) */
+
+	for(x = descr->entry_point; x >= 0 && x < descr->size && slot[x] == -1; x = descr->fun[x].next)
+	{
+		slot[x] = pos;
+		order[pos++] = x;
+	}
+
+	length = pos;
+
+	/* functional arguments, in breadth-first order... */
+
+	for(k = 0; k < pos; k++)
+	{
+		struct pfq_functional_descr const *fun = &descr->fun[order[k]];
+		int i;
+
+        	for(i = 0; i < sizeof(fun->arg)/sizeof(fun->arg[0]); i++)
+		{
+			if (!is_arg_function(&fun->arg[i]))
+				continue;
+
+			x = fun->arg[i].size;
+			if (x < descr->size && slot[x] == -1) {
+				slot[x] = pos;
+				order[pos++] = x;
+			}
+		}
+	}
+
+	/* unreachable functions... */
+
+	for(n = 0; n < descr->size; n++)
+	{
+		if (slot[n] == -1) {
+			slot[n] = pos;
+			order[pos++] = n;
+		}
+	}
+
+	return length;
+}
+
+
 /*
  * Prerequisite: valid computation (check by means of pfq_validate_computation_descr)
  */
 
 int
-pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_computation_tree *comp, void *context)
+pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_computation_tree *comp, void *context, struct symtable_entry * const *symtab)
 {
+	struct pfq_functional_node *node;
+	int *slot, *order;
 	size_t n;
 
+	slot = kmalloc(sizeof(int) * 2 * (descr->size ? descr->size : 1), GFP_KERNEL);
+	if (slot == NULL) {
+		printk(KERN_INFO "[PFQ] rtlink: out of memory!\n");
+		return -ENOMEM;
+	}
+
+	order = slot + descr->size;
+
         /* size */
 
         comp->size = descr->size;
 
+        /* execution plan */
+
+        comp->length = computation_plan(descr, slot, order);
+
         /* entry point */
 
-        comp->entry_point = &comp->node[descr->entry_point];
+        comp->entry_point = &comp->node[slot[descr->entry_point]];
 
 	/* link functions */
 
         for(n = 0; n < descr->size; n++)
         {
         	struct pfq_functional_descr const *fun;
- 		const char *signature;
-        	init_ptr_t init, fini;
-		void *addr;
                 size_t i;
 
                 fun = &descr->fun[n];
 
-		addr = resolve_user_symbol(&pfq_lang_functions, fun->symbol, &signature, &init, &fini);
-		if (addr == NULL) {
+		if (symtab[n] == NULL) {
         		printk(KERN_INFO "[PFQ] %zu: rtlink: bad descriptor!\n", n);
-        		return -EPERM;
+        		goto error;
 		}
 
-		comp->node[n].fun.ptr = addr;
-        	comp->node[n].init    = init;
-        	comp->node[n].fini    = fini;
-		comp->node[n].next    = get_functional_by_index(descr, comp, descr->fun[n].next);
+		node = &comp->node[slot[n]];
+
+		node->fun.ptr = symtab[n]->function;
+        	node->init    = symtab[n]->init;
+        	node->fini    = symtab[n]->fini;
+		node->next    = get_functional_by_index(descr, comp, slot, descr->fun[n].next);
 
-		comp->node[n].fun.arg[0].value = 0;
-		comp->node[n].fun.arg[1].value = 0;
-		comp->node[n].fun.arg[2].value = 0;
-		comp->node[n].fun.arg[3].value = 0;
+		node->fun.arg[0].value = 0;
+		node->fun.arg[1].value = 0;
+		node->fun.arg[2].value = 0;
+		node->fun.arg[3].value = 0;
 
-		comp->node[n].fun.arg[0].nelem = 0;
-		comp->node[n].fun.arg[1].nelem = 0;
-		comp->node[n].fun.arg[2].nelem = 0;
-		comp->node[n].fun.arg[3].nelem = 0;
+		node->fun.arg[0].nelem = 0;
+		node->fun.arg[1].nelem = 0;
+		node->fun.arg[2].nelem = 0;
+		node->fun.arg[3].nelem = 0;
 
         	for(i = 0; i < sizeof(fun->arg)/sizeof(fun->arg[0]); i++)
 		{
@@ -559,11 +680,11 @@ pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_com
 				char *str = pod_user(&context, fun->arg[i].addr, strlen_user(fun->arg[i].addr));
 				if (str == NULL) {
 					pr_devel("[PFQ] %zu: pod_user: internal error!\n", n);
-					return -EPERM;
+					goto error;
 				}
 
-				comp->node[n].fun.arg[i].value = (ptrdiff_t)str;
-				comp->node[n].fun.arg[i].nelem = -1;
+				node->fun.arg[i].value = (ptrdiff_t)str;
+				node->fun.arg[i].nelem = -1;
 			}
 			else if (is_arg_vector_str(&fun->arg[i])) {
 
@@ -578,7 +699,7 @@ pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_com
 				str = pod_user(&context, fun->arg[i].addr, strlen_user(fun->arg[i].addr));
 				if (str == NULL) {
 					pr_devel("[PFQ] %zu: pod_user: internal error!\n", n);
-					return -EPERM;
+					goto error;
 				}
 
 				for(j = 0; j < fun->arg[i].nelem; j++)
@@ -592,8 +713,8 @@ pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_com
 					str = end+1;
 				}
 
-				comp->node[n].fun.arg[i].value = (ptrdiff_t)base_ptr;
-				comp->node[n].fun.arg[i].nelem = fun->arg[i].nelem;
+				node->fun.arg[i].value = (ptrdiff_t)base_ptr;
+				node->fun.arg[i].nelem = fun->arg[i].nelem;
 			}
 			else if (is_arg_data(&fun->arg[i])) {
 
@@ -602,22 +723,22 @@ pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_com
 					char *ptr = pod_user(&context, fun->arg[i].addr, fun->arg[i].size);
 					if (ptr == NULL) {
 						pr_devel("[PFQ] %zu: pod_user(2): internal error!\n", n);
-						return -EPERM;
+						goto error;
 					}
 
-					comp->node[n].fun.arg[i].value = (ptrdiff_t)ptr;
-					comp->node[n].fun.arg[i].nelem = -1;
+					node->fun.arg[i].value = (ptrdiff_t)ptr;
+					node->fun.arg[i].nelem = -1;
 				}
 				else {
 					ptrdiff_t arg = 0;
 
 					if (copy_from_user(&arg, fun->arg[i].addr, fun->arg[i].size)) {
 						pr_devel("[PFQ] %zu: copy_from_user: internal error!\n", n);
-						return -EPERM;
+						goto error;
 					}
 
-					comp->node[n].fun.arg[i].value = arg;
-					comp->node[n].fun.arg[i].nelem = -1;
+					node->fun.arg[i].value = arg;
+					node->fun.arg[i].nelem = -1;
 				}
 
 			}
@@ -628,32 +749,37 @@ pfq_computation_rtlink(struct pfq_computation_descr const *descr, struct pfq_com
 					char *ptr = pod_user(&context, fun->arg[i].addr, fun->arg[i].size * fun->arg[i].nelem);
 					if (ptr == NULL) {
 						pr_devel("[PFQ] %zu: pod_user(2): internal error!\n", n);
-						return -EPERM;
+						goto error;
 					}
 
-					comp->node[n].fun.arg[i].value = (ptrdiff_t)ptr;
-					comp->node[n].fun.arg[i].nelem = fun->arg[i].nelem;
+					node->fun.arg[i].value = (ptrdiff_t)ptr;
+					node->fun.arg[i].nelem = fun->arg[i].nelem;
 				}
 				else {  /* empty vector */
 
-					comp->node[n].fun.arg[i].value = 0xdeadbeef;
-					comp->node[n].fun.arg[i].nelem = 0;
+					node->fun.arg[i].value = 0xdeadbeef;
+					node->fun.arg[i].nelem = 0;
 				}
 			}
 			else if (is_arg_function(&fun->arg[i])) {
 
-				comp->node[n].fun.arg[i].value = (ptrdiff_t)get_functional_by_index(descr, comp, fun->arg[i].size);
-				comp->node[n].fun.arg[i].nelem = -1;
+				node->fun.arg[i].value = (ptrdiff_t)get_functional_by_index(descr, comp, slot, fun->arg[i].size);
+				node->fun.arg[i].nelem = -1;
 			}
 			else if (!is_arg_null(&fun->arg[i])) {
 
 				pr_devel("[PFQ] pfq_computation_rtlink: internal error@ function:%zu argument[%zu] => { %p, %zu, %zu }!\n", n, i, (void __user *)fun->arg[i].addr, fun->arg[i].size, fun->arg[i].nelem);
-				return -EPERM;
+				goto error;
 			}
 		}
 	}
 
+	kfree(slot);
 	return 0;
+
+error:
+	kfree(slot);
+	return -EPERM;
 }
 
 
@@ -41,6 +41,17 @@ int cap_len      	= 1514;
 int max_len      	= 1514;
 
 int batch_len 		= 1;
+int batch_min 		= 1;
+int batch_latency 	= 0;            /* target latency of adaptive batching (usec), 0 = disabled */
+int flush_timeout 	= 1000;         /* max GC residency of a packet (usec) */
+int tx_idle 		= 100;          /* idle polling of Tx threads before sleeping (usec, -1 = always poll) */
+int tx_pace_window	= 2000;         /* paced Tx: packets due within the window leave in the same batch (nsec) */
+
+int vector_eval 	= 0;            /* evaluate PFQ/lang computations a batch at a time */
+
+int steer_hash		= 0;            /* steering hash function (Q_STEER_HASH_xxx) */
+char *steer_key		= NULL;         /* Toeplitz key (hex string) */
+int steer_consistent	= 0;            /* consistent hashing (Maglev) for steering */
 
 int vl_untag     	= 0;
 
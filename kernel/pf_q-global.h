@@ -43,6 +43,17 @@ extern int cap_len;
 extern int max_len;
 
 extern int batch_len;
+extern int batch_min;
+extern int batch_latency;
+extern int flush_timeout;
+extern int tx_idle;
+extern int tx_pace_window;
+
+extern int vector_eval;
+
+extern int steer_hash;
+extern char *steer_key;
+extern int steer_consistent;
 
 extern int vl_untag;
 
@@ -32,6 +32,8 @@
 #include <pf_q-devmap.h>
 #include <pf_q-bitops.h>
 #include <pf_q-engine.h>
+#include <pf_q-hash.h>
+#include <pf_q-global.h>
 
 
 DEFINE_SEMAPHORE(group_sem);
@@ -40,6 +42,37 @@ DEFINE_SEMAPHORE(group_sem);
 static struct pfq_group pfq_groups[Q_MAX_GROUP];
 
 
+/* consistent steering: rebuild the table of the group for its sockets (user-context).
+ * The packet path only looks it up, and checks that the socket is eligible */
+
+static void
+__pfq_group_maglev_update(struct pfq_group *g, unsigned long sock_mask)
+{
+        struct pfq_group_maglev *table = NULL, *old;
+
+        if (!steer_consistent)
+                return;
+
+        if (sock_mask) {
+                table = kmalloc(sizeof(struct pfq_group_maglev), GFP_KERNEL);
+                if (table == NULL) {
+                        printk(KERN_WARNING "[PFQ] group maglev: out of memory!\n");
+                        return;
+                }
+
+                table->sock_mask = sock_mask;
+                pfq_maglev_build(table->table, sock_mask);
+        }
+
+        /* group_sem serializes the updates: the old table is freed after the readers */
+
+        old = rcu_dereference_protected(g->maglev, 1);
+        rcu_assign_pointer(g->maglev, table);
+        if (old)
+                kfree_rcu(old, rcu);
+}
+
+
 bool
 __pfq_group_access(int gid, int id, int policy, bool create)
 {
@@ -92,13 +125,14 @@ __pfq_group_init(int gid)
         atomic_long_set(&g->bp_filter,0L);
         atomic_long_set(&g->comp,     0L);
         atomic_long_set(&g->comp_ctx, 0L);
+        RCU_INIT_POINTER(g->maglev, NULL);
+
+        g->snaplen_set = false;
+        memset(g->snaplen, 0, sizeof(g->snaplen));
 
 	pfq_group_stats_reset(&g->stats);
 
-        for(i = 0; i < Q_MAX_COUNTERS; i++)
-        {
-                sparse_set(&g->context.counter[i], 0);
-        }
+        sparse_block_reset(g->context.counter, Q_MAX_COUNTERS);
 
 	for(i = 0; i < Q_MAX_PERSISTENT; i++)
 	{
@@ -147,6 +181,9 @@ __pfq_group_free(int gid)
         	pfq_free_sk_filter(filter);
 
         g->vlan_filt = false;
+        g->snaplen_set = false;
+
+        __pfq_group_maglev_update(g, 0);
 
         pr_devel("[PFQ] group %d destroyed.\n", gid);
 }
@@ -186,6 +223,8 @@ __pfq_join_group(int gid, int id, unsigned long class_mask, int policy)
 		g->owner = id;
 	}
 
+        __pfq_group_maglev_update(g, __pfq_get_all_groups_mask(gid));
+
 	if (g->policy == Q_POLICY_GROUP_UNDEFINED) {
 		g->policy = policy;
 	}
@@ -218,6 +257,8 @@ __pfq_leave_group(int gid, int id)
 
         if (__pfq_group_is_empty(gid))
                 __pfq_group_free(gid);
+        else
+                __pfq_group_maglev_update(g, __pfq_get_all_groups_mask(gid));
 
         return 0;
 }
@@ -397,6 +438,42 @@ pfq_get_groups(int id)
 }
 
 
+int
+pfq_groups_init(void)
+{
+        int n;
+
+        for(n = 0; n < Q_MAX_GROUP; n++)
+        {
+                struct pfq_group * g = &pfq_groups[n];
+
+                if (sparse_stats_alloc(&g->stats) ||
+                    sparse_block_alloc(g->context.counter, Q_MAX_COUNTERS)) {
+                        printk(KERN_WARNING "[PFQ] groups: out of memory!\n");
+                        pfq_groups_fini();
+                        return -ENOMEM;
+                }
+        }
+
+        return 0;
+}
+
+
+void
+pfq_groups_fini(void)
+{
+        int n;
+
+        for(n = 0; n < Q_MAX_GROUP; n++)
+        {
+                struct pfq_group * g = &pfq_groups[n];
+
+                sparse_stats_free(&g->stats);
+                sparse_block_free(g->context.counter, Q_MAX_COUNTERS);
+        }
+}
+
+
 struct pfq_group *
 pfq_get_group(int gid)
 {
@@ -460,6 +537,31 @@ void __pfq_set_group_vlan_filter(int gid, bool value, int vid)
 }
 
 
+void __pfq_set_group_snaplen(int gid, unsigned long class_mask, unsigned int snaplen)
+{
+        struct pfq_group *g = pfq_get_group(gid);
+        unsigned long bit;
+        bool set = false;
+        int i;
+
+        if (!g) {
+                pr_devel("[PFQ] group error: invalid group id %d!\n", gid);
+                return;
+        }
+
+        pfq_bitwise_foreach(class_mask, bit,
+        {
+                g->snaplen[pfq_ctz(bit)] = snaplen;
+        })
+
+        for(i = 0; i < Q_CLASS_MAX; i++)
+                set |= g->snaplen[i] != 0;
+
+        smp_wmb();
+
+        g->snaplen_set = set;
+}
+
 
 int pfq_check_group(int id, int gid, const char *msg)
 {
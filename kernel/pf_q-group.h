@@ -30,6 +30,7 @@
 #include <linux/filter.h>
 #include <linux/spinlock.h>
 #include <linux/semaphore.h>
+#include <linux/rcupdate.h>
 
 #include <pf_q-macro.h>
 #include <pf_q-sparse.h>
@@ -37,6 +38,16 @@
 #include <pf_q-bpf.h>
 
 
+/* consistent steering: Maglev table of the sockets of the group */
+
+struct pfq_group_maglev
+{
+        struct rcu_head rcu;
+        unsigned long sock_mask;                        /* sockets the table is built for */
+        u8 table[Q_MAGLEV_TABLE_SIZE];                  /* socket id per slot */
+};
+
+
 /* persistent state */
 
 struct pfq_group_persistent
@@ -65,9 +76,14 @@ struct pfq_group
         bool   vlan_filt;                               /* enable/disable vlan filtering */
         char   vid_filters[4096];                       /* vlan filters */
 
+        bool   snaplen_set;                             /* some class has a capture length */
+        unsigned int snaplen[Q_CLASS_MAX];              /* per-class capture length (0 = caplen of the socket) */
+
         atomic_long_t comp;                             /* struct pfq_computation_tree *  (new functional program) */
         atomic_long_t comp_ctx;                         /* void *: storage context (new functional program) */
 
+        struct pfq_group_maglev __rcu *maglev;          /* built on join/leave, read under rcu */
+
 	struct pfq_group_stats stats;
 
         struct pfq_group_persistent context;
@@ -78,6 +94,9 @@ extern struct semaphore group_sem;
 
 struct pfq_computation_tree;
 
+extern int  pfq_groups_init(void);
+extern void pfq_groups_fini(void);
+
 extern int  pfq_join_free_group(int id, unsigned long class_mask, int policy);
 extern int  pfq_join_group(int gid, int id, unsigned long class_mask, int policy);
 extern int  pfq_leave_group(int gid, int id);
@@ -104,6 +123,8 @@ extern bool __pfq_check_group_vlan_filter(int gid, int vid);
 extern bool __pfq_toggle_group_vlan_filters(int gid, bool value);
 extern void __pfq_set_group_vlan_filter(int gid, bool value, int vid);
 
+extern void __pfq_set_group_snaplen(int gid, unsigned long class_mask, unsigned int snaplen);
+
 static inline
 bool __pfq_group_is_empty(int gid)
 {
@@ -0,0 +1,188 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+
+#include <pf_q-global.h>
+#include <pf_q-bitops.h>
+#include <pf_q-hash.h>
+
+
+/* Toeplitz key: the default (0x6d5a repeated) makes the hash symmetric */
+
+u8 pfq_toeplitz_key[Q_TOEPLITZ_KEY_LEN] =
+{
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+	0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+};
+
+
+/* table[n][v]: contribution of the byte v at position n of the input */
+
+u32 pfq_toeplitz_table[Q_TOEPLITZ_INPUT_LEN][256];
+
+
+const char *
+pfq_hash_name(int hash)
+{
+	switch(hash)
+	{
+	case Q_STEER_HASH_XOR:		return "xor";
+	case Q_STEER_HASH_TOEPLITZ:	return "toeplitz";
+	case Q_STEER_HASH_XORSHIFT:	return "xorshift";
+	case Q_STEER_HASH_CRC32C:	return "crc32c";
+	}
+	return "unknown";
+}
+
+
+/* 32 bits of the key, starting from the given bit */
+
+static u32
+toeplitz_window(const u8 *key, int bit)
+{
+	u64 w = 0;
+	int n;
+
+	for(n = 0; n < 5; n++)
+	{
+		int i = bit/8 + n;
+		w = (w << 8) | (i < Q_TOEPLITZ_KEY_LEN ? key[i] : 0);
+	}
+
+	return (u32)(w >> (8 - bit % 8));
+}
+
+
+/* parse the key, as a string of hex digits (separators ':' and '-' are allowed) */
+
+static int
+toeplitz_key_parse(const char *str, u8 *key)
+{
+	size_t n = 0;
+
+	while (*str)
+	{
+		if (*str == ':' || *str == '-') {
+			str++;
+			continue;
+		}
+
+		if (n == Q_TOEPLITZ_KEY_LEN || !isxdigit(str[0]) || !isxdigit(str[1]))
+			return -EINVAL;
+
+		key[n++] = (hex_to_bin(str[0]) << 4) | hex_to_bin(str[1]);
+		str += 2;
+	}
+
+	return n == Q_TOEPLITZ_KEY_LEN ? 0 : -EINVAL;
+}
+
+
+/*
+ * Maglev lookup table (Eisenbud et al., NSDI '16): each socket fills the
+ * slots in the order of its own permutation, which depends only on the
+ * socket id. When a socket joins or leaves, only ~1/N of the slots change
+ * owner. All the cpus build the same table for the same set of sockets.
+ */
+
+void
+pfq_maglev_build(u8 *table, unsigned long sock_mask)
+{
+	u16 pos[Q_MAX_ID], skip[Q_MAX_ID];
+	u8  id[Q_MAX_ID];
+	unsigned long bit;
+	size_t n, len = 0, filled = 0;
+
+	memset(table, 0xff, Q_MAGLEV_TABLE_SIZE);
+
+	pfq_bitwise_foreach(sock_mask, bit,
+	{
+		int sid = pfq_ctz(bit);
+
+		id[len]   = sid;
+		pos[len]  = pfq_hash_xorshift(sid) % Q_MAGLEV_TABLE_SIZE;
+		skip[len] = pfq_hash_xorshift(sid + 0x9e3779b97f4a7c15ULL) % (Q_MAGLEV_TABLE_SIZE - 1) + 1;
+		len++;
+	})
+
+	if (len == 0)
+		return;
+
+	for(;;)
+	{
+		for(n = 0; n < len; n++)
+		{
+			while (table[pos[n]] != 0xff)
+				pos[n] = (pos[n] + skip[n]) % Q_MAGLEV_TABLE_SIZE;
+
+			table[pos[n]] = id[n];
+			pos[n] = (pos[n] + skip[n]) % Q_MAGLEV_TABLE_SIZE;
+
+			if (++filled == Q_MAGLEV_TABLE_SIZE)
+				return;
+		}
+	}
+}
+
+
+int
+pfq_hash_init(void)
+{
+	int n, v, b;
+
+	if (steer_hash < Q_STEER_HASH_XOR || steer_hash > Q_STEER_HASH_CRC32C) {
+		printk(KERN_INFO "[PFQ] steer_hash=%d not allowed: valid range [%d,%d]!\n", steer_hash, Q_STEER_HASH_XOR, Q_STEER_HASH_CRC32C);
+		return -EFAULT;
+	}
+
+	if (steer_key && toeplitz_key_parse(steer_key, pfq_toeplitz_key) < 0) {
+		printk(KERN_INFO "[PFQ] steer_key='%s' not allowed: expected %d hex bytes!\n", steer_key, Q_TOEPLITZ_KEY_LEN);
+		return -EFAULT;
+	}
+
+	for(n = 0; n < Q_TOEPLITZ_INPUT_LEN; n++)
+	{
+		for(v = 0; v < 256; v++)
+		{
+			u32 h = 0;
+
+			for(b = 0; b < 8; b++)
+			{
+				if (v & (0x80 >> b))
+					h ^= toeplitz_window(pfq_toeplitz_key, n * 8 + b);
+			}
+
+			pfq_toeplitz_table[n][v] = h;
+		}
+	}
+
+	printk(KERN_INFO "[PFQ] steering hash: %s%s\n", pfq_hash_name(steer_hash), steer_consistent ? " (consistent)" : "");
+	return 0;
+}
+
@@ -0,0 +1,190 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PF_Q_HASH_H
+#define PF_Q_HASH_H
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/crc32.h>
+#include <linux/in6.h>
+
+#if defined(CONFIG_X86_64)
+#include <asm/cpufeature.h>
+#endif
+
+#include <pf_q-macro.h>
+
+
+/* steering hash functions (steer_hash) */
+
+#define Q_STEER_HASH_XOR	0	/* xor of addresses and ports (legacy) */
+#define Q_STEER_HASH_TOEPLITZ	1	/* Toeplitz, as RSS NICs (symmetric with the default key) */
+#define Q_STEER_HASH_XORSHIFT	2	/* multiply-xorshift, symmetric */
+#define Q_STEER_HASH_CRC32C	3	/* crc32c (SSE4.2 where available), symmetric */
+
+
+extern int steer_hash;
+
+extern u32 pfq_toeplitz_table[Q_TOEPLITZ_INPUT_LEN][256];
+extern u8  pfq_toeplitz_key[Q_TOEPLITZ_KEY_LEN];
+
+extern int  pfq_hash_init(void);
+extern const char *pfq_hash_name(int hash);
+extern void pfq_maglev_build(u8 *table, unsigned long sock_mask);
+
+
+static inline u32
+pfq_hash_toeplitz(const void *data, size_t len)
+{
+	const u8 *p = data;
+	u32 ret = 0;
+	size_t n;
+
+	for(n = 0; n < len; n++)
+		ret ^= pfq_toeplitz_table[n][p[n]];
+
+	return ret;
+}
+
+
+/* 64-bit finalizer of MurmurHash3 */
+
+static inline u32
+pfq_hash_xorshift(u64 x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (u32)x;
+}
+
+
+static inline u32
+pfq_hash_crc32c(u32 crc, u64 x)
+{
+#if defined(CONFIG_X86_64)
+	if (static_cpu_has(X86_FEATURE_XMM4_2)) {
+		u64 ret = crc;
+		asm("crc32q %1, %0" : "+r" (ret) : "rm" (x));
+		return (u32)ret;
+	}
+#endif
+	return __crc32c_le(crc, (unsigned char const *)&x, sizeof(x));
+}
+
+
+/* slot of the Maglev table for the given hash (same cost as the fold) */
+
+static inline unsigned int
+pfq_maglev_slot(u32 hash)
+{
+	if (steer_hash == Q_STEER_HASH_XOR)
+		return (hash ^ (hash >> 8) ^ (hash >> 16)) % Q_MAGLEV_TABLE_SIZE;
+
+	return ((u64)hash * Q_MAGLEV_TABLE_SIZE) >> 32;
+}
+
+
+/* symmetric hashes: the endpoints are sorted before hashing */
+
+static inline u32
+pfq_hash_ip(__be32 saddr, __be32 daddr)
+{
+	switch(steer_hash)
+	{
+	case Q_STEER_HASH_TOEPLITZ: {
+		__be32 in[2] = { saddr, daddr };
+		return pfq_hash_toeplitz(in, sizeof(in));
+	}
+	case Q_STEER_HASH_XORSHIFT: {
+		u32 a = min(saddr, daddr), b = max(saddr, daddr);
+		return pfq_hash_xorshift((u64)a << 32 | b);
+	}
+	case Q_STEER_HASH_CRC32C: {
+		u32 a = min(saddr, daddr), b = max(saddr, daddr);
+		return pfq_hash_crc32c(~0U, (u64)a << 32 | b);
+	}
+	}
+
+	return (__force u32)(saddr ^ daddr);
+}
+
+
+static inline u32
+pfq_hash_flow(__be32 saddr, __be32 daddr, __be16 source, __be16 dest)
+{
+	switch(steer_hash)
+	{
+	case Q_STEER_HASH_TOEPLITZ: {
+		__be32 in[3] = { saddr, daddr, ((__force u32)source) | ((__force u32)dest << 16) };
+		return pfq_hash_toeplitz(in, sizeof(in));
+	}
+	case Q_STEER_HASH_XORSHIFT:
+	case Q_STEER_HASH_CRC32C: {
+		u64 a = (u64)saddr << 16 | source, b = (u64)daddr << 16 | dest;
+		u64 lo = min(a, b), hi = max(a, b);
+
+		if (steer_hash == Q_STEER_HASH_XORSHIFT)
+			return pfq_hash_xorshift(lo ^ pfq_hash_xorshift(hi));
+
+		return pfq_hash_crc32c(pfq_hash_crc32c(~0U, lo), hi);
+	}
+	}
+
+	return (__force u32)(saddr ^ daddr ^ (__force __be32)source ^ (__force __be32)dest);
+}
+
+
+static inline u32
+pfq_hash_ip6(struct in6_addr const *saddr, struct in6_addr const *daddr)
+{
+	switch(steer_hash)
+	{
+	case Q_STEER_HASH_TOEPLITZ: {
+		struct in6_addr in[2] = { *saddr, *daddr };
+		return pfq_hash_toeplitz(in, sizeof(in));
+	}
+	case Q_STEER_HASH_XORSHIFT:
+	case Q_STEER_HASH_CRC32C: {
+		u64 const *s = (u64 const *)saddr->s6_addr32, *d = (u64 const *)daddr->s6_addr32;
+		u64 const *lo = s, *hi = d;
+
+		if (memcmp(saddr, daddr, sizeof(struct in6_addr)) > 0)
+			swap(lo, hi);
+
+		if (steer_hash == Q_STEER_HASH_XORSHIFT)
+			return pfq_hash_xorshift(lo[0] ^ pfq_hash_xorshift(lo[1] ^ pfq_hash_xorshift(hi[0] ^ pfq_hash_xorshift(hi[1]))));
+
+		return pfq_hash_crc32c(pfq_hash_crc32c(pfq_hash_crc32c(pfq_hash_crc32c(~0U, lo[0]), lo[1]), hi[0]), hi[1]);
+	}
+	}
+
+	return saddr->s6_addr32[0] ^ saddr->s6_addr32[1] ^ saddr->s6_addr32[2] ^ saddr->s6_addr32[3] ^
+	       daddr->s6_addr32[0] ^ daddr->s6_addr32[1] ^ daddr->s6_addr32[2] ^ daddr->s6_addr32[3];
+}
+
+
+#endif /* PF_Q_HASH_H */
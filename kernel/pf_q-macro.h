@@ -31,6 +31,7 @@
 
 #define Q_GC_LOG_QUEUE_LEN	16
 #define Q_GC_POOL_QUEUE_LEN 	Q_SKBUFF_LONG_BATCH
+#define Q_GC_RESIDENCY_SLOTS	16	/* log2 usec histogram */
 
 #define Q_MAX_DEVICE           	256
 #define Q_MAX_DEVICE_MASK       (Q_MAX_DEVICE-1)
@@ -39,6 +40,7 @@
 #define Q_MAX_HW_QUEUE_MASK     (Q_MAX_HW_QUEUE-1)
 
 #define Q_GRACE_PERIOD 		100 /* msec */
+#define Q_BATCH_WINDOW		1000000 /* nsec, arrival rate window */
 
 #define Q_TX_RING_SIZE          (8192)
 #define Q_TX_RING_MASK          (PFQ_TX_RING_SIZE-1)
@@ -46,6 +48,12 @@
 #define Q_SLOT_ALIGN(s, n)      ((s+(n-1)) & ~(n-1))
 
 #define Q_FUN_SYMB_LEN          256
+#define Q_SYMTABLE_HASH_BITS    8
+
+#define Q_TOEPLITZ_KEY_LEN      40      /* RSS key (bytes) */
+#define Q_TOEPLITZ_INPUT_LEN    36      /* max hash input (bytes) */
+#define Q_MAGLEV_TABLE_SIZE     1021    /* consistent steering table (prime) */
+
 #define Q_PERSISTENT_MEM 	64
 
 
@@ -38,6 +38,7 @@
 
 #include <pf_q-sparse.h>
 #include <pf_q-monad.h>
+#include <pf_q-parse.h>
 #include <pf_q-GC.h>
 
 /**** macros ****/
@@ -175,9 +176,15 @@ struct pfq_functional_node
 };
 
 
+/* nodes are laid out in execution order: the monadic chain starting
+ * from the entry point takes node[0..length), followed by the functions
+ * passed as arguments (predicates, properties, etc.)
+ */
+
 struct pfq_computation_tree
 {
         size_t size;
+        size_t length;
         struct pfq_functional_node *entry_point;
         struct pfq_functional_node node[];
 };
@@ -24,6 +24,12 @@
 #ifndef PF_Q_MONAD_H
 #define PF_Q_MONAD_H
 
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <linux/icmp.h>
+
 #include <pf_q-group.h>
 #include <pf_q-skbuff.h>
 #include <pf_q-macro.h>
@@ -61,6 +67,53 @@ typedef struct
 } fanout_t;
 
 
+/* packet headers, parsed on demand (see pf_q-parse.h) */
+
+#define Q_HDR_PARSED		(1 << 0)
+#define Q_HDR_IP		(1 << 1)
+#define Q_HDR_IP6		(1 << 2)
+#define Q_HDR_UDP		(1 << 3)
+#define Q_HDR_TCP		(1 << 4)
+#define Q_HDR_ICMP		(1 << 5)
+#define Q_HDR_ICMP6		(1 << 6)
+#define Q_HDR_FRAG		(1 << 7)	/* IPv4 fragment (first or not) */
+#define Q_HDR_PORTS		(1 << 8)	/* flow ports (UDP/TCP, unfragmented packets) */
+
+
+/* IPv4 5-tuple: the ports are 0 unless Q_HDR_PORTS is set */
+
+struct pfq_flow
+{
+	__be32			saddr;
+	__be32			daddr;
+	__be16			source;
+	__be16			dest;
+	uint8_t			proto;
+};
+
+
+struct pfq_headers
+{
+	uint16_t		flags;
+	uint16_t		l4_off;		/* offset of the transport header */
+
+	struct pfq_flow		flow;
+
+	union
+	{
+		struct iphdr	ip;
+		struct ipv6hdr	ip6;
+	} l3;
+
+	union
+	{
+		struct udphdr	udp;
+		struct tcphdr	tcp;
+		struct icmphdr	icmp;
+	} l4;
+};
+
+
 /* Action monad */
 
 struct pfq_monad
@@ -68,6 +121,7 @@ struct pfq_monad
         fanout_t 		fanout;
         unsigned long 		state;
         struct pfq_group	*group;
+        struct pfq_headers	headers;
 };
 
 
@@ -0,0 +1,194 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+
+#include <pf_q-netdev.h>
+#include <pf_q-macro.h>
+
+
+/* clear the binding (if bound to dev, or to any device when dev is NULL):
+ * rtnl held. Returns the device to release after a grace period. */
+
+static struct net_device *
+__pfq_netdev_clear(struct net_device __rcu **slot, struct net_device *dev)
+{
+	struct net_device *old = rtnl_dereference(*slot);
+
+	if (old == NULL || (dev && old != dev))
+		return NULL;
+
+	RCU_INIT_POINTER(*slot, NULL);
+	return old;
+}
+
+
+static void
+__pfq_netdev_put(struct net_device **devs, size_t num)
+{
+	size_t n;
+
+	if (num == 0)
+		return;
+
+	/* wait for the readers (rcu and rx softirq) before releasing */
+
+	synchronize_net();
+
+	for(n = 0; n < num; n++)
+		dev_put(devs[n]);
+}
+
+
+/* clear all the bindings of the socket to dev (any device, if NULL) */
+
+static size_t
+__pfq_netdev_clear_sock(struct pfq_sock *so, struct net_device *dev, struct net_device **devs)
+{
+	struct net_device *old;
+	size_t n, num = 0;
+
+	old = __pfq_netdev_clear(&so->egress_dev, dev);
+	if (old)
+		devs[num++] = old;
+
+	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+	{
+		old = __pfq_netdev_clear(&so->tx_opt.queue[n].dev, dev);
+		if (old)
+			devs[num++] = old;
+	}
+
+	return num;
+}
+
+
+int
+pfq_netdev_bind(struct pfq_sock *so, struct net_device __rcu **slot, int if_index)
+{
+	struct net_device *dev, *old;
+
+	rtnl_lock();
+
+	dev = __dev_get_by_index(sock_net(&so->sk), if_index);
+	if (dev == NULL || dev->reg_state != NETREG_REGISTERED) {
+		rtnl_unlock();
+		return -EPERM;
+	}
+
+	dev_hold(dev);
+
+	old = rtnl_dereference(*slot);
+	rcu_assign_pointer(*slot, dev);
+
+	rtnl_unlock();
+
+	__pfq_netdev_put(&old, old ? 1 : 0);
+	return 0;
+}
+
+
+void
+pfq_netdev_unbind(struct net_device __rcu **slot)
+{
+	struct net_device *old;
+
+	rtnl_lock();
+	old = __pfq_netdev_clear(slot, NULL);
+	rtnl_unlock();
+
+	__pfq_netdev_put(&old, old ? 1 : 0);
+}
+
+
+void
+pfq_netdev_unbind_all(struct pfq_sock *so)
+{
+	struct net_device *devs[Q_MAX_TX_QUEUES + 1];
+	size_t num;
+
+	rtnl_lock();
+	num = __pfq_netdev_clear_sock(so, NULL, devs);
+	rtnl_unlock();
+
+	__pfq_netdev_put(devs, num);
+}
+
+
+/* device unregistered: drop the bindings of all the sockets (rtnl held) */
+
+static int
+pfq_netdev_event(struct notifier_block *nb, unsigned long event, void *ptr)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,11,0))
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+#else
+	struct net_device *dev = (struct net_device *)ptr;
+#endif
+	struct net_device *devs[Q_MAX_TX_QUEUES + 1];
+	size_t n, num;
+
+	if (event != NETDEV_UNREGISTER)
+		return NOTIFY_DONE;
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_sock *so = pfq_get_sock_by_id(n);
+		if (so == NULL)
+			continue;
+
+		num = __pfq_netdev_clear_sock(so, dev, devs);
+		if (num) {
+			printk(KERN_INFO "[PFQ|%d] device %s unregistered: %zu binding(s) dropped.\n", so->id, dev->name, num);
+			__pfq_netdev_put(devs, num);
+		}
+	}
+
+	return NOTIFY_DONE;
+}
+
+
+static struct notifier_block pfq_netdev_notifier =
+{
+	.notifier_call = pfq_netdev_event,
+};
+
+
+int
+pfq_netdev_notifier_init(void)
+{
+	return register_netdevice_notifier(&pfq_netdev_notifier);
+}
+
+
+void
+pfq_netdev_notifier_fini(void)
+{
+	unregister_netdevice_notifier(&pfq_netdev_notifier);
+}
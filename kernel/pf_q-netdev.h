@@ -0,0 +1,68 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+
+#ifndef PF_Q_NETDEV_H
+#define PF_Q_NETDEV_H
+
+#include <linux/kernel.h>
+#include <linux/netdevice.h>
+#include <linux/rcupdate.h>
+
+#include <pf_q-sock.h>
+
+
+/*
+ * Device bindings (egress endpoint and tx queues): the net_device is looked
+ * up and held once, at bind time, and released when unbound, when the socket
+ * is closed, or when the device is unregistered (netdevice notifier).
+ * The fast paths read the binding under rcu, with no lookup by index.
+ */
+
+extern int  pfq_netdev_notifier_init(void);
+extern void pfq_netdev_notifier_fini(void);
+
+extern int  pfq_netdev_bind(struct pfq_sock *so, struct net_device __rcu **slot, int if_index);
+extern void pfq_netdev_unbind(struct net_device __rcu **slot);
+extern void pfq_netdev_unbind_all(struct pfq_sock *so);
+
+
+/* the bound device, held for a path that may sleep (NULL if unbound) */
+
+static inline struct net_device *
+pfq_netdev_get(struct net_device __rcu **slot)
+{
+	struct net_device *dev;
+
+	rcu_read_lock();
+	dev = rcu_dereference(*slot);
+	if (dev)
+		dev_hold(dev);
+	rcu_read_unlock();
+
+	return dev;
+}
+
+
+#endif /* PF_Q_NETDEV_H */
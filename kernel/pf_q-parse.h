@@ -0,0 +1,190 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PF_Q_PARSE_H
+#define PF_Q_PARSE_H
+
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <linux/tcp.h>
+#include <linux/icmp.h>
+
+#include <pf_q-monad.h>
+
+
+/*
+ * The headers of a packet are parsed once, the first time a function of the
+ * computation asks for them, and cached in the monad. The cache is reset
+ * (headers.flags = 0) each time the monad is set up for a computation.
+ */
+
+static inline void
+__pfq_parse_l4(struct sk_buff *skb, struct pfq_headers *h, u8 protocol)
+{
+	switch(protocol)
+	{
+	case IPPROTO_UDP:
+	case IPPROTO_TCP:   /* the ports are in the first 8 bytes of both */
+		if (skb_copy_bits(skb, h->l4_off, &h->l4.udp, sizeof(struct udphdr)) < 0)
+			break;
+
+		if (!(h->flags & Q_HDR_FRAG)) {
+			h->flags |= Q_HDR_PORTS;
+			h->flow.source = h->l4.udp.source;
+			h->flow.dest   = h->l4.udp.dest;
+		}
+
+		if (protocol == IPPROTO_UDP)
+			h->flags |= Q_HDR_UDP;
+		else if (skb_copy_bits(skb, h->l4_off, &h->l4.tcp, sizeof(struct tcphdr)) == 0)
+			h->flags |= Q_HDR_TCP;
+		break;
+	case IPPROTO_ICMP:
+		if (skb_copy_bits(skb, h->l4_off, &h->l4.icmp, sizeof(struct icmphdr)) == 0)
+			h->flags |= Q_HDR_ICMP;
+		break;
+	case IPPROTO_ICMPV6:    /* the icmpv6 header is 32 bits long */
+		if (skb_copy_bits(skb, h->l4_off, &h->l4.icmp, 4) == 0)
+			h->flags |= Q_HDR_ICMP6;
+		break;
+	}
+}
+
+
+static inline void
+__pfq_parse_headers(struct sk_buff *skb, struct pfq_headers *h)
+{
+	__be16 proto = eth_hdr(skb)->h_proto;
+
+	h->flags = Q_HDR_PARSED;
+	memset(&h->flow, 0, sizeof(h->flow));
+
+	if (proto == __constant_htons(ETH_P_IP)) {
+
+		if (skb_copy_bits(skb, skb->mac_len, &h->l3.ip, sizeof(struct iphdr)) < 0)
+			return;
+
+		h->flags |= Q_HDR_IP;
+		h->l4_off = skb->mac_len + (h->l3.ip.ihl<<2);
+
+		h->flow.saddr = h->l3.ip.saddr;
+		h->flow.daddr = h->l3.ip.daddr;
+		h->flow.proto = h->l3.ip.protocol;
+
+		if (h->l3.ip.frag_off & __constant_htons(IP_MF|IP_OFFSET))
+			h->flags |= Q_HDR_FRAG;
+
+		/* non-first fragments carry no transport header */
+
+		if (h->l3.ip.frag_off & __constant_htons(IP_OFFSET))
+			return;
+
+		__pfq_parse_l4(skb, h, h->l3.ip.protocol);
+	}
+	else if (proto == __constant_htons(ETH_P_IPV6)) {
+
+		if (skb_copy_bits(skb, skb->mac_len, &h->l3.ip6, sizeof(struct ipv6hdr)) < 0)
+			return;
+
+		h->flags |= Q_HDR_IP6;
+		h->l4_off = skb->mac_len + sizeof(struct ipv6hdr);
+
+		__pfq_parse_l4(skb, h, h->l3.ip6.nexthdr);
+	}
+}
+
+
+static inline struct pfq_headers const *
+pfq_headers(SkBuff b)
+{
+	struct pfq_headers *h = &PFQ_CB(b.skb)->monad->headers;
+
+	if (!(h->flags & Q_HDR_PARSED))
+		__pfq_parse_headers(b.skb, h);
+
+	return h;
+}
+
+
+static inline struct iphdr const *
+pfq_ip_hdr(SkBuff b)
+{
+	struct pfq_headers const *h = pfq_headers(b);
+	return (h->flags & Q_HDR_IP) ? &h->l3.ip : NULL;
+}
+
+
+static inline struct ipv6hdr const *
+pfq_ip6_hdr(SkBuff b)
+{
+	struct pfq_headers const *h = pfq_headers(b);
+	return (h->flags & Q_HDR_IP6) ? &h->l3.ip6 : NULL;
+}
+
+
+static inline struct pfq_flow const *
+pfq_flow(SkBuff b)
+{
+	struct pfq_headers const *h = pfq_headers(b);
+	return (h->flags & Q_HDR_IP) ? &h->flow : NULL;
+}
+
+
+/* transport headers (IPv4 only) */
+
+static inline struct udphdr const *
+pfq_udp_hdr(SkBuff b)
+{
+	struct pfq_headers const *h = pfq_headers(b);
+	return (h->flags & (Q_HDR_IP|Q_HDR_UDP)) == (Q_HDR_IP|Q_HDR_UDP) ? &h->l4.udp : NULL;
+}
+
+
+static inline struct tcphdr const *
+pfq_tcp_hdr(SkBuff b)
+{
+	struct pfq_headers const *h = pfq_headers(b);
+	return (h->flags & (Q_HDR_IP|Q_HDR_TCP)) == (Q_HDR_IP|Q_HDR_TCP) ? &h->l4.tcp : NULL;
+}
+
+
+static inline struct icmphdr const *
+pfq_icmp_hdr(SkBuff b)
+{
+	struct pfq_headers const *h = pfq_headers(b);
+	return (h->flags & (Q_HDR_IP|Q_HDR_ICMP)) == (Q_HDR_IP|Q_HDR_ICMP) ? &h->l4.icmp : NULL;
+}
+
+
+static inline bool
+pfq_has_headers(SkBuff b, uint16_t flags)
+{
+	return (pfq_headers(b)->flags & flags) == flags;
+}
+
+
+#endif /* PF_Q_PARSE_H */
@@ -30,6 +30,19 @@
 #include <pf_q-memory.h>
 #include <pf_q-module.h>
 #include <pf_q-GC.h>
+#include <pf_q-percpu.h>
+
+
+static enum hrtimer_restart
+pfq_percpu_flush_timer(struct hrtimer *timer)
+{
+	struct local_data *local = container_of(timer, struct local_data, flush_timer);
+
+	/* the flush takes place in softirq context, as pfq_receive does */
+
+	tasklet_schedule(&local->flush_tasklet);
+	return HRTIMER_NORESTART;
+}
 
 
 int pfq_percpu_init(void)
@@ -49,12 +62,41 @@ int pfq_percpu_init(void)
                 struct local_data *local = per_cpu_ptr(cpu_data, cpu);
 
 		gc_data_init(&local->gc);
+
+		hrtimer_init(&local->flush_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+		local->flush_timer.function = pfq_percpu_flush_timer;
+
+		tasklet_init(&local->flush_tasklet, pfq_receive_flush, cpu);
+
+		memset(local->gc_residency, 0, sizeof(local->gc_residency));
+
+		local->batch_len  = batch_len;
+		local->batch_ts   = ktime_get();
+		local->batch_pkts = 0;
+		local->arrival_ns = 0;
+		local->cost_ns    = 0;
 	}
 
 	return 0;
 }
 
 
+void pfq_percpu_fini(void)
+{
+	int cpu;
+
+	/* stop the flush timers (and pending tasklets) of each cpu */
+
+	for_each_possible_cpu(cpu) {
+
+		struct local_data *local = per_cpu_ptr(cpu_data, cpu);
+
+		hrtimer_cancel(&local->flush_timer);
+		tasklet_kill(&local->flush_tasklet);
+	}
+}
+
+
 int pfq_percpu_flush(void)
 {
         int cpu;
@@ -26,13 +26,21 @@
 
 #include <linux/percpu.h>
 #include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 
 #include <pf_q-skbuff-list.h>
 #include <pf_q-macro.h>
 #include <pf_q-GC.h>
+#include <pf_q-monad.h>
 
 int pfq_percpu_init(void);
 int pfq_percpu_flush(void);
+void pfq_percpu_fini(void);
+
+/* defined in pf_q.c: flush the GC of the given cpu (tasklet) */
+
+extern void pfq_receive_flush(unsigned long cpu);
 
 /* per-cpu data... */
 
@@ -42,10 +50,26 @@ struct local_data
         unsigned long           sock_mask [Q_MAX_ID];
 
         int                     sock_cnt;
+        unsigned long           steer_disp[Q_MAX_ID];   /* packets steered to each socket */
 
 	struct gc_data 		gc;		/* garbage collector */
 	ktime_t 		last_ts;	/* timestamp of the last packet */
 
+	struct hrtimer		flush_timer;	/* GC flush deadline */
+	struct tasklet_struct	flush_tasklet;
+
+	unsigned long		gc_residency[Q_GC_RESIDENCY_SLOTS];
+
+	int			batch_len;	/* effective batch length (adaptive) */
+	ktime_t			batch_ts;	/* start of the arrival rate window */
+	unsigned long		batch_pkts;	/* packets received in the window */
+	u64			arrival_ns;	/* mean inter-arrival time (ewma) */
+	u64			cost_ns;	/* mean processing cost per packet (ewma) */
+
+	struct pfq_monad	monad[Q_SKBUFF_SHORT_BATCH];	/* vector evaluation: per-packet monads */
+	size_t			num_fwd[Q_SKBUFF_SHORT_BATCH];
+	size_t			to_kernel[Q_SKBUFF_SHORT_BATCH];
+
         atomic_t                enable_skb_pool;
 
         struct pfq_sk_buff_list tx_pool;
@@ -85,7 +85,7 @@ pr_devel_computation_tree(struct pfq_computation_tree const *tree)
         	pr_devel("[PFQ] computation (unspecified)\n");
         	return;
 	}
-        pr_devel("[PFQ] computation size=%zu entry_point=%p\n", tree->size, tree->entry_point);
+        pr_devel("[PFQ] computation size=%zu length=%zu entry_point=%p\n", tree->size, tree->length, tree->entry_point);
         for(n = 0; n < tree->size; n++)
         {
                 pr_devel_functional_node(&tree->node[n], n);
@@ -38,6 +38,8 @@
 #include <pf_q-proc.h>
 #include <pf_q-memory.h>
 #include <pf_q-printk.h>
+#include <pf_q-percpu.h>
+#include <pf_q-hash.h>
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 #define PDE_DATA(a) PDE(a)->data
@@ -48,6 +50,9 @@ struct proc_dir_entry *pfq_proc_dir = NULL;
 static const char proc_computations[] = "computations";
 static const char proc_groups[]       = "groups";
 static const char proc_stats[]        = "stats";
+static const char proc_gc[]           = "gc";
+static const char proc_batch[]        = "batch";
+static const char proc_steer[]        = "steer";
 
 #ifdef PFQ_USE_EXTENDED_PROC
 static const char proc_memory[]       = "memory";
@@ -75,7 +80,7 @@ seq_printf_computation_tree(struct seq_file *m, struct pfq_computation_tree cons
         	return;
 	}
 
-        seq_printf(m, "computation size=%zu entry_point=%p\n", tree->size, tree->entry_point);
+        seq_printf(m, "computation size=%zu length=%zu entry_point=%p\n", tree->size, tree->length, tree->entry_point);
         for(n = 0; n < tree->size; n++)
         {
                 seq_printf_functional_node(m, &tree->node[n], n);
@@ -119,15 +124,19 @@ static int pfq_proc_groups(struct seq_file *m, void *v)
 	for(n = 0; n < Q_MAX_GROUP; n++)
 	{
 		struct pfq_group *this_group = pfq_get_group(n);
+		long stats[SPARSE_BLOCK_LEN(&this_group->stats)];
+
 		if (!this_group->policy)
 			continue;
 
-        	seq_printf(m, "%5zu: %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu", n, sparse_read(&this_group->stats.recv),
-				   	                           	      sparse_read(&this_group->stats.drop),
-					                           	      sparse_read(&this_group->stats.frwd),
-					                           	      sparse_read(&this_group->stats.kern),
-					                           	      sparse_read(&this_group->stats.disc),
-					                           	      sparse_read(&this_group->stats.quit));
+		sparse_stats_read(&this_group->stats, stats);
+
+        	seq_printf(m, "%5zu: %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu", n, stats[SPARSE_BLOCK_IDX(struct pfq_group_stats, recv)],
+				   	                           	      stats[SPARSE_BLOCK_IDX(struct pfq_group_stats, drop)],
+					                           	      stats[SPARSE_BLOCK_IDX(struct pfq_group_stats, frwd)],
+					                           	      stats[SPARSE_BLOCK_IDX(struct pfq_group_stats, kern)],
+					                           	      stats[SPARSE_BLOCK_IDX(struct pfq_group_stats, disc)],
+					                           	      stats[SPARSE_BLOCK_IDX(struct pfq_group_stats, quit)]);
 
         	seq_printf(m, "%3d %3d ", this_group->policy, this_group->pid);
 
@@ -162,6 +171,91 @@ static int pfq_proc_stats(struct seq_file *m, void *v)
 }
 
 
+static int pfq_proc_gc(struct seq_file *m, void *v)
+{
+	char label[16];
+	int cpu, n;
+
+	seq_printf(m, "batch_len=%d flush_timeout=%dus\n", batch_len, flush_timeout);
+	seq_printf(m, "residency (usec):\n");
+
+	seq_printf(m, "cpu: ");
+	for(n = 0; n < Q_GC_RESIDENCY_SLOTS-1; n++)
+	{
+		snprintf(label, sizeof(label), "<%lu", 1UL << n);
+		seq_printf(m, "%-9s ", label);
+	}
+	snprintf(label, sizeof(label), ">=%lu", 1UL << (Q_GC_RESIDENCY_SLOTS-2));
+	seq_printf(m, "%-9s\n", label);
+
+	for_each_online_cpu(cpu)
+	{
+		struct local_data *local = per_cpu_ptr(cpu_data, cpu);
+
+		seq_printf(m, "%3d: ", cpu);
+		for(n = 0; n < Q_GC_RESIDENCY_SLOTS; n++)
+			seq_printf(m, "%-9lu ", local->gc_residency[n]);
+		seq_printf(m, "\n");
+	}
+
+	return 0;
+}
+
+
+static int pfq_proc_batch(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	if (batch_latency)
+		seq_printf(m, "adaptive: target=%dus min=%d max=%d\n", batch_latency, batch_min, batch_len);
+	else
+		seq_printf(m, "fixed: batch_len=%d\n", batch_len);
+
+	seq_printf(m, "cpu: batch_len arrival_ns cost_ns\n");
+
+	for_each_online_cpu(cpu)
+	{
+		struct local_data *local = per_cpu_ptr(cpu_data, cpu);
+
+		seq_printf(m, "%3d: %-9d %-10llu %-10llu\n", cpu, batch_latency ? local->batch_len : batch_len,
+							(unsigned long long)local->arrival_ns,
+							(unsigned long long)local->cost_ns);
+	}
+
+	return 0;
+}
+
+
+static int pfq_proc_steer(struct seq_file *m, void *v)
+{
+	int cpu, n;
+
+	seq_printf(m, "hash: %s\n", pfq_hash_name(steer_hash));
+	seq_printf(m, "consistent: %s\n", steer_consistent ? "maglev" : "no");
+
+	if (steer_hash == Q_STEER_HASH_TOEPLITZ) {
+		seq_printf(m, "key: ");
+		for(n = 0; n < Q_TOEPLITZ_KEY_LEN; n++)
+			seq_printf(m, "%02x%s", pfq_toeplitz_key[n], n == Q_TOEPLITZ_KEY_LEN-1 ? "\n" : ":");
+	}
+
+	seq_printf(m, "id: dispatched\n");
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		unsigned long disp = 0;
+
+		for_each_online_cpu(cpu)
+			disp += per_cpu_ptr(cpu_data, cpu)->steer_disp[n];
+
+		if (disp)
+			seq_printf(m, "%2d: %lu\n", n, disp);
+	}
+
+	return 0;
+}
+
+
 #ifdef PFQ_USE_EXTENDED_PROC
 
 static int pfq_proc_memory(struct seq_file *m, void *v)
@@ -219,6 +313,47 @@ static int pfq_proc_stats_open(struct inode *inode, struct file *file)
 	return single_open(file, pfq_proc_stats, PDE_DATA(inode));
 }
 
+static int pfq_proc_gc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_gc, PDE_DATA(inode));
+}
+
+static int pfq_proc_batch_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_batch, PDE_DATA(inode));
+}
+
+static int pfq_proc_steer_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_steer, PDE_DATA(inode));
+}
+
+static ssize_t
+pfq_proc_steer_reset(struct file *file, const char __user *buf, size_t length, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct local_data *local = per_cpu_ptr(cpu_data, cpu);
+		memset(local->steer_disp, 0, sizeof(local->steer_disp));
+	}
+ 	return 1;
+}
+
+static ssize_t
+pfq_proc_gc_reset(struct file *file, const char __user *buf, size_t length, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct local_data *local = per_cpu_ptr(cpu_data, cpu);
+		memset(local->gc_residency, 0, sizeof(local->gc_residency));
+	}
+ 	return 1;
+}
+
 static ssize_t
 pfq_proc_stats_reset(struct file *file, const char __user *buf, size_t length, loff_t *ppos)
 {
@@ -237,6 +372,35 @@ static const struct file_operations pfq_proc_stats_fops = {
 };
 
 
+static const struct file_operations pfq_proc_gc_fops = {
+ 	.owner   = THIS_MODULE,
+ 	.open    = pfq_proc_gc_open,
+ 	.read    = seq_read,
+ 	.write   = pfq_proc_gc_reset,
+ 	.llseek  = seq_lseek,
+ 	.release = single_release,
+};
+
+
+static const struct file_operations pfq_proc_batch_fops = {
+ 	.owner   = THIS_MODULE,
+ 	.open    = pfq_proc_batch_open,
+ 	.read    = seq_read,
+ 	.llseek  = seq_lseek,
+ 	.release = single_release,
+};
+
+
+static const struct file_operations pfq_proc_steer_fops = {
+ 	.owner   = THIS_MODULE,
+ 	.open    = pfq_proc_steer_open,
+ 	.read    = seq_read,
+ 	.write   = pfq_proc_steer_reset,
+ 	.llseek  = seq_lseek,
+ 	.release = single_release,
+};
+
+
 static const struct file_operations pfq_proc_groups_fops = {
  	.owner   = THIS_MODULE,
  	.open    = pfq_proc_groups_open,
@@ -264,6 +428,9 @@ int pfq_proc_init(void)
 	proc_create(proc_computations, 	0644, pfq_proc_dir, &pfq_proc_comp_fops);
 	proc_create(proc_groups,       	0644, pfq_proc_dir, &pfq_proc_groups_fops);
 	proc_create(proc_stats,		0644, pfq_proc_dir, &pfq_proc_stats_fops);
+	proc_create(proc_gc,		0644, pfq_proc_dir, &pfq_proc_gc_fops);
+	proc_create(proc_batch,		0644, pfq_proc_dir, &pfq_proc_batch_fops);
+	proc_create(proc_steer,		0644, pfq_proc_dir, &pfq_proc_steer_fops);
 #ifdef PFQ_USE_EXTENDED_PROC
 	proc_create(proc_memory,	0644, pfq_proc_dir, &pfq_proc_memory_fops);
 #endif
@@ -277,6 +444,9 @@ int pfq_proc_fini(void)
 	remove_proc_entry(proc_computations, pfq_proc_dir);
 	remove_proc_entry(proc_groups, 	     pfq_proc_dir);
 	remove_proc_entry(proc_stats, 	     pfq_proc_dir);
+	remove_proc_entry(proc_gc, 	     pfq_proc_dir);
+	remove_proc_entry(proc_batch, 	     pfq_proc_dir);
+	remove_proc_entry(proc_steer, 	     pfq_proc_dir);
 #ifdef PFQ_USE_EXTENDED_PROC
 	remove_proc_entry(proc_memory, 	     pfq_proc_dir);
 #endif
@@ -0,0 +1,568 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
+#include <linux/delay.h>
+#include <linux/log2.h>
+
+#include <pf_q-rx-pool.h>
+#include <pf_q-macro.h>
+
+
+atomic_long_t pfq_rx_pool_devmap[Q_MAX_DEVICE][Q_MAX_HW_QUEUE];
+
+
+static int
+rx_pool_page_cmp(const void *a, const void *b)
+{
+	unsigned long pa = ((struct pfq_rx_pool_page const *)a)->pfn;
+	unsigned long pb = ((struct pfq_rx_pool_page const *)b)->pfn;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+
+static int
+rx_pool_pfn_cmp(const void *key, const void *elem)
+{
+	unsigned long pfn = *(unsigned long const *)key;
+	unsigned long pe  = ((struct pfq_rx_pool_page const *)elem)->pfn;
+
+	return pfn < pe ? -1 : pfn > pe;
+}
+
+
+struct pfq_rx_pool *
+pfq_rx_pool_create_pages(struct page **pages, size_t npages, size_t frame_size)
+{
+	struct pfq_rx_pool *pool;
+	size_t n;
+
+	if (!is_power_of_2(frame_size) || frame_size < 2048 || frame_size > PAGE_SIZE || npages == 0) {
+		pr_devel("[PFQ] rx pool: invalid frame_size=%zu npages=%zu!\n", frame_size, npages);
+		return NULL;
+	}
+
+	pool = kzalloc(sizeof(struct pfq_rx_pool), GFP_KERNEL);
+	if (pool == NULL)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	init_completion(&pool->idle);
+	atomic_set(&pool->lent, 1);
+
+	pool->npages      = npages;
+	pool->size        = npages * PAGE_SIZE;
+	pool->frame_size  = frame_size;
+	pool->frame_shift = ilog2(frame_size);
+	pool->frames      = pool->size >> pool->frame_shift;
+	pool->if_index    = Q_ANY_DEVICE;
+	pool->hw_queue    = Q_ANY_QUEUE;
+
+	pool->pages  = vmalloc(npages * sizeof(struct page *));
+	pool->lookup = vmalloc(npages * sizeof(struct pfq_rx_pool_page));
+	pool->state  = vzalloc(pool->frames);
+	pool->free   = vmalloc(pool->frames * sizeof(u32));
+	pool->owner  = vmalloc(pool->frames * sizeof(struct pfq_rx_pool *));
+
+	if (!pool->pages || !pool->lookup || !pool->state || !pool->free || !pool->owner)
+		goto err;
+
+	memcpy(pool->pages, pages, npages * sizeof(struct page *));
+
+	for(n = 0; n < npages; n++)
+	{
+		pool->lookup[n].pfn   = page_to_pfn(pages[n]);
+		pool->lookup[n].index = n;
+	}
+
+	sort(pool->lookup, npages, sizeof(struct pfq_rx_pool_page), rx_pool_page_cmp, NULL);
+
+	pool->addr = vm_map_ram(pool->pages, npages, page_to_nid(pages[0]), PAGE_KERNEL);
+	if (pool->addr == NULL) {
+		pr_devel("[PFQ] rx pool: mapping memory failure.\n");
+		goto err;
+	}
+
+	/* all the frames are free; frame 0 on top */
+
+	for(n = 0; n < pool->frames; n++)
+	{
+		pool->free[n]  = pool->frames - 1 - n;
+		pool->owner[n] = pool;
+	}
+
+	pool->free_len = pool->frames;
+
+	pr_devel("[PFQ] rx pool: %zu frames of %zu bytes (%zu pages)\n", pool->frames, pool->frame_size, npages);
+	return pool;
+err:
+	vfree(pool->owner);
+	vfree(pool->free);
+	vfree(pool->state);
+	vfree(pool->lookup);
+	vfree(pool->pages);
+	kfree(pool);
+	return NULL;
+}
+
+
+struct pfq_rx_pool *
+pfq_rx_pool_create(struct pfq_rx_pool_descr const *descr)
+{
+	struct pfq_rx_pool *pool;
+	struct page **pages;
+	size_t n, npages;
+
+	if (((unsigned long)descr->addr & ~PAGE_MASK) || (descr->size & ~PAGE_MASK) || descr->size == 0) {
+		pr_devel("[PFQ] rx pool: memory not page aligned!\n");
+		return NULL;
+	}
+
+	npages = descr->size >> PAGE_SHIFT;
+
+	pages = vmalloc(npages * sizeof(struct page *));
+	if (pages == NULL)
+		return NULL;
+
+	if (get_user_pages_fast((unsigned long)descr->addr, npages, 1, pages) != npages) {
+		pr_devel("[PFQ] rx pool: could not get user pages!\n");
+		vfree(pages);
+		return NULL;
+	}
+
+	pool = pfq_rx_pool_create_pages(pages, npages, descr->frame_size);
+	if (pool == NULL) {
+		for(n = 0; n < npages; n++)
+			put_page(pages[n]);
+		vfree(pages);
+		return NULL;
+	}
+
+	vfree(pages);
+
+	pool->user = true;
+
+	if (descr->if_index != Q_ANY_DEVICE && pfq_rx_pool_bind(pool, descr->if_index, descr->hw_queue) < 0) {
+		pfq_rx_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+
+/* bind the pool to the device/queue of a direct-capture driver */
+
+int
+pfq_rx_pool_bind(struct pfq_rx_pool *pool, int if_index, int hw_queue)
+{
+	atomic_long_t *slot = &pfq_rx_pool_devmap[if_index & Q_MAX_DEVICE_MASK][hw_queue & Q_MAX_HW_QUEUE_MASK];
+
+	if (if_index < 0 || hw_queue < 0 || atomic_long_cmpxchg(slot, 0, (long)pool) != 0) {
+		pr_devel("[PFQ] rx pool: device %d queue %d not available!\n", if_index, hw_queue);
+		return -EBUSY;
+	}
+
+	pool->if_index = if_index;
+	pool->hw_queue = hw_queue;
+	return 0;
+}
+
+
+void
+pfq_rx_pool_destroy(struct pfq_rx_pool *pool)
+{
+	size_t n;
+
+	if (pool == NULL)
+		return;
+
+	if (pool->if_index != Q_ANY_DEVICE)
+		atomic_long_set(&pfq_rx_pool_devmap[pool->if_index & Q_MAX_DEVICE_MASK][pool->hw_queue & Q_MAX_HW_QUEUE_MASK], 0);
+
+	/* wait for the drivers still holding the pool... */
+
+	msleep(Q_GRACE_PERIOD);
+
+	/* ...and for the skbs built on the frames (frames still in the rings of
+	 * the driver are kept alive by its page references) */
+
+	if (!atomic_dec_and_test(&pool->lent)) {
+		while (!wait_for_completion_timeout(&pool->idle, HZ))
+			printk(KERN_WARNING "[PFQ] rx pool: waiting for %d skbs of device %d queue %d...\n",
+			       atomic_read(&pool->lent), pool->if_index, pool->hw_queue);
+	}
+
+	vm_unmap_ram(pool->addr, pool->npages);
+
+	if (pool->user) {
+		for(n = 0; n < pool->npages; n++)
+		{
+			if (!PageReserved(pool->pages[n]))
+				SetPageDirty(pool->pages[n]);
+			put_page(pool->pages[n]);
+		}
+	}
+
+	pr_devel("[PFQ] rx pool: zcopy=%ld copy=%ld empty=%lu\n", atomic_long_read(&pool->stats.zcopy),
+			atomic_long_read(&pool->stats.copy), pool->stats.empty);
+
+	vfree(pool->owner);
+	vfree(pool->free);
+	vfree(pool->state);
+	vfree(pool->lookup);
+	vfree(pool->pages);
+	kfree(pool);
+}
+
+
+/* user space gives a frame back (pool locked): the frame is free, unless the
+ * skb built on it is still alive, in which case its destructor frees it */
+
+static void
+__rx_pool_return(struct pfq_rx_pool *pool, u32 frame)
+{
+	for(;;)
+	{
+		u8 state = ACCESS_ONCE(pool->state[frame]);
+
+		if (state == pfq_frame_user) {
+			if (cmpxchg(&pool->state[frame], state, pfq_frame_free) == state) {
+				pool->free[pool->free_len++] = frame;
+				return;
+			}
+		}
+		else if (state == pfq_frame_delivered) {
+			if (cmpxchg(&pool->state[frame], state, pfq_frame_returned) == state)
+				return;
+		}
+		else
+			return;
+	}
+}
+
+
+/* the completion ring lives in the shared memory of the socket */
+
+void
+pfq_rx_pool_attach(struct pfq_rx_pool *pool, struct pfq_tx_queue_hdr *compl, void *ring)
+{
+	size_t n;
+
+	spin_lock_bh(&pool->lock);
+
+	/* frames still owned by user space (previous session) are free again */
+
+	for(n = 0; n < pool->frames; n++)
+		__rx_pool_return(pool, n);
+
+	pool->compl_ring = ring;
+	pool->compl = compl;
+
+	spin_unlock_bh(&pool->lock);
+}
+
+
+void
+pfq_rx_pool_detach(struct pfq_rx_pool *pool)
+{
+	spin_lock_bh(&pool->lock);
+	pool->compl = NULL;
+	pool->compl_ring = NULL;
+	spin_unlock_bh(&pool->lock);
+}
+
+
+/* move the frames returned by user space to the free stack (pool locked) */
+
+static void
+__rx_pool_drain(struct pfq_rx_pool *pool)
+{
+	struct pfq_tx_queue_hdr *compl = pool->compl;
+	int avail, n;
+	unsigned int index;
+
+	if (compl == NULL)
+		return;
+
+	avail = pfq_spsc_read_avail(compl);
+	index = compl->consumer.index;
+
+	smp_rmb();
+
+	for(n = 0; n < avail; n++)
+	{
+		u32 frame = pool->compl_ring[(index + n) & compl->size_mask];
+
+		if (likely(frame < pool->frames))
+			__rx_pool_return(pool, frame);
+	}
+
+	pfq_spsc_read_commit_n(compl, avail);
+}
+
+
+static size_t
+__rx_pool_get(struct pfq_rx_pool *pool, u32 *frames, size_t n, u8 state)
+{
+	size_t i;
+
+	spin_lock_bh(&pool->lock);
+
+	if (pool->free_len < n)
+		__rx_pool_drain(pool);
+
+	if (n > pool->free_len) {
+		pool->stats.empty++;
+		n = pool->free_len;
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		u32 frame = pool->free[--pool->free_len];
+		pool->state[frame] = state;
+		frames[i] = frame;
+	}
+
+	spin_unlock_bh(&pool->lock);
+	return n;
+}
+
+
+size_t
+pfq_rx_pool_get(struct pfq_rx_pool *pool, u32 *frames, size_t n)
+{
+	return __rx_pool_get(pool, frames, n, pfq_frame_user);
+}
+
+
+void
+pfq_rx_pool_put(struct pfq_rx_pool *pool, u32 const *frames, size_t n)
+{
+	size_t i;
+
+	spin_lock_bh(&pool->lock);
+
+	for(i = 0; i < n; i++)
+		__rx_pool_return(pool, frames[i]);
+
+	spin_unlock_bh(&pool->lock);
+}
+
+
+static bool
+rx_pool_page_frame(struct pfq_rx_pool *pool, struct page *page, unsigned int offset, u32 *frame)
+{
+	struct pfq_rx_pool_page const *p;
+	unsigned long pfn = page_to_pfn(page);
+
+	p = bsearch(&pfn, pool->lookup, pool->npages, sizeof(struct pfq_rx_pool_page), rx_pool_pfn_cmp);
+	if (p == NULL)
+		return false;
+
+	*frame = (((size_t)p->index << PAGE_SHIFT) + offset) >> pool->frame_shift;
+	return true;
+}
+
+
+/* direct-capture drivers */
+
+/* the driver, or the skb built on the frame, gives up the frame: it goes to
+ * user space if the packet has been delivered, back to the pool otherwise */
+
+static void
+rx_pool_release(struct pfq_rx_pool *pool, u32 frame)
+{
+	for(;;)
+	{
+		u8 state = ACCESS_ONCE(pool->state[frame]);
+
+		if (state == pfq_frame_driver || state == pfq_frame_returned) {
+			if (cmpxchg(&pool->state[frame], state, pfq_frame_free) == state) {
+				spin_lock_bh(&pool->lock);
+				pool->free[pool->free_len++] = frame;
+				spin_unlock_bh(&pool->lock);
+				break;
+			}
+		}
+		else if (state == pfq_frame_delivered) {
+			if (cmpxchg(&pool->state[frame], state, pfq_frame_user) == state)
+				break;
+		}
+		else
+			break;
+	}
+}
+
+
+static void
+pfq_rx_pool_skb_destructor(struct sk_buff *skb)
+{
+	struct pfq_rx_pool **owner = skb_shinfo(skb)->destructor_arg;
+	struct pfq_rx_pool *pool = *owner;
+
+	rx_pool_release(pool, owner - pool->owner);
+
+	if (atomic_dec_and_test(&pool->lent))
+		complete(&pool->idle);
+}
+
+
+/* the frame (if any) a direct-capture driver received the packet into */
+
+bool
+pfq_rx_pool_skb_frame(struct pfq_rx_pool *pool, struct sk_buff const *skb, u32 *frame)
+{
+	struct pfq_rx_pool **owner;
+
+	if (skb->destructor != pfq_rx_pool_skb_destructor)
+		return false;
+
+	owner = skb_shinfo(skb)->destructor_arg;
+	if (*owner != pool)
+		return false;
+
+	*frame = owner - pool->owner;
+	return true;
+}
+
+
+/*
+ * The frame of a pool skb is released by the destructor of the skb, not when
+ * its fragment is freed: the stack (skb_orphan) and the clones would read the
+ * frame after its release. Such skbs are copied before they are handed to the
+ * kernel or to a device; the others are cloned (or shared).
+ */
+
+struct sk_buff *
+pfq_rx_pool_skb_share(struct sk_buff *skb, bool clone)
+{
+	if (skb->destructor == pfq_rx_pool_skb_destructor)
+		return skb_copy(skb, GFP_ATOMIC);
+
+	return clone ? skb_clone(skb, GFP_ATOMIC) : skb_get(skb);
+}
+
+
+int
+pfq_rx_pool_alloc_frame(struct net_device *dev, int queue, struct page **page, unsigned int *offset)
+{
+	struct pfq_rx_pool *pool = pfq_rx_pool_get_by_dev(dev->ifindex, queue);
+	size_t pos;
+	u32 frame;
+
+	if (pool == NULL || pool->if_index != dev->ifindex)
+		return -ENODEV;
+
+	if (__rx_pool_get(pool, &frame, 1, pfq_frame_driver) == 0)
+		return -ENOMEM;
+
+	pos = (size_t)frame << pool->frame_shift;
+
+	*page   = pool->pages[pos >> PAGE_SHIFT];
+	*offset = offset_in_page(pos);
+
+	get_page(*page);
+	return pool->frame_size;
+}
+
+
+/* give back a frame the driver did not receive any packet into */
+
+void
+pfq_rx_pool_free_frame(struct net_device *dev, int queue, struct page *page, unsigned int offset)
+{
+	struct pfq_rx_pool *pool = pfq_rx_pool_get_by_dev(dev->ifindex, queue);
+	u32 frame;
+
+	if (pool && rx_pool_page_frame(pool, page, offset, &frame))
+		rx_pool_release(pool, frame);
+
+	put_page(page);
+}
+
+
+/*
+ * The head of the skb (and its skb_shared_info) is in kernel memory: the
+ * first bytes of the packet are copied there and the rest of the frame is
+ * attached as a page fragment. On failure the frame is given back.
+ */
+
+struct sk_buff *
+pfq_rx_pool_build_skb(struct net_device *dev, int queue, struct page *page, unsigned int offset, unsigned int len)
+{
+	struct pfq_rx_pool *pool = pfq_rx_pool_get_by_dev(dev->ifindex, queue);
+	char *data = page_address(page) + offset + Q_RX_POOL_HEADROOM;
+	unsigned int head = min_t(unsigned int, len, PFQ_RX_POOL_HEAD);
+	struct sk_buff *skb;
+	u32 frame;
+
+	if (pool == NULL || !rx_pool_page_frame(pool, page, offset, &frame) ||
+	    len > pool->frame_size - Q_RX_POOL_HEADROOM)
+		goto err;
+
+	skb = netdev_alloc_skb_ip_align(dev, PFQ_RX_POOL_HEAD);
+	if (skb == NULL)
+		goto err;
+
+	memcpy(skb_put(skb, head), data, head);
+
+	skb_record_rx_queue(skb, queue);
+
+	if (len == head) {
+		/* the whole packet is in the head: the frame is not needed */
+		pfq_rx_pool_free_frame(dev, queue, page, offset);
+		return skb;
+	}
+
+	skb_add_rx_frag(skb, 0, page, offset + Q_RX_POOL_HEADROOM + head, len - head,
+			pool->frame_size - Q_RX_POOL_HEADROOM - head);
+
+	atomic_inc(&pool->lent);
+
+	skb_shinfo(skb)->destructor_arg = &pool->owner[frame];
+	skb->destructor = pfq_rx_pool_skb_destructor;
+
+	return skb;
+err:
+	pfq_rx_pool_free_frame(dev, queue, page, offset);
+	return NULL;
+}
+
+
+EXPORT_SYMBOL_GPL(pfq_rx_pool_alloc_frame);
+EXPORT_SYMBOL_GPL(pfq_rx_pool_free_frame);
+EXPORT_SYMBOL_GPL(pfq_rx_pool_skb_share);
+EXPORT_SYMBOL_GPL(pfq_rx_pool_build_skb);
+
+EXPORT_SYMBOL_GPL(pfq_rx_pool_create_pages);
+EXPORT_SYMBOL_GPL(pfq_rx_pool_destroy);
+EXPORT_SYMBOL_GPL(pfq_rx_pool_bind);
+EXPORT_SYMBOL_GPL(pfq_rx_pool_put);
@@ -0,0 +1,160 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PF_Q_RX_POOL_H
+#define PF_Q_RX_POOL_H
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/pf_q.h>
+
+#include <pf_q-macro.h>
+
+
+/*
+ * Zero-copy rx: a pool of frames in user memory (pinned), where the packets
+ * received by a socket are stored. The rx queue carries descriptors of the
+ * frames (pfq_pkthdr_frame), and user space returns them to the kernel
+ * through the completion ring, once the packets are consumed.
+ *
+ * Direct-capture drivers can receive packets straight into the frames of a
+ * pool bound to their device/queue (pfq_rx_pool_alloc_frame/build_skb, and
+ * pfq_rx_pool_free_frame for the frames not used): such
+ * packets are delivered to user space without any copy. Other packets are
+ * copied once into a free frame.
+ */
+
+/*
+ * The owner of a frame changes with a single cmpxchg on its state. A frame
+ * lent to a driver is owned by the skb built on it until the skb is freed:
+ * if the packet is delivered meanwhile, the frame goes to user space from the
+ * skb destructor, or back to the pool if user space has already returned it.
+ */
+
+enum pfq_rx_frame_state
+{
+	pfq_frame_free,         /* owned by the pool */
+	pfq_frame_driver,       /* lent to a direct-capture driver (or its skb) */
+	pfq_frame_delivered,    /* skb alive, packet delivered to user space */
+	pfq_frame_returned,     /* skb alive, frame already returned by user space */
+	pfq_frame_user          /* owned by user space */
+};
+
+
+#define PFQ_RX_POOL_HEAD	128	/* bytes of the frame copied into the linear part of the skb */
+
+
+struct pfq_rx_pool_page
+{
+	unsigned long		pfn;
+	u32			index;
+};
+
+
+struct pfq_rx_pool
+{
+	spinlock_t		lock;
+
+	struct page	      **pages;
+	size_t			npages;
+	struct pfq_rx_pool_page *lookup;	/* sorted by pfn */
+
+	char		       *addr;		/* kernel mapping of the pool */
+	size_t			size;
+	size_t			frame_size;
+	unsigned int		frame_shift;
+	size_t			frames;
+
+	u8		       *state;		/* per-frame state */
+	struct pfq_rx_pool    **owner;		/* per-frame back pointer: destructor_arg of the skbs */
+	u32		       *free;		/* stack of free frames */
+	size_t			free_len;
+
+	int			if_index;
+	int			hw_queue;
+
+	struct pfq_tx_queue_hdr *compl;		/* completion ring, set when the socket is enabled */
+	u32		       *compl_ring;
+
+	bool			user;		/* pages pinned from user space */
+
+	atomic_t		lent;		/* skbs built on the frames, biased by one */
+	struct completion	idle;		/* the last of them is freed */
+
+	struct {
+		atomic_long_t	zcopy;		/* packets received by drivers into the frames */
+		atomic_long_t	copy;		/* packets copied into the frames */
+		unsigned long	empty;		/* pool exhausted (locked) */
+	} stats;
+};
+
+
+extern atomic_long_t pfq_rx_pool_devmap[Q_MAX_DEVICE][Q_MAX_HW_QUEUE];
+
+
+extern struct pfq_rx_pool *pfq_rx_pool_create(struct pfq_rx_pool_descr const *descr);
+extern struct pfq_rx_pool *pfq_rx_pool_create_pages(struct page **pages, size_t npages, size_t frame_size);
+extern void pfq_rx_pool_destroy(struct pfq_rx_pool *pool);
+extern int  pfq_rx_pool_bind(struct pfq_rx_pool *pool, int if_index, int hw_queue);
+
+extern void pfq_rx_pool_attach(struct pfq_rx_pool *pool, struct pfq_tx_queue_hdr *compl, void *ring);
+extern void pfq_rx_pool_detach(struct pfq_rx_pool *pool);
+
+extern size_t pfq_rx_pool_get(struct pfq_rx_pool *pool, u32 *frames, size_t n);
+extern void   pfq_rx_pool_put(struct pfq_rx_pool *pool, u32 const *frames, size_t n);
+
+extern bool pfq_rx_pool_skb_frame(struct pfq_rx_pool *pool, struct sk_buff const *skb, u32 *frame);
+extern struct sk_buff *pfq_rx_pool_skb_share(struct sk_buff *skb, bool clone);
+
+/* direct-capture drivers */
+
+extern int pfq_rx_pool_alloc_frame(struct net_device *dev, int queue, struct page **page, unsigned int *offset);
+extern void pfq_rx_pool_free_frame(struct net_device *dev, int queue, struct page *page, unsigned int offset);
+extern struct sk_buff *pfq_rx_pool_build_skb(struct net_device *dev, int queue, struct page *page, unsigned int offset, unsigned int len);
+
+
+static inline size_t
+pfq_rx_pool_compl_size(struct pfq_rx_pool const *pool)
+{
+	return pool ? roundup_pow_of_two(pool->frames + 1) : 0;
+}
+
+
+static inline char *
+pfq_rx_pool_frame_ptr(struct pfq_rx_pool const *pool, u32 frame)
+{
+	return pool->addr + ((size_t)frame << pool->frame_shift);
+}
+
+
+static inline struct pfq_rx_pool *
+pfq_rx_pool_get_by_dev(int if_index, int queue)
+{
+	return (struct pfq_rx_pool *)atomic_long_read(&pfq_rx_pool_devmap[if_index & Q_MAX_DEVICE_MASK][queue & Q_MAX_HW_QUEUE_MASK]);
+}
+
+
+#endif /* PF_Q_RX_POOL_H */
@@ -26,6 +26,7 @@
 #include <linux/module.h>
 
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <linux/printk.h>
 #include <linux/kthread.h>
 #include <linux/mm.h>
@@ -34,12 +35,14 @@
 #include <pf_q-shared-queue.h>
 
 #include <pf_q-shmem.h>
+#include <pf_q-tx-zcopy.h>
 #include <pf_q-bitops.h>
 #include <pf_q-module.h>
 #include <pf_q-sock.h>
 #include <pf_q-global.h>
 #include <pf_q-memory.h>
 #include <pf_q-GC.h>
+#include <pf_q-rx-pool.h>
 
 
 static inline
@@ -52,9 +55,351 @@ void *pfq_skb_copy_from_linear_data(const struct sk_buff *skb, void *to, size_t
 
 
 static inline
-char *mpdb_slot_ptr(struct pfq_rx_opt *ro, struct pfq_rx_queue_hdr *qd, size_t qindex, size_t slot)
+char *mpdb_slot_ptr(struct pfq_rx_opt *ro, struct pfq_rx_queue_hdr *qd, size_t qindex, size_t offset)
 {
-	return (char *)(ro->base_addr) + ( (qindex&1) ? ro->queue_size : 0 + slot) * ro->slot_size;
+	return (char *)(ro->base_addr) + (qindex & (ro->segments - 1)) * ro->queue_size * ro->slot_size + offset;
+}
+
+
+/*
+ * rx segments: close the segment being filled (full) and move to the next one,
+ * provided that user space has returned it. The index and the length of the
+ * closed segment are stored in the header, for user space to read it.
+ * Return false if the next segment is still owned by user space.
+ */
+
+static bool
+pfq_mpdb_next_segment(struct pfq_rx_opt *ro, struct pfq_rx_queue_hdr *rx_queue, int qindex, size_t capacity)
+{
+	for(;;)
+	{
+		int data  = atomic_read((atomic_t *)&rx_queue->data);
+		int index = MPDB_QUEUE_INDEX(data);
+
+		/* already moved, by another producer or by user space */
+
+		if (index != qindex || MPDB_QUEUE_LEN(data) < capacity)
+			return true;
+
+		if (((index + 1 - rx_queue->released) & 0xff) >= ro->segments)
+			return false;
+
+		if (atomic_cmpxchg((atomic_t *)&rx_queue->data, data, (int)((unsigned int)(index + 1) << 24)) == data) {
+			rx_queue->seg[index & (ro->segments - 1)] = data;
+			return true;
+		}
+	}
+}
+
+
+/*
+ * zero-copy rx: store the packet in a frame of the pool, and its position
+ * in the slot. Packets received by a direct-capture driver into a frame of
+ * this pool are not copied. Return false if there are no frames left.
+ */
+
+static inline bool
+pfq_rx_pool_store(struct pfq_rx_pool *pool, struct sk_buff *skb, size_t *bytes,
+		  struct pfq_pkthdr_frame *fd, u32 const *frames, size_t *used, size_t nframes,
+		  size_t *zcopy)
+{
+	u32 frame;
+
+	/* the frame goes to user space when the skb is freed (see pf_q-rx-pool.c) */
+
+	if (pfq_rx_pool_skb_frame(pool, skb, &frame) &&
+	    cmpxchg(&pool->state[frame], pfq_frame_driver, pfq_frame_delivered) == pfq_frame_driver) {
+
+		fd->index  = frame;
+		fd->offset = Q_RX_POOL_HEADROOM;
+		(*zcopy)++;
+		return true;
+	}
+
+	if (*used == nframes)
+		return false;
+
+	frame = frames[(*used)++];
+
+	*bytes = min_t(size_t, *bytes, pool->frame_size);
+
+	if (skb_copy_bits(skb, 0, pfq_rx_pool_frame_ptr(pool, frame), *bytes) != 0)
+		return false;
+
+	fd->index  = frame;
+	fd->offset = 0;
+	return true;
+}
+
+
+/* bytes of the packet to capture: the caplen of the socket, limited by the
+ * snaplen of the group (or of the computation) */
+
+static inline size_t
+pfq_rx_caplen(struct pfq_rx_opt *ro, struct sk_buff *skb)
+{
+	size_t bytes = min_t(size_t, skb->len, ro->caplen);
+	unsigned int snaplen = PFQ_CB(skb)->snaplen;
+
+	return snaplen ? min_t(size_t, bytes, snaplen) : bytes;
+}
+
+
+/* notify the waiters of the socket (poll and eventfd) */
+
+static inline void
+pfq_rx_notify(struct pfq_rx_opt *ro)
+{
+	bool wake = false;
+
+	if (waitqueue_active(&ro->waitqueue)) {
+		wake_up_interruptible(&ro->waitqueue);
+		wake = true;
+	}
+
+	if (ro->efd) {
+		eventfd_signal(ro->efd, 1);
+		wake = true;
+	}
+
+#ifdef PFQ_USE_EXTENDED_PROC
+	if (wake)
+		sparse_inc(&global_stats.wake);
+#else
+	(void)wake;
+#endif
+}
+
+
+enum hrtimer_restart
+pfq_rx_wakeup_timer(struct hrtimer *timer)
+{
+	struct pfq_rx_opt *ro = container_of(timer, struct pfq_rx_opt, wake_timer);
+
+	clear_bit(0, &ro->wake_armed);
+	pfq_rx_notify(ro);
+	return HRTIMER_NORESTART;
+}
+
+
+/* the queue is full: the waiters are notified once, until packets are
+ * enqueued again (poll checks the length of the queue before sleeping) */
+
+static inline void
+pfq_rx_notify_full(struct pfq_rx_opt *ro)
+{
+	if (!test_bit(0, &ro->wake_full) && !test_and_set_bit(0, &ro->wake_full))
+		pfq_rx_notify(ro);
+}
+
+
+static inline void
+pfq_rx_clear_full(struct pfq_rx_opt *ro)
+{
+	if (unlikely(test_bit(0, &ro->wake_full)))
+		clear_bit(0, &ro->wake_full);
+}
+
+
+/*
+ * packed queues: the length of the queue counts blocks, the packets stored
+ * in the queue (of index qindex) are counted apart. Return the packets
+ * stored before the batch.
+ */
+
+static inline size_t
+pfq_rx_packed_count(struct pfq_rx_opt *ro, int qindex, size_t sent)
+{
+	int old, new;
+
+	do {
+		old = atomic_read(&ro->wake_count);
+		new = MPDB_QUEUE_INDEX(old) == qindex ? old + (int)sent : (qindex << 24) | (int)sent;
+	}
+	while (atomic_cmpxchg(&ro->wake_count, old, new) != old);
+
+	return MPDB_QUEUE_INDEX(old) == qindex ? MPDB_QUEUE_LEN(old) : 0;
+}
+
+
+/*
+ * wakeup coalescing: the waiters are notified when the length of the queue
+ * crosses the threshold. Below the threshold, the timer bounds the delay of
+ * the notification; it is armed once, by the first packet.
+ */
+
+static inline void
+pfq_rx_wakeup(struct pfq_rx_opt *ro, size_t before, size_t after)
+{
+	if (before < ro->wake_pkts && after >= ro->wake_pkts) {
+		pfq_rx_notify(ro);
+		return;
+	}
+
+	if (ro->wake_usecs && after < ro->wake_pkts &&
+	    !test_bit(0, &ro->wake_armed) && !test_and_set_bit(0, &ro->wake_armed))
+		hrtimer_start(&ro->wake_timer, ns_to_ktime((u64)ro->wake_usecs * NSEC_PER_USEC), HRTIMER_MODE_REL);
+}
+
+
+static inline void
+pfq_rx_set_hdr(struct pfq_rx_opt *ro, volatile struct pfq_pkthdr *hdr, struct sk_buff *skb, size_t bytes, int gid, u64 tsc)
+{
+        /* copy mark from pfq_cb (annotation) */
+
+        hdr->data = PFQ_CB(skb)->mark;
+
+	/* setup the header */
+
+	switch(ro->tstamp)
+	{
+	case Q_TSTAMP_ON: {
+		struct timespec ts;
+		skb_get_timestampns(skb, &ts);
+		hdr->tstamp.tv.sec  = (uint32_t)ts.tv_sec;
+		hdr->tstamp.tv.nsec = (uint32_t)ts.tv_nsec;
+	} break;
+	case Q_TSTAMP_TSC:
+		hdr->tstamp.tv64 = get_cycles();
+		break;
+	case Q_TSTAMP_TSC_BATCH:
+		hdr->tstamp.tv64 = tsc;
+		break;
+	}
+
+	hdr->if_index    = skb->dev->ifindex & 0xff;
+	hdr->gid         = gid;
+
+	hdr->len         = (uint16_t)skb->len;
+	hdr->caplen 	 = (uint16_t)bytes;
+	hdr->un.vlan_tci = skb->vlan_tci & ~VLAN_TAG_PRESENT;
+	hdr->hw_queue    = (uint8_t)(skb_get_rx_queue(skb) & 0xff);
+}
+
+
+/*
+ * per-cpu rx rings: a sub-ring has a single producer at a time, hence
+ * neither the atomic reservation of the slots nor the commit of each slot
+ * are required. The producer index is published once, after the batch.
+ *
+ * The producer runs in softirq (or with bottom halves disabled), and the
+ * cpus that share a sub-ring (more cpus online than rings) are serialized
+ * by the lock of the ring, taken once per batch and uncontended otherwise.
+ */
+
+static size_t
+__pfq_ring_enqueue_batch(struct pfq_rx_opt *ro,
+			 int ring_index,
+			 struct pfq_skbuff_batch *skbs,
+			 unsigned long long mask,
+			 int burst_len,
+			 int gid)
+{
+	struct pfq_tx_queue_hdr *ring = pfq_get_rx_ring_hdr(ro, ring_index);
+	struct pfq_rx_pool *pool = ro->pool;
+	struct sk_buff *skb;
+
+	u32 frames[Q_SKBUFF_SHORT_BATCH];
+	size_t nframes = 0, used = 0, zcopy = 0;
+
+	size_t n, sent = 0, index, len, mask_slots = ro->ring_size - 1;
+	u64 tsc = ro->tstamp == Q_TSTAMP_TSC_BATCH ? get_cycles() : 0;
+	int avail;
+
+	/* the free slots are cached: the consumer index is read again only when needed */
+
+	avail = pfq_spsc_write_avail(ring);
+	if (avail < burst_len) {
+		ring->producer.cache = 0;
+		avail = pfq_spsc_write_avail(ring);
+	}
+
+	if (avail == 0) {
+		pfq_rx_notify_full(ro);
+		return 0;
+	}
+
+	burst_len = min(burst_len, avail);
+
+	if (pool) {
+		nframes = pfq_rx_pool_get(pool, frames, burst_len);
+		if (nframes == 0)
+			return 0;
+		burst_len = nframes;
+	}
+
+	index = ring->producer.index;
+	len   = pfq_spsc_len(ring);
+
+	for_each_skbuff_bitmask(skbs, mask, skb, n)
+	{
+		volatile struct pfq_pkthdr *hdr;
+		size_t bytes;
+		char *pkt;
+
+		if (sent == burst_len)
+			break;
+
+		bytes = pfq_rx_caplen(ro, skb);
+
+		hdr = (struct pfq_pkthdr *)((char *)(ring + 1) + ((index + sent) & mask_slots) * ro->slot_size);
+		pkt = (char *)(hdr+1);
+
+		if (pool) {
+			if (!pfq_rx_pool_store(pool, skb, &bytes, (struct pfq_pkthdr_frame *)pkt, frames, &used, nframes, &zcopy))
+				break;
+		}
+		else if (skb_is_nonlinear(skb)) {
+			if (skb_copy_bits(skb, 0, pkt, bytes) != 0)
+				break;
+		}
+		else
+			pfq_skb_copy_from_linear_data(skb, pkt, bytes);
+
+		pfq_rx_set_hdr(ro, hdr, skb, bytes, gid, tsc);
+
+		/* the slot is published along with the producer index */
+
+		hdr->commit = (uint8_t)ring_index;
+
+		sent++;
+	}
+
+	if (sent) {
+		pfq_spsc_write_commit_n(ring, sent);
+		pfq_rx_clear_full(ro);
+		pfq_rx_wakeup(ro, len, len + sent);
+	}
+
+	if (pool) {
+		if (used < nframes)
+			pfq_rx_pool_put(pool, frames + used, nframes - used);
+
+		atomic_long_add(zcopy, &pool->stats.zcopy);
+		atomic_long_add(used, &pool->stats.copy);
+	}
+
+	return sent;
+}
+
+
+static size_t
+pfq_ring_enqueue_batch(struct pfq_rx_opt *ro,
+		       struct pfq_skbuff_batch *skbs,
+		       unsigned long long mask,
+		       int burst_len,
+		       int gid)
+{
+	int ring_index = smp_processor_id() % ro->rings;
+	size_t sent;
+
+	WARN_ON_ONCE(!in_softirq());
+
+	spin_lock(&ro->ring_lock[ring_index]);
+	sent = __pfq_ring_enqueue_batch(ro, ring_index, skbs, mask, burst_len, gid);
+	spin_unlock(&ro->ring_lock[ring_index]);
+
+	return sent;
 }
 
 
@@ -65,52 +410,104 @@ size_t pfq_mpdb_enqueue_batch(struct pfq_rx_opt *ro,
 		              int gid)
 {
 	struct pfq_rx_queue_hdr *rx_queue = pfq_get_rx_queue_hdr(ro);
+	struct pfq_rx_pool *pool = ro->pool;
 	int data, qlen, qindex;
 	struct sk_buff *skb;
 
-	size_t n, sent = 0;
+	u32 frames[Q_SKBUFF_SHORT_BATCH];
+	size_t nframes = 0, used = 0, zcopy = 0;
+
+	bool packed = ro->packed, full = false;
+	size_t n, sent = 0, reserve, capacity, pos;
 	char *this_slot;
+	u64 tsc;
 
 	if (unlikely(rx_queue == NULL))
 		return 0;
 
+	if (ro->rings)
+		return pfq_ring_enqueue_batch(ro, skbs, mask, burst_len, gid);
+
+	capacity = pfq_rx_queue_capacity(ro);
+
 	data = atomic_read((atomic_t *)&rx_queue->data);
 
-        if (MPDB_QUEUE_LEN(data) > ro->queue_size)
-		return 0;
+        if (MPDB_QUEUE_LEN(data) > capacity) {
+		if (ro->segments == 2 || !pfq_mpdb_next_segment(ro, rx_queue, MPDB_QUEUE_INDEX(data), capacity))
+			return 0;
+	}
+
+	/* zero-copy rx: the packets of the batch are limited by the free frames */
+
+	if (pool) {
+		nframes = pfq_rx_pool_get(pool, frames, burst_len);
+		if (nframes == 0)
+			return 0;
+		burst_len = nframes;
+	}
+
+	/* raw tsc timestamps: the clock is read once per batch */
 
-	data = atomic_add_return(burst_len, (atomic_t *)&rx_queue->data);
+	tsc = ro->tstamp == Q_TSTAMP_TSC_BATCH ? get_cycles() : 0;
 
-	qlen      = MPDB_QUEUE_LEN(data) - burst_len;
+	/* packed queue: reserve the blocks of the whole batch at once */
+
+	if (packed) {
+		unsigned long long pmask = mask;
+
+		reserve = 0;
+		for_each_skbuff_bitmask(skbs, pmask, skb, n)
+			reserve += MPDB_QUEUE_PACKED_SLOT_SIZE(pfq_rx_caplen(ro, skb)) / MPDB_QUEUE_BLOCK;
+	}
+	else
+		reserve = burst_len;
+
+	data = atomic_add_return(reserve, (atomic_t *)&rx_queue->data);
+
+	qlen      = MPDB_QUEUE_LEN(data) - reserve;
 	qindex    = MPDB_QUEUE_INDEX(data);
-        this_slot = mpdb_slot_ptr(ro, rx_queue, qindex, qlen);
+        this_slot = mpdb_slot_ptr(ro, rx_queue, qindex, qlen * (packed ? MPDB_QUEUE_BLOCK : ro->slot_size));
+	pos       = qlen;
 
 	for_each_skbuff_bitmask(skbs, mask, skb, n)
 	{
 		volatile struct pfq_pkthdr *hdr;
-		size_t bytes, slot_index;
+		size_t bytes, slot_index, blocks = 1;
 		char *pkt;
 
-		bytes = min_t(size_t, skb->len, ro->caplen);
-		slot_index = qlen + sent;
+		bytes = pfq_rx_caplen(ro, skb);
+		slot_index = pos;
 
 		hdr = (struct pfq_pkthdr *)this_slot;
 		pkt = (char *)(hdr+1);
 
-		if (slot_index > ro->queue_size) {
+		/* packed queue: the last packet is truncated to the end of the queue, so that
+		 * the blocks up to the capacity are all committed */
 
-			if (waitqueue_active(&ro->waitqueue)) {
-#ifdef PFQ_USE_EXTENDED_PROC
- 				sparse_inc(&global_stats.wake);
-#endif
-				wake_up_interruptible(&ro->waitqueue);
+		if (packed && slot_index < capacity) {
+			blocks = MPDB_QUEUE_PACKED_SLOT_SIZE(bytes) / MPDB_QUEUE_BLOCK;
+			if (slot_index + blocks > capacity) {
+				blocks = capacity - slot_index;
+				bytes  = blocks * MPDB_QUEUE_BLOCK - sizeof(struct pfq_pkthdr);
 			}
+		}
 
-			return sent;
+		if (slot_index >= capacity) {
+			full = true;
+			pfq_rx_notify_full(ro);
+			break;
 		}
 
+		if (sent == burst_len)
+			break;
+
 		/* copy bytes of packet */
 
+		if (pool) {
+			if (!pfq_rx_pool_store(pool, skb, &bytes, (struct pfq_pkthdr_frame *)pkt, frames, &used, nframes, &zcopy))
+				break;
+		}
+		else
 #ifdef PFQ_USE_SKB_LINEARIZE
 		if (unlikely(skb_is_nonlinear(skb)))
 #else
@@ -123,49 +520,55 @@ size_t pfq_mpdb_enqueue_batch(struct pfq_rx_opt *ro,
 				return 0;
 			}
 		}
+		else if (packed)  /* the next slot follows the packet */
+			memcpy(pkt, skb->data, bytes);
 		else
 			pfq_skb_copy_from_linear_data(skb, pkt, bytes);
 
-                /* copy mark from pfq_cb (annotation) */
+		pfq_rx_set_hdr(ro, hdr, skb, bytes, gid, tsc);
 
-                hdr->data = PFQ_CB(skb)->mark;
+		/* commit the slot (release semantic) */
 
-		/* setup the header */
+		smp_wmb();
 
-		if (ro->tstamp != 0) {
-			struct timespec ts;
-			skb_get_timestampns(skb, &ts);
-			hdr->tstamp.tv.sec  = (uint32_t)ts.tv_sec;
-			hdr->tstamp.tv.nsec = (uint32_t)ts.tv_nsec;
-		}
+		hdr->commit = (uint8_t)qindex;
 
-		hdr->if_index    = skb->dev->ifindex & 0xff;
-		hdr->gid         = gid;
+		if (!packed && slot_index < ro->wake_pkts && slot_index + 1 >= ro->wake_pkts)
+			pfq_rx_notify(ro);
 
-		hdr->len         = (uint16_t)skb->len;
-		hdr->caplen 	 = (uint16_t)bytes;
-		hdr->un.vlan_tci = skb->vlan_tci & ~VLAN_TAG_PRESENT;
-		hdr->hw_queue    = (uint8_t)(skb_get_rx_queue(skb) & 0xff);
+		sent++;
 
-		/* commit the slot (release semantic) */
+		pos       += blocks;
+		this_slot += packed ? blocks * MPDB_QUEUE_BLOCK : ro->slot_size;
+	}
 
-		smp_wmb();
+	/* the threshold counts packets: with packed queues the position is in blocks */
 
-		hdr->commit = (uint8_t)qindex;
+	if (sent) {
+		if (!full)
+			pfq_rx_clear_full(ro);
 
-		if ((slot_index & 8191) == 0 &&
-				waitqueue_active(&ro->waitqueue)) {
-#ifdef PFQ_USE_EXTENDED_PROC
- 			sparse_inc(&global_stats.wake);
-#endif
-		        wake_up_interruptible(&ro->waitqueue);
+		if (packed) {
+			size_t before = pfq_rx_packed_count(ro, qindex, sent);
+			pfq_rx_wakeup(ro, before, before + sent);
 		}
+		else if (pos < ro->wake_pkts)
+			pfq_rx_wakeup(ro, qlen, pos);
+	}
 
-		sent++;
+	if (pool) {
+		if (used < nframes)
+			pfq_rx_pool_put(pool, frames + used, nframes - used);
 
-		this_slot += ro->slot_size;
+		atomic_long_add(zcopy, &pool->stats.zcopy);
+		atomic_long_add(used, &pool->stats.copy);
 	}
 
+	/* rx segments: the packets left are stored in the next segment */
+
+	if (full && ro->segments > 2 && pfq_mpdb_next_segment(ro, rx_queue, qindex, capacity))
+		sent += pfq_mpdb_enqueue_batch(ro, skbs, mask, burst_len - sent, gid);
+
 	return sent;
 }
 
@@ -178,15 +581,50 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 		struct pfq_queue_hdr * queue;
 		size_t n;
 
+		/* the length of the queue (in blocks) must fit the 24 bits of rx.data */
+
+		if (so->rx_opt.packed && pfq_rx_queue_capacity(&so->rx_opt) >= (1 << 23)) {
+			pr_devel("[PFQ|%d] packed rx queue too large!\n", so->id);
+			return -EINVAL;
+		}
+
+		/* zero-copy tx: the fragments of a slot must fit the skb */
+
+		if (so->tx_opt.zerocopy && !pfq_tx_zcopy_maxlen(so->tx_opt.maxlen)) {
+			pr_devel("[PFQ|%d] zero-copy tx: maxlen too large!\n", so->id);
+			return -EINVAL;
+		}
+
+		/* per-cpu rx rings: the memory of the rx queues is split among the sub-rings */
+
+		if (so->rx_opt.rings) {
+
+			so->rx_opt.ring_mem = (pfq_queue_rx_mem(so) / so->rx_opt.rings) & ~(size_t)63;
+
+			if (so->rx_opt.ring_mem < sizeof(struct pfq_tx_queue_hdr) + 2 * so->rx_opt.slot_size) {
+				pr_devel("[PFQ|%d] rx queue too small for %d rx rings!\n", so->id, so->rx_opt.rings);
+				return -EINVAL;
+			}
+
+			so->rx_opt.ring_size = rounddown_pow_of_two((so->rx_opt.ring_mem - sizeof(struct pfq_tx_queue_hdr)) / so->rx_opt.slot_size);
+
+			so->rx_opt.ring_lock = kcalloc(so->rx_opt.rings, sizeof(spinlock_t), GFP_KERNEL);
+			if (so->rx_opt.ring_lock == NULL)
+				return -ENOMEM;
+
+			for(n = 0; n < so->rx_opt.rings; n++)
+				spin_lock_init(&so->rx_opt.ring_lock[n]);
+		}
+
 		/* alloc queue memory */
 
 		if (user_addr) {
 			if (pfq_hugepage_map(&so->shmem, user_addr, pfq_shared_memory_size(so)) < 0)
-				return -ENOMEM;
+				goto err_rings;
 		}
 		else {
-			if (pfq_shared_memory_alloc(&so->shmem, pfq_shared_memory_size(so)) < 0)
-				return -ENOMEM;
+			if (pfq_shared_memory_alloc(&so->shmem, pfq_shared_memory_size(so), pfq_shared_memory_node(so)) < 0)
+				goto err_rings;
 		}
 
 		/* so->mem_addr and so->mem_size are set now */
@@ -200,6 +638,20 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 		queue->rx.data      = (1L << 24);
 		queue->rx.size      = so->rx_opt.queue_size;
 		queue->rx.slot_size = so->rx_opt.slot_size;
+		queue->rx.rings     = so->rx_opt.rings;
+		queue->rx.ring_size = so->rx_opt.ring_size;
+		queue->rx.ring_mem  = so->rx_opt.ring_mem;
+		queue->rx.segments  = so->rx_opt.segments;
+		queue->rx.released  = 1;
+
+		for(n = 0; n < Q_MAX_RX_SEGMENTS; n++)
+			queue->rx.seg[n] = 0;
+
+		/* raw tsc timestamps: calibration */
+
+		queue->rx.tsc_khz  = pfq_tsc_khz();
+		queue->rx.tsc_base = get_cycles();
+		queue->rx.ns_base  = ktime_to_ns(ktime_get_real());
 
 		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
 		{
@@ -208,18 +660,79 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 			queue->tx[n].consumer.index = 0;
 			queue->tx[n].consumer.cache = 0;
 
+			queue->tx[n].thread.asleep = 0;
+			memset(&queue->tx[n].thread.stats, 0, sizeof(queue->tx[n].thread.stats));
+			memset(&queue->tx[n].pace, 0, sizeof(queue->tx[n].pace));
+
+			queue->tx[n].loop.iter   = 0;
+			queue->tx[n].loop.active = 0;
+			pfq_tx_loop_init(&so->tx_opt.queue[n].loop);
+
 			queue->tx[n].size_mask = so->tx_opt.queue_size - 1;
 			queue->tx[n].max_len   = so->tx_opt.maxlen;
 			queue->tx[n].size      = so->tx_opt.queue_size;
 			queue->tx[n].slot_size = so->tx_opt.slot_size;
 
-			so->tx_opt.queue[n].base_addr = so->shmem.addr + sizeof(struct pfq_queue_hdr) + pfq_queue_mpdb_mem(so) * 2 + pfq_queue_spsc_mem(so) * n;
+			so->tx_opt.queue[n].base_addr = so->shmem.addr + sizeof(struct pfq_queue_hdr) + pfq_queue_rx_mem(so) + pfq_queue_spsc_mem(so) * n;
+		}
+
+		/* zero-copy tx: completion of the slots of the bound queues */
+
+		if (so->tx_opt.zerocopy) {
+
+			for(n = 0; n < so->tx_opt.num_queues; n++)
+			{
+				so->tx_opt.queue[n].zcopy = pfq_tx_zcopy_create(&queue->tx[n]);
+				if (!so->tx_opt.queue[n].zcopy) {
+					while (n-- > 0) {
+						pfq_tx_zcopy_destroy(so->tx_opt.queue[n].zcopy);
+						so->tx_opt.queue[n].zcopy = NULL;
+					}
+					pfq_shared_memory_free(&so->shmem);
+					goto err_rings;
+				}
+			}
+		}
+
+		/* initialize the completion ring of the rx pool (zero-copy rx) */
+
+		if (so->rx_opt.pool) {
+
+			size_t size = pfq_rx_pool_compl_size(so->rx_opt.pool);
+
+			queue->completion.producer.index = 0;
+			queue->completion.producer.cache = 0;
+			queue->completion.consumer.index = 0;
+			queue->completion.consumer.cache = 0;
+
+			queue->completion.size_mask = size - 1;
+			queue->completion.max_len   = 0;
+			queue->completion.size      = size;
+			queue->completion.slot_size = sizeof(u32);
+
+			pfq_rx_pool_attach(so->rx_opt.pool, &queue->completion,
+					   so->shmem.addr + sizeof(struct pfq_queue_hdr) + pfq_queue_rx_mem(so) + pfq_queue_spsc_mem(so) * Q_MAX_TX_QUEUES);
 		}
 
 		/* update the queues base_addr */
 
 		so->rx_opt.base_addr = so->shmem.addr + sizeof(struct pfq_queue_hdr);
 
+		for(n = 0; n < so->rx_opt.rings; n++)
+		{
+			struct pfq_tx_queue_hdr *ring = pfq_get_rx_ring_hdr(&so->rx_opt, n);
+
+			ring->producer.index = 0;
+			ring->producer.cache = 0;
+			ring->consumer.index = 0;
+			ring->consumer.cache = 0;
+
+			ring->size_mask = so->rx_opt.ring_size - 1;
+			ring->max_len   = so->rx_opt.caplen;
+			ring->size      = so->rx_opt.ring_size;
+			ring->slot_size = so->rx_opt.slot_size;
+		}
+
 		/* commit both the queues */
 
 		smp_wmb();
@@ -235,7 +748,15 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 				so->rx_opt.queue_size,
 				so->rx_opt.slot_size,
 				so->rx_opt.caplen,
-				pfq_queue_mpdb_mem(so) * 2);
+				pfq_queue_rx_mem(so));
+
+		if (so->rx_opt.segments > 2)
+			pr_devel("[PFQ|%d] Rx segments: %d\n", so->id, so->rx_opt.segments);
+
+		if (so->rx_opt.rings)
+			pr_devel("[PFQ|%d] Rx rings: %d x len=%zu\n", so->id,
+					so->rx_opt.rings,
+					so->rx_opt.ring_size);
 
 		pr_devel("[PFQ|%d] Tx queue: len=%zu slot_size=%zu maxlen=%zu, mem=%zu bytes\n", so->id,
 				so->tx_opt.queue_size,
@@ -244,6 +765,11 @@ pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr)
 				pfq_queue_spsc_mem(so) * 4);
 	}
 	return 0;
+
+err_rings:
+	kfree(so->rx_opt.ring_lock);
+	so->rx_opt.ring_lock = NULL;
+	return -ENOMEM;
 }
 
 
@@ -263,7 +789,33 @@ pfq_shared_queue_disable(struct pfq_sock *so)
 
 		msleep(Q_GRACE_PERIOD);
 
-		pfq_shared_memory_free(&so->shmem);
+		hrtimer_cancel(&so->rx_opt.wake_timer);
+		clear_bit(0, &so->rx_opt.wake_armed);
+
+		if (so->rx_opt.pool)
+			pfq_rx_pool_detach(so->rx_opt.pool);
+
+		kfree(so->rx_opt.ring_lock);
+		so->rx_opt.ring_lock = NULL;
+
+		/* zero-copy tx: the shared memory is freed by the last skb in flight */
+
+		if (so->tx_opt.zerocopy) {
+
+			struct pfq_tx_zcopy_shmem *zs = pfq_tx_zcopy_shmem_get(&so->shmem);
+
+			for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+			{
+				if (so->tx_opt.queue[n].zcopy) {
+					pfq_tx_zcopy_disable(so->tx_opt.queue[n].zcopy, zs);
+					so->tx_opt.queue[n].zcopy = NULL;
+				}
+			}
+
+			pfq_tx_zcopy_shmem_put(zs);
+		}
+		else
+			pfq_shared_memory_free(&so->shmem);
 
 		so->shmem.addr = NULL;
 		so->shmem.size = 0;
@@ -28,6 +28,7 @@
 #include <linux/skbuff.h>
 #include <linux/pf_q.h>
 #include <linux/if_vlan.h>
+#include <linux/timex.h>
 
 #include <pf_q-macro.h>
 #include <pf_q-sock.h>
@@ -49,6 +50,24 @@ static inline size_t pfq_queue_mpdb_mem(struct pfq_sock *so)
         return so->rx_opt.queue_size * so->rx_opt.slot_size;
 }
 
+/* raw tsc timestamps: frequency of the tsc, in kHz (0 = not available) */
+
+static inline unsigned int pfq_tsc_khz(void)
+{
+#ifdef CONFIG_X86
+        return tsc_khz;
+#else
+        return 0;
+#endif
+}
+
+/* the memory of all the rx segments */
+
+static inline size_t pfq_queue_rx_mem(struct pfq_sock *so)
+{
+        return pfq_queue_mpdb_mem(so) * so->rx_opt.segments;
+}
+
 static inline size_t pfq_queue_spsc_mem(struct pfq_sock *so)
 {
         return so->tx_opt.queue_size * so->tx_opt.slot_size;
@@ -61,6 +80,20 @@ size_t pfq_mpdb_queue_len(struct pfq_sock *p)
 	struct pfq_queue_hdr *q = pfq_get_queue_hdr(p);
 	if (!q)
 		return 0;
+
+	if (p->rx_opt.rings) {
+		size_t len = 0;
+		int n;
+
+		for(n = 0; n < p->rx_opt.rings; n++)
+		{
+			struct pfq_tx_queue_hdr *ring = pfq_get_rx_ring_hdr(&p->rx_opt, n);
+			len += pfq_spsc_len(ring);
+		}
+
+		return len;
+	}
+
         return MPDB_QUEUE_LEN(q->rx.data);
 }
 
@@ -71,7 +104,7 @@ int pfq_mpdb_queue_index(struct pfq_sock *p)
 	struct pfq_queue_hdr *q = pfq_get_queue_hdr(p);
 	if (!q)
 		return 0;
-        return MPDB_QUEUE_INDEX(q->rx.data) & 1;
+        return MPDB_QUEUE_INDEX(q->rx.data) & (p->rx_opt.segments - 1);
 }
 
 
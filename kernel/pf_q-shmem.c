@@ -26,33 +26,51 @@
 #include <linux/module.h>
 #include <linux/vmalloc.h>
 #include <linux/pagemap.h>
+#include <linux/netdevice.h>
 
 #include <pf_q-shmem.h>
 #include <pf_q-shared-queue.h>
+#include <pf_q-rx-pool.h>
+#include <pf_q-devmap.h>
+#include <pf_q-group.h>
 
 
 static int
-pfq_memory_map(struct vm_area_struct *vma, unsigned long size, char *ptr, unsigned int flags, enum pfq_shmem_kind kind)
+pfq_memory_map(struct vm_area_struct *vma, unsigned long size, struct pfq_shmem_descr *shmem, unsigned int flags)
 {
-	// unsigned long addr = vma->vm_start;
+	unsigned long addr = vma->vm_start;
 
         vma->vm_flags |= flags;
 
-	switch(kind)
+	switch(shmem->kind)
 	{
 	case pfq_shmem_virt: {
-		if (remap_vmalloc_range(vma, ptr, 0) != 0) {
+		if (remap_vmalloc_range(vma, shmem->addr, 0) != 0) {
 			printk(KERN_WARNING "[PFQ] remap_vmalloc_range error.\n");
 			return -EAGAIN;
 		}
 	} break;
 
-	//case pfq_shmem_phys: {
-	//	if (remap_pfn_range(vma, addr, virt_to_phys(ptr) >> PAGE_SHIFT, vma->vm_end - vma->vm_start, PAGE_SHARED) != 0) {
-	//		printk(KERN_WARNING "[PFQ] remap_vmalloc_range error.\n");
-	//		return -EAGAIN;
-	//	}
-	//} break;
+	case pfq_shmem_pages: {
+		size_t n, i;
+
+		/* the chunks are mapped one page at a time: the mapping holds a
+		 * reference to each page, so that the memory outlives Q_SO_DISABLE
+		 * until the process unmaps it */
+
+		for(n = 0; n < shmem->nchunks && addr < vma->vm_end; n++)
+		{
+			for(i = 0; i < (1UL << compound_order(shmem->chunks[n])) && addr < vma->vm_end; i++)
+			{
+				if (vm_insert_page(vma, addr, shmem->chunks[n] + i) != 0) {
+					printk(KERN_WARNING "[PFQ] vm_insert_page error.\n");
+					return -EAGAIN;
+				}
+
+				addr += PAGE_SIZE;
+			}
+		}
+	} break;
 
 	case pfq_shmem_user:
 		break;
@@ -79,7 +97,7 @@ pfq_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma)
                 return -EINVAL;
         }
 
-        if((ret = pfq_memory_map(vma, size, so->shmem.addr, VM_LOCKED, so->shmem.kind)) < 0)
+        if((ret = pfq_memory_map(vma, size, &so->shmem, VM_LOCKED)) < 0)
                 return ret;
 
         return 0;
@@ -153,13 +171,113 @@ pfq_hugepage_unmap(struct pfq_shmem_descr *shmem)
 }
 
 
+static void
+pfq_shared_memory_pages_free(struct pfq_shmem_descr *shmem)
+{
+	size_t n;
+
+	if (shmem->nchunks > 1 && shmem->addr)
+		vunmap(shmem->addr);
+
+	for(n = 0; n < shmem->nchunks; n++)
+		__free_pages(shmem->chunks[n], compound_order(shmem->chunks[n]));
+
+	vfree(shmem->chunks);
+
+	shmem->chunks = NULL;
+	shmem->nchunks = 0;
+}
+
+
+static int
+pfq_shared_memory_pages_alloc(struct pfq_shmem_descr *shmem, size_t tot_mem, int node)
+{
+	size_t npages = tot_mem >> PAGE_SHIFT, left = npages, n = 0;
+	unsigned int order = get_order(HUGEPAGE_SIZE);
+	struct page **pages;
+
+	shmem->chunks  = vmalloc(npages * sizeof(struct page *));
+	shmem->nchunks = 0;
+
+	pages = vmalloc(npages * sizeof(struct page *));
+
+	if (!shmem->chunks || !pages)
+		goto err;
+
+	/* compound pages of the largest order that fits the memory left (up to a huge page);
+	 * a smaller order is tried when the node is too fragmented. */
+
+	while (left)
+	{
+		unsigned int o = min_t(unsigned int, order, ilog2(left));
+		struct page *page;
+		size_t i;
+
+		for(;;)
+		{
+			page = alloc_pages_node(node, GFP_KERNEL | __GFP_COMP | __GFP_ZERO | __GFP_NOWARN | (o ? __GFP_NORETRY : 0), o);
+			if (page || o == 0)
+				break;
+			o--;
+		}
+
+		if (!page)
+			goto err;
+
+		shmem->chunks[shmem->nchunks++] = page;
+
+		for(i = 0; i < (1UL << o); i++)
+			pages[n++] = page + i;
+
+		left -= 1UL << o;
+
+		/* don't insist on orders that already failed */
+
+		order = o;
+	}
+
+	/* a single chunk is used through the linear mapping of the kernel */
+
+	if (shmem->nchunks == 1)
+		shmem->addr = page_address(shmem->chunks[0]);
+	else
+		shmem->addr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
+
+	if (!shmem->addr)
+		goto err;
+
+	vfree(pages);
+
+	shmem->size = tot_mem;
+	shmem->kind = pfq_shmem_pages;
+
+	pr_devel("[PFQ] total shared memory: %zu bytes (%zu chunks, node %d).\n", tot_mem, shmem->nchunks, page_to_nid(shmem->chunks[0]));
+	return 0;
+
+err:
+	if (shmem->chunks)
+		pfq_shared_memory_pages_free(shmem);
+	vfree(pages);
+	return -ENOMEM;
+}
+
+
 int
-pfq_shared_memory_alloc(struct pfq_shmem_descr *shmem, size_t mem_size)
+pfq_shared_memory_alloc(struct pfq_shmem_descr *shmem, size_t mem_size, int node)
 {
 	size_t tot_mem = PAGE_ALIGN(mem_size);
 
 	printk(KERN_WARNING "[PFQ] allocating shared memory...\n");
 
+	/* huge compound pages on the given node first... */
+
+	if (pfq_shared_memory_pages_alloc(shmem, tot_mem, node) == 0)
+		return 0;
+
+	/* ...otherwise fall back to vmalloc */
+
+	pr_devel("[PFQ] shared memory alloc: no pages on node %d, using vmalloc!\n", node);
+
         shmem->addr = vmalloc_user(tot_mem);
         shmem->size = tot_mem;
 	shmem->kind = pfq_shmem_virt;
@@ -181,8 +299,9 @@ pfq_shared_memory_free(struct pfq_shmem_descr *shmem)
 
 		switch(shmem->kind)
 		{
-		case pfq_shmem_virt: vfree(shmem->addr); break;
-		case pfq_shmem_user: pfq_hugepage_unmap(shmem); break;
+		case pfq_shmem_virt:  vfree(shmem->addr); break;
+		case pfq_shmem_pages: pfq_shared_memory_pages_free(shmem); break;
+		case pfq_shmem_user:  pfq_hugepage_unmap(shmem); break;
 		}
 
 		shmem->addr = NULL;
@@ -193,20 +312,96 @@ pfq_shared_memory_free(struct pfq_shmem_descr *shmem)
 }
 
 
-size_t pfq_total_queue_mem(struct pfq_sock *so)
+static int
+pfq_netdev_node(struct pfq_sock *so, int if_index)
 {
-        return sizeof(struct pfq_queue_hdr) + pfq_queue_mpdb_mem(so) * 2 + pfq_queue_spsc_mem(so) * Q_MAX_TX_QUEUES;
+	struct net_device *dev;
+	int node = NUMA_NO_NODE;
+
+	dev = dev_get_by_index(sock_net(&so->sk), if_index);
+	if (dev) {
+		node = dev_to_node(dev->dev.parent ? dev->dev.parent : &dev->dev);
+		dev_put(dev);
+	}
+
+	return node;
 }
 
 
+int
+pfq_shared_memory_node(struct pfq_sock *so)
+{
+	unsigned long groups;
+	int n, node, q;
 
-#define HUGEPAGE_SIZE  (2*1024*1024)
+	if (so->shmem.node != NUMA_NO_NODE)
+		return so->shmem.node;
 
-size_t pfq_shared_memory_size(struct pfq_sock *so)
+	/* the node of the first device bound to the groups of the socket... */
+
+	groups = pfq_get_groups(so->id);
+
+	for(n = 0; n < Q_MAX_DEVICE; n++)
+	{
+		if (!__pfq_devmap_monitor_get(n))
+			continue;
+
+		for(q = 0; q < Q_MAX_HW_QUEUE; q++)
+		{
+			if (__pfq_devmap_get_groups(n, q) & groups) {
+				node = pfq_netdev_node(so, n);
+				if (node != NUMA_NO_NODE)
+					return node;
+				break;
+			}
+		}
+	}
+
+	/* ...or of the first device bound for transmission... */
+
+	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+	{
+		if (so->tx_opt.queue[n].if_index != -1) {
+			node = pfq_netdev_node(so, so->tx_opt.queue[n].if_index);
+			if (node != NUMA_NO_NODE)
+				return node;
+		}
+	}
+
+	/* ...otherwise the node of the consumer, the cpu that enables the socket */
+
+	return numa_node_id();
+}
+
+
+int
+pfq_shared_memory_nid(struct pfq_shmem_descr *shmem)
 {
-	size_t tot_mem = pfq_total_queue_mem(so);
+	if (!shmem->addr)
+		return NUMA_NO_NODE;
 
-	return (1 + tot_mem/HUGEPAGE_SIZE) * HUGEPAGE_SIZE;
+	switch(shmem->kind)
+	{
+	case pfq_shmem_virt:  return page_to_nid(vmalloc_to_page(shmem->addr));
+	case pfq_shmem_pages: return page_to_nid(shmem->chunks[0]);
+	case pfq_shmem_user:  return page_to_nid(shmem->hugepages[0]);
+	}
+
+	return NUMA_NO_NODE;
+}
+
+
+size_t pfq_total_queue_mem(struct pfq_sock *so)
+{
+        return sizeof(struct pfq_queue_hdr) + pfq_queue_rx_mem(so) + pfq_queue_spsc_mem(so) * Q_MAX_TX_QUEUES +
+               pfq_rx_pool_compl_size(so->rx_opt.pool) * sizeof(u32);
+}
+
+
+
+size_t pfq_shared_memory_size(struct pfq_sock *so)
+{
+	return PAGE_ALIGN(pfq_total_queue_mem(so));
 }
 
 
@@ -26,11 +26,16 @@
 
 #include <linux/vmalloc.h>
 #include <linux/net.h>
+#include <linux/numa.h>
 
 struct pfq_sock;
 
+#define HUGEPAGE_SIZE  (2*1024*1024)
+
+
 enum pfq_shmem_kind {
 	pfq_shmem_virt,
+	pfq_shmem_pages,
 	pfq_shmem_user
 };
 
@@ -43,6 +48,11 @@ struct pfq_shmem_descr
 
 	struct page** 		hugepages;
 	size_t 			npages;
+
+	struct page**		chunks;		/* compound pages (pfq_shmem_pages) */
+	size_t			nchunks;
+
+	int			node;		/* NUMA node requested (NUMA_NO_NODE = auto) */
 };
 
 
@@ -51,10 +61,13 @@ size_t pfq_total_queue_mem(struct pfq_sock *so);
 
 int pfq_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma);
 
-int pfq_shared_memory_alloc(struct pfq_shmem_descr *shmem, size_t size);
+int pfq_shared_memory_alloc(struct pfq_shmem_descr *shmem, size_t size, int node);
 void pfq_shared_memory_free(struct pfq_shmem_descr *shmem);
 size_t pfq_shared_memory_size(struct pfq_sock *so);
 
+int pfq_shared_memory_node(struct pfq_sock *so);
+int pfq_shared_memory_nid(struct pfq_shmem_descr *shmem);
+
 int pfq_hugepage_map(struct pfq_shmem_descr *shmem, unsigned long addr, size_t size);
 int pfq_hugepage_unmap(struct pfq_shmem_descr *shmem);
 
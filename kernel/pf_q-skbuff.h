@@ -37,6 +37,8 @@ struct pfq_cb
 	struct gc_log 	 *log;
 	struct pfq_monad *monad;
 	int 		 direct;
+	unsigned int	 snaplen;	/* capture length of the packet for the current group (0 = caplen) */
+	ktime_t		 enqueue;	/* arrival in the GC (ktime_get), skb->tstamp may be unset */
 };
 
 /* wrapper used in garbage collector */
@@ -34,6 +34,10 @@
 
 static atomic_t      pfq_sock_count;
 
+/* number of sockets that require the packets to be timestamped */
+
+static atomic_t      pfq_sock_tstamp;
+
 atomic_long_t pfq_sock_vector[Q_MAX_ID];
 
 
@@ -56,6 +60,23 @@ int pfq_get_sock_count(void)
 }
 
 
+void pfq_sock_set_tstamp(struct pfq_sock *so, int tstamp)
+{
+        if (so->rx_opt.tstamp != Q_TSTAMP_ON && tstamp == Q_TSTAMP_ON)
+                atomic_inc(&pfq_sock_tstamp);
+        else if (so->rx_opt.tstamp == Q_TSTAMP_ON && tstamp != Q_TSTAMP_ON)
+                atomic_dec(&pfq_sock_tstamp);
+
+        so->rx_opt.tstamp = tstamp;
+}
+
+
+int pfq_get_sock_tstamp_count(void)
+{
+        return atomic_read(&pfq_sock_tstamp);
+}
+
+
 struct pfq_sock *
 pfq_get_sock_by_id(size_t id)
 {
@@ -26,6 +26,9 @@
 
 #include <linux/kernel.h>
 #include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/eventfd.h>
+#include <linux/rcupdate.h>
 #include <linux/pf_q.h>
 
 #include <net/sock.h>
@@ -33,10 +36,17 @@
 #include <pf_q-macro.h>
 #include <pf_q-stats.h>
 #include <pf_q-shmem.h>
+#include <pf_q-tx-loop.h>
 
 
 extern atomic_long_t pfq_sock_vector[Q_MAX_ID];
 
+struct pfq_rx_pool;
+struct pfq_tx_zcopy;
+struct pfq_tx_engine;
+
+extern enum hrtimer_restart pfq_rx_wakeup_timer(struct hrtimer *timer);
+
 
 struct pfq_rx_opt
 {
@@ -50,13 +60,39 @@ struct pfq_rx_opt
 	size_t 			queue_size;
 	size_t 			slot_size;
 
+	struct pfq_rx_pool     *pool;		/* zero-copy rx (optional) */
+	int			packed;		/* variable-length slots */
+	int			segments;	/* number of rx segments (2 = double buffer) */
+
+	int			rings;		/* number of per-cpu sub-rings (0 = double buffer) */
+	size_t			ring_size;
+	size_t			ring_mem;
+	spinlock_t	       *ring_lock;	/* per sub-ring producer lock (set when enabled) */
+
 	wait_queue_head_t 	waitqueue;
 
+	size_t			wake_pkts;	/* wakeup coalescing */
+	int			wake_usecs;
+	unsigned long		wake_armed;
+	unsigned long		wake_full;	/* full queue notified */
+	atomic_t		wake_count;	/* packed queue: index << 24 | packets */
+	struct hrtimer		wake_timer;
+	struct eventfd_ctx     *efd;
+
         struct pfq_socket_rx_stats stats;
 
 } ____cacheline_aligned_in_smp;
 
 
+/* capacity of a rx queue, in slots or in blocks (packed) */
+
+static inline
+size_t pfq_rx_queue_capacity(struct pfq_rx_opt const *that)
+{
+	return that->packed ? that->queue_size * that->slot_size / MPDB_QUEUE_BLOCK : that->queue_size;
+}
+
+
 static inline
 struct pfq_rx_queue_hdr *
 pfq_get_rx_queue_hdr(struct pfq_rx_opt *that)
@@ -65,6 +101,16 @@ pfq_get_rx_queue_hdr(struct pfq_rx_opt *that)
 }
 
 
+/* per-cpu rx rings: header of the given sub-ring */
+
+static inline
+struct pfq_tx_queue_hdr *
+pfq_get_rx_ring_hdr(struct pfq_rx_opt *that, int ring)
+{
+	return (struct pfq_tx_queue_hdr *)((char *)that->base_addr + ring * that->ring_mem);
+}
+
+
 static inline
 void pfq_rx_opt_init(struct pfq_rx_opt *that, size_t caplen)
 {
@@ -75,7 +121,7 @@ void pfq_rx_opt_init(struct pfq_rx_opt *that, size_t caplen)
         that->base_addr = NULL;
 
         /* disable tiemstamping by default */
-        that->tstamp = false;
+        that->tstamp = Q_TSTAMP_OFF;
 
         /* set q_slots and q_caplen default values */
 
@@ -84,14 +130,33 @@ void pfq_rx_opt_init(struct pfq_rx_opt *that, size_t caplen)
         that->queue_size = 0;
         that->slot_size = 0;
 
+        that->pool = NULL;
+        that->packed = 0;
+        that->segments = 2;
+
+        that->rings = 0;
+        that->ring_size = 0;
+        that->ring_mem = 0;
+        that->ring_lock = NULL;
+
         /* initialize waitqueue */
 
         init_waitqueue_head(&that->waitqueue);
 
+        /* wakeup at the first packet, no deadline */
+
+        that->wake_pkts  = 1;
+        that->wake_usecs = 0;
+        that->wake_armed = 0;
+        that->wake_full  = 0;
+        atomic_set(&that->wake_count, 0);
+        that->efd        = NULL;
+
+        hrtimer_init(&that->wake_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        that->wake_timer.function = pfq_rx_wakeup_timer;
+
         /* reset stats */
-        sparse_set(&that->stats.recv, 0);
-        sparse_set(&that->stats.lost, 0);
-        sparse_set(&that->stats.drop, 0);
+        sparse_stats_reset(&that->stats);
 
 }
 
@@ -105,7 +170,13 @@ struct pfq_tx_queue_info
 	int 			hw_queue;
 	int 			cpu;
 
+	struct net_device __rcu *dev;		/* held while bound (pf_q-netdev) */
+
 	struct task_struct     *task;
+	struct pfq_tx_zcopy    *zcopy;		/* zero-copy tx (set when the socket is enabled) */
+	struct pfq_tx_engine   *engine;		/* shared Tx engine (instead of the task) */
+
+	struct pfq_tx_loop_state loop;		/* owned by the consumer of the queue */
 };
 
 
@@ -117,6 +188,8 @@ struct pfq_tx_opt
 	size_t  		queue_size;
 	size_t  		slot_size;
         size_t 	       	 	num_queues;
+	int			zerocopy;	/* transmit the slots without copy */
+	int			engine;		/* attach the queues to the per-core Tx engines */
 
 	struct pfq_tx_queue_info queue[Q_MAX_TX_QUEUES];
 
@@ -145,6 +218,8 @@ void pfq_tx_opt_init(struct pfq_tx_opt *that, size_t maxlen)
         that->queue_size = 0;
         that->slot_size  = 0;
 	that->num_queues = 0;
+	that->zerocopy   = 0;
+	that->engine     = 0;
 
 	for(n = 0; n < Q_MAX_TX_QUEUES; ++n)
 	{
@@ -155,10 +230,13 @@ void pfq_tx_opt_init(struct pfq_tx_opt *that, size_t maxlen)
 		that->queue[n].hw_queue  = -1;
 		that->queue[n].cpu       = -1;
 		that->queue[n].task 	 = NULL;
+		that->queue[n].zcopy 	 = NULL;
+		that->queue[n].engine 	 = NULL;
+		RCU_INIT_POINTER(that->queue[n].dev, NULL);
+		pfq_tx_loop_init(&that->queue[n].loop);
        	}
 
-        sparse_set(&that->stats.sent, 0);
-        sparse_set(&that->stats.disc, 0);
+        sparse_stats_reset(&that->stats);
 }
 
 
@@ -171,6 +249,7 @@ struct pfq_sock
 	int		    	egress_type;
         int 		    	egress_index;
         int 		    	egress_queue;
+	struct net_device __rcu *egress_dev;	/* held while bound (pf_q-netdev) */
 
 	struct pfq_shmem_descr  shmem;
 
@@ -196,6 +275,8 @@ pfq_sk(struct sock *sk)
 
 
 int    pfq_get_sock_count(void);
+int    pfq_get_sock_tstamp_count(void);
+void   pfq_sock_set_tstamp(struct pfq_sock *so, int tstamp);
 int    pfq_get_free_sock_id(struct pfq_sock * so);
 struct pfq_sock * pfq_get_sock_by_id(size_t id);
 void   pfq_release_sock_id(int id);
@@ -26,6 +26,7 @@
 #include <linux/version.h>
 
 #include <linux/kthread.h>
+#include <linux/log2.h>
 #include <linux/pf_q.h>
 
 #include <pf_q-transmit.h>
@@ -41,6 +42,10 @@
 #include <pf_q-sockopt.h>
 #include <pf_q-endpoint.h>
 #include <pf_q-shared-queue.h>
+#include <pf_q-rx-pool.h>
+#include <pf_q-netdev.h>
+#include <pf_q-tx-engine.h>
+#include <pf_q-tx-loop.h>
 
 
 int pfq_getsockopt(struct socket *sock,
@@ -123,18 +128,24 @@ int pfq_getsockopt(struct socket *sock,
         case Q_SO_GET_STATS:
         {
                 struct pfq_stats stat;
+                long rx[SPARSE_BLOCK_LEN(&so->rx_opt.stats)];
+                long tx[SPARSE_BLOCK_LEN(&so->tx_opt.stats)];
+
                 if (len != sizeof(struct pfq_stats))
                         return -EINVAL;
 
-                stat.recv = sparse_read(&so->rx_opt.stats.recv);
-                stat.lost = sparse_read(&so->rx_opt.stats.lost);
-                stat.drop = sparse_read(&so->rx_opt.stats.drop);
+                sparse_stats_read(&so->rx_opt.stats, rx);
+                sparse_stats_read(&so->tx_opt.stats, tx);
+
+                stat.recv = rx[SPARSE_BLOCK_IDX(struct pfq_socket_rx_stats, recv)];
+                stat.lost = rx[SPARSE_BLOCK_IDX(struct pfq_socket_rx_stats, lost)];
+                stat.drop = rx[SPARSE_BLOCK_IDX(struct pfq_socket_rx_stats, drop)];
 
 		stat.frwd = 0;
 		stat.kern = 0;
 
-                stat.sent = sparse_read(&so->tx_opt.stats.sent);
-                stat.disc = sparse_read(&so->tx_opt.stats.disc);
+                stat.sent = tx[SPARSE_BLOCK_IDX(struct pfq_socket_tx_stats, sent)];
+                stat.disc = tx[SPARSE_BLOCK_IDX(struct pfq_socket_tx_stats, disc)];
 
                 if (copy_to_user(optval, &stat, sizeof(stat)))
                         return -EFAULT;
@@ -159,6 +170,21 @@ int pfq_getsockopt(struct socket *sock,
                         return -EFAULT;
         } break;
 
+        case Q_SO_GET_SHMEM_NODE:
+        {
+                int node;
+
+                if (len != sizeof(node))
+                        return -EINVAL;
+
+                /* the node of the memory, once the socket is enabled */
+
+                node = so->shmem.addr ? pfq_shared_memory_nid(&so->shmem) : so->shmem.node;
+
+                if (copy_to_user(optval, &node, sizeof(node)))
+                        return -EFAULT;
+        } break;
+
         case Q_SO_GET_RX_CAPLEN:
         {
                 if (len != sizeof(so->rx_opt.caplen))
@@ -205,6 +231,7 @@ int pfq_getsockopt(struct socket *sock,
         {
                 struct pfq_group *g;
                 struct pfq_stats stat;
+                long gs[SPARSE_BLOCK_LEN(&g->stats)];
                 int err, gid;
 
                 if (len != sizeof(stat))
@@ -232,10 +259,12 @@ int pfq_getsockopt(struct socket *sock,
                         return -EACCES;
                 }
 
-                stat.recv = sparse_read(&g->stats.recv);
-                stat.drop = sparse_read(&g->stats.drop);
-                stat.frwd = sparse_read(&g->stats.frwd);
-                stat.kern = sparse_read(&g->stats.kern);
+                sparse_stats_read(&g->stats, gs);
+
+                stat.recv = gs[SPARSE_BLOCK_IDX(struct pfq_group_stats, recv)];
+                stat.drop = gs[SPARSE_BLOCK_IDX(struct pfq_group_stats, drop)];
+                stat.frwd = gs[SPARSE_BLOCK_IDX(struct pfq_group_stats, frwd)];
+                stat.kern = gs[SPARSE_BLOCK_IDX(struct pfq_group_stats, kern)];
 
                 stat.lost = 0;
                 stat.sent = 0;
@@ -249,6 +278,7 @@ int pfq_getsockopt(struct socket *sock,
         {
                 struct pfq_group *g;
                 struct pfq_counters cs;
+                long counters[Q_MAX_COUNTERS];
                 int i, err, gid;
 
                 if (len != sizeof(cs))
@@ -276,9 +306,11 @@ int pfq_getsockopt(struct socket *sock,
                         return -EACCES;
                 }
 
+                sparse_block_read(g->context.counter, Q_MAX_COUNTERS, counters);
+
                 for(i = 0; i < Q_MAX_COUNTERS; i++)
                 {
-                        cs.counter[i] = sparse_read(&g->context.counter[i]);
+                        cs.counter[i] = counters[i];
                 }
 
                 if (copy_to_user(optval, &cs, sizeof(cs)))
@@ -294,6 +326,130 @@ int pfq_getsockopt(struct socket *sock,
 
 
 
+static int
+pfq_set_group_computation(struct pfq_sock *so, struct pfq_group_computation const *tmp)
+{
+        struct pfq_computation_descr *descr = NULL;
+        struct pfq_computation_tree *comp = NULL;
+        struct symtable_entry **symtab = NULL;
+        size_t psize, ucsize;
+        void *context = NULL;
+        bool symtab_locked = false;
+        int err = 0;
+
+        err = pfq_check_group_access(so->id, tmp->gid, "group computation");
+        if (err != 0)
+                return err;
+
+        if (copy_from_user(&psize, tmp->prog, sizeof(size_t)))
+                return -EFAULT;
+
+        pr_devel("[PFQ|%d] computation size: %zu\n", so->id, psize);
+
+        ucsize = sizeof(size_t) * 2 + psize * sizeof(struct pfq_functional_descr);
+
+        descr = kmalloc(ucsize, GFP_KERNEL);
+        if (descr == NULL) {
+                pr_devel("[PFQ|%d] computation: out of memory!\n", so->id);
+                return -ENOMEM;
+        }
+
+        if (copy_from_user(descr, tmp->prog, ucsize)) {
+                pr_devel("[PFQ|%d] computation: copy_from_user error!\n", so->id);
+                err = -EFAULT;
+                goto error;
+        }
+
+        /* print user computation */
+
+        pr_devel_computation_descr(descr);
+
+        /* resolve symbols (once): the symtable stays locked until the computation
+         * is installed, so that the functions of an add-on module cannot be
+         * unregistered while the resolved entries are in use */
+
+        pfq_symtable_lock();
+        symtab_locked = true;
+
+        symtab = pfq_computation_resolve(descr);
+        if (symtab == NULL) {
+                pr_devel("[PFQ|%d] computation: unresolved symbol!\n", so->id);
+                err = -EPERM;
+                goto error;
+        }
+
+        /* check the correctness of computation */
+
+        if (pfq_check_computation_descr(descr, symtab) < 0) {
+                pr_devel("[PFQ|%d] invalid expression!\n", so->id);
+                err = -EFAULT;
+                goto error;
+        }
+
+        /* allocate context */
+
+        context = pfq_context_alloc(descr);
+        if (context == NULL) {
+                pr_devel("[PFQ|%d] context: alloc error!\n", so->id);
+                err = -EFAULT;
+                goto error;
+        }
+
+        /* allocate a pfq_computation_tree */
+
+        comp = pfq_computation_alloc(descr);
+        if (comp == NULL) {
+                pr_devel("[PFQ|%d] computation: alloc error!\n", so->id);
+                err = -EFAULT;
+                goto error;
+        }
+
+        /* link functions of computation */
+
+        if (pfq_computation_rtlink(descr, comp, context, symtab) < 0) {
+                pr_devel("[PFQ|%d] computation aborted!", so->id);
+                err = -EPERM;
+                goto error;
+        }
+
+        /* print executable tree data structure */
+
+        pr_devel_computation_tree(comp);
+
+        /* run init functions */
+
+        if (pfq_computation_init(comp) < 0) {
+                pr_devel("[PFQ|%d] initialization of computation aborted!", so->id);
+                pfq_computation_fini(comp);
+                err = -EPERM;
+                goto error;
+        }
+
+        /* enable functional program */
+
+        if (pfq_set_group_prog(tmp->gid, comp, context) < 0) {
+                pr_devel("[PFQ|%d] set group program error!\n", so->id);
+                err = -EPERM;
+                goto error;
+        }
+
+        pfq_symtable_unlock();
+
+        kfree(symtab);
+        kfree(descr);
+        return 0;
+
+error:  if (symtab_locked)
+                pfq_symtable_unlock();
+
+        kfree(comp);
+        kfree(context);
+        kfree(symtab);
+        kfree(descr);
+        return err;
+}
+
+
 int pfq_setsockopt(struct socket *sock,
                 int level, int optname,
                 char __user * optval,
@@ -342,6 +498,17 @@ int pfq_setsockopt(struct socket *sock,
 			if (so->tx_opt.queue[n].cpu == Q_NO_KTHREAD)
 				continue;
 
+			/* shared engine: the queue is serviced by the kthread of the core */
+
+			if (so->tx_opt.engine) {
+				err = pfq_tx_engine_attach(so, n, so->tx_opt.queue[n].cpu);
+				if (err) {
+					printk(KERN_INFO "[PFQ|%d] TX[%zu] engine: attach failed on cpu %d!\n", so->id, n, so->tx_opt.queue[n].cpu);
+					break;
+				}
+				continue;
+			}
+
 			data = kmalloc(sizeof(struct pfq_thread_data), GFP_KERNEL);
 			if (!data) {
 				printk(KERN_INFO "[PFQ|%d] kernel_thread: could not allocate thread_data! Failed starting thread on cpu %d!\n",
@@ -390,6 +557,8 @@ int pfq_setsockopt(struct socket *sock,
 				kthread_stop(so->tx_opt.queue[n].task);
 				so->tx_opt.queue[n].task = NULL;
 			}
+
+			pfq_tx_engine_detach(so, n);
 		}
 
                 err = pfq_shared_queue_disable(so);
@@ -463,16 +632,15 @@ int pfq_setsockopt(struct socket *sock,
                 if (copy_from_user(&info, optval, optlen))
                         return -EFAULT;
 
-                rcu_read_lock();
-                if (!dev_get_by_index_rcu(sock_net(&so->sk), info.if_index)) {
-                        rcu_read_unlock();
-                        pr_devel("[PFQ|%d] egress bind: invalid if_index=%d\n", so->id, info.if_index);
+                if (info.hw_queue < -1) {
+                        pr_devel("[PFQ|%d] egress bind: invalid queue=%d\n", so->id, info.hw_queue);
                         return -EPERM;
                 }
-                rcu_read_unlock();
 
-                if (info.hw_queue < -1) {
-                        pr_devel("[PFQ|%d] egress bind: invalid queue=%d\n", so->id, info.hw_queue);
+                /* the device is held while bound */
+
+                if (pfq_netdev_bind(so, &so->egress_dev, info.if_index) < 0) {
+                        pr_devel("[PFQ|%d] egress bind: invalid if_index=%d\n", so->id, info.if_index);
                         return -EPERM;
                 }
 
@@ -489,6 +657,8 @@ int pfq_setsockopt(struct socket *sock,
 		so->egress_type  = pfq_endpoint_socket;
                 so->egress_index = 0;
                 so->egress_queue = 0;
+
+                pfq_netdev_unbind(&so->egress_dev);
                 pr_devel("[PFQ|%d] egress unbind.\n", so->id);
 
         } break;
@@ -502,11 +672,19 @@ int pfq_setsockopt(struct socket *sock,
                 if (copy_from_user(&tstamp, optval, optlen))
                         return -EFAULT;
 
-                tstamp = tstamp ? 1 : 0;
+                if (tstamp < Q_TSTAMP_OFF || tstamp > Q_TSTAMP_TSC_BATCH) {
+                        pr_devel("[PFQ|%d] invalid timestamp mode=%d!\n", so->id, tstamp);
+                        return -EINVAL;
+                }
+
+                if (tstamp >= Q_TSTAMP_TSC && !pfq_tsc_khz()) {
+                        pr_devel("[PFQ|%d] timestamp: tsc not available!\n", so->id);
+                        return -EINVAL;
+                }
 
-                so->rx_opt.tstamp = tstamp;
+                pfq_sock_set_tstamp(so, tstamp);
 
-                pr_devel("[PFQ|%d] timestamp enabled.\n", so->id);
+                pr_devel("[PFQ|%d] timestamp mode=%d.\n", so->id, tstamp);
         } break;
 
         case Q_SO_SET_RX_CAPLEN:
@@ -525,12 +703,173 @@ int pfq_setsockopt(struct socket *sock,
 
                 so->rx_opt.caplen = caplen;
 
-                so->rx_opt.slot_size = MPDB_QUEUE_SLOT_SIZE(so->rx_opt.caplen);
+                so->rx_opt.slot_size = so->rx_opt.pool ? MPDB_QUEUE_FRAME_SLOT_SIZE : MPDB_QUEUE_SLOT_SIZE(so->rx_opt.caplen);
 
                 pr_devel("[PFQ|%d] caplen=%zu, slot_size=%zu\n",
                                 so->id, so->rx_opt.caplen, so->rx_opt.slot_size);
         } break;
 
+        case Q_SO_SET_RX_POOL:
+        {
+                struct pfq_rx_pool_descr descr;
+                struct pfq_rx_pool *pool;
+
+                if (optlen != sizeof(descr))
+                        return -EINVAL;
+
+                if (copy_from_user(&descr, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] rx pool: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (descr.addr && so->rx_opt.packed) {
+                        pr_devel("[PFQ|%d] rx pool: packed rx queue!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (descr.if_index != Q_ANY_DEVICE) {
+                        rcu_read_lock();
+                        if (!dev_get_by_index_rcu(sock_net(&so->sk), descr.if_index)) {
+                                rcu_read_unlock();
+                                pr_devel("[PFQ|%d] rx pool: invalid if_index=%d\n", so->id, descr.if_index);
+                                return -EPERM;
+                        }
+                        rcu_read_unlock();
+                }
+
+                if (so->rx_opt.pool) {
+                        pfq_rx_pool_destroy(so->rx_opt.pool);
+                        so->rx_opt.pool = NULL;
+                }
+
+                if (descr.addr == NULL) {  /* back to copy mode */
+                        so->rx_opt.slot_size = MPDB_QUEUE_SLOT_SIZE(so->rx_opt.caplen);
+                        break;
+                }
+
+                pool = pfq_rx_pool_create(&descr);
+                if (pool == NULL) {
+                        pr_devel("[PFQ|%d] rx pool: could not register the pool!\n", so->id);
+                        return -ENOMEM;
+                }
+
+                so->rx_opt.pool = pool;
+                so->rx_opt.slot_size = MPDB_QUEUE_FRAME_SLOT_SIZE;
+
+                pr_devel("[PFQ|%d] rx pool: %zu frames of %zu bytes, slot_size=%zu\n", so->id,
+                                pool->frames, pool->frame_size, so->rx_opt.slot_size);
+        } break;
+
+        case Q_SO_SET_RX_PACKED:
+        {
+                int packed;
+
+                if (optlen != sizeof(packed))
+                        return -EINVAL;
+
+                if (copy_from_user(&packed, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] rx packed: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (packed && so->rx_opt.pool) {
+                        pr_devel("[PFQ|%d] rx packed: rx pool registered!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (packed && so->rx_opt.rings) {
+                        pr_devel("[PFQ|%d] rx packed: rx rings enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                so->rx_opt.packed = !!packed;
+
+                pr_devel("[PFQ|%d] rx packed: %d\n", so->id, so->rx_opt.packed);
+        } break;
+
+        case Q_SO_SET_RX_RINGS:
+        {
+                int rings;
+
+                if (optlen != sizeof(rings))
+                        return -EINVAL;
+
+                if (copy_from_user(&rings, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] rx rings: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (rings && so->rx_opt.packed) {
+                        pr_devel("[PFQ|%d] rx rings: packed rx queue!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (rings && so->rx_opt.segments > 2) {
+                        pr_devel("[PFQ|%d] rx rings: rx segments enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                /* one sub-ring per online cpu (the cpus brought online later share
+                 * the rings); the index of the ring is stored in the u8 commit of the slots */
+
+                if (rings && num_online_cpus() > Q_MAX_CPU) {
+                        pr_devel("[PFQ|%d] rx rings: %d cpus, at most %d supported!\n", so->id, num_online_cpus(), Q_MAX_CPU);
+                        return -EINVAL;
+                }
+
+                so->rx_opt.rings = rings ? num_online_cpus() : 0;
+
+                pr_devel("[PFQ|%d] rx rings: %d\n", so->id, so->rx_opt.rings);
+        } break;
+
+        case Q_SO_SET_RX_WAKEUP:
+        {
+                struct pfq_rx_wakeup wakeup;
+                struct eventfd_ctx *efd = NULL;
+
+                if (optlen != sizeof(wakeup))
+                        return -EINVAL;
+
+                if (copy_from_user(&wakeup, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] rx wakeup: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (wakeup.packets < 1 || wakeup.usecs < 0) {
+                        pr_devel("[PFQ|%d] rx wakeup: packets=%d usecs=%d not allowed!\n", so->id, wakeup.packets, wakeup.usecs);
+                        return -EINVAL;
+                }
+
+                if (wakeup.eventfd >= 0) {
+                        efd = eventfd_ctx_fdget(wakeup.eventfd);
+                        if (IS_ERR(efd)) {
+                                pr_devel("[PFQ|%d] rx wakeup: bad eventfd %d!\n", so->id, wakeup.eventfd);
+                                return PTR_ERR(efd);
+                        }
+                }
+
+                if (so->rx_opt.efd)
+                        eventfd_ctx_put(so->rx_opt.efd);
+
+                so->rx_opt.wake_pkts  = wakeup.packets;
+                so->rx_opt.wake_usecs = wakeup.usecs;
+                so->rx_opt.efd        = efd;
+
+                pr_devel("[PFQ|%d] rx wakeup: packets=%d usecs=%d eventfd=%d\n", so->id, wakeup.packets, wakeup.usecs, wakeup.eventfd);
+        } break;
+
         case Q_SO_SET_RX_SLOTS:
         {
                 typeof(so->rx_opt.queue_size) slots;
@@ -551,6 +890,63 @@ int pfq_setsockopt(struct socket *sock,
                 pr_devel("[PFQ|%d] rx_queue slots=%zu\n", so->id, so->rx_opt.queue_size);
         } break;
 
+        case Q_SO_SET_RX_SEGMENTS:
+        {
+                int segments;
+
+                if (optlen != sizeof(segments))
+                        return -EINVAL;
+
+                if (copy_from_user(&segments, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] rx segments: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                /* the index of the segment is taken modulo 256 (8 bits of rx.data) */
+
+                if (segments < 2 || segments > Q_MAX_RX_SEGMENTS || !is_power_of_2(segments)) {
+                        pr_devel("[PFQ|%d] invalid rx segments=%d (max %d)\n", so->id, segments, Q_MAX_RX_SEGMENTS);
+                        return -EINVAL;
+                }
+
+                if (segments > 2 && so->rx_opt.rings) {
+                        pr_devel("[PFQ|%d] rx segments: rx rings enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                so->rx_opt.segments = segments;
+
+                pr_devel("[PFQ|%d] rx segments=%d\n", so->id, so->rx_opt.segments);
+        } break;
+
+        case Q_SO_SET_SHMEM_NODE:
+        {
+                int node;
+
+                if (optlen != sizeof(node))
+                        return -EINVAL;
+
+                if (copy_from_user(&node, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] shmem node: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (node != NUMA_NO_NODE && (node < 0 || node >= MAX_NUMNODES || !node_online(node))) {
+                        pr_devel("[PFQ|%d] invalid shmem node=%d\n", so->id, node);
+                        return -EINVAL;
+                }
+
+                so->shmem.node = node;
+
+                pr_devel("[PFQ|%d] shmem node=%d\n", so->id, so->shmem.node);
+        } break;
+
         case Q_SO_SET_TX_MAXLEN:
         {
                 typeof (so->tx_opt.maxlen) maxlen;
@@ -573,6 +969,44 @@ int pfq_setsockopt(struct socket *sock,
 
         } break;
 
+        case Q_SO_SET_TX_ZEROCOPY:
+        {
+                int value;
+
+                if (optlen != sizeof(value))
+                        return -EINVAL;
+                if (copy_from_user(&value, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] zero-copy tx: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                so->tx_opt.zerocopy = value ? 1 : 0;
+
+                pr_devel("[PFQ|%d] tx zerocopy=%d\n", so->id, so->tx_opt.zerocopy);
+        } break;
+
+        case Q_SO_SET_TX_ENGINE:
+        {
+                int value;
+
+                if (optlen != sizeof(value))
+                        return -EINVAL;
+                if (copy_from_user(&value, optval, optlen))
+                        return -EFAULT;
+
+                if (so->shmem.addr) {
+                        pr_devel("[PFQ|%d] tx engine: socket enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                so->tx_opt.engine = value ? 1 : 0;
+
+                pr_devel("[PFQ|%d] tx engine=%d\n", so->id, so->tx_opt.engine);
+        } break;
+
         case Q_SO_SET_TX_SLOTS:
         {
                 typeof (so->tx_opt.queue_size) slots;
@@ -715,6 +1149,31 @@ int pfq_setsockopt(struct socket *sock,
                 pr_devel("[PFQ|%d] vlan_set filter vid %d for gid=%d\n", so->id, filt.vid, filt.gid);
         } break;
 
+        case Q_SO_GROUP_SNAPLEN:
+        {
+                struct pfq_group_snaplen snap;
+                int err;
+
+                if (optlen != sizeof(snap))
+                        return -EINVAL;
+
+                if (copy_from_user(&snap, optval, optlen))
+                        return -EFAULT;
+
+                err = pfq_check_group_access(so->id, snap.gid, "group snaplen");
+                if (err != 0)
+                	return err;
+
+                if (snap.snaplen < 0 || snap.class_mask == 0) {
+                        pr_devel("[PFQ|%d] group snaplen error: gid=%d snaplen=%d class_mask=%lx!\n", so->id, snap.gid, snap.snaplen, snap.class_mask);
+                        return -EINVAL;
+                }
+
+                __pfq_set_group_snaplen(snap.gid, snap.class_mask, (unsigned int)snap.snaplen);
+
+                pr_devel("[PFQ|%d] group snaplen=%d for gid=%d class_mask=%lx\n", so->id, snap.snaplen, snap.gid, snap.class_mask);
+        } break;
+
         case Q_SO_TX_BIND:
         {
                 struct pfq_binding info;
@@ -731,14 +1190,6 @@ int pfq_setsockopt(struct socket *sock,
 			return -EPERM;
 		}
 
-                rcu_read_lock();
-                if (!dev_get_by_index_rcu(sock_net(&so->sk), info.if_index)) {
-                        rcu_read_unlock();
-                        pr_devel("[PFQ|%d] TX bind: invalid if_index=%d\n", so->id, info.if_index);
-                        return -EPERM;
-                }
-                rcu_read_unlock();
-
                 if (info.hw_queue < -1) {
                         pr_devel("[PFQ|%d] TX bind: invalid queue=%d\n", so->id, info.hw_queue);
                         return -EPERM;
@@ -751,6 +1202,13 @@ int pfq_setsockopt(struct socket *sock,
 			return -EPERM;
 		}
 
+                /* the device is held while bound */
+
+                if (pfq_netdev_bind(so, &so->tx_opt.queue[i].dev, info.if_index) < 0) {
+                        pr_devel("[PFQ|%d] TX bind: invalid if_index=%d\n", so->id, info.if_index);
+                        return -EPERM;
+                }
+
                 so->tx_opt.queue[i].if_index = info.if_index;
                 so->tx_opt.queue[i].hw_queue = info.hw_queue;
                 so->tx_opt.queue[i].cpu      = info.cpu;
@@ -771,6 +1229,8 @@ int pfq_setsockopt(struct socket *sock,
 			so->tx_opt.queue[n].if_index = -1;
 			so->tx_opt.queue[n].hw_queue = -1;
 			so->tx_opt.queue[n].cpu      = -1;
+
+			pfq_netdev_unbind(&so->tx_opt.queue[n].dev);
 		}
 
         } break;
@@ -812,110 +1272,88 @@ int pfq_setsockopt(struct socket *sock,
 			return err;
         } break;
 
-        case Q_SO_GROUP_FUNCTION:
+        case Q_SO_TX_LOOP:
         {
-                struct pfq_computation_descr *descr = NULL;
-                struct pfq_computation_tree *comp = NULL;
-                struct pfq_group_computation tmp;
-                size_t psize, ucsize;
-                void *context = NULL;
-                int err = 0;
+                struct pfq_tx_loop loop;
+                struct pfq_tx_queue_hdr *txq;
+                int err;
 
-                if (optlen != sizeof(tmp))
+                if (optlen != sizeof(loop))
                         return -EINVAL;
-
-                if (copy_from_user(&tmp, optval, optlen))
+                if (copy_from_user(&loop, optval, optlen))
                         return -EFAULT;
 
-                err = pfq_check_group_access(so->id, tmp.gid, "group computation");
-                if (err != 0)
-                	return err;
-
-                if (copy_from_user(&psize, tmp.prog, sizeof(size_t)))
-                        return -EFAULT;
-
-                pr_devel("[PFQ|%d] computation size: %zu\n", so->id, psize);
-
-                ucsize = sizeof(size_t) * 2 + psize * sizeof(struct pfq_functional_descr);
-
-                descr = kmalloc(ucsize, GFP_KERNEL);
-                if (descr == NULL) {
-                        pr_devel("[PFQ|%d] computation: out of memory!\n", so->id);
-                        return -ENOMEM;
+                if (loop.queue < 0 || loop.queue >= so->tx_opt.num_queues) {
+                        pr_devel("[PFQ|%d] TX loop: bad queue %d (num_queue=%zu)!\n", so->id, loop.queue, so->tx_opt.num_queues);
+                        return -EINVAL;
                 }
 
-                if (copy_from_user(descr, tmp.prog, ucsize)) {
-                        pr_devel("[PFQ|%d] computation: copy_from_user error!\n", so->id);
-                        err = -EFAULT;
-                        goto error;
+                txq = pfq_get_tx_queue_hdr(&so->tx_opt, loop.queue);
+                if (txq == NULL) {
+                        pr_devel("[PFQ|%d] TX loop: socket not enabled!\n", so->id);
+                        return -EPERM;
                 }
 
-                /* print user computation */
+                /* the slots of a zero-copy queue are released on completion */
 
-                pr_devel_computation_descr(descr);
+                if (so->tx_opt.zerocopy) {
+                        pr_devel("[PFQ|%d] TX loop: zero-copy tx!\n", so->id);
+                        return -EPERM;
+                }
 
-		/* check the correctness of computation */
+                err = pfq_tx_loop_request(&so->tx_opt.queue[loop.queue].loop, txq, &loop);
+                if (err)
+                        return err;
 
-		if (pfq_check_computation_descr(descr) < 0) {
-                        pr_devel("[PFQ|%d] invalid expression!\n", so->id);
-                        err = -EFAULT;
-                        goto error;
-		}
+                /* the consumer takes the request */
 
-                /* allocate context */
+                pfq_queue_flush_or_wakeup(so, loop.queue);
 
-                context = pfq_context_alloc(descr);
-                if (context == NULL) {
-                        pr_devel("[PFQ|%d] context: alloc error!\n", so->id);
-                        err = -EFAULT;
-                        goto error;
-                }
+                pr_devel("[PFQ|%d] TX[%d] loop: slots=%u count=%lld flags=%x\n", so->id, loop.queue, loop.slots, loop.count, loop.flags);
+        } break;
 
-                /* allocate a pfq_computation_tree */
+        case Q_SO_GROUP_FUNCTION:
+        {
+                struct pfq_group_computation tmp;
 
-                comp = pfq_computation_alloc(descr);
-                if (comp == NULL) {
-                        pr_devel("[PFQ|%d] computation: alloc error!\n", so->id);
-                        err = -EFAULT;
-                        goto error;
-                }
+                if (optlen != sizeof(tmp))
+                        return -EINVAL;
 
-                /* link functions of computation */
+                if (copy_from_user(&tmp, optval, optlen))
+                        return -EFAULT;
 
-                if (pfq_computation_rtlink(descr, comp, context) < 0) {
-                        pr_devel("[PFQ|%d] computation aborted!", so->id);
-                        err = -EPERM;
-                        goto error;
-                }
+                return pfq_set_group_computation(so, &tmp);
 
-		/* print executable tree data structure */
+        } break;
 
-		pr_devel_computation_tree(comp);
+        case Q_SO_GROUP_FUNCTIONS:
+        {
+                struct pfq_group_computations tmp;
+                struct pfq_group_computation comp;
+                size_t n;
+                int err;
 
-		/* run init functions */
+                if (optlen != sizeof(tmp))
+                        return -EINVAL;
 
-		if (pfq_computation_init(comp) < 0) {
-                        pr_devel("[PFQ|%d] initialization of computation aborted!", so->id);
-                        pfq_computation_fini(comp);
-                        err = -EPERM;
-                        goto error;
-		}
+                if (copy_from_user(&tmp, optval, optlen))
+                        return -EFAULT;
 
-                /* enable functional program */
+                pr_devel("[PFQ|%d] loading %zu computations...\n", so->id, tmp.size);
 
-                if (pfq_set_group_prog(tmp.gid, comp, context) < 0) {
-                        pr_devel("[PFQ|%d] set group program error!\n", so->id);
-                        err = -EPERM;
-                        goto error;
-                }
+                /* computations are installed in order: stop at the first error */
 
-		kfree(descr);
-                return 0;
+                for(n = 0; n < tmp.size; n++)
+                {
+                        if (copy_from_user(&comp, &tmp.comp[n], sizeof(comp)))
+                                return -EFAULT;
 
-	error:  kfree(comp);
-		kfree(context);
-		kfree(descr);
-		return err;
+                        err = pfq_set_group_computation(so, &comp);
+                        if (err != 0) {
+                                pr_devel("[PFQ|%d] computation %zu (gid=%d) error!\n", so->id, n, comp.gid);
+                                return err;
+                        }
+                }
 
         } break;
 
@@ -26,39 +26,76 @@
 #define PF_Q_SPARSE_H
 
 #include <linux/smp.h>  /* get_cpu */
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/stddef.h>
 #include <asm/local.h>
 
 #include <pf_q-macro.h>
 
 
-typedef struct { local_t value; } ____cacheline_aligned counter_t;
+/*
+ * A sparse counter is a reference to a per-cpu local_t. Counters are
+ * allocated in blocks: the counters of a block are contiguous in the
+ * per-cpu area of each cpu, so that a whole stats block can be read with
+ * a single walk over the online cpus.
+ */
 
+typedef struct { local_t __percpu *value; } sparse_counter_t;
 
-typedef struct { counter_t ctx[Q_MAX_CPU]; } sparse_counter_t;
+
+static inline
+int sparse_block_alloc(sparse_counter_t *sc, size_t n)
+{
+	local_t __percpu *block = __alloc_percpu(sizeof(local_t) * n, __alignof__(local_t));
+	size_t i;
+
+	if (!block)
+		return -ENOMEM;
+
+	for(i = 0; i < n; i++)
+		sc[i].value = block + i;
+
+	return 0;
+}
+
+
+static inline
+void sparse_block_free(sparse_counter_t *sc, size_t n)
+{
+	size_t i;
+
+	free_percpu(sc[0].value);
+
+	for(i = 0; i < n; i++)
+		sc[i].value = NULL;
+}
 
 
 static inline
 void __sparse_inc(sparse_counter_t *sc, int cpu)
 {
-        local_inc(&sc->ctx[cpu].value);
+        local_inc(per_cpu_ptr(sc->value, cpu));
 }
 
 static inline
 void __sparse_dec(sparse_counter_t *sc, int cpu)
 {
-        local_dec(&sc->ctx[cpu].value);
+        local_dec(per_cpu_ptr(sc->value, cpu));
 }
 
 static inline
 void __sparse_add(sparse_counter_t *sc, long n, int cpu)
 {
-        local_add(n, &sc->ctx[cpu].value);
+        local_add(n, per_cpu_ptr(sc->value, cpu));
 }
 
 static inline
 void __sparse_sub(sparse_counter_t *sc, long n, int cpu)
 {
-        local_sub(n, &sc->ctx[cpu].value);
+        local_sub(n, per_cpu_ptr(sc->value, cpu));
 }
 
 
@@ -96,8 +133,8 @@ static inline
 void sparse_set(sparse_counter_t *sc, long n)
 {
         unsigned int i, me = get_cpu();
-        for(i = 0; i < Q_MAX_CPU; i++)
-                local_set(&sc->ctx[i].value, i == me ? n : 0);
+        for_each_possible_cpu(i)
+                local_set(per_cpu_ptr(sc->value, i), i == me ? n : 0);
         put_cpu();
 }
 
@@ -105,10 +142,53 @@ static inline
 long sparse_read(sparse_counter_t *sc)
 {
         long ret = 0; int i;
-        for(i=0; i < Q_MAX_CPU; i++)
-                ret += local_read(&sc->ctx[i].value);
+        for_each_online_cpu(i)
+                ret += local_read(per_cpu_ptr(sc->value, i));
 
         return ret;
 }
 
+
+static inline
+void sparse_block_reset(sparse_counter_t *sc, size_t n)
+{
+        int i;
+        for_each_possible_cpu(i)
+                memset(per_cpu_ptr(sc[0].value, i), 0, sizeof(local_t) * n);
+}
+
+static inline
+void sparse_block_read(sparse_counter_t *sc, size_t n, long *ret)
+{
+        size_t j; int i;
+
+        memset(ret, 0, sizeof(long) * n);
+
+        for_each_online_cpu(i)
+        {
+                local_t *block = per_cpu_ptr(sc[0].value, i);
+                for(j = 0; j < n; j++)
+                        ret[j] += local_read(&block[j]);
+        }
+}
+
+
+/* stats blocks: structures made of sparse counters only */
+
+#define SPARSE_BLOCK_LEN(stats) (sizeof(*(stats))/sizeof(sparse_counter_t))
+
+#define SPARSE_BLOCK_IDX(type, field) (offsetof(type, field)/sizeof(sparse_counter_t))
+
+#define sparse_stats_alloc(stats) \
+	sparse_block_alloc((sparse_counter_t *)(stats), SPARSE_BLOCK_LEN(stats))
+
+#define sparse_stats_free(stats) \
+	sparse_block_free((sparse_counter_t *)(stats), SPARSE_BLOCK_LEN(stats))
+
+#define sparse_stats_reset(stats) \
+	sparse_block_reset((sparse_counter_t *)(stats), SPARSE_BLOCK_LEN(stats))
+
+#define sparse_stats_read(stats, ret) \
+	sparse_block_read((sparse_counter_t *)(stats), SPARSE_BLOCK_LEN(stats), ret)
+
 #endif /* PF_Q_SPARSE_H */
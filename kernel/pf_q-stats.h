@@ -30,7 +30,7 @@
 #include <pf_q-sparse.h>
 
 
-/* sparse_counter_t stats */
+/* sparse_counter_t stats: each structure is allocated as a per-cpu block */
 
 
 struct pfq_socket_rx_stats
@@ -61,12 +61,7 @@ struct pfq_group_stats
 static inline
 void pfq_group_stats_reset(struct pfq_group_stats *stats)
 {
-        sparse_set(&stats->recv, 0);
-        sparse_set(&stats->drop, 0);
-        sparse_set(&stats->frwd, 0);
-        sparse_set(&stats->kern, 0);
-        sparse_set(&stats->disc, 0);
-        sparse_set(&stats->quit, 0);
+        sparse_stats_reset(stats);
 }
 
 struct pfq_global_stats
@@ -86,16 +81,7 @@ struct pfq_global_stats
 static inline
 void pfq_global_stats_reset(struct pfq_global_stats *stats)
 {
-	sparse_set(&stats->recv, 0);
-	sparse_set(&stats->lost, 0);
-	sparse_set(&stats->sent, 0);
-	sparse_set(&stats->frwd, 0);
-	sparse_set(&stats->kern, 0);
-	sparse_set(&stats->disc, 0);
-	sparse_set(&stats->quit, 0);
-
-	sparse_set(&stats->poll, 0);
-	sparse_set(&stats->wake, 0);
+	sparse_stats_reset(stats);
 }
 
 
@@ -116,15 +102,7 @@ struct pfq_memory_stats
 static inline
 void pfq_memory_stats_reset(struct pfq_memory_stats *stats)
 {
-        sparse_set(&stats->os_alloc, 0);
-        sparse_set(&stats->os_free,  0);
-        sparse_set(&stats->rc_alloc, 0);
-        sparse_set(&stats->rc_free,  0);
-        sparse_set(&stats->rc_miss, 0);
-        sparse_set(&stats->err_intdis, 0);
-        sparse_set(&stats->err_shared, 0);
-        sparse_set(&stats->err_cloned, 0);
-        sparse_set(&stats->err_memory, 0);
+        sparse_stats_reset(stats);
 }
 
 
@@ -28,6 +28,7 @@
 #include <linux/string.h>
 #include <linux/semaphore.h>
 #include <linux/rwsem.h>
+#include <linux/jhash.h>
 
 #include <pf_q-module.h>
 #include <pf_q-group.h>
@@ -45,6 +46,19 @@ LIST_HEAD(pfq_lang_functions);
 EXPORT_SYMBOL_GPL(pfq_lang_functions);
 
 
+/* hash table of symbols (of all categories) */
+
+static struct hlist_head pfq_symtable_hash[1 << Q_SYMTABLE_HASH_BITS];
+
+
+static inline struct hlist_head *
+__pfq_symtable_bucket(struct list_head *category, const char *symbol)
+{
+	u32 h = jhash(symbol, strlen(symbol), (u32)(unsigned long)category);
+	return &pfq_symtable_hash[h & ((1 << Q_SYMTABLE_HASH_BITS) - 1)];
+}
+
+
 static void
 __pfq_symtable_free(struct list_head *category)
 {
@@ -55,28 +69,30 @@ __pfq_symtable_free(struct list_head *category)
 	{
     		this = list_entry(pos, struct symtable_entry, list);
 		list_del(pos);
+		hlist_del(&this->hnode);
                 kfree(this);
 	}
 }
 
 
-static struct symtable_entry *
+/* the caller holds symtable_sem */
+
+struct symtable_entry *
 __pfq_symtable_search(struct list_head *category, const char *symbol)
 {
-	struct list_head *pos = NULL;
 	struct symtable_entry *this;
+	struct hlist_node *pos;
 
         if (symbol == NULL)
                 return NULL;
 
-	list_for_each(pos, category)
+	hlist_for_each(pos, __pfq_symtable_bucket(category, symbol))
 	{
-    		this = list_entry(pos, struct symtable_entry, list);
-        	if (!strcmp(this->symbol, symbol))
+    		this = hlist_entry(pos, struct symtable_entry, hnode);
+        	if (this->category == category && !strcmp(this->symbol, symbol))
 			return this;
 	}
 	return NULL;
-
 }
 
 
@@ -102,6 +118,7 @@ __pfq_symtable_register_function(struct list_head *category, const char *symbol,
 	}
 
 	INIT_LIST_HEAD(&elem->list);
+	INIT_HLIST_NODE(&elem->hnode);
 
 	elem->function = fun;
         elem->init = init;
@@ -111,8 +128,11 @@ __pfq_symtable_register_function(struct list_head *category, const char *symbol,
         elem->symbol[Q_FUN_SYMB_LEN-1] = '\0';
 	list_add(&elem->list, category);
 
+	elem->category = category;
 	elem->signature = signature;
 
+	hlist_add_head(&elem->hnode, __pfq_symtable_bucket(category, elem->symbol));
+
 	return 0;
 }
 
@@ -120,17 +140,13 @@ __pfq_symtable_register_function(struct list_head *category, const char *symbol,
 static int
 __pfq_symtable_unregister_function(struct list_head *category, const char *symbol)
 {
-	struct list_head *pos = NULL, *q;
-	struct symtable_entry *this;
+	struct symtable_entry *this = __pfq_symtable_search(category, symbol);
 
-	list_for_each_safe(pos, q, category)
-	{
-    		this = list_entry(pos, struct symtable_entry, list);
-		if (!strcmp(this->symbol, symbol)) {
-			list_del(pos);
-	       		kfree(this);
-			return 0;
-		}
+	if (this) {
+		list_del(&this->list);
+		hlist_del(&this->hnode);
+		kfree(this);
+		return 0;
 	}
 	printk(KERN_INFO "[PFQ] symtable error: '%s' no such function\n", symbol);
 	return -1;
@@ -269,8 +285,11 @@ pfq_symtable_unregister_function(const char *module, struct list_head *category,
 	down(&symtable_sem);
 
 	elem = __pfq_symtable_search(category, symbol);
-	if (elem == NULL)
+	if (elem == NULL) {
+		up(&symtable_sem);
+		up_write(&symtable_rw_sem);
         	return -1;
+	}
 
 	__pfq_dismiss_function(elem->function);
         __pfq_symtable_unregister_function(category, symbol);
@@ -38,6 +38,8 @@
 struct symtable_entry
 {
 	struct list_head 	list;
+	struct hlist_node	hnode;		/* symbol hash table */
+	struct list_head *	category;
 	char 			symbol[Q_FUN_SYMB_LEN];
 	void *                  function;
 	void *			init;
@@ -67,6 +69,23 @@ extern int pfq_symtable_register_functions  (const char *module, struct list_hea
 extern int pfq_symtable_unregister_functions(const char *module, struct list_head *category, struct pfq_function_descr *fun);
 
 extern struct symtable_entry *pfq_symtable_search(struct list_head *category, const char *symbol);
+extern struct symtable_entry *__pfq_symtable_search(struct list_head *category, const char *symbol);
+
+
+/* the entries found with __pfq_symtable_search are valid until the symtable
+ * is unlocked: the functions cannot be unregistered meanwhile */
+
+static inline void
+pfq_symtable_lock(void)
+{
+	down(&symtable_sem);
+}
+
+static inline void
+pfq_symtable_unlock(void)
+{
+	up(&symtable_sem);
+}
 
 
 #endif /* PF_Q_SYMTABLE_H */
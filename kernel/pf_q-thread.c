@@ -30,18 +30,45 @@
 #include <linux/module.h>
 #include <linux/version.h>
 #include <linux/kthread.h>
+#include <linux/sched.h>
 
 #include <pf_q-macro.h>
 #include <pf_q-thread.h>
 #include <pf_q-memory.h>
 #include <pf_q-sock.h>
 #include <pf_q-transmit.h>
+#include <pf_q-global.h>
+#include <pf_q-netdev.h>
+
+/* sleep until the doorbell is rung (or the thread is stopped) */
+
+static void
+pfq_tx_thread_sleep(struct pfq_tx_opt *to, size_t index, struct pfq_tx_queue_hdr *txq)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	txq->thread.asleep = 1;
+	smp_mb();
+
+	/* re-check the queue: a packet injected before the flag was seen
+	 * by user space would not ring the doorbell */
+
+	if (!pfq_tx_queue_avail(to, index) && !kthread_should_stop()) {
+		schedule();
+		txq->thread.stats.wakeup++;
+	}
+
+	__set_current_state(TASK_RUNNING);
+	txq->thread.asleep = 0;
+}
+
 
 int
 pfq_tx_thread(void *_data)
 {
         struct pfq_thread_data *data = (struct pfq_thread_data *)_data;
-        struct net_device *dev;
+	struct pfq_tx_queue_hdr *txq;
+	u64 idle_since = 0;
 	int cpu;
 
 	if (data == NULL) {
@@ -50,7 +77,7 @@ pfq_tx_thread(void *_data)
 	}
 
 	cpu = smp_processor_id();
-        dev = dev_get_by_index(sock_net(&data->so->sk), data->so->tx_opt.queue[data->id].if_index);
+	txq = pfq_get_tx_queue_hdr(&data->so->tx_opt, data->id);
 
        	printk(KERN_INFO "[PFQ] TX[%zu] thread started on cpu %d.\n", data->id, cpu);
 
@@ -58,7 +85,43 @@ pfq_tx_thread(void *_data)
 
         for(;;)
         {
-                __pfq_queue_flush(data->id, &data->so->tx_opt, dev, cpu, cpu_to_node(cpu));
+		/* the device bound to the queue, held for this pass: it may be
+		 * unbound (or unregistered) while the thread is running */
+
+		struct net_device *dev = pfq_netdev_get(&data->so->tx_opt.queue[data->id].dev);
+		int sent = 0;
+
+		if (dev) {
+			sent = __pfq_queue_flush(data->id, &data->so->tx_opt, dev, cpu, cpu_to_node(cpu));
+			dev_put(dev);
+		}
+
+                if (sent || (dev && pfq_tx_queue_avail(&data->so->tx_opt, data->id))) {
+			txq->thread.stats.busy++;
+			idle_since = 0;
+		}
+		else if (dev == NULL) {
+
+			/* the device is gone: nothing to transmit until the socket is rebound */
+
+			schedule_timeout_interruptible(HZ/10);
+		}
+		else {
+			txq->thread.stats.idle++;
+
+			/* adaptive: poll the empty queue up to tx_idle usec, then sleep */
+
+			if (tx_idle >= 0) {
+				u64 now = local_clock();
+
+				if (!idle_since)
+					idle_since = now;
+				else if (now - idle_since >= (u64)tx_idle * 1000) {
+					pfq_tx_thread_sleep(&data->so->tx_opt, data->id, txq);
+					idle_since = 0;
+				}
+			}
+		}
 
                 if (kthread_should_stop())
                         break;
@@ -69,9 +132,8 @@ pfq_tx_thread(void *_data)
 			cpu_relax();
         }
 
-        dev_put(dev);
-
-        printk(KERN_INFO "[PFQ] TX[%zu] thread stopped on cpu %d.\n", data->id, cpu);
+        printk(KERN_INFO "[PFQ] TX[%zu] thread stopped on cpu %d (busy=%llu idle=%llu wakeup=%llu).\n", data->id, cpu,
+		txq->thread.stats.busy, txq->thread.stats.idle, txq->thread.stats.wakeup);
 
         kfree(data);
 
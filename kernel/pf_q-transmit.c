@@ -38,17 +38,13 @@
 #include <pf_q-macro.h>
 #include <pf_q-global.h>
 #include <pf_q-GC.h>
+#include <pf_q-tx-zcopy.h>
+#include <pf_q-netdev.h>
+#include <pf_q-tx-engine.h>
+#include <pf_q-tx-loop.h>
+#include <pf_q-rx-pool.h>
 
 
-static inline u16
-__pfq_dev_cap_txqueue(struct net_device *dev, u16 hw_queue)
-{
-	if (unlikely(hw_queue >= dev->real_num_tx_queues))
-		return 0;
-
-	return hw_queue;
-}
-
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(3,13,0))
 static u16 __pfq_pick_tx(struct net_device *dev, struct sk_buff *skb)
 {
@@ -82,8 +78,11 @@ pfq_pick_tx(struct net_device *dev, struct sk_buff *skb, int *hw_queue)
 }
 
 
+static int __pfq_queue_xmit_locked(struct pfq_skbuff_batch *skbs, struct net_device *dev, struct netdev_queue *txq, int hw_queue);
+
+
 static inline int
-__pfq_tx_queue_xmit(size_t qidx, struct pfq_skbuff_batch *skbs, struct net_device *dev, struct pfq_tx_opt *to, int cpu, struct local_data *local)
+__pfq_tx_queue_xmit(size_t qidx, struct pfq_skbuff_batch *skbs, struct net_device *dev, struct netdev_queue *locked, struct pfq_tx_opt *to, int cpu, struct local_data *local)
 {
 	size_t sent;
 
@@ -94,7 +93,8 @@ __pfq_tx_queue_xmit(size_t qidx, struct pfq_skbuff_batch *skbs, struct net_devic
 
 	/* transmit the batch */
 
-	sent = pfq_queue_xmit(skbs, dev, to->queue[qidx].hw_queue);
+	sent = locked ? __pfq_queue_xmit_locked(skbs, dev, locked, to->queue[qidx].hw_queue)
+		      : pfq_queue_xmit(skbs, dev, to->queue[qidx].hw_queue);
 
 	/* update stats */
 
@@ -111,18 +111,26 @@ __pfq_tx_queue_xmit(size_t qidx, struct pfq_skbuff_batch *skbs, struct net_devic
 }
 
 
+/* flush the queue: when locked is not NULL, the caller holds the lock of that
+ * netdev queue (bh disabled), and the skbs are allocated atomically */
+
 int
-__pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, int cpu, int node)
+__pfq_queue_flush_txq(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, struct netdev_queue *locked, int cpu, int node)
 {
 	struct pfq_skbuff_short_batch skbs;
+	const gfp_t gfp = locked ? GFP_ATOMIC : GFP_KERNEL;
+	u64 now = 0;
 
+	struct pfq_tx_zcopy *zc = to->queue[qidx].zcopy;
+	struct pfq_tx_loop_state *loop = &to->queue[qidx].loop;
+	struct pfq_tx_loop_cursor cur;
 	struct pfq_tx_queue_hdr *txq;
 	struct local_data *local;
 	struct pfq_pkthdr_tx * hdr;
 	struct sk_buff *skb;
 	size_t len, tot_sent = 0;
 
-	int index, avail, n;
+	int index, avail, n, looping = 0;
 
 	/* get the socket queue */
 
@@ -136,8 +144,31 @@ __pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, in
 
 	local = __this_cpu_ptr(cpu_data);
 
-	avail = pfq_spsc_read_avail(txq);
-	index = pfq_spsc_read_index(txq);
+	/* zero-copy: the slots are committed to the driver, and released on completion */
+
+	if (zc) {
+		avail = pfq_tx_zcopy_avail(zc);
+		index = zc->next;
+	}
+	else {
+		/* loop: the slots are transmitted from the cursor, and released
+		 * when the loop ends */
+
+		int state = pfq_tx_loop_check(loop, txq);
+		if (unlikely(state != PFQ_TX_LOOP_OFF)) {
+
+			if (state == PFQ_TX_LOOP_WAIT)
+				return 0;
+
+			looping = 1;
+			avail = pfq_tx_loop_pass(loop, txq, &cur);
+			index = pfq_tx_loop_index(loop, txq, &cur);
+		}
+		else {
+			avail = pfq_spsc_read_avail(txq);
+			index = pfq_spsc_read_index(txq);
+		}
+	}
 
 	for(n = 0; n < avail; ++n)
 	{
@@ -147,7 +178,7 @@ __pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, in
 
 			int sent, i;
 
-			sent = __pfq_tx_queue_xmit(qidx, SKBUFF_BATCH_ADDR(skbs), dev, to, cpu, local);
+			sent = __pfq_tx_queue_xmit(qidx, SKBUFF_BATCH_ADDR(skbs), dev, locked, to, cpu, local);
 
 			tot_sent += sent;
 
@@ -155,8 +186,16 @@ __pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, in
 			   unset packets are transmitted later in the loop
 			 */
 
-			pfq_spsc_read_commit_n(txq, sent);
+			if (zc)
+				pfq_tx_zcopy_commit_n(zc, sent);
+			else if (looping)
+				pfq_tx_loop_commit_n(loop, txq, sent);
+			else
+				pfq_spsc_read_commit_n(txq, sent);
+
+			/* the clock of the pacer is read again after a batch */
 
+			now = 0;
 
 			/* free/recycle the transmitted skb... */
 
@@ -174,30 +213,60 @@ __pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, in
 				skb_get(skb);
 		}
 		else {
-			skb = pfq_tx_alloc_skb(to->maxlen, GFP_KERNEL, node);
-			if (unlikely(skb == NULL))
-				break;
-
 			hdr = (struct pfq_pkthdr_tx *) (to->queue[qidx].base_addr + index * txq->slot_size);
 
-			/* fill the skb */
+			/* paced tx: packets are held until their departure time; those
+			 * due within the window are transmitted in the same batch */
+
+			if (hdr->tstamp && !looping) {
+				if (!now)
+					now = pfq_tx_clock();
+
+				/* the window is writable at runtime: negative values mean 0 */
+
+				if (hdr->tstamp > now + (u64)max(tx_pace_window, 0))
+					break;
+
+				pfq_tx_pace_account(txq, hdr->tstamp, now);
+			}
 
 			len = min_t(size_t, hdr->len, txq->max_len);
 
-			/* set the skb */
+			if (zc) {
+				/* reference the slot in the skb */
 
-			skb_reset_tail_pointer(skb);
-			skb->dev = dev;
-			skb->len = 0;
-			__skb_put(skb, len);
+				skb = pfq_tx_zcopy_skb(zc, index, (const char *)(hdr+1), len, gfp, node);
+				if (unlikely(skb == NULL))
+					break;
+
+				skb->dev = dev;
+				skb_get(skb);
+			}
+			else {
+				skb = pfq_tx_alloc_skb(to->maxlen, gfp, node);
+				if (unlikely(skb == NULL))
+					break;
+
+				/* set the skb */
+
+				skb_reset_tail_pointer(skb);
+				skb->dev = dev;
+				skb->len = 0;
+				__skb_put(skb, len);
+
+				/* get the skb */
+
+				skb_get(skb);
 
-			/* get the skb */
+				/* copy bytes in the socket buffer */
 
-			skb_get(skb);
+				skb_copy_to_linear_data(skb, hdr+1, len < 64 ? 64 : len);
 
-			/* copy bytes in the socket buffer */
+				/* per packet rewrites of the loop */
 
-			skb_copy_to_linear_data(skb, hdr+1, len < 64 ? 64 : len);
+				if (looping && loop->conf.flags)
+					pfq_tx_loop_rewrite(&loop->conf, skb, pfq_tx_loop_seq(loop, &cur));
+			}
 
 			/* enqueue the skb to the batch */
 
@@ -205,7 +274,14 @@ __pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, in
 
 			/* get the index... */
 
-			index = pfq_spsc_next_index(txq, index);
+			if (looping) {
+				pfq_tx_loop_next(loop, &cur);
+				index = pfq_tx_loop_index(loop, txq, &cur);
+			}
+			else if (zc)
+				index = pfq_tx_zcopy_next(zc, index);
+			else
+				index = pfq_spsc_next_index(txq, index);
 		}
 	}
 
@@ -213,17 +289,26 @@ __pfq_queue_flush(size_t qidx, struct pfq_tx_opt *to, struct net_device *dev, in
 
 		/* transmit the last batch */
 
-		int sent = __pfq_tx_queue_xmit(qidx, SKBUFF_BATCH_ADDR(skbs), dev, to, cpu, local);
+		int sent = __pfq_tx_queue_xmit(qidx, SKBUFF_BATCH_ADDR(skbs), dev, locked, to, cpu, local);
 		tot_sent += sent;
 
 		/* commit the slots of packets successfully *sent* */
 
-		pfq_spsc_read_commit_n(txq, sent);
+		if (zc)
+			pfq_tx_zcopy_commit_n(zc, sent);
+		else if (looping)
+			pfq_tx_loop_commit_n(loop, txq, sent);
+		else
+			pfq_spsc_read_commit_n(txq, sent);
 
-		/* recycle the skbs */
+		/* recycle the skbs (the slots of the zero-copy skbs not sent are not released) */
 
 		for_each_skbuff(SKBUFF_BATCH_ADDR(skbs), skb, n)
+		{
+			if (zc && n >= sent)
+				pfq_tx_zcopy_cancel(zc, skb);
 			pfq_kfree_skb_pool(skb, &local->tx_pool);
+		}
 	}
 
 	return tot_sent;
@@ -240,15 +325,27 @@ pfq_queue_flush_or_wakeup(struct pfq_sock *so, int index)
 	struct pfq_tx_queue_hdr *txq = pfq_get_tx_queue_hdr(&so->tx_opt, index);
 	struct net_device *dev;
 
-	if (!pfq_spsc_read_avail(txq))
-		return 0;
+	/* the doorbell of the kernel thread: the consumer side of the queue
+	 * belongs to the thread, and is not touched here */
 
 	if (so->tx_opt.queue[index].task) {
-		wake_up_process(so->tx_opt.queue[index].task);
+		if (txq->thread.asleep)
+			wake_up_process(so->tx_opt.queue[index].task);
 		return 0;
 	}
 
-	dev = dev_get_by_index(sock_net(&so->sk), so->tx_opt.queue[index].if_index);
+	if (so->tx_opt.queue[index].engine) {
+		if (txq->thread.asleep)
+			pfq_tx_engine_wakeup(so->tx_opt.queue[index].engine);
+		return 0;
+	}
+
+	if (!pfq_tx_queue_avail(&so->tx_opt, index))
+		return 0;
+
+	/* the device bound to the queue (no lookup by index) */
+
+	dev = pfq_netdev_get(&so->tx_opt.queue[index].dev);
 	if (!dev)
 		return -EPERM;
 
@@ -302,9 +399,7 @@ int
 pfq_queue_xmit(struct pfq_skbuff_batch *skbs, struct net_device *dev, int hw_queue)
 {
 	struct netdev_queue *txq;
-	struct sk_buff *skb;
-	int n, ret = 0;
-	size_t last;
+	int ret;
 
 	/* get txq and fix the hw_queue for this batch.
 	 *
@@ -313,10 +408,26 @@ pfq_queue_xmit(struct pfq_skbuff_batch *skbs, struct net_device *dev, int hw_que
 
 	txq = pfq_pick_tx(dev, skbs->queue[0], &hw_queue);
 
-	last = pfq_skbuff_batch_len(skbs) - 1;
-
 	__netif_tx_lock_bh(txq);
 
+	ret = __pfq_queue_xmit_locked(skbs, dev, txq, hw_queue);
+
+	__netif_tx_unlock_bh(txq);
+	return ret;
+}
+
+
+/* transmit the batch to txq, whose lock is held by the caller */
+
+static int
+__pfq_queue_xmit_locked(struct pfq_skbuff_batch *skbs, struct net_device *dev, struct netdev_queue *txq, int hw_queue)
+{
+	struct sk_buff *skb;
+	int n, ret = 0;
+	size_t last;
+
+	last = pfq_skbuff_batch_len(skbs) - 1;
+
 	for_each_skbuff(skbs, skb, n)
 	{
 		skb_set_queue_mapping(skb, hw_queue);
@@ -327,14 +438,12 @@ pfq_queue_xmit(struct pfq_skbuff_batch *skbs, struct net_device *dev, int hw_que
 			goto intr;
 	}
 
-	__netif_tx_unlock_bh(txq);
 	return ret;
 
 intr:
 	for_each_skbuff_from(ret + 1, skbs, skb, n)
 		kfree_skb(skb);
 
-	__netif_tx_unlock_bh(txq);
 	return ret;
 }
 
@@ -380,7 +489,17 @@ intr:
 int
 pfq_lazy_xmit(struct gc_buff buff, struct net_device *dev, int hw_queue)
 {
+	struct local_data *local = __this_cpu_ptr(cpu_data);
+	struct gc_data *gc = &local->gc;
 	struct gc_log *log = PFQ_CB(buff.skb)->log;
+	struct gc_fwd_list *list;
+	size_t index = log - gc->log;
+
+	if (unlikely(index >= gc->pool.len)) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] bridge %s: packet not in the GC!\n", dev->name);
+		return 0;
+	}
 
 	if (log->num_devs >= Q_GC_LOG_QUEUE_LEN) {
 		if (printk_ratelimit())
@@ -388,8 +507,19 @@ pfq_lazy_xmit(struct gc_buff buff, struct net_device *dev, int hw_queue)
 		return 0;
 	}
 
-	skb_set_queue_mapping(buff.skb, hw_queue);
-	log->dev[log->num_devs++] = dev;
+	/* append the packet to the forwarding list of the device/hw queue */
+
+	list = gc_get_fwd_list(gc, dev, hw_queue);
+	if (list == NULL || list->len == Q_GC_POOL_QUEUE_LEN) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] bridge %s: forward list full!\n", dev->name);
+		return 0;
+	}
+
+	list->index[list->len++] = (u8)index;
+	gc->fwd.cnt_total++;
+
+	log->num_devs++;
 	log->xmit_todo++;
 
 	return 1;
@@ -429,67 +559,48 @@ pfq_queue_lazy_xmit_by_mask(struct gc_queue_buff *queue, unsigned long long mask
 
 
 size_t
-pfq_lazy_xmit_exec(struct gc_data *gc, struct gc_fwd_targets const *t)
+pfq_lazy_xmit_exec(struct gc_data *gc, struct gc_fwd_targets const *ts)
 {
 	struct netdev_queue *txq;
-	struct net_device *dev;
 	struct sk_buff *skb;
         size_t sent = 0;
-	size_t n, i, k;
+	size_t n, i;
 	int queue;
 
-	/* for each net_device... */
+	/* for each net_device/hw queue, transmit its list in a single locked burst */
 
-	for(n = 0; n < t->num; n++)
+	for(n = 0; n < ts->num; n++)
 	{
-		dev = t->dev[n];
-		k = 0; txq = NULL;
-
-		/* scan the list of skbs, and forward them in batch fashion */
-
-		for(i = 0; i < gc->pool.len; i++)
-		{
-			struct gc_log *log;
-                        size_t j, num;
-
-			/* select the packet */
+		struct gc_fwd_list const *list = &ts->list[n];
 
-                        log = &gc->log[i];
+		if (list->len == 0)
+			continue;
 
-			num = gc_count_dev_in_log(dev, log);
-			if (num == 0)
-				continue;
+		/* with no hw queue given, the first packet of the list picks it */
 
-			skb = gc->pool.queue[i].skb;
+		queue = list->hw_queue;
+		txq = pfq_pick_tx(list->dev, gc->pool.queue[list->index[0]].skb, &queue);
 
-			/* the first packet for this dev determines the hw queue */
+		__netif_tx_lock_bh(txq);
 
-			if (!txq) {
-				queue = skb->queue_mapping;
-				txq = pfq_pick_tx(dev, skb, &queue);
-
-				__netif_tx_lock_bh(txq);
-			}
+		for(i = 0; i < list->len; i++)
+		{
+			const int xmit_more = i != list->len - 1;
 
-			/* forward this skb `num` times */
+			skb = gc->pool.queue[list->index[i]].skb;
 
-                        for (j = 0; j < num; j++)
-			{
-				const int xmit_more = ++k != t->cnt[n];
+			/* the last transmission of a packet takes the skb itself */
 
-				skb = log->xmit_todo-- > 1 ? skb_clone(skb, GFP_ATOMIC) : skb_get(skb);
-				if (skb) {
-					if (__pfq_xmit(skb, dev, txq, xmit_more) == NETDEV_TX_OK)
-		   				sent++;
-				}
+			skb = pfq_rx_pool_skb_share(skb, PFQ_CB(skb)->log->xmit_todo-- > 1);
+			if (skb) {
+				skb_set_queue_mapping(skb, queue);
+				if (__pfq_xmit(skb, list->dev, txq, xmit_more) == NETDEV_TX_OK)
+					sent++;
 			}
-
 		}
 
-		if (txq)
-			__netif_tx_unlock_bh(txq);
+		__netif_tx_unlock_bh(txq);
 	}
 
 	return sent;
 }
-
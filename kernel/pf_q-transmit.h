@@ -30,14 +30,33 @@
 
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
 
 #include <pf_q-skbuff-batch.h>
 #include <pf_q-sock.h>
 #include <pf_q-module.h>
 #include <pf_q-GC.h>
+#include <pf_q-tx-zcopy.h>
 
 
-extern int __pfq_queue_flush(size_t index, struct pfq_tx_opt *to, struct net_device *dev, int cpu, int node);
+static inline u16
+__pfq_dev_cap_txqueue(struct net_device *dev, u16 hw_queue)
+{
+	if (unlikely(hw_queue >= dev->real_num_tx_queues))
+		return 0;
+
+	return hw_queue;
+}
+
+
+extern int __pfq_queue_flush_txq(size_t index, struct pfq_tx_opt *to, struct net_device *dev, struct netdev_queue *locked, int cpu, int node);
+
+static inline int
+__pfq_queue_flush(size_t index, struct pfq_tx_opt *to, struct net_device *dev, int cpu, int node)
+{
+	return __pfq_queue_flush_txq(index, to, dev, NULL, cpu, node);
+}
 
 static inline int
 pfq_queue_flush(size_t index, struct pfq_tx_opt *to, struct net_device *dev)
@@ -49,6 +68,51 @@ pfq_queue_flush(size_t index, struct pfq_tx_opt *to, struct net_device *dev)
 extern int pfq_queue_flush_or_wakeup(struct pfq_sock *so, int index);
 
 
+/* clock of the paced tx (CLOCK_MONOTONIC, tsc-based on x86) */
+
+static inline u64
+pfq_tx_clock(void)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0))
+	return ktime_get_ns();
+#else
+	return ktime_to_ns(ktime_get());
+#endif
+}
+
+
+/* inter-departure error of a paced packet, with respect to the previous one */
+
+static inline void
+pfq_tx_pace_account(struct pfq_tx_queue_hdr *txq, u64 tstamp, u64 now)
+{
+	if (txq->pace.last_tstamp && tstamp >= txq->pace.last_tstamp) {
+
+		s64 err = (s64)(now - txq->pace.last_departure) - (s64)(tstamp - txq->pace.last_tstamp);
+		u64 jitter = err < 0 ? -err : err;
+
+		txq->pace.stats.jitter += jitter;
+		if (jitter > txq->pace.stats.jitter_max)
+			txq->pace.stats.jitter_max = jitter;
+	}
+
+	txq->pace.last_tstamp    = tstamp;
+	txq->pace.last_departure = now;
+	txq->pace.stats.paced++;
+}
+
+
+/* packets waiting for transmission in the queue */
+
+static inline int
+pfq_tx_queue_avail(struct pfq_tx_opt *to, size_t index)
+{
+	struct pfq_tx_zcopy *zc = to->queue[index].zcopy;
+
+	return zc ? pfq_tx_zcopy_avail(zc) : pfq_spsc_read_avail(pfq_get_tx_queue_hdr(to, index));
+}
+
+
 extern int pfq_queue_xmit(struct pfq_skbuff_batch *skbs, struct net_device *dev, int queue_index);
 extern int pfq_queue_xmit_by_mask(struct pfq_skbuff_batch *skbs, unsigned long long skbs_mask, struct net_device *dev, int queue_index);
 static inline int pfq_xmit(struct sk_buff *skb, struct net_device *dev, int queue_index)
@@ -0,0 +1,443 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/netdevice.h>
+
+#include <pf_q-tx-engine.h>
+#include <pf_q-transmit.h>
+#include <pf_q-netdev.h>
+#include <pf_q-global.h>
+
+
+static DEFINE_MUTEX(pfq_tx_engines_lock);
+
+static struct pfq_tx_engine *pfq_tx_engines[NR_CPUS];
+
+
+/* the Tx queues of the engine with packets to transmit (e->lock held) */
+
+static bool
+pfq_tx_engine_pending(struct pfq_tx_engine *e)
+{
+	struct pfq_tx_group *g;
+	struct pfq_tx_ring *r;
+
+	list_for_each_entry(g, &e->groups, list)
+	{
+		list_for_each_entry(r, &g->rings, list)
+		{
+			if (rcu_access_pointer(r->so->tx_opt.queue[r->index].dev) &&
+			    pfq_tx_queue_avail(&r->so->tx_opt, r->index))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+
+static void
+pfq_tx_engine_set_asleep(struct pfq_tx_engine *e, unsigned int asleep, bool woken)
+{
+	struct pfq_tx_group *g;
+	struct pfq_tx_ring *r;
+
+	list_for_each_entry(g, &e->groups, list)
+	{
+		list_for_each_entry(r, &g->rings, list)
+		{
+			struct pfq_tx_queue_hdr *txq = pfq_get_tx_queue_hdr(&r->so->tx_opt, r->index);
+
+			txq->thread.asleep = asleep;
+			if (woken)
+				txq->thread.stats.wakeup++;
+		}
+	}
+}
+
+
+/* sleep on the doorbell: as the Tx threads do, for all the queues of the engine */
+
+static void
+pfq_tx_engine_sleep(struct pfq_tx_engine *e)
+{
+	bool pending, woken = false;
+
+	atomic_set(&e->kick, 0);
+
+	mutex_lock(&e->lock);
+	pfq_tx_engine_set_asleep(e, 1, false);
+	smp_mb();
+	pending = pfq_tx_engine_pending(e);
+	mutex_unlock(&e->lock);
+
+	/* a doorbell rung after the check sets the kick flag */
+
+	if (!pending) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!atomic_xchg(&e->kick, 0) && !kthread_should_stop()) {
+			schedule();
+			woken = true;
+		}
+		__set_current_state(TASK_RUNNING);
+	}
+
+	mutex_lock(&e->lock);
+	pfq_tx_engine_set_asleep(e, 0, woken);
+	mutex_unlock(&e->lock);
+}
+
+
+static int
+pfq_tx_engine_flush_ring(struct pfq_tx_ring *r, struct net_device *dev, struct netdev_queue *locked, int cpu, int node)
+{
+	struct pfq_tx_queue_hdr *txq = pfq_get_tx_queue_hdr(&r->so->tx_opt, r->index);
+	int sent = __pfq_queue_flush_txq(r->index, &r->so->tx_opt, dev, locked, cpu, node);
+
+	if (sent)
+		txq->thread.stats.busy++;
+	else
+		txq->thread.stats.idle++;
+
+	return sent;
+}
+
+
+/* a pass over the queues of a group: those bound to the same netdev queue
+ * are flushed under a single lock, the others one by one */
+
+static int
+pfq_tx_engine_flush_group(struct pfq_tx_group *g, int cpu, int node)
+{
+	struct netdev_queue *locked = NULL;
+	struct net_device *dev = NULL;
+	struct pfq_tx_ring *r;
+	int sent = 0, rebound = 0;
+
+	list_for_each_entry(r, &g->rings, list)
+	{
+		struct net_device *rdev;
+
+		if (!pfq_tx_queue_avail(&r->so->tx_opt, r->index))
+			continue;
+
+		rdev = pfq_netdev_get(&r->so->tx_opt.queue[r->index].dev);
+		if (rdev == NULL)
+			continue;
+
+		/* the first queue with packets locks the netdev queue of the group */
+
+		if (g->hw_queue >= 0 && locked == NULL) {
+			dev = rdev;
+			dev_hold(dev);
+			locked = netdev_get_tx_queue(dev, __pfq_dev_cap_txqueue(dev, g->hw_queue));
+			__netif_tx_lock_bh(locked);
+		}
+
+		if (locked && rdev == dev)
+			sent += pfq_tx_engine_flush_ring(r, rdev, locked, cpu, node);
+		else if (!locked)
+			sent += pfq_tx_engine_flush_ring(r, rdev, NULL, cpu, node);
+		else
+			rebound++;
+
+		dev_put(rdev);
+	}
+
+	if (locked) {
+		__netif_tx_unlock_bh(locked);
+
+		/* queues rebound to another device are flushed one by one, after
+		 * the unlock, so that they are not starved by the first queue */
+
+		if (rebound) {
+			list_for_each_entry(r, &g->rings, list)
+			{
+				struct net_device *rdev;
+
+				if (!pfq_tx_queue_avail(&r->so->tx_opt, r->index))
+					continue;
+
+				rdev = pfq_netdev_get(&r->so->tx_opt.queue[r->index].dev);
+				if (rdev == NULL)
+					continue;
+
+				if (rdev != dev)
+					sent += pfq_tx_engine_flush_ring(r, rdev, NULL, cpu, node);
+
+				dev_put(rdev);
+			}
+		}
+
+		dev_put(dev);
+	}
+
+	return sent;
+}
+
+
+static int
+pfq_tx_engine_thread(void *data)
+{
+	struct pfq_tx_engine *e = (struct pfq_tx_engine *)data;
+	int cpu = smp_processor_id();
+	int node = cpu_to_node(cpu);
+	u64 idle_since = 0;
+
+       	printk(KERN_INFO "[PFQ] TX engine started on cpu %d.\n", cpu);
+
+	__set_current_state(TASK_RUNNING);
+
+	for(;;)
+	{
+		struct pfq_tx_group *g;
+		int sent = 0;
+
+		mutex_lock(&e->lock);
+
+		list_for_each_entry(g, &e->groups, list)
+			sent += pfq_tx_engine_flush_group(g, cpu, node);
+
+		mutex_unlock(&e->lock);
+
+		/* adaptive: poll the empty queues up to tx_idle usec, then sleep */
+
+		if (sent)
+			idle_since = 0;
+		else if (tx_idle >= 0) {
+			u64 now = local_clock();
+
+			if (!idle_since)
+				idle_since = now;
+			else if (now - idle_since >= (u64)tx_idle * 1000) {
+				pfq_tx_engine_sleep(e);
+				idle_since = 0;
+			}
+		}
+
+		if (kthread_should_stop())
+			break;
+
+		if (need_resched())
+			schedule();
+		else
+			cpu_relax();
+	}
+
+       	printk(KERN_INFO "[PFQ] TX engine stopped on cpu %d.\n", cpu);
+	return 0;
+}
+
+
+static struct pfq_tx_engine *
+pfq_tx_engine_create(int cpu)
+{
+	struct pfq_tx_engine *e;
+
+	e = kzalloc_node(sizeof(struct pfq_tx_engine), GFP_KERNEL, cpu_to_node(cpu));
+	if (e == NULL)
+		return NULL;
+
+	mutex_init(&e->lock);
+	INIT_LIST_HEAD(&e->groups);
+	atomic_set(&e->kick, 0);
+	e->cpu = cpu;
+
+	e->task = kthread_create_on_node(pfq_tx_engine_thread, e, cpu_to_node(cpu), "pfq_tx_engine/%d", cpu);
+	if (IS_ERR(e->task)) {
+		printk(KERN_INFO "[PFQ] TX engine: create failed on cpu %d!\n", cpu);
+		kfree(e);
+		return NULL;
+	}
+
+	kthread_bind(e->task, cpu);
+	wake_up_process(e->task);
+
+	return e;
+}
+
+
+/* any cpu: the engine with fewer queues (the current cpu, if none is running) */
+
+static int
+pfq_tx_engine_pick_cpu(void)
+{
+	int cpu, ret = -1;
+
+	for_each_online_cpu(cpu)
+	{
+		struct pfq_tx_engine *e = pfq_tx_engines[cpu];
+		if (e && (ret == -1 || e->num_rings < pfq_tx_engines[ret]->num_rings))
+			ret = cpu;
+	}
+
+	return ret == -1 ? raw_smp_processor_id() : ret;
+}
+
+
+int
+pfq_tx_engine_attach(struct pfq_sock *so, size_t index, int cpu)
+{
+	struct pfq_tx_queue_info *info = &so->tx_opt.queue[index];
+	struct pfq_tx_engine *e;
+	struct pfq_tx_group *g;
+	struct pfq_tx_ring *r;
+	int err = 0;
+
+	r = kzalloc(sizeof(struct pfq_tx_ring), GFP_KERNEL);
+	if (r == NULL)
+		return -ENOMEM;
+
+	r->so    = so;
+	r->index = index;
+
+	mutex_lock(&pfq_tx_engines_lock);
+
+	if (cpu == Q_ANY_CPU)
+		cpu = pfq_tx_engine_pick_cpu();
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	e = pfq_tx_engines[cpu];
+	if (e == NULL) {
+		e = pfq_tx_engine_create(cpu);
+		if (e == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+		pfq_tx_engines[cpu] = e;
+	}
+
+	mutex_lock(&e->lock);
+
+	list_for_each_entry(g, &e->groups, list)
+	{
+		if (g->if_index == info->if_index && g->hw_queue == info->hw_queue)
+			goto found;
+	}
+
+	g = kzalloc(sizeof(struct pfq_tx_group), GFP_KERNEL);
+	if (g == NULL) {
+		mutex_unlock(&e->lock);
+		err = -ENOMEM;
+		goto out;
+	}
+
+	g->if_index = info->if_index;
+	g->hw_queue = info->hw_queue;
+	INIT_LIST_HEAD(&g->rings);
+	list_add_tail(&g->list, &e->groups);
+found:
+	list_add_tail(&r->list, &g->rings);
+	e->num_rings++;
+
+	mutex_unlock(&e->lock);
+
+	info->engine = e;
+
+	pr_devel("[PFQ|%d] TX[%zu] attached to the engine on cpu %d (%zu queues).\n", so->id, index, cpu, e->num_rings);
+out:
+	mutex_unlock(&pfq_tx_engines_lock);
+
+	if (err) {
+		kfree(r);
+		return err;
+	}
+
+	/* the engine may be asleep: the doorbell of this queue was not armed */
+
+	pfq_tx_engine_wakeup(e);
+	return 0;
+}
+
+
+void
+pfq_tx_engine_detach(struct pfq_sock *so, size_t index)
+{
+	struct pfq_tx_engine *e = so->tx_opt.queue[index].engine;
+	struct pfq_tx_group *g, *gtmp;
+	struct pfq_tx_ring *r, *rtmp;
+
+	if (e == NULL)
+		return;
+
+	/* the engine does not touch the queue after this */
+
+	mutex_lock(&e->lock);
+
+	list_for_each_entry_safe(g, gtmp, &e->groups, list)
+	{
+		list_for_each_entry_safe(r, rtmp, &g->rings, list)
+		{
+			if (r->so == so && r->index == index) {
+				list_del(&r->list);
+				kfree(r);
+				e->num_rings--;
+			}
+		}
+
+		if (list_empty(&g->rings)) {
+			list_del(&g->list);
+			kfree(g);
+		}
+	}
+
+	mutex_unlock(&e->lock);
+
+	so->tx_opt.queue[index].engine = NULL;
+
+	pr_devel("[PFQ|%d] TX[%zu] detached from the engine on cpu %d.\n", so->id, index, e->cpu);
+}
+
+
+/* stop the engines (no socket is attached when the module is unloaded) */
+
+void
+pfq_tx_engine_fini(void)
+{
+	int cpu;
+
+	mutex_lock(&pfq_tx_engines_lock);
+
+	for(cpu = 0; cpu < NR_CPUS; cpu++)
+	{
+		struct pfq_tx_engine *e = pfq_tx_engines[cpu];
+		if (e == NULL)
+			continue;
+
+		kthread_stop(e->task);
+		kfree(e);
+		pfq_tx_engines[cpu] = NULL;
+	}
+
+	mutex_unlock(&pfq_tx_engines_lock);
+}
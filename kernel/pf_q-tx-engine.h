@@ -0,0 +1,87 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+
+#ifndef PF_Q_TX_ENGINE_H
+#define PF_Q_TX_ENGINE_H
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+
+#include <pf_q-sock.h>
+
+
+/*
+ * Tx engines: a kernel thread per core, shared by the sockets that attach
+ * their Tx queues to it (instead of starting a thread per queue). The queues
+ * are grouped by (device, hw queue), so that the lock of a netdev queue is
+ * taken once per pass for all the queues transmitting to it.
+ */
+
+struct pfq_tx_ring
+{
+	struct list_head	 list;
+	struct pfq_sock		*so;
+	size_t			 index;		/* Tx queue of the socket */
+};
+
+
+struct pfq_tx_group
+{
+	struct list_head	 list;
+	int			 if_index;
+	int			 hw_queue;
+	struct list_head	 rings;
+};
+
+
+struct pfq_tx_engine
+{
+	struct mutex		 lock;		/* groups and rings */
+	struct list_head	 groups;
+	size_t			 num_rings;
+
+	struct task_struct	*task;
+	int			 cpu;
+	atomic_t		 kick;		/* doorbell rung while going to sleep */
+};
+
+
+extern void pfq_tx_engine_fini(void);
+
+extern int  pfq_tx_engine_attach(struct pfq_sock *so, size_t index, int cpu);
+extern void pfq_tx_engine_detach(struct pfq_sock *so, size_t index);
+
+
+static inline void
+pfq_tx_engine_wakeup(struct pfq_tx_engine *e)
+{
+	atomic_set(&e->kick, 1);
+	wake_up_process(e->task);
+}
+
+
+#endif /* PF_Q_TX_ENGINE_H */
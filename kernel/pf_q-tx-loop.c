@@ -0,0 +1,233 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <net/ip.h>
+#include <net/checksum.h>
+
+#include <pf_q-tx-loop.h>
+
+
+/* the request of user space: the loop is started (or stopped) by the consumer */
+
+int
+pfq_tx_loop_request(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq, struct pfq_tx_loop const *conf)
+{
+	if (conf->count == 0) {
+		atomic_set(&loop->ctl, PFQ_TX_LOOP_STOP);
+		return 0;
+	}
+
+	if (conf->slots == 0 || conf->slots >= txq->size) {
+		pr_devel("[PFQ] Tx loop: bad slots %u (queue size %u)!\n", conf->slots, txq->size);
+		return -EINVAL;
+	}
+
+	if (((conf->flags & Q_TX_LOOP_SADDR) && !conf->saddr_range) ||
+	    ((conf->flags & Q_TX_LOOP_DADDR) && !conf->daddr_range) ||
+	    ((conf->flags & Q_TX_LOOP_SPORT) && !conf->sport_range) ||
+	    ((conf->flags & Q_TX_LOOP_DPORT) && !conf->dport_range)) {
+		pr_devel("[PFQ] Tx loop: bad range!\n");
+		return -EINVAL;
+	}
+
+	/* one loop at a time: the staged configuration is not in use until it ends */
+
+	if (atomic_cmpxchg(&loop->active, 0, 1) != 0)
+		return -EBUSY;
+
+	loop->staged = *conf;
+
+	txq->loop.iter = 0;
+	txq->loop.active = 1;
+
+	smp_wmb();
+
+	atomic_set(&loop->ctl, PFQ_TX_LOOP_START);
+	return 0;
+}
+
+
+/* release the slots of the loop to user space */
+
+static void
+pfq_tx_loop_end(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq)
+{
+	if (loop->len) {
+
+		smp_wmb();
+
+		txq->consumer.index = (txq->consumer.index + loop->len) & txq->size_mask;
+		txq->consumer.cache = 0;
+
+		smp_wmb();
+
+		pr_devel("[PFQ] Tx loop: %llu iterations of %u slots.\n", loop->iter, loop->len);
+	}
+
+	loop->want = 0;
+	loop->len  = 0;
+	loop->slot = 0;
+}
+
+
+static void
+pfq_tx_loop_deactivate(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq)
+{
+	txq->loop.active = 0;
+	smp_wmb();
+	atomic_set(&loop->active, 0);
+}
+
+
+int
+__pfq_tx_loop_check(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq)
+{
+	int ctl = atomic_xchg(&loop->ctl, 0);
+
+	if (ctl) {
+		smp_rmb();
+
+		pfq_tx_loop_end(loop, txq);
+
+		if (ctl == PFQ_TX_LOOP_START) {
+			loop->conf = loop->staged;
+			loop->want = loop->conf.slots;
+			loop->iter = 0;
+		}
+		else
+			pfq_tx_loop_deactivate(loop, txq);
+	}
+
+	/* wait for the slots of the loop (the cache of the consumer is not used) */
+
+	if (loop->want) {
+
+		unsigned int avail = (txq->producer.index - txq->consumer.index + txq->size) & txq->size_mask;
+		smp_rmb();
+
+		if (avail < loop->want)
+			return PFQ_TX_LOOP_WAIT;
+
+		loop->len  = loop->want;
+		loop->want = 0;
+	}
+
+	return loop->len ? PFQ_TX_LOOP_RUN : PFQ_TX_LOOP_OFF;
+}
+
+
+/* n packets of the loop transmitted (in order) */
+
+void
+pfq_tx_loop_commit_n(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq, unsigned int n)
+{
+	if (unlikely(!loop->len))
+		return;
+
+	loop->slot += n;
+	loop->iter += loop->slot / loop->len;
+	loop->slot %= loop->len;
+
+	txq->loop.iter = loop->iter;
+
+	if (loop->conf.count > 0 && loop->iter >= (unsigned long long)loop->conf.count) {
+		pfq_tx_loop_end(loop, txq);
+		pfq_tx_loop_deactivate(loop, txq);
+	}
+}
+
+
+/* rewrite the IPv4/UDP fields of the packet, and update the checksums */
+
+void
+pfq_tx_loop_rewrite(struct pfq_tx_loop const *conf, struct sk_buff *skb, u32 seq)
+{
+	struct udphdr *udp = NULL;
+	struct iphdr *ip;
+	bool udp_csum;
+	__be32 addr;
+	__be16 port;
+
+	if (skb->len < ETH_HLEN + sizeof(struct iphdr) ||
+	    ((struct ethhdr *)skb->data)->h_proto != htons(ETH_P_IP))
+		return;
+
+	ip = (struct iphdr *)(skb->data + ETH_HLEN);
+
+	if (ip->version != 4 || ip->ihl < 5 || skb->len < ETH_HLEN + ip->ihl * 4)
+		return;
+
+	if (ip->protocol == IPPROTO_UDP && !(ip->frag_off & htons(IP_OFFSET)) &&
+	    skb->len >= ETH_HLEN + ip->ihl * 4 + sizeof(struct udphdr))
+		udp = (struct udphdr *)((u8 *)ip + ip->ihl * 4);
+
+	udp_csum = udp && udp->check;
+
+	if (conf->flags & Q_TX_LOOP_IP_ID)
+		ip->id = htons(ntohs(ip->id) + (u16)seq);
+
+	/* the addresses are in the pseudo header of the udp checksum */
+
+	if (conf->flags & Q_TX_LOOP_SADDR) {
+		addr = htonl(conf->saddr + seq % conf->saddr_range);
+		if (udp_csum)
+			csum_replace4(&udp->check, ip->saddr, addr);
+		ip->saddr = addr;
+	}
+
+	if (conf->flags & Q_TX_LOOP_DADDR) {
+		addr = htonl(conf->daddr + seq % conf->daddr_range);
+		if (udp_csum)
+			csum_replace4(&udp->check, ip->daddr, addr);
+		ip->daddr = addr;
+	}
+
+	if (udp) {
+		if (conf->flags & Q_TX_LOOP_SPORT) {
+			port = htons((u16)(conf->sport + seq % conf->sport_range));
+			if (udp_csum)
+				csum_replace2(&udp->check, udp->source, port);
+			udp->source = port;
+		}
+
+		if (conf->flags & Q_TX_LOOP_DPORT) {
+			port = htons((u16)(conf->dport + seq % conf->dport_range));
+			if (udp_csum)
+				csum_replace2(&udp->check, udp->dest, port);
+			udp->dest = port;
+		}
+
+		if (udp_csum && !udp->check)
+			udp->check = CSUM_MANGLED_0;
+	}
+
+	ip_send_check(ip);
+}
@@ -0,0 +1,150 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+
+#ifndef PF_Q_TX_LOOP_H
+#define PF_Q_TX_LOOP_H
+
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/atomic.h>
+#include <linux/pf_q.h>
+
+#include <pf_q-macro.h>
+
+
+/*
+ * Tx loop: the slots of a Tx queue are transmitted repeatedly, without
+ * being released to user space until the loop ends. The request (sockopt)
+ * is taken by the consumer of the queue (the Tx thread, the engine or the
+ * flush), which owns the state of the loop; it waits until the slots of the
+ * loop are enqueued, then transmits them in passes of at most a queue size.
+ *
+ * The configuration of a request is staged, and copied by the consumer when
+ * it takes the START. The loop is active from the request to its end: this
+ * state is kept here, the queue header (user-writable) only mirrors it.
+ */
+
+#define PFQ_TX_LOOP_OFF		0
+#define PFQ_TX_LOOP_WAIT	1	/* waiting for the slots */
+#define PFQ_TX_LOOP_RUN		2
+
+#define PFQ_TX_LOOP_START	1
+#define PFQ_TX_LOOP_STOP	2
+
+
+struct pfq_tx_loop_state
+{
+	struct pfq_tx_loop	conf;		/* owned by the consumer */
+	struct pfq_tx_loop	staged;		/* the request, taken with START */
+	atomic_t		ctl;		/* request to the consumer (START/STOP) */
+	atomic_t		active;
+
+	unsigned int		want;		/* slots to wait for */
+	unsigned int		len;		/* slots looped (0 = no loop) */
+	unsigned int		slot;		/* next slot to transmit */
+	unsigned long long	iter;		/* iterations completed */
+};
+
+
+struct pfq_tx_loop_cursor
+{
+	unsigned int		slot;
+	unsigned long long	iter;
+};
+
+
+extern int  pfq_tx_loop_request(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq, struct pfq_tx_loop const *conf);
+extern int  __pfq_tx_loop_check(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq);
+extern void pfq_tx_loop_commit_n(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq, unsigned int n);
+extern void pfq_tx_loop_rewrite(struct pfq_tx_loop const *conf, struct sk_buff *skb, u32 seq);
+
+
+static inline void
+pfq_tx_loop_init(struct pfq_tx_loop_state *loop)
+{
+	memset(loop, 0, sizeof(*loop));
+	atomic_set(&loop->ctl, 0);
+	atomic_set(&loop->active, 0);
+}
+
+
+/* the state of the loop, after the pending request is taken */
+
+static inline int
+pfq_tx_loop_check(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq)
+{
+	if (likely(!atomic_read(&loop->ctl) && !loop->want && !loop->len))
+		return PFQ_TX_LOOP_OFF;
+
+	return __pfq_tx_loop_check(loop, txq);
+}
+
+
+/* the packets of this pass: at most a queue size, up to the end of the loop */
+
+static inline int
+pfq_tx_loop_pass(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq, struct pfq_tx_loop_cursor *cur)
+{
+	unsigned long long left;
+
+	cur->slot = loop->slot;
+	cur->iter = loop->iter;
+
+	if (loop->conf.count < 0)
+		return (int)txq->size;
+
+	left = ((unsigned long long)loop->conf.count - loop->iter) * loop->len - loop->slot;
+
+	return (int)min_t(unsigned long long, left, txq->size);
+}
+
+
+/* the slot index of the cursor */
+
+static inline int
+pfq_tx_loop_index(struct pfq_tx_loop_state *loop, struct pfq_tx_queue_hdr *txq, struct pfq_tx_loop_cursor const *cur)
+{
+	return (int)((txq->consumer.index + cur->slot) & txq->size_mask);
+}
+
+
+static inline u32
+pfq_tx_loop_seq(struct pfq_tx_loop_state *loop, struct pfq_tx_loop_cursor const *cur)
+{
+	return (u32)(cur->iter * loop->len + cur->slot);
+}
+
+
+static inline void
+pfq_tx_loop_next(struct pfq_tx_loop_state *loop, struct pfq_tx_loop_cursor *cur)
+{
+	if (++cur->slot == loop->len) {
+		cur->slot = 0;
+		cur->iter++;
+	}
+}
+
+
+#endif /* PF_Q_TX_LOOP_H */
@@ -0,0 +1,246 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+
+#include <pf_q-tx-zcopy.h>
+#include <pf_q-memory.h>
+
+
+/* the last skb of a disabled queue is completed */
+
+static void
+pfq_tx_zcopy_free(struct work_struct *work)
+{
+	struct pfq_tx_zcopy *zc = container_of(work, struct pfq_tx_zcopy, work);
+
+	pfq_tx_zcopy_shmem_put(zc->shmem);
+	vfree(zc);
+}
+
+
+/* completion of an skb: release the slots completed in order */
+
+static void
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0))
+pfq_tx_zcopy_complete(struct ubuf_info *ubuf, bool success)
+#else
+pfq_tx_zcopy_complete(struct ubuf_info *ubuf)
+#endif
+{
+	struct pfq_tx_zcopy *zc = ubuf->ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&zc->lock, flags);
+
+	__set_bit(ubuf->desc, zc->done);
+
+	while (test_bit(zc->consumer, zc->done))
+	{
+		__clear_bit(zc->consumer, zc->done);
+		zc->consumer = pfq_tx_zcopy_next(zc, zc->consumer);
+	}
+
+	zc->txq->consumer.index = zc->consumer;
+
+	spin_unlock_irqrestore(&zc->lock, flags);
+
+	/* the queue is disabled: vfree and the release of the shared memory
+	 * are deferred to process context */
+
+	if (atomic_dec_and_test(&zc->inflight))
+		schedule_work(&zc->work);
+}
+
+
+struct pfq_tx_zcopy *
+pfq_tx_zcopy_create(struct pfq_tx_queue_hdr *txq)
+{
+	struct pfq_tx_zcopy *zc;
+	size_t n;
+
+	zc = vzalloc(sizeof(struct pfq_tx_zcopy) + txq->size * sizeof(struct ubuf_info) + BITS_TO_LONGS(txq->size) * sizeof(long));
+	if (!zc) {
+		printk(KERN_WARNING "[PFQ] zero-copy tx: out of memory!\n");
+		return NULL;
+	}
+
+	spin_lock_init(&zc->lock);
+
+	zc->txq       = txq;
+	zc->size_mask = txq->size_mask;
+	zc->next      = txq->consumer.index & zc->size_mask;
+	zc->consumer  = zc->next;
+	zc->done      = (unsigned long *)(zc->ubuf + txq->size);
+
+	atomic_set(&zc->inflight, 1);
+	INIT_WORK(&zc->work, pfq_tx_zcopy_free);
+
+	for(n = 0; n < txq->size; n++)
+	{
+		zc->ubuf[n].callback = pfq_tx_zcopy_complete;
+		zc->ubuf[n].ctx      = zc;
+		zc->ubuf[n].desc     = n;
+	}
+
+	return zc;
+}
+
+
+/* a queue that has not transmitted any packet */
+
+void
+pfq_tx_zcopy_destroy(struct pfq_tx_zcopy *zc)
+{
+	vfree(zc);
+}
+
+
+/* take over the shared memory of a socket being disabled (the descriptor is
+ * cleared, the requested node is kept) */
+
+struct pfq_tx_zcopy_shmem *
+pfq_tx_zcopy_shmem_get(struct pfq_shmem_descr *shmem)
+{
+	struct pfq_tx_zcopy_shmem *zs = kmalloc(sizeof(struct pfq_tx_zcopy_shmem), GFP_KERNEL | __GFP_NOFAIL);
+
+	zs->descr = *shmem;
+	atomic_set(&zs->users, 1);
+
+	shmem->addr      = NULL;
+	shmem->size      = 0;
+	shmem->hugepages = NULL;
+	shmem->npages    = 0;
+	shmem->chunks    = NULL;
+	shmem->nchunks   = 0;
+
+	return zs;
+}
+
+
+void
+pfq_tx_zcopy_shmem_put(struct pfq_tx_zcopy_shmem *zs)
+{
+	if (atomic_dec_and_test(&zs->users)) {
+		pfq_shared_memory_free(&zs->descr);
+		kfree(zs);
+	}
+}
+
+
+/* the skbs still queued to the driver reference the ubuf_info and the slots:
+ * the queue (and the shared memory) is freed by the last completion */
+
+void
+pfq_tx_zcopy_disable(struct pfq_tx_zcopy *zc, struct pfq_tx_zcopy_shmem *zs)
+{
+	atomic_inc(&zs->users);
+	zc->shmem = zs;
+
+	if (atomic_dec_and_test(&zc->inflight))
+		pfq_tx_zcopy_free(&zc->work);
+	else
+		pr_devel("[PFQ] zero-copy tx: skbs in flight, shared memory released on completion.\n");
+}
+
+
+/* the fragments of a slot must fit the skb */
+
+bool
+pfq_tx_zcopy_maxlen(size_t maxlen)
+{
+	return maxlen <= PFQ_TX_ZCOPY_HEAD + (MAX_SKB_FRAGS - 1) * PAGE_SIZE;
+}
+
+
+static inline struct page *
+pfq_tx_zcopy_page(const char *addr)
+{
+	return is_vmalloc_addr(addr) ? vmalloc_to_page(addr) : virt_to_page(addr);
+}
+
+
+struct sk_buff *
+pfq_tx_zcopy_skb(struct pfq_tx_zcopy *zc, unsigned int index, const char *data, size_t len, gfp_t gfp, int node)
+{
+	size_t head = min_t(size_t, len, PFQ_TX_ZCOPY_HEAD);
+	struct sk_buff *skb;
+	int nr = 0;
+
+	skb = pfq_tx_alloc_skb(PFQ_TX_ZCOPY_HEAD, gfp, node);
+	if (unlikely(skb == NULL))
+		return NULL;
+
+	/* the headers are copied into the linear part... */
+
+	skb_reset_tail_pointer(skb);
+	skb->len = 0;
+	skb_copy_to_linear_data(skb, data, head);
+	__skb_put(skb, head);
+
+	data += head;
+	len  -= head;
+
+	/* ...the payload is referenced in the shared memory */
+
+	while (len)
+	{
+		struct page *page = pfq_tx_zcopy_page(data);
+		unsigned int off  = offset_in_page(data);
+		unsigned int size = min_t(size_t, len, PAGE_SIZE - off);
+
+		get_page(page);
+		skb_fill_page_desc(skb, nr++, page, off, size);
+
+		skb->len      += size;
+		skb->data_len += size;
+		skb->truesize += size;
+
+		data += size;
+		len  -= size;
+	}
+
+	skb_shinfo(skb)->destructor_arg = &zc->ubuf[index];
+	skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+
+	atomic_inc(&zc->inflight);
+	return skb;
+}
+
+
+/* an skb not transmitted: it is freed without releasing the slot, sent again later */
+
+void
+pfq_tx_zcopy_cancel(struct pfq_tx_zcopy *zc, struct sk_buff *skb)
+{
+	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
+		skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
+		atomic_dec(&zc->inflight);
+	}
+}
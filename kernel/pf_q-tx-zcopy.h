@@ -0,0 +1,121 @@
+/***************************************************************
+ *
+ * (C) 2014 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+
+#ifndef PF_Q_TX_ZCOPY_H
+#define PF_Q_TX_ZCOPY_H
+
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/skbuff.h>
+#include <linux/workqueue.h>
+#include <linux/pf_q.h>
+
+#include <pf_q-macro.h>
+#include <pf_q-shmem.h>
+
+
+/*
+ * Zero-copy tx: the skb built for a slot of a tx queue references the
+ * payload in the shared memory (page fragments); only the first bytes (the
+ * headers) are copied into the linear part. The slot is released to user
+ * space when the skb is completed by the driver (ubuf_info callback): in
+ * zero-copy mode the consumer index of the queue is the completion index.
+ * Slots completed out of order are held until the previous ones complete.
+ *
+ * The cursors live in the kernel, the queue header (user-writable) only
+ * mirrors them. When the socket is disabled with skbs still in flight, the
+ * shared memory is freed by the last completion.
+ */
+
+#define PFQ_TX_ZCOPY_HEAD	64		/* bytes copied into the linear part */
+
+
+/* the shared memory of a disabled socket, until the last skb completes */
+
+struct pfq_tx_zcopy_shmem
+{
+	struct pfq_shmem_descr	descr;
+	atomic_t		users;		/* the socket and the queues with skbs in flight */
+};
+
+
+struct pfq_tx_zcopy
+{
+	spinlock_t		lock;
+
+	struct pfq_tx_queue_hdr *txq;
+	unsigned int		size_mask;
+	unsigned int		next;		/* next slot to transmit */
+	unsigned int		consumer;	/* completion cursor, published to txq->consumer.index */
+
+	atomic_t		inflight;	/* skbs not completed yet, +1 while enabled */
+	unsigned long	       *done;		/* slots completed out of order */
+
+	struct pfq_tx_zcopy_shmem *shmem;	/* set when disabled */
+	struct work_struct	work;
+
+	struct ubuf_info	ubuf[0];	/* one per slot */
+};
+
+
+extern struct pfq_tx_zcopy *pfq_tx_zcopy_create(struct pfq_tx_queue_hdr *txq);
+extern void pfq_tx_zcopy_destroy(struct pfq_tx_zcopy *zc);
+
+extern struct pfq_tx_zcopy_shmem *pfq_tx_zcopy_shmem_get(struct pfq_shmem_descr *shmem);
+extern void pfq_tx_zcopy_shmem_put(struct pfq_tx_zcopy_shmem *zs);
+extern void pfq_tx_zcopy_disable(struct pfq_tx_zcopy *zc, struct pfq_tx_zcopy_shmem *zs);
+
+extern bool pfq_tx_zcopy_maxlen(size_t maxlen);
+
+extern struct sk_buff *pfq_tx_zcopy_skb(struct pfq_tx_zcopy *zc, unsigned int index, const char *data, size_t len, gfp_t gfp, int node);
+extern void pfq_tx_zcopy_cancel(struct pfq_tx_zcopy *zc, struct sk_buff *skb);
+
+
+/* slots to transmit: from the next slot to the producer index */
+
+static inline int
+pfq_tx_zcopy_avail(struct pfq_tx_zcopy *zc)
+{
+	int avail = (zc->txq->producer.index - zc->next) & zc->size_mask;
+	smp_rmb();
+	return avail;
+}
+
+
+static inline unsigned int
+pfq_tx_zcopy_next(struct pfq_tx_zcopy *zc, unsigned int index)
+{
+	return (index + 1) & zc->size_mask;
+}
+
+
+static inline void
+pfq_tx_zcopy_commit_n(struct pfq_tx_zcopy *zc, unsigned int n)
+{
+	zc->next = (zc->next + n) & zc->size_mask;
+}
+
+
+#endif /* PF_Q_TX_ZCOPY_H */
@@ -41,6 +41,7 @@
 #include <linux/vmalloc.h>
 #include <linux/percpu.h>
 #include <linux/bug.h>
+#include <linux/math64.h>
 
 #include <net/sock.h>
 #ifdef CONFIG_INET
@@ -71,6 +72,10 @@
 #include <pf_q-transmit.h>
 #include <pf_q-percpu.h>
 #include <pf_q-GC.h>
+#include <pf_q-hash.h>
+#include <pf_q-rx-pool.h>
+#include <pf_q-netdev.h>
+#include <pf_q-tx-engine.h>
 
 static struct net_proto_family  pfq_family_ops;
 static struct packet_type       pfq_prot_hook;
@@ -92,7 +97,39 @@ module_param(cap_len,         int, 0644);
 module_param(max_len,         int, 0644);
 module_param(max_queue_slots, int, 0644);
 
-module_param(batch_len,       int, 0644);
+/* batch parameters can be changed at runtime: validate them on write */
+
+static int pfq_batch_param_set(const char *val, const struct kernel_param *kp)
+{
+	int n, err;
+
+	err = kstrtoint(val, 0, &n);
+	if (err)
+		return err;
+
+	if (n < 0 || (n == 0 && kp->arg != &batch_latency) ||
+	    (kp->arg == &batch_len && (size_t)n > Q_SKBUFF_SHORT_BATCH))
+		return -EINVAL;
+
+	WRITE_ONCE(*(int *)kp->arg, n);
+	return 0;
+}
+
+static const struct kernel_param_ops pfq_batch_param_ops = {
+	.set = pfq_batch_param_set,
+	.get = param_get_int,
+};
+
+module_param_cb(batch_len,     &pfq_batch_param_ops, &batch_len,     0644);
+module_param_cb(batch_min,     &pfq_batch_param_ops, &batch_min,     0644);
+module_param_cb(batch_latency, &pfq_batch_param_ops, &batch_latency, 0644);
+module_param(flush_timeout,   int, 0644);
+module_param(tx_idle,         int, 0644);
+module_param(tx_pace_window,  int, 0644);
+module_param(vector_eval,     int, 0644);
+module_param(steer_hash,      int, 0444);
+module_param(steer_key,       charp, 0444);
+module_param(steer_consistent, int, 0444);
 
 module_param(skb_pool_size,   int, 0644);
 module_param(vl_untag,        int, 0644);
@@ -107,7 +144,16 @@ MODULE_PARM_DESC(max_len, " Maximum transmission length (bytes)");
 
 MODULE_PARM_DESC(max_queue_slots, " Max Queue slots (default=226144)");
 
-MODULE_PARM_DESC(batch_len, " Batch queue length");
+MODULE_PARM_DESC(batch_len, " Batch queue length (max length with adaptive batching)");
+MODULE_PARM_DESC(batch_min, " Min batch queue length with adaptive batching (default=1)");
+MODULE_PARM_DESC(batch_latency, " Target latency of adaptive batching (usec, default=0 disabled)");
+MODULE_PARM_DESC(flush_timeout, " Max time a packet is held in the batch queue (usec, default=1000)");
+MODULE_PARM_DESC(tx_idle, " Idle polling of Tx threads before sleeping on the doorbell (usec, -1 = always poll, default=100)");
+MODULE_PARM_DESC(tx_pace_window, " Paced Tx: packets due within the window are transmitted in the same batch (nsec, default=2000)");
+MODULE_PARM_DESC(vector_eval, " Run PFQ/lang computations a batch at a time (default=0)");
+MODULE_PARM_DESC(steer_hash, " Steering hash: 0=xor 1=toeplitz 2=xorshift 3=crc32c (default=0)");
+MODULE_PARM_DESC(steer_key, " Toeplitz key, 40 hex bytes (default=6d:5a:..., symmetric)");
+MODULE_PARM_DESC(steer_consistent, " Consistent hashing for steering, only ~1/N flows move when a socket joins/leaves (default=0)");
 
 MODULE_PARM_DESC(vl_untag,  " Enable vlan untagging (default=0)");
 
@@ -197,93 +243,336 @@ void send_to_kernel(struct sk_buff *skb)
 }
 
 
-static int
-pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
+static inline
+void pfq_gc_residency_account(struct local_data *local, struct gc_data *gc)
 {
- 	unsigned long long sock_queue[Q_SKBUFF_SHORT_BATCH];
+	ktime_t now = ktime_get();
+	struct sk_buff *skb;
+	long unsigned n;
 
-        unsigned long group_mask, socket_mask;
+	for_each_skbuff(SKBUFF_BATCH_ADDR(gc->pool), skb, n)
+	{
+		s64 delta = ktime_us_delta(now, PFQ_CB(skb)->enqueue);
+		int slot = delta > 0 ? min_t(int, fls64(delta), Q_GC_RESIDENCY_SLOTS-1) : 0;
 
-	struct local_data * local;
-        struct gc_data *gcollector;
+		local->gc_residency[slot]++;
+	}
+}
 
-        long unsigned n, bit, lb;
-        struct pfq_monad monad;
-	struct gc_buff buff;
-	size_t this_batch_len;
-        int cpu;
 
-#ifdef PFQ_RX_PROFILE
-	cycles_t start, stop;
-#endif
+/*
+ * Adaptive batching: choose the largest batch whose latency, that is the time
+ * spent waiting for the batch to fill up plus the time spent to process it,
+ * does not exceed the target: (len-1) * arrival + len * cost <= batch_latency.
+ */
 
-#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0))
-	BUILD_BUG_ON_MSG(Q_SKBUFF_SHORT_BATCH > (sizeof(sock_queue[0]) << 3), "skbuff batch overflow");
+static inline
+int pfq_batch_len_adapt(struct local_data *local)
+{
+	u64 target = (u64)READ_ONCE(batch_latency) * 1000;
+	u64 len = div64_u64(target + local->arrival_ns, local->arrival_ns + local->cost_ns + 1);
+	int hi = READ_ONCE(batch_len), lo = min(READ_ONCE(batch_min), hi);
+
+	return (int)clamp_t(u64, len, lo, hi);
+}
+
+
+static inline
+void pfq_batch_account(struct local_data *local, ktime_t start, size_t this_batch_len)
+{
+	ktime_t now = ktime_get();
+	u64 cost = ktime_to_ns(ktime_sub(now, start));
+	s64 window;
+
+	local->cost_ns = (local->cost_ns * 7 + div64_u64(cost, this_batch_len)) >> 3;
+
+	window = ktime_to_ns(ktime_sub(now, local->batch_ts));
+	if (window < Q_BATCH_WINDOW)
+		return;
+
+	local->arrival_ns = (local->arrival_ns * 7 + div64_u64(window, max(local->batch_pkts, 1UL))) >> 3;
+	local->batch_pkts = 0;
+	local->batch_ts   = now;
+
+	local->batch_len  = pfq_batch_len_adapt(local);
+}
+
+
+/* check the bp and vlan filters of a group: false if the packet is dropped */
+
+static inline
+bool pfq_group_filter(struct pfq_group *this_group, int gid, struct gc_buff buff,
+		      bool bf_filter_enabled, bool vlan_filter_enabled, int cpu)
+{
+	/* check for bp filter */
+
+	if (bf_filter_enabled) {
+
+		struct sk_filter *bpf = (struct sk_filter *)atomic_long_read(&this_group->bp_filter);
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,15,0))
+		if (bpf && !sk_run_filter(buff.skb, bpf->insns))
+#else
+		if (bpf && !SK_RUN_FILTER(bpf, buff.skb))
 #endif
+		{
+			__sparse_inc(&this_group->stats.drop, cpu);
+			return false;
+		}
+	}
 
-	/* if no socket is open, drop the packet now */
+	/* check vlan filter */
 
-        if (pfq_get_sock_count() == 0) {
-        	kfree_skb(skb);
-               	return 0;
+	if (vlan_filter_enabled) {
+
+		if (!__pfq_check_group_vlan_filter(gid, buff.skb->vlan_tci & ~VLAN_TAG_PRESENT)) {
+			__sparse_inc(&this_group->stats.drop, cpu);
+			return false;
+		}
 	}
 
-	/* if required, timestamp the packet now */
+	return true;
+}
 
-        if (skb->tstamp.tv64 == 0)
-                __net_timestamp(skb);
 
-        /* if vlan header is present, remove it */
+/* capture length of the packet for this group: set by the computation (snap),
+ * or the largest one of the classes the packet is delivered to (0 = caplen) */
 
-        if (vl_untag && skb->protocol == cpu_to_be16(ETH_P_8021Q)) {
-                skb = pfq_vlan_untag(skb);
-                if (unlikely(!skb)) {
-			sparse_inc(&global_stats.lost);
-                        return -1;
-		}
-        }
+static inline
+void pfq_group_snaplen(struct pfq_group *this_group, struct sk_buff *skb, unsigned long class_mask)
+{
+	unsigned int snaplen = 0;
+	unsigned long cbit;
 
-        skb_reset_mac_len(skb);
+	if (likely(!this_group->snaplen_set) || PFQ_CB(skb)->snaplen)
+		return;
 
-        /* push the mac header: reset skb->data to the beginning of the packet */
+	pfq_bitwise_foreach(class_mask, cbit,
+	{
+		unsigned int len = this_group->snaplen[pfq_ctz(cbit)];
+		if (len == 0)
+			return;
+		snaplen = max(snaplen, len);
+	})
 
-        if (likely(skb->pkt_type != PACKET_OUTGOING)) {
-            skb_push(skb, skb->mac_len);
-        }
+	PFQ_CB(skb)->snaplen = snaplen;
+}
 
-	/* get the cpu */
 
-        cpu = get_cpu();
+/* compute the mask of sockets the packet is delivered to, according to the fanout */
 
-	local = per_cpu_ptr(cpu_data, cpu);
+static inline
+unsigned long pfq_fanout_sock_mask(struct local_data *local, struct pfq_group *this_group, fanout_t const *fanout)
+{
+	unsigned long cbit, eligible_mask = 0;
 
-	gcollector = &local->gc;
+	/* compute the eligible mask of sockets enabled for this packet... */
 
-	/* set the ownership of this skb to the garbage collector */
+	pfq_bitwise_foreach(fanout->class_mask, cbit,
+	{
+		int class = pfq_ctz(cbit);
+		eligible_mask |= atomic_long_read(&this_group->sock_mask[class]);
+	})
+
+	if (is_steering(*fanout)) {
+
+		/* cache the number of sockets in the mask */
+
+		if (unlikely(eligible_mask != local->eligible_mask)) {
+
+			unsigned long ebit;
+
+			local->eligible_mask = eligible_mask;
+			local->sock_cnt = 0;
+
+			pfq_bitwise_foreach(eligible_mask, ebit,
+			{
+				local->sock_mask[local->sock_cnt++] = ebit;
+			})
+		}
+
+		if (likely(local->sock_cnt)) {
+
+			unsigned long sock_mask = 0;
+
+			/* consistent steering: the table of the group is built on join/leave,
+			 * for all its sockets; a socket not eligible for this packet (other
+			 * classes, or a stale table) falls back to the plain steering */
+
+			if (steer_consistent) {
+				struct pfq_group_maglev *mg;
+
+				rcu_read_lock();
+				mg = rcu_dereference(this_group->maglev);
+				if (likely(mg != NULL))
+					sock_mask = (1UL << mg->table[pfq_maglev_slot(fanout->hash)]) & eligible_mask;
+				rcu_read_unlock();
+			}
+
+			if (!sock_mask) {
+				if (steer_hash == Q_STEER_HASH_XOR) {
+					unsigned int h = fanout->hash ^ (fanout->hash >> 8) ^ (fanout->hash >> 16);
+					sock_mask = local->sock_mask[pfq_fold(h, local->sock_cnt)];
+				}
+				else {  /* the hash is already well mixed: scale it to the number of sockets */
+					sock_mask = local->sock_mask[((u64)fanout->hash * local->sock_cnt) >> 32];
+				}
+			}
+
+			local->steer_disp[pfq_ctz(sock_mask)]++;
+			return sock_mask;
+		}
 
-	buff = gc_make_buff(gcollector, skb);
-	if (buff.skb == NULL) {
-		if (printk_ratelimit())
-			printk(KERN_INFO "[PFQ] GC: memory exhausted!\n");
-		__sparse_inc(&global_stats.lost, cpu);
-		kfree_skb(skb);
 		return 0;
 	}
 
-        PFQ_CB(buff.skb)->direct = direct;
+	/* clone or continue ... */
 
-        if ((gc_size(gcollector) < batch_len) &&
-             (ktime_to_ns(ktime_sub(skb_get_ktime(buff.skb), local->last_ts)) < 1000000) )
-        {
-        	put_cpu();
-                return 0;
+	return eligible_mask;
+}
+
+
+/*
+ * Vector evaluation of the computation of a group: every function runs over
+ * all the packets of the batch before moving to the next one. The monads of
+ * the packets are kept in per-cpu arrays, indexed by the position in the GC.
+ * pktref is filled with one entry per packet of the batch, so that the bits
+ * of sock_queue match the indices of pktref.
+ */
+
+static unsigned long
+pfq_receive_group_vector(struct local_data *local, struct pfq_group *this_group, int gid, unsigned long bit,
+			 struct pfq_computation_tree *prg, struct gc_queue_buff *pktref,
+			 unsigned long long *sock_queue, size_t this_batch_len, int cpu)
+{
+        struct gc_data *gcollector = &local->gc;
+
+	bool bf_filter_enabled = atomic_long_read(&this_group->bp_filter);
+	bool vlan_filter_enabled = __pfq_vlan_filters_enabled(gid);
+
+	unsigned long live = 0, done, lb, socket_mask = 0;
+	struct gc_buff buff;
+	long unsigned n;
+
+	pktref->len = this_batch_len;
+
+	for_each_gcbuff(&gcollector->pool, buff, n)
+	{
+		struct pfq_monad *monad;
+
+		if (n == this_batch_len)
+			break;
+
+		pktref->queue[n] = buff;
+
+		/* skip this packet for this group */
+
+		if (unlikely((PFQ_CB(buff.skb)->group_mask & bit) == 0))
+			continue;
+
+		__sparse_inc(&this_group->stats.recv, cpu);
+
+		if (!pfq_group_filter(this_group, gid, buff, bf_filter_enabled, vlan_filter_enabled, cpu))
+			continue;
+
+		/* setup monad for this computation */
+
+		monad = &local->monad[n];
+
+		monad->fanout.class_mask = Q_CLASS_DEFAULT;
+		monad->fanout.type       = fanout_copy;
+		monad->state  		 = 0;
+		monad->group 		 = this_group;
+		monad->headers.flags	 = 0;
+
+		local->num_fwd[n]   = PFQ_CB(buff.skb)->log->num_devs;
+		local->to_kernel[n] = PFQ_CB(buff.skb)->log->to_kernel;
+
+		PFQ_CB(buff.skb)->monad   = monad;
+		PFQ_CB(buff.skb)->snaplen = 0;
+
+		live |= 1UL << n;
 	}
 
+	/* run the functional program over the batch */
+
+	done = live;
+
+	live = pfq_run_batch(prg, pktref->queue, local->monad, live);
+
+	pfq_bitwise_foreach(done, lb,
+	{
+		unsigned long sock_mask;
+
+		n = pfq_ctz(lb);
+		buff = pktref->queue[n];
+
+		if (buff.skb == NULL) {
+			__sparse_inc(&this_group->stats.drop, cpu);
+			continue;
+		}
+
+		/* update stats */
+
+		__sparse_add(&this_group->stats.frwd, PFQ_CB(buff.skb)->log->num_devs - local->num_fwd[n], cpu);
+		__sparse_add(&this_group->stats.kern, PFQ_CB(buff.skb)->log->to_kernel - local->to_kernel[n], cpu);
+
+		/* skip the packet? */
+
+		if (unlikely((live & lb) == 0)) {
+			__sparse_inc(&this_group->stats.drop, cpu);
+			continue;
+		}
+
+		pfq_group_snaplen(this_group, buff.skb, local->monad[n].fanout.class_mask);
+
+		sock_mask = pfq_fanout_sock_mask(local, this_group, &local->monad[n].fanout);
+
+		mask_to_sock_queue(n, sock_mask, sock_queue);
+		socket_mask |= sock_mask;
+	})
+
+	return socket_mask;
+}
+
+
+/* process the batch of packets held by the GC of this cpu */
+
+static void
+pfq_receive_batch(struct local_data *local, int cpu)
+{
+ 	unsigned long long sock_queue[Q_SKBUFF_SHORT_BATCH];
+
+        unsigned long group_mask, socket_mask;
+
+        struct gc_data *gcollector = &local->gc;
+	struct sk_buff *skb;
+
+        long unsigned n, bit, lb;
+        struct pfq_monad monad;
+	struct gc_buff buff;
+	size_t this_batch_len;
+	ktime_t batch_start = ktime_set(0, 0);
+	bool vector = vector_eval;
+
+#ifdef PFQ_RX_PROFILE
+	cycles_t start, stop;
+#endif
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,9,0))
+	BUILD_BUG_ON_MSG(Q_SKBUFF_SHORT_BATCH > (sizeof(sock_queue[0]) << 3), "skbuff batch overflow");
+#endif
+
+	if (batch_latency)
+		batch_start = ktime_get();
+
 	this_batch_len = gc_size(gcollector);
 
 	__sparse_add(&global_stats.recv, this_batch_len, cpu);
 
-	local->last_ts = skb_get_ktime(buff.skb);
+	local->last_ts = PFQ_CB(gcollector->pool.queue[this_batch_len-1].skb)->enqueue;
+
+	pfq_gc_residency_account(local, gcollector);
 
 	/* cleanup sock_queue... */
 
@@ -304,7 +593,6 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 		group_mask |= local_group_mask;
 
 		PFQ_CB(skb)->group_mask = local_group_mask;
-		PFQ_CB(skb)->monad      = &monad;
 	}
 
 
@@ -319,12 +607,21 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 		bool vlan_filter_enabled = __pfq_vlan_filters_enabled(gid);
 
 		struct gc_queue_buff pktref = { len:0 };
+		struct pfq_computation_tree *prg;
 
 		socket_mask = 0;
 
+		/* vector evaluation of the computation, if enabled */
+
+		prg = (struct pfq_computation_tree *)atomic_long_read(&this_group->comp);
+		if (prg && vector) {
+
+			socket_mask = pfq_receive_group_vector(local, this_group, gid, bit, prg, &pktref, sock_queue, this_batch_len, cpu);
+			goto copy_to_endpoints;
+		}
+
 		for_each_gcbuff(&gcollector->pool, buff, n)
 		{
-			struct pfq_computation_tree *prg;
 			unsigned long sock_mask = 0;
 
 			/* stop processing packets in GC ? */
@@ -341,40 +638,18 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 
 			__sparse_inc(&this_group->stats.recv, cpu);
 
+			/* check for bp and vlan filters */
 
-			/* check for bp filter */
-
-			if (bf_filter_enabled) {
-
-				struct sk_filter *bpf = (struct sk_filter *)atomic_long_read(&this_group->bp_filter);
-
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,15,0))
-				if (bpf && !sk_run_filter(buff.skb, bpf->insns))
-#else
-				if (bpf && !SK_RUN_FILTER(bpf, buff.skb))
-#endif
-                        	{
-					__sparse_inc(&this_group->stats.drop, cpu);
-					continue;
-				}
-			}
-
-			/* check vlan filter */
-
-			if (vlan_filter_enabled) {
+			if (!pfq_group_filter(this_group, gid, buff, bf_filter_enabled, vlan_filter_enabled, cpu))
+				continue;
 
-				if (!__pfq_check_group_vlan_filter(gid, buff.skb->vlan_tci & ~VLAN_TAG_PRESENT)) {
-					__sparse_inc(&this_group->stats.drop, cpu);
-					continue;
-				}
-			}
+			PFQ_CB(buff.skb)->snaplen = 0;
 
 			/* check where a functional program is available for this group */
 
 			prg = (struct pfq_computation_tree *)atomic_long_read(&this_group->comp);
 			if (prg) {
 
-				unsigned long cbit, eligible_mask = 0;
 				size_t to_kernel = PFQ_CB(buff.skb)->log->to_kernel;
 				size_t num_fwd   = PFQ_CB(buff.skb)->log->num_devs;
 
@@ -384,6 +659,9 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 				monad.fanout.type       = fanout_copy;
 				monad.state  		= 0;
 				monad.group 		= this_group;
+				monad.headers.flags	= 0;
+
+				PFQ_CB(buff.skb)->monad = &monad;
 
 				/* run the functional program */
 
@@ -412,46 +690,14 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 
 				/* process output... */
 
+				pfq_group_snaplen(this_group, buff.skb, monad.fanout.class_mask);
 
-				/* compute the eligible mask of sockets enabled for this packet... */
-
-				pfq_bitwise_foreach(monad.fanout.class_mask, cbit,
-				{
-					int class = pfq_ctz(cbit);
-					eligible_mask |= atomic_long_read(&this_group->sock_mask[class]);
-				})
-
-
-				if (is_steering(monad.fanout)) {
-
-					/* cache the number of sockets in the mask */
-
-					if (unlikely(eligible_mask != local->eligible_mask)) {
-
-						unsigned long ebit;
-
-						local->eligible_mask = eligible_mask;
-						local->sock_cnt = 0;
-
-						pfq_bitwise_foreach(eligible_mask, ebit,
-						{
-							local->sock_mask[local->sock_cnt++] = ebit;
-						})
-					}
-
-					if (likely(local->sock_cnt)) {
-						unsigned int h = monad.fanout.hash ^ (monad.fanout.hash >> 8) ^ (monad.fanout.hash >> 16);
-						sock_mask |= local->sock_mask[pfq_fold(h, local->sock_cnt)];
-					}
-				}
-				else {  /* clone or continue ... */
-
-					sock_mask |= eligible_mask;
-				}
+				sock_mask |= pfq_fanout_sock_mask(local, this_group, &monad.fanout);
 			}
 			else { /* save a reference of the current packet */
 
 				pktref.queue[pktref.len++] = buff;
+				pfq_group_snaplen(this_group, buff.skb, Q_CLASS_DEFAULT);
 				sock_mask |= atomic_long_read(&this_group->sock_mask[0]);
 			}
 
@@ -459,6 +705,8 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 			socket_mask |= sock_mask;
 		}
 
+	copy_to_endpoints:
+
 		/* copy payload of packets to endpoints... */
 
 		pfq_bitwise_foreach(socket_mask, lb,
@@ -485,8 +733,7 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 
 		if (to_kernel) {
 
-			skb = cb->log->num_devs > 0 ?
-				skb_clone(skb, GFP_ATOMIC) : skb_get(skb);
+			skb = pfq_rx_pool_skb_share(skb, cb->log->num_devs > 0);
 
 			if (skb) {
 				__sparse_inc(&global_stats.kern, cpu);
@@ -502,16 +749,12 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 
 	/* forward skbs to network devices */
 
-	{
- 		struct gc_fwd_targets targets;
-               	size_t total;
-
-		gc_get_fwd_targets(gcollector, &targets);
+	if (gcollector->fwd.num) {
 
-		total = pfq_lazy_xmit_exec(gcollector, &targets);
+               	size_t total = pfq_lazy_xmit_exec(gcollector, &gcollector->fwd);
 
 		__sparse_add(&global_stats.frwd, total, cpu);
-		__sparse_add(&global_stats.disc, targets.cnt_total - total, cpu);
+		__sparse_add(&global_stats.disc, gcollector->fwd.cnt_total - total, cpu);
 	}
 
 	/* reset GC, free skbs */
@@ -526,14 +769,118 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
 
 	gc_reset(gcollector);
 
-	put_cpu();
+	/* update the adaptive batch controller */
+
+	if (batch_latency)
+		pfq_batch_account(local, batch_start, this_batch_len);
 
 #ifdef PFQ_RX_PROFILE
 	stop = get_cycles();
 
 	if (printk_ratelimit())
-		printk(KERN_INFO "[PFQ] RX profile: %llu_tsc.\n", (stop-start)/batch_len);
+		printk(KERN_INFO "[PFQ] RX profile: %llu_tsc.\n", (stop-start)/this_batch_len);
 #endif
+}
+
+
+/* flush the packets left in the GC when the deadline expires (tasklet) */
+
+void pfq_receive_flush(unsigned long cpu)
+{
+	struct local_data * local;
+
+	/* the GC of a cpu is only processed by the cpu itself */
+
+	if (unlikely(cpu != smp_processor_id()))
+		return;
+
+	local = per_cpu_ptr(cpu_data, cpu);
+
+	if (gc_size(&local->gc) == 0)
+		return;
+
+	pfq_receive_batch(local, cpu);
+}
+
+
+static int
+pfq_receive(struct napi_struct *napi, struct sk_buff * skb, int direct)
+{
+	struct local_data * local;
+        struct gc_data *gcollector;
+	struct gc_buff buff;
+        int cpu;
+
+	/* if no socket is open, drop the packet now */
+
+        if (pfq_get_sock_count() == 0) {
+        	kfree_skb(skb);
+               	return 0;
+	}
+
+	/* if required by some socket, timestamp the packet now */
+
+        if (skb->tstamp.tv64 == 0 && pfq_get_sock_tstamp_count())
+                __net_timestamp(skb);
+
+        /* if vlan header is present, remove it */
+
+        if (vl_untag && skb->protocol == cpu_to_be16(ETH_P_8021Q)) {
+                skb = pfq_vlan_untag(skb);
+                if (unlikely(!skb)) {
+			sparse_inc(&global_stats.lost);
+                        return -1;
+		}
+        }
+
+        skb_reset_mac_len(skb);
+
+        /* push the mac header: reset skb->data to the beginning of the packet */
+
+        if (likely(skb->pkt_type != PACKET_OUTGOING)) {
+            skb_push(skb, skb->mac_len);
+        }
+
+	/* get the cpu */
+
+        cpu = get_cpu();
+
+	local = per_cpu_ptr(cpu_data, cpu);
+
+	gcollector = &local->gc;
+
+	/* set the ownership of this skb to the garbage collector */
+
+	buff = gc_make_buff(gcollector, skb);
+	if (buff.skb == NULL) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] GC: memory exhausted!\n");
+		__sparse_inc(&global_stats.lost, cpu);
+		kfree_skb(skb);
+		put_cpu();
+		return 0;
+	}
+
+        PFQ_CB(buff.skb)->direct = direct;
+        PFQ_CB(buff.skb)->enqueue = ktime_get();
+
+	local->batch_pkts++;
+
+        if ((gc_size(gcollector) < (batch_latency ? local->batch_len : batch_len)) &&
+             (ktime_us_delta(PFQ_CB(buff.skb)->enqueue, local->last_ts) < flush_timeout))
+        {
+		/* first packet of the batch: arm the flush deadline */
+
+		if (gc_size(gcollector) == 1)
+			hrtimer_start(&local->flush_timer, ns_to_ktime((u64)flush_timeout * 1000), HRTIMER_MODE_REL_PINNED);
+
+        	put_cpu();
+                return 0;
+	}
+
+	pfq_receive_batch(local, cpu);
+
+	put_cpu();
         return 0;
 }
 
@@ -584,6 +931,11 @@ out:
 
 static void pfq_sock_destruct(struct sock *sk)
 {
+        struct pfq_sock *so = pfq_sk(sk);
+
+        sparse_stats_free(&so->rx_opt.stats);
+        sparse_stats_free(&so->tx_opt.stats);
+
         skb_queue_purge(&sk->sk_error_queue);
 
         WARN_ON(atomic_read(&sk->sk_rmem_alloc));
@@ -633,12 +985,26 @@ pfq_create(
 
         so = pfq_sk(sk);
 
+        /* allocate per-cpu stats (before the id is published) */
+
+        if (sparse_stats_alloc(&so->rx_opt.stats) ||
+            sparse_stats_alloc(&so->tx_opt.stats)) {
+
+                printk(KERN_WARNING "[PFQ] error: could not allocate socket stats\n");
+                sparse_stats_free(&so->rx_opt.stats);
+                sparse_stats_free(&so->tx_opt.stats);
+                sk_free(sk);
+                return -ENOMEM;
+        }
+
         /* get a unique id for this sock */
 
         so->id = pfq_get_free_sock_id(so);
         if (so->id == -1) {
 
                 printk(KERN_WARNING "[PFQ] error: resource exhausted\n");
+                sparse_stats_free(&so->rx_opt.stats);
+                sparse_stats_free(&so->tx_opt.stats);
                 sk_free(sk);
                 return -EBUSY;
         }
@@ -648,6 +1014,7 @@ pfq_create(
 	so->egress_type  = pfq_endpoint_socket;
 	so->egress_index = 0;
 	so->egress_queue = 0;
+	RCU_INIT_POINTER(so->egress_dev, NULL);
 
         so->shmem.addr = NULL;
         so->shmem.size = 0;
@@ -656,6 +1023,10 @@ pfq_create(
         so->shmem.hugepages = NULL;
         so->shmem.npages = 0;
 
+        so->shmem.chunks = NULL;
+        so->shmem.nchunks = 0;
+        so->shmem.node = NUMA_NO_NODE;
+
         down(&sock_sem);
 
         /* initialize both rx_opt and tx_opt */
@@ -700,6 +1071,8 @@ pfq_release(struct socket *sock)
 			kthread_stop(so->tx_opt.queue[n].task);
 			so->tx_opt.queue[n].task = NULL;
 		}
+
+		pfq_tx_engine_detach(so, n);
 	}
 
         pr_devel("[PFQ|%d] releasing socket...\n", id);
@@ -707,9 +1080,25 @@ pfq_release(struct socket *sock)
         pfq_leave_all_groups(so->id);
         pfq_release_sock_id(so->id);
 
+        /* release the devices bound (egress and tx queues) */
+
+        pfq_netdev_unbind_all(so);
+
+        pfq_sock_set_tstamp(so, Q_TSTAMP_OFF);
+
         if (so->shmem.addr)
                 pfq_shared_queue_disable(so);
 
+        if (so->rx_opt.pool) {
+                pfq_rx_pool_destroy(so->rx_opt.pool);
+                so->rx_opt.pool = NULL;
+        }
+
+        if (so->rx_opt.efd) {
+                eventfd_ctx_put(so->rx_opt.efd);
+                so->rx_opt.efd = NULL;
+        }
+
         down(&sock_sem);
 
         /* purge both batch and recycle queues if no socket is open */
@@ -869,7 +1258,7 @@ void unregister_device_handler(void)
 
 static int __init pfq_init_module(void)
 {
-        int n;
+        int err;
         printk(KERN_INFO "[PFQ] loading (%s)...\n", Q_VERSION);
 
         if (max_queue_slots & (max_queue_slots-1))
@@ -884,27 +1273,75 @@ static int __init pfq_init_module(void)
                 return -EFAULT;
         }
 
+	if (batch_min <= 0 || batch_min > batch_len) {
+                printk(KERN_INFO "[PFQ] batch_min=%d not allowed: valid range (0,%d]!\n", batch_min, batch_len);
+                return -EFAULT;
+        }
+
+	if (batch_latency < 0) {
+                printk(KERN_INFO "[PFQ] batch_latency=%d not allowed: valid range [0,...]!\n", batch_latency);
+                return -EFAULT;
+        }
+
+	if (tx_pace_window < 0) {
+                printk(KERN_INFO "[PFQ] tx_pace_window=%d not allowed: valid range [0,...]!\n", tx_pace_window);
+                return -EFAULT;
+        }
+
+	if (flush_timeout <= 0) {
+                printk(KERN_INFO "[PFQ] flush_timeout=%d not allowed: valid range (0,...]!\n", flush_timeout);
+		return -EFAULT;
+	}
+
+	if (pfq_hash_init() < 0)
+		return -EFAULT;
+
 	if (skb_pool_size > PFQ_SK_BUFF_LIST_SIZE) {
                 printk(KERN_INFO "[PFQ] skb_pool_size=%d not allowed: valid range (0,%d]!\n", skb_pool_size, PFQ_SK_BUFF_LIST_SIZE);
 		return -EFAULT;
 	}
 
+	/* allocate per-cpu stats */
+
+	if (sparse_stats_alloc(&global_stats) ||
+	    sparse_stats_alloc(&memory_stats)) {
+		printk(KERN_WARNING "[PFQ] stats: out of memory!\n");
+		err = -ENOMEM;
+		goto err_stats;
+	}
+
+	pfq_global_stats_reset(&global_stats);
+	pfq_memory_stats_reset(&memory_stats);
+
+	if (pfq_groups_init()) {
+		err = -ENOMEM;
+		goto err_stats;
+	}
+
 	if (pfq_percpu_init()) {
-		return -EFAULT;
+		err = -EFAULT;
+		goto err_groups;
 	}
 
 	if (pfq_proc_init()) {
-		return -ENOMEM;
+		err = -ENOMEM;
+		goto err_percpu;
 	}
 
         /* register pfq sniffer protocol */
-        n = proto_register(&pfq_proto, 0);
-        if (n != 0)
-                return n;
+        err = proto_register(&pfq_proto, 0);
+        if (err != 0)
+                goto err_proc;
 
 	/* register the pfq socket */
         sock_register(&pfq_family_ops);
 
+	/* drop the device bindings when the devices are unregistered */
+	if (pfq_netdev_notifier_init()) {
+		err = -EFAULT;
+		goto err_sock;
+	}
+
         /* finally register the basic device handler */
         register_device_handler();
 
@@ -915,7 +1352,8 @@ static int __init pfq_init_module(void)
 #ifdef PFQ_USE_SKB_RECYCLE
         if (pfq_skb_pool_init() != 0) {
         	pfq_skb_pool_purge();
-        	return -ENOMEM;
+		err = -ENOMEM;
+		goto err_handler;
 	}
         pfq_skb_pool_enable(true);
         printk(KERN_INFO "[PFQ] skb pool initialized.\n");
@@ -923,6 +1361,30 @@ static int __init pfq_init_module(void)
 
 	printk(KERN_INFO "[PFQ] ready!\n");
         return 0;
+
+	/* unwind, in reverse order */
+
+#ifdef PFQ_USE_SKB_RECYCLE
+err_handler:
+	unregister_device_handler();
+	msleep(Q_GRACE_PERIOD);
+	pfq_symtable_free();
+	pfq_netdev_notifier_fini();
+#endif
+err_sock:
+	sock_unregister(PF_Q);
+	proto_unregister(&pfq_proto);
+err_proc:
+	pfq_proc_fini();
+err_percpu:
+	pfq_percpu_fini();
+	free_percpu(cpu_data);
+err_groups:
+	pfq_groups_fini();
+err_stats:
+	sparse_stats_free(&global_stats);
+	sparse_stats_free(&memory_stats);
+	return err;
 }
 
 
@@ -939,6 +1401,12 @@ static void __exit pfq_exit_module(void)
         /* unregister the pfq socket */
         sock_unregister(PF_Q);
 
+	/* unregister the netdevice notifier */
+	pfq_netdev_notifier_fini();
+
+	/* stop the shared Tx engines */
+	pfq_tx_engine_fini();
+
         /* unregister the pfq protocol */
         proto_unregister(&pfq_proto);
 
@@ -948,6 +1416,9 @@ static void __exit pfq_exit_module(void)
         /* wait grace period */
         msleep(Q_GRACE_PERIOD);
 
+        /* stop GC flush timers */
+        pfq_percpu_fini();
+
         /* purge both GC and recycles queues */
         total += pfq_percpu_flush();
 
@@ -959,13 +1430,19 @@ static void __exit pfq_exit_module(void)
 
         /* free per-cpu data */
 	free_percpu(cpu_data);
-
 	/* free functions */
 
 	pfq_symtable_free();
 
 	pfq_proc_fini();
 
+	/* free per-cpu stats */
+
+	pfq_groups_fini();
+
+	sparse_stats_free(&global_stats);
+	sparse_stats_free(&memory_stats);
+
         printk(KERN_INFO "[PFQ] unloaded.\n");
 }
 
@@ -1050,5 +1527,10 @@ EXPORT_SYMBOL_GPL(pfq_gro_receive);
 EXPORT_SYMBOL_GPL(pfq_symtable_register_functions);
 EXPORT_SYMBOL_GPL(pfq_symtable_unregister_functions);
 
+EXPORT_SYMBOL_GPL(pfq_symtable_search);
+EXPORT_SYMBOL_GPL(pfq_run);
+EXPORT_SYMBOL_GPL(pfq_run_batch);
+EXPORT_SYMBOL_GPL(pfq_mpdb_enqueue_batch);
+
 module_init(pfq_init_module);
 module_exit(pfq_exit_module);
@@ -673,6 +673,18 @@ namespace lang
 
         auto mark           = [] (unsigned long value) { return mfunction("mark", value); };
 
+        //! Set the capture length of the packet (0 = caplen of the socket).
+        /*
+         * Only the first bytes of the packet are copied to the sockets of the group,
+         * as by a per-group snaplen.
+         *
+         * Example:
+         *
+         * when (is_tcp, snap (96))
+         */
+
+        auto snap           = [] (int value) { return mfunction("snap", value); };
+
         //! Increment the i-th counter of the current group.
         /*
          * Example:
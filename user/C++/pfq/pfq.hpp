@@ -43,6 +43,7 @@
 #include <type_traits>
 #include <algorithm>
 #include <thread>
+#include <chrono>
 
 #include <pfq/util.hpp>
 #include <pfq/queue.hpp>
@@ -79,6 +80,35 @@ namespace pfq {
         any           = Q_CLASS_ANY
     };
 
+    //! wait strategy of read.
+    /*!
+     * When the Rx queue is empty: spin (busy-poll the queue up to the timeout),
+     * hybrid (busy-poll for a spin budget, then ppoll), block (ppoll) or none
+     * (return at once).
+     */
+
+    enum class wait_strategy : int
+    {
+        spin   = Q_WAIT_SPIN,
+        hybrid = Q_WAIT_HYBRID,
+        block  = Q_WAIT_BLOCK,
+        none   = Q_WAIT_NONE
+    };
+
+    //! Timestamp modes.
+    /*!
+     * off, on (precise, realtime), tsc (raw tsc read per packet) and
+     * tsc_batch (raw tsc read once per batch).
+     */
+
+    enum class tstamp_mode : int
+    {
+        off       = Q_TSTAMP_OFF,
+        on        = Q_TSTAMP_ON,
+        tsc       = Q_TSTAMP_TSC,
+        tsc_batch = Q_TSTAMP_TSC_BATCH
+    };
+
     //! vlan options.
     /*!
      * Special vlan ids are untag (matches with untagged vlans) and anytag.
@@ -168,10 +198,22 @@ namespace pfq {
             size_t tx_num_bind;
 
             bool   tx_async;
+            bool   rx_packed;
+
+            int    rx_rings;            // per-cpu rx rings: number of sub-rings
+            size_t rx_ring_size;
+            size_t rx_ring_mem;
+            int    rx_ring;             // sub-ring of the last read
+            size_t rx_ring_pending;     // slots of the last read (released by the next one)
+
+            wait_strategy rx_wait;
+            long int rx_wait_spin;      // spin budget (ns)
+
+            int    rx_segments;         // number of rx segments (2 = double buffer)
+            unsigned int rx_segment;    // index of the next segment to read
         };
 
         int fd_;
-        int hd_;
 
         std::unique_ptr<pfq_data> data_;
 
@@ -181,7 +223,6 @@ namespace pfq {
 
         socket()
         : fd_(-1)
-        , hd_(-1)
         , data_()
         {}
 
@@ -190,7 +231,6 @@ namespace pfq {
         template <typename ...Ts>
         socket(param::list_t, Ts&& ...args)
         : fd_(-1)
-        , hd_(-1)
         , data_()
         {
             auto def = param::make_default();
@@ -214,7 +254,6 @@ namespace pfq {
 
         socket(size_t caplen, size_t rx_slots = 65536, size_t maxlen = 64, size_t tx_slots = 4096)
         : fd_(-1)
-        , hd_(-1)
         , data_()
         {
             this->open(class_mask::default_, group_policy::priv, caplen, rx_slots, maxlen, tx_slots);
@@ -228,7 +267,6 @@ namespace pfq {
 
         socket(group_policy policy, size_t caplen, size_t rx_slots = 65536, size_t maxlen = 64, size_t tx_slots = 4096)
         : fd_(-1)
-        , hd_(-1)
         , data_()
         {
             this->open(class_mask::default_, policy, caplen, rx_slots, maxlen, tx_slots);
@@ -242,7 +280,6 @@ namespace pfq {
 
         socket(class_mask mask, group_policy policy, size_t caplen, size_t rx_slots = 65536, size_t maxlen = 64, size_t tx_slots = 4096)
         : fd_(-1)
-        , hd_(-1)
         , data_()
         {
             this->open(mask, policy, caplen, rx_slots, maxlen, tx_slots);
@@ -275,11 +312,9 @@ namespace pfq {
 
         socket(socket &&other) noexcept
         : fd_(other.fd_)
-        , hd_(other.hd_)
         , data_(std::move(other.data_))
         {
             other.fd_ = -1;
-            other.hd_ = -1;
         }
 
         //! Move assignment operator.
@@ -291,9 +326,7 @@ namespace pfq {
             {
                 data_     = std::move(other.data_);
                 fd_       = other.fd_;
-                hd_       = other.hd_;
                 other.fd_ = -1;
-                other.hd_ = -1;
             }
             return *this;
         }
@@ -305,7 +338,6 @@ namespace pfq {
         {
             std::swap(data_, other.data_);
             std::swap(fd_,   other.fd_);
-            std::swap(hd_,   other.hd_);
         }
 
         //! Open the socket with the given group policy.
@@ -391,6 +423,45 @@ namespace pfq {
 
     private:
 
+        struct free_deleter
+        {
+            void operator()(void *a) const { ::free(a); }
+        };
+
+        template <typename Ser>
+        static std::unique_ptr<pfq_computation_descr, free_deleter>
+        make_computation_descr(Ser const &ser)
+        {
+            std::unique_ptr<pfq_computation_descr, free_deleter> prg (
+                reinterpret_cast<pfq_computation_descr *>(::malloc(sizeof(size_t) * 2 + sizeof(pfq_functional_descr) * ser.size())));
+
+            if (!prg)
+                throw pfq_error("PFQ: computation descriptor: out of memory");
+
+            prg->size = ser.size();
+            prg->entry_point = 0;
+
+            int n = 0;
+
+            for(auto & descr : ser)
+            {
+                prg->fun[n].symbol = descr.symbol.c_str();
+
+                for(size_t i = 0; i < sizeof(prg->fun[0].arg)/sizeof(prg->fun[0].arg[0]); i++)
+                {
+                    prg->fun[n].arg[i].addr  = descr.arg[i].ptr ? descr.arg[i].ptr->forall_addr() : nullptr;
+                    prg->fun[n].arg[i].size  = descr.arg[i].size;
+                    prg->fun[n].arg[i].nelem = descr.arg[i].nelem;
+                }
+
+                prg->fun[n].next  = descr.link;
+
+                n++;
+            }
+
+            return prg;
+        }
+
         pfq_data * data()
         {
             if (data_)
@@ -431,7 +502,17 @@ namespace pfq {
                                         0,
                                         0,
                                         0,
-                                        true
+                                        true,
+                                        false,
+                                        0,
+                                        0,
+                                        0,
+                                        0,
+                                        0,
+                                        static_cast<wait_strategy>(Q_WAIT_DEFAULT),
+                                        0,
+                                        2,
+                                        0
                                      });
 
             // get id
@@ -487,12 +568,6 @@ namespace pfq {
                     throw pfq_error("FPQ: close error");
 
                 fd_ = -1;
-
-                if (hd_ != -1)
-                {
-                    ::close(hd_);
-                    hd_ = -1;
-                }
             }
         }
 
@@ -510,26 +585,15 @@ namespace pfq {
             if (::getsockopt(fd_, PF_Q, Q_SO_GET_SHMEM_SIZE, &tot_mem, &size) == -1)
                 throw pfq_error(errno, "PFQ: queue memory error");
 
-            hd_ = ::open(("/dev/hugepages/pfq." + std::to_string(fd_)).c_str(),  O_CREAT | O_RDWR, 0755);
-            if (hd_ != -1)
-                data()->shm_addr = ::mmap(nullptr, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, hd_, 0);
+            // the memory is allocated by the kernel (huge pages, on the NUMA node of the socket)
 
-            if (data()->shm_addr == MAP_FAILED)
-            {
-                void * null = nullptr;
-                if(::setsockopt(fd_, PF_Q, Q_SO_ENABLE, &null, sizeof(null)) == -1) {
-                    throw pfq_error(errno, "PFQ: socket enable");
-                }
-
-                data()->shm_addr = ::mmap(nullptr, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, fd_, 0);
-            }
-            else
-            {
-                if(::setsockopt(fd_, PF_Q, Q_SO_ENABLE, &data()->shm_addr, sizeof(data()->shm_addr)) == -1) {
-                    throw pfq_error(errno, "PFQ: socket enable");
-                }
+            void * null = nullptr;
+            if(::setsockopt(fd_, PF_Q, Q_SO_ENABLE, &null, sizeof(null)) == -1) {
+                throw pfq_error(errno, "PFQ: socket enable");
             }
 
+            data()->shm_addr = ::mmap(nullptr, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, fd_, 0);
+
             if (data()->shm_addr == MAP_FAILED)
                 throw pfq_error(errno, "PFQ: socket enable (mmap)");
 
@@ -538,8 +602,25 @@ namespace pfq {
             data()->rx_queue_addr = static_cast<char *>(data()->shm_addr) + sizeof(pfq_queue_hdr);
             data()->rx_queue_size = data()->rx_slots * data()->rx_slot_size;
 
-            data()->tx_queue_addr = static_cast<char *>(data()->shm_addr) + sizeof(pfq_queue_hdr) + data()->rx_queue_size * 2;
+            data()->tx_queue_addr = static_cast<char *>(data()->shm_addr) + sizeof(pfq_queue_hdr) + data()->rx_queue_size * static_cast<size_t>(data()->rx_segments);
             data()->tx_queue_size = data()->tx_slots * data()->tx_slot_size;
+
+            if (data()->rx_segments > 2)
+            {
+                auto q = static_cast<struct pfq_queue_hdr *>(data()->shm_addr);
+                data()->rx_segment = MPDB_QUEUE_INDEX(q->rx.data);
+            }
+
+            if (data()->rx_rings)
+            {
+                auto q = static_cast<struct pfq_queue_hdr *>(data()->shm_addr);
+
+                data()->rx_rings        = static_cast<int>(q->rx.rings);
+                data()->rx_ring_size    = q->rx.ring_size;
+                data()->rx_ring_mem     = q->rx.ring_mem;
+                data()->rx_ring         = 0;
+                data()->rx_ring_pending = 0;
+            }
         }
 
         //! Disable the socket.
@@ -557,9 +638,6 @@ namespace pfq {
             {
                 if (::munmap(data()->shm_addr, data()->shm_size) == -1)
                     throw pfq_error(errno, "PFQ: munmap error");
-
-                if (hd_ != -1)
-                    unlink(("/dev/hugepages/pfq." + std::to_string(fd_)).c_str());
             }
 
             data()->shm_addr = nullptr;
@@ -595,6 +673,49 @@ namespace pfq {
                 throw pfq_error(errno, "PFQ: set timestamp mode");
         }
 
+        //! Set the timestamp mode for packets.
+        /*!
+         * Raw tsc timestamps are stored in tstamp.tv64 and converted into
+         * realtime nanoseconds by tsc_to_ns. Packets are timestamped only
+         * when some socket requires it.
+         */
+
+        void
+        timestamp_enable(tstamp_mode mode)
+        {
+            int ts = static_cast<int>(mode);
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_RX_TSTAMP, &ts, sizeof(ts)) == -1)
+                throw pfq_error(errno, "PFQ: set timestamp mode");
+        }
+
+        //! Return the timestamp mode for packets.
+
+        tstamp_mode
+        timestamp_mode() const
+        {
+           int ret; socklen_t size = sizeof(int);
+           if (::getsockopt(fd_, PF_Q, Q_SO_GET_RX_TSTAMP, &ret, &size) == -1)
+                throw pfq_error(errno, "PFQ: get timestamp mode");
+           return static_cast<tstamp_mode>(ret);
+        }
+
+        //! Convert a raw tsc timestamp into realtime nanoseconds.
+        /*!
+         * The calibration is taken when the socket is enabled.
+         */
+
+        uint64_t
+        tsc_to_ns(uint64_t tsc) const
+        {
+            auto q = static_cast<struct pfq_queue_hdr *>(data()->shm_addr);
+            if (!q)
+                throw pfq_error("PFQ: tsc_to_ns: socket not enabled");
+            if (!q->rx.tsc_khz)
+                throw pfq_error("PFQ: tsc_to_ns: tsc not available");
+
+            return pfq_rx_tsc_to_ns(&q->rx, tsc);
+        }
+
         //! Check whether the timestamping for packets is enabled.
 
         bool
@@ -696,6 +817,170 @@ namespace pfq {
             return data()->rx_slot_size;
         }
 
+        //! Specify the number of Rx segments (a power of two, up to Q_MAX_RX_SEGMENTS).
+        /*!
+         * With 2 segments (default) the Rx queue is a double buffer: each read hands
+         * the previous segment back to the kernel. With more segments, the consumer
+         * keeps the queues returned by read until it releases them (in order), while
+         * the kernel fills the other segments. Not available with per-cpu Rx rings.
+         */
+
+        void
+        rx_segments(int value)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (rx segments could not be set)");
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_RX_SEGMENTS, &value, sizeof(value)) == -1) {
+                throw pfq_error(errno, "PFQ: set Rx segments error");
+            }
+
+            data()->rx_segments = value;
+        }
+
+        //! Return the number of Rx segments.
+
+        int
+        rx_segments() const
+        {
+            return data()->rx_segments;
+        }
+
+        //! Specify the NUMA node of the shared memory (-1 = automatic).
+        /*!
+         * The memory of the queues is allocated by the kernel from huge pages when the
+         * socket is enabled. By default it is taken on the node of the device bound to
+         * the socket (Rx first, then Tx) or, lacking a device, on the node of the cpu
+         * that enables the socket.
+         */
+
+        void
+        shmem_node(int node)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (shared memory node could not be set)");
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_SHMEM_NODE, &node, sizeof(node)) == -1) {
+                throw pfq_error(errno, "PFQ: set shared memory node error");
+            }
+        }
+
+        //! Return the NUMA node of the shared memory.
+        /*!
+         * Before the socket is enabled, the node specified (-1 = automatic).
+         */
+
+        int
+        shmem_node() const
+        {
+            int node; socklen_t size = sizeof(node);
+            if (::getsockopt(fd_, PF_Q, Q_SO_GET_SHMEM_NODE, &node, &size) == -1)
+                throw pfq_error(errno, "PFQ: get shared memory node error");
+            return node;
+        }
+
+        //! Enable variable-length Rx slots.
+        /*!
+         * Each packet takes only the cache lines it needs, so that more packets
+         * fit the same Rx queue. The queue must be iterated forward.
+         */
+
+        void
+        rx_packed(bool value)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (packed queue could not be set)");
+
+            int packed = value;
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_RX_PACKED, &packed, sizeof(packed)) == -1) {
+                throw pfq_error(errno, "PFQ: set Rx packed error");
+            }
+
+            data()->rx_packed = value;
+        }
+
+        //! Check whether the Rx slots are variable-length.
+
+        bool
+        rx_packed() const
+        {
+            return data()->rx_packed;
+        }
+
+        //! Enable per-cpu Rx rings.
+        /*!
+         * The Rx memory is split in one single-producer ring per online cpu, so that the
+         * cpus delivering packets to the socket do not contend for the queue.
+         * Each read returns the packets of the next non-empty ring, and releases
+         * those returned by the previous one.
+         */
+
+        void
+        rx_rings(bool value)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (rx rings could not be set)");
+
+            int rings = value;
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_RX_RINGS, &rings, sizeof(rings)) == -1) {
+                throw pfq_error(errno, "PFQ: set Rx rings error");
+            }
+
+            data()->rx_rings = value;
+        }
+
+        //! Set the wakeup coalescing of the socket.
+        /*!
+         * Waiters are notified when the Rx queue holds the given number of packets,
+         * or at most after the given microseconds (0 = no deadline). If efd is a valid
+         * eventfd, it is signaled as well, so that many sockets can be waited for in
+         * a single epoll loop.
+         */
+
+        void
+        rx_wakeup(int packets, int usecs, int efd = -1)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (rx wakeup could not be set)");
+
+            pfq_rx_wakeup value { packets, usecs, efd };
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_RX_WAKEUP, &value, sizeof(value)) == -1) {
+                throw pfq_error(errno, "PFQ: set Rx wakeup error");
+            }
+        }
+
+        //! Set the wait strategy of read, when the Rx queue is empty.
+        /*!
+         * The spin budget (hybrid strategy) is specified in nanoseconds.
+         * The default is none (block if compiled with PFQ_USE_POLL).
+         */
+
+        void
+        rx_wait(wait_strategy strategy, long int spin_ns = 0)
+        {
+            if (spin_ns < 0)
+                throw pfq_error("PFQ: bad spin budget");
+
+            data()->rx_wait = strategy;
+            data()->rx_wait_spin = spin_ns;
+        }
+
+        //! Return the wait strategy of read.
+
+        wait_strategy
+        rx_wait() const
+        {
+            return data()->rx_wait;
+        }
+
+        //! Return the number of Rx rings (until the socket is enabled, 1 if requested).
+
+        int
+        rx_rings() const
+        {
+            return data()->rx_rings;
+        }
+
         //! Specify the length of the Tx queue, in number of packets.
         /*!
          * The number of Tx slots can't exceed the value specified by
@@ -723,6 +1008,43 @@ namespace pfq {
            return data()->tx_slots;
         }
 
+        //! Enable the zero-copy transmission.
+        /*!
+         * The packets are transmitted straight from the slots of the Tx queues, and
+         * a slot is released only when the driver completes the packet.
+         */
+
+        void
+        tx_zerocopy(bool value)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (Tx zero-copy could not be set)");
+
+            int v = value;
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_TX_ZEROCOPY, &v, sizeof(v)) == -1) {
+                throw pfq_error(errno, "PFQ: set Tx zero-copy error");
+            }
+        }
+
+        //! Attach the Tx queues to the shared per-core Tx engines.
+        /*!
+         * Instead of starting a kernel thread per queue, the queues bound to a core
+         * are serviced by the engine of that core, along with those of the other
+         * sockets (any_cpu selects the engine with fewer queues).
+         */
+
+        void
+        tx_engine(bool value)
+        {
+            if (enabled())
+                throw pfq_error("PFQ: enabled (Tx engine could not be set)");
+
+            int v = value;
+            if (::setsockopt(fd_, PF_Q, Q_SO_SET_TX_ENGINE, &v, sizeof(v)) == -1) {
+                throw pfq_error(errno, "PFQ: set Tx engine error");
+            }
+        }
+
 
         //! Bind the main group of the socket to the given device/queue.
         /*!
@@ -912,38 +1234,50 @@ namespace pfq {
         template <typename Comp>
         void set_group_computation(int gid, Comp const &comp)
         {
-            struct free_deleter
-            {
-                void operator()(void *a) const { ::free(a); }
-            };
-
             auto ser = pfq::lang::serialize(comp, 0).first;
+            auto prg = make_computation_descr(ser);
 
-            std::unique_ptr<pfq_computation_descr, free_deleter> prg (
-                reinterpret_cast<pfq_computation_descr *>(::malloc(sizeof(size_t) * 2 + sizeof(pfq_functional_descr) * ser.size())));
+            set_group_computation(gid, prg.get());
+        }
 
-            prg->size = ser.size();
-            prg->entry_point = 0;
+        //! Specify the functional computations of multiple groups.
+        /*!
+         * The computations, given as pairs of group id and PFQ/lang expression,
+         * are loaded with a single call. They are installed in order, and the
+         * loading stops at the first error.
+         */
 
-            int n = 0;
+        template <typename Comp>
+        void set_group_computations(std::vector<std::pair<int, Comp>> const &comps)
+        {
+            std::vector<decltype(pfq::lang::serialize(comps.front().second, 0).first)> sers;
+            std::vector<std::unique_ptr<pfq_computation_descr, free_deleter>> prgs;
+            std::vector<pfq_group_computation> vec;
 
-            for(auto & descr : ser)
-            {
-                prg->fun[n].symbol = descr.symbol.c_str();
+            sers.reserve(comps.size());
 
-                for(size_t i = 0; i < sizeof(prg->fun[0].arg)/sizeof(prg->fun[0].arg[0]); i++)
-                {
-                    prg->fun[n].arg[i].addr  = descr.arg[i].ptr ? descr.arg[i].ptr->forall_addr() : nullptr;
-                    prg->fun[n].arg[i].size  = descr.arg[i].size;
-                    prg->fun[n].arg[i].nelem = descr.arg[i].nelem;
-                }
+            for(auto & c : comps)
+            {
+                sers.push_back(pfq::lang::serialize(c.second, 0).first);
+                prgs.push_back(make_computation_descr(sers.back()));
+                vec.push_back(pfq_group_computation{ c.first, prgs.back().get() });
+            }
 
-                prg->fun[n].next  = descr.link;
+            set_group_computations(vec);
+        }
 
-                n++;
-            }
+        //! Specify the functional computations of multiple groups.
+        /*!
+         * The functional computations are specified by pfq_computation_descriptors.
+         * This function should not be used; use the pfq-lang eDSL instead.
+         */
 
-            set_group_computation(gid, prg.get());
+        void
+        set_group_computations(std::vector<pfq_group_computation> &comps)
+        {
+            struct pfq_group_computations p { comps.size(), comps.data() };
+            if (::setsockopt(fd_, PF_Q, Q_SO_GROUP_FUNCTIONS, &p, sizeof(p)) == -1)
+                throw pfq_error(errno, "PFQ: group computations error");
         }
 
         //! Specify a functional computation for the given group.
@@ -1085,29 +1419,226 @@ namespace pfq {
             if (!data()->shm_addr)
                 throw pfq_error("PFQ: read: socket not enabled");
 
+            if (data_->rx_rings)
+                return read_rings(microseconds);
+
+            if (data_->rx_segments > 2)
+                return read_segments(microseconds);
+
             auto q = static_cast<struct pfq_queue_hdr *>(data()->shm_addr);
 
             size_t data = q->rx.data;
             size_t index = MPDB_QUEUE_INDEX(data);
 
             if( MPDB_QUEUE_LEN(data) == 0 ) {
-#ifdef PFQ_USE_POLL
-                this->poll(microseconds);
-#else
-                (void)microseconds;
-#endif
+                this->wait_rx(microseconds);
             }
 
             // reset the next buffer...
 
             data = __sync_lock_test_and_set(&q->rx.data, (unsigned int)((index+1) << 24));
 
-            auto queue_len = std::min(static_cast<size_t>(MPDB_QUEUE_LEN(data)), data_->rx_slots);
+            auto capacity  = data_->rx_packed ? data_->rx_queue_size / MPDB_QUEUE_BLOCK : data_->rx_slots;
+            auto queue_len = std::min(static_cast<size_t>(MPDB_QUEUE_LEN(data)), capacity);
 
             return queue(static_cast<char *>(data_->rx_queue_addr) + (index & 1) * data_->rx_queue_size,
-                         data_->rx_slot_size, queue_len, index);
+                         data_->rx_packed ? MPDB_QUEUE_BLOCK : data_->rx_slot_size, queue_len, index, data_->rx_packed);
+        }
+
+        //! Return the segment of a queue to the kernel.
+        /*!
+         * Required with more than two Rx segments: the non-empty queues returned
+         * by read must be released in the same order. Otherwise it does nothing.
+         */
+
+        void
+        release(queue const &q)
+        {
+            if (data()->rx_segments == 2 || q.empty())
+                return;
+
+            if (!data()->shm_addr)
+                throw pfq_error("PFQ: release: socket not enabled");
+
+            auto hdr = static_cast<struct pfq_queue_hdr *>(data()->shm_addr);
+
+            if (q.index() != (hdr->rx.released & 0xff))
+                throw pfq_error("PFQ: release: segment out of order");
+
+            // full barrier: the segment is no longer accessed
+
+            __sync_fetch_and_add(&hdr->rx.released, 1);
+        }
+
+    private:
+
+        pfq_tx_queue_hdr *
+        rx_ring(int index) const
+        {
+            return reinterpret_cast<pfq_tx_queue_hdr *>(static_cast<char *>(data_->rx_queue_addr) + index * data_->rx_ring_mem);
+        }
+
+        bool
+        rx_empty() const
+        {
+            if (!data_->rx_rings) {
+                unsigned int data = static_cast<pfq_queue_hdr *>(data_->shm_addr)->rx.data;
+                return MPDB_QUEUE_LEN(data) == 0 && (data_->rx_segments == 2 || MPDB_QUEUE_INDEX(data) == data_->rx_segment);
+            }
+
+            for(int n = 0; n < data_->rx_rings; n++)
+            {
+                auto ring = rx_ring(n);
+                if (ring->producer.index != ring->consumer.index)
+                    return false;
+            }
+
+            return true;
+        }
+
+        // wait for packets (the rx queue is empty), according to the wait strategy
+
+        void
+        wait_rx(long int microseconds)
+        {
+            using clock = std::chrono::steady_clock;
+
+            if (microseconds == 0 || data_->rx_wait == wait_strategy::none)
+                return;
+
+            if (data_->rx_wait != wait_strategy::block)
+            {
+                auto now = clock::now();
+                auto deadline = microseconds < 0 ? clock::time_point::max() : now + std::chrono::microseconds(microseconds);
+                auto spin_end = data_->rx_wait == wait_strategy::spin ? deadline : std::min(deadline, now + std::chrono::nanoseconds(data_->rx_wait_spin));
+
+                for(unsigned int n = 1; rx_empty(); n++)
+                {
+                    cpu_relax();
+
+                    // the clock is read once every 64 rounds
+
+                    if ((n & 63) == 0 && (now = clock::now()) >= spin_end)
+                        break;
+                }
+
+                if (data_->rx_wait == wait_strategy::spin || !rx_empty())
+                    return;
+
+                if (microseconds > 0) {
+                    microseconds = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+                    if (microseconds <= 0)
+                        return;
+                }
+            }
+
+            this->poll(microseconds);
+        }
+
+        // per-cpu rx rings: release the slots of the last read, and return the
+        // contiguous slots available in the next non-empty sub-ring (round-robin)
+
+        queue
+        read_rings(long int microseconds)
+        {
+            if (data_->rx_ring_pending) {
+                pfq_spsc_read_commit_n(rx_ring(data_->rx_ring), data_->rx_ring_pending);
+                data_->rx_ring_pending = 0;
+            }
+
+            pfq_tx_queue_hdr *ring = nullptr;
+            int n, avail = 0;
+
+            for(n = 1; n <= data_->rx_rings; n++)
+            {
+                ring  = rx_ring((data_->rx_ring + n) % data_->rx_rings);
+                avail = pfq_spsc_read_avail(ring);
+                if (avail)
+                    break;
+
+                if (n == data_->rx_rings && microseconds != 0) {
+                    this->wait_rx(microseconds);
+                    microseconds = 0;
+                    n = 0;
+                }
+            }
+
+            if (avail == 0)
+                return queue(data_->rx_queue_addr, data_->rx_slot_size, 0, 0);
+
+            // the slots are published by the producer index
+
+            smp_rmb();
+
+            data_->rx_ring = (data_->rx_ring + n) % data_->rx_rings;
+
+            size_t index = ring->consumer.index;
+            size_t len   = std::min(static_cast<size_t>(avail), data_->rx_ring_size - index);
+
+            data_->rx_ring_pending = len;
+
+            return queue(reinterpret_cast<char *>(ring + 1) + index * data_->rx_slot_size,
+                         data_->rx_slot_size, len, static_cast<size_t>(data_->rx_ring));
+        }
+
+        // rx segments: return the next segment, either closed by the kernel (full) or
+        // closed here, provided that the segment that follows has been released
+
+        queue
+        read_segments(long int microseconds)
+        {
+            auto q = static_cast<struct pfq_queue_hdr *>(data_->shm_addr);
+            auto mask = static_cast<unsigned int>(data_->rx_segments - 1);
+            auto slot_size = data_->rx_packed ? MPDB_QUEUE_BLOCK : data_->rx_slot_size;
+
+            unsigned int index = data_->rx_segment, data;
+
+            for(;;)
+            {
+                data = q->rx.data;
+
+                if (MPDB_QUEUE_INDEX(data) != index)
+                {
+                    // closed by the kernel: wait for its length to be published
+
+                    data = q->rx.seg[index & mask];
+                    if (MPDB_QUEUE_INDEX(data) == index)
+                        break;
+
+                    cpu_relax();
+                    continue;
+                }
+
+                if (MPDB_QUEUE_LEN(data) == 0)
+                {
+                    if (microseconds == 0)
+                        return queue(data_->rx_queue_addr, slot_size, 0, index, data_->rx_packed);
+
+                    this->wait_rx(microseconds);
+                    microseconds = 0;
+                    continue;
+                }
+
+                // the segment that follows is still owned by user space
+
+                if (((index + 1 - q->rx.released) & 0xff) >= static_cast<unsigned int>(data_->rx_segments))
+                    return queue(data_->rx_queue_addr, slot_size, 0, index, data_->rx_packed);
+
+                if (__sync_bool_compare_and_swap(&q->rx.data, data, ((index + 1) & 0xff) << 24))
+                    break;
+            }
+
+            data_->rx_segment = (index + 1) & 0xff;
+
+            auto capacity  = data_->rx_packed ? data_->rx_queue_size / MPDB_QUEUE_BLOCK : data_->rx_slots;
+            auto queue_len = std::min(static_cast<size_t>(MPDB_QUEUE_LEN(data)), capacity);
+
+            return queue(static_cast<char *>(data_->rx_queue_addr) + (index & mask) * data_->rx_queue_size,
+                         slot_size, queue_len, index, data_->rx_packed);
         }
 
+    public:
+
         //! Return the current commit version (used internally by the memory mapped queue).
 
         uint8_t
@@ -1132,11 +1663,14 @@ namespace pfq {
 
             auto this_queue = this->read(microseconds);
 
-            if (buff.second < data_->rx_slots * data_->rx_slot_size)
+            if (buff.second < data_->rx_slots * data_->rx_slot_size) {
+                this->release(this_queue);
                 throw pfq_error("PFQ: buffer too small");
+            }
 
             memcpy(buff.first, this_queue.data(), this_queue.slot_size() * this_queue.size());
-            return queue(buff.first, this_queue.slot_size(), this_queue.size(), this_queue.index());
+            this->release(this_queue);
+            return queue(buff.first, this_queue.slot_size(), this_queue.size(), this_queue.index(), this_queue.packed());
         }
 
 
@@ -1151,22 +1685,49 @@ namespace pfq {
         template <typename Fun>
         size_t dispatch(Fun callback, long int microseconds = -1, char *user = nullptr)
         {
-            auto many = this->read(microseconds);
+            // per-cpu rx rings: the sub-rings are visited once per dispatch
 
-            auto it = std::begin(many),
-                 it_e = std::end(many);
+            int rounds = data()->rx_rings ? data()->rx_rings : 1;
             size_t n = 0;
-            for(; it != it_e; ++it)
+
+            for(int r = 0; r < rounds; r++)
             {
-                while (!it.ready())
-                    std::this_thread::yield();
+                auto many = this->read(r == 0 ? microseconds : 0);
 
-                callback(user, &(*it), reinterpret_cast<const char *>(it.data()));
-                n++;
+                if (r > 0 && many.empty())
+                    break;
+
+                auto it = std::begin(many),
+                     it_e = std::end(many);
+                for(; it != it_e; ++it)
+                {
+                    while (!it.ready())
+                        cpu_relax();
+
+                    callback(user, &(*it), reinterpret_cast<const char *>(it.data()));
+                    n++;
+                }
+
+                this->release(many);
             }
             return n;
         }
 
+        //! Specify the capture length for the given classes of a group.
+        /*!
+         * Packets delivered by the group to sockets of the given classes are
+         * truncated to snaplen bytes (0 = caplen of the socket). Within a
+         * computation, the snap function sets the capture length of a packet.
+         */
+
+        void group_snaplen(int gid, int snaplen, class_mask mask = class_mask::any)
+        {
+            pfq_group_snaplen value { gid, static_cast<unsigned long>(mask), snaplen };
+
+            if (::setsockopt(fd_, PF_Q, Q_SO_GROUP_SNAPLEN, &value, sizeof(value)) == -1)
+                throw pfq_error(errno, "PFQ: group snaplen error");
+        }
+
         //! Set vlan filtering for the given group.
 
         void vlan_filters_enable(int gid, bool toggle)
@@ -1259,6 +1820,44 @@ namespace pfq {
             return std::vector<unsigned long>(std::begin(cs.counter), std::end(cs.counter));
         }
 
+        //! Return the counters of the Tx kernel thread of the given queue.
+        /*!
+         * Loops with packets to transmit (busy), loops on an empty queue (idle) and
+         * sleeps ended by the doorbell (wakeup). An idle thread goes to sleep after
+         * tx_idle usec (module parameter) and is woken up by the next inject.
+         */
+
+        pfq_tx_thread_stats
+        tx_thread_stats(int queue) const
+        {
+            if (!data()->shm_addr)
+                throw pfq_error("PFQ: Tx thread stats: socket not enabled");
+
+            if (queue < 0 || queue >= Q_MAX_TX_QUEUES)
+                throw pfq_error("PFQ: Tx thread stats: bad queue");
+
+            return static_cast<struct pfq_queue_hdr *>(data()->shm_addr)->tx[queue].thread.stats;
+        }
+
+        //! Return the counters of the paced transmission of the given queue.
+        /*!
+         * Packets transmitted at a departure time (paced), and the sum and the max
+         * of the errors of the inter-departure times (nsec) with respect to those
+         * of the timestamps.
+         */
+
+        pfq_tx_pace_stats
+        tx_pace_stats(int queue) const
+        {
+            if (!data()->shm_addr)
+                throw pfq_error("PFQ: Tx pace stats: socket not enabled");
+
+            if (queue < 0 || queue >= Q_MAX_TX_QUEUES)
+                throw pfq_error("PFQ: Tx pace stats: bad queue");
+
+            return static_cast<struct pfq_queue_hdr *>(data()->shm_addr)->tx[queue].pace.stats;
+        }
+
         //! Return the memory size of the Rx queue.
 
         size_t
@@ -1313,14 +1912,39 @@ namespace pfq {
             return rc;
         }
 
+        //! Store the packet and transmit it at the given time.
+        /*!
+         * The departure time is in nanoseconds of CLOCK_MONOTONIC (the clock of
+         * std::chrono::steady_clock). The transmission is invoked every @flush_hint
+         * packets; the packets not due yet are held in the queue.
+         */
+
+        bool
+        send_at(const_buffer pkt, uint64_t nsec, size_t flush_hint = 1)
+        {
+            auto rc = inject(pkt, any_queue, nsec);
+
+            if (++data_->tx_attempt == flush_hint) {
+
+                data_->tx_attempt = 0;
+
+                if (!data_->tx_async)
+                    tx_queue_flush(any_queue);
+            }
+
+            return rc;
+        }
+
         //! Schedule the packet for transmission.
         /*!
          * The packet is copied into a Tx queue (according to a symmetric hash)
          * and transmitted by a kernel thread, or when tx_queue_flush is called.
+         * A non-zero @nsec is the departure time (CLOCK_MONOTONIC): the packet is
+         * held in the queue until then.
          */
 
         bool
-        inject(const_buffer buf, int queue = any_queue)
+        inject(const_buffer buf, int queue = any_queue, uint64_t nsec = 0)
         {
             if (!data_->shm_addr)
                 throw pfq_error("PFQ: inject: socket not enabled");
@@ -1345,11 +1969,21 @@ namespace pfq {
 
             hdr->len = std::min(static_cast<const uint16_t>(buf.second),
                                 static_cast<const uint16_t>(tx->max_len));
+            hdr->tstamp = nsec;
 
             memcpy(pkt, buf.first, hdr->len);
 
             pfq_spsc_write_commit(tx);
 
+            // ring the doorbell if the Tx kernel thread is asleep
+
+            if (data_->tx_async)
+            {
+                __sync_synchronize();
+                if (tx->thread.asleep)
+                    tx_queue_flush(tss);
+            }
+
             return true;
         }
 
@@ -1366,6 +2000,49 @@ namespace pfq {
             if (::setsockopt(fd_, PF_Q, Q_SO_TX_FLUSH, &queue, sizeof(queue)) == -1)
                 throw pfq_error(errno, "PFQ: Tx queue flush");
         }
+
+        //! Transmit the next slots of a Tx queue repeatedly.
+        /*!
+         * The next loop.slots packets injected into loop.queue are transmitted
+         * loop.count times (-1 = forever) by the kernel, then released; the
+         * fields selected by loop.flags (Q_TX_LOOP_) are rewritten per packet.
+         */
+
+        void
+        tx_loop(pfq_tx_loop const &loop)
+        {
+            if (::setsockopt(fd_, PF_Q, Q_SO_TX_LOOP, &loop, sizeof(loop)) == -1)
+                throw pfq_error(errno, "PFQ: Tx loop");
+        }
+
+        //! Stop the loop of the given Tx queue.
+
+        void
+        tx_loop_stop(int queue)
+        {
+            pfq_tx_loop loop = { };
+
+            loop.queue = queue;
+            loop.count = 0;
+
+            tx_loop(loop);
+        }
+
+        //! Return the iterations completed by the loop of the given queue, and whether it is running.
+
+        std::pair<unsigned long long, bool>
+        tx_loop_state(int queue) const
+        {
+            if (!data()->shm_addr)
+                throw pfq_error("PFQ: Tx loop: socket not enabled");
+
+            if (queue < 0 || queue >= Q_MAX_TX_QUEUES)
+                throw pfq_error("PFQ: Tx loop: bad queue");
+
+            auto const &loop = static_cast<struct pfq_queue_hdr *>(data()->shm_addr)->tx[queue].loop;
+
+            return std::make_pair(static_cast<unsigned long long>(loop.iter), loop.active != 0);
+        }
     };
 
 
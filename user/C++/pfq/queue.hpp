@@ -47,21 +47,21 @@ namespace pfq {
         {
             friend struct queue::const_iterator;
 
-            iterator(pfq_pkthdr *h, size_t slot_size, size_t index)
-            : hdr_(h), slot_size_(slot_size), index_(index)
+            iterator(pfq_pkthdr *h, size_t slot_size, size_t index, bool packed = false)
+            : hdr_(h), slot_size_(slot_size), index_(index), packed_(packed)
             {}
 
             ~iterator() = default;
 
             iterator(const iterator &other)
-            : hdr_(other.hdr_), slot_size_(other.slot_size_), index_(other.index_)
+            : hdr_(other.hdr_), slot_size_(other.slot_size_), index_(other.index_), packed_(other.packed_)
             {}
 
             iterator &
             operator++()
             {
                 hdr_ = reinterpret_cast<pfq_pkthdr *>(
-                        reinterpret_cast<char *>(hdr_) + slot_size_);
+                        reinterpret_cast<char *>(hdr_) + (packed_ ? MPDB_QUEUE_PACKED_SLOT_SIZE(hdr_->caplen) : slot_size_));
                 return *this;
             }
 
@@ -115,22 +115,23 @@ namespace pfq {
             pfq_pkthdr *hdr_;
             size_t   slot_size_;
             size_t   index_;
+            bool     packed_;
         };
 
         //! Constant forward iterator over packets.
 
         struct const_iterator : public std::iterator<std::forward_iterator_tag, pfq_pkthdr>
         {
-            const_iterator(pfq_pkthdr *h, size_t slot_size, size_t index)
-            : hdr_(h), slot_size_(slot_size), index_(index)
+            const_iterator(pfq_pkthdr *h, size_t slot_size, size_t index, bool packed = false)
+            : hdr_(h), slot_size_(slot_size), index_(index), packed_(packed)
             {}
 
             const_iterator(const const_iterator &other)
-            : hdr_(other.hdr_), slot_size_(other.slot_size_), index_(other.index_)
+            : hdr_(other.hdr_), slot_size_(other.slot_size_), index_(other.index_), packed_(other.packed_)
             {}
 
             const_iterator(const queue::iterator &other)
-            : hdr_(other.hdr_), slot_size_(other.slot_size_), index_(other.index_)
+            : hdr_(other.hdr_), slot_size_(other.slot_size_), index_(other.index_), packed_(other.packed_)
             {}
 
             ~const_iterator() = default;
@@ -139,7 +140,7 @@ namespace pfq {
             operator++()
             {
                 hdr_ = reinterpret_cast<pfq_pkthdr *>(
-                        reinterpret_cast<char *>(hdr_) + slot_size_);
+                        reinterpret_cast<char *>(hdr_) + (packed_ ? MPDB_QUEUE_PACKED_SLOT_SIZE(hdr_->caplen) : slot_size_));
                 return *this;
             }
 
@@ -193,6 +194,7 @@ namespace pfq {
             pfq_pkthdr *hdr_;
             size_t  slot_size_;
             size_t  index_;
+            bool    packed_;
         };
 
     public:
@@ -200,10 +202,12 @@ namespace pfq {
         //! Constructor
         /*!
          * Construct a queue descriptor, stored at the given address.
+         * A packed queue has variable-length slots: slot_size is the block
+         * size and queue_len is expressed in blocks.
          */
 
-        queue(void *addr, size_t slot_size, size_t queue_len, size_t index)
-        : addr_(addr), slot_size_(slot_size), queue_len_(queue_len), index_(index)
+        queue(void *addr, size_t slot_size, size_t queue_len, size_t index, bool packed = false)
+        : addr_(addr), slot_size_(slot_size), queue_len_(queue_len), index_(index), packed_(packed)
         {}
 
         //! Defaulted copy constructor.
@@ -215,7 +219,7 @@ namespace pfq {
         ~queue() = default;
 
 
-        //! Return the number of packets stored in this queue.
+        //! Return the number of packets stored in this queue (blocks, if packed).
 
         size_t
         size() const
@@ -247,6 +251,14 @@ namespace pfq {
             return slot_size_;
         }
 
+        //! Check whether the queue has variable-length slots.
+
+        bool
+        packed() const
+        {
+            return packed_;
+        }
+
         //! Return the pointer to the packet.
 
         const void *
@@ -263,7 +275,7 @@ namespace pfq {
         iterator
         begin()
         {
-            return iterator(reinterpret_cast<pfq_pkthdr *>(addr_), slot_size_, index_);
+            return iterator(reinterpret_cast<pfq_pkthdr *>(addr_), slot_size_, index_, packed_);
         }
 
         //! Return a constant iterator to the first slot of a non-empty queue.
@@ -274,7 +286,7 @@ namespace pfq {
         const_iterator
         begin() const
         {
-            return const_iterator(reinterpret_cast<pfq_pkthdr *>(addr_), slot_size_, index_);
+            return const_iterator(reinterpret_cast<pfq_pkthdr *>(addr_), slot_size_, index_, packed_);
         }
 
         //! Return an iterator past to the end of the queue.
@@ -283,7 +295,7 @@ namespace pfq {
         end()
         {
             return iterator(reinterpret_cast<pfq_pkthdr *>(
-                        static_cast<char *>(addr_) + queue_len_ * slot_size_), slot_size_, index_);
+                        static_cast<char *>(addr_) + queue_len_ * slot_size_), slot_size_, index_, packed_);
         }
 
         //! Return a constant iterator past to the end of the queue.
@@ -292,7 +304,7 @@ namespace pfq {
         end() const
         {
             return const_iterator(reinterpret_cast<pfq_pkthdr *>(
-                        static_cast<char *>(addr_) + queue_len_ * slot_size_), slot_size_, index_);
+                        static_cast<char *>(addr_) + queue_len_ * slot_size_), slot_size_, index_, packed_);
         }
 
         //! Return a constant iterator to the first slot of an non-empty queue.
@@ -303,7 +315,7 @@ namespace pfq {
         const_iterator
         cbegin() const
         {
-            return const_iterator(reinterpret_cast<pfq_pkthdr *>(addr_), slot_size_, index_);
+            return const_iterator(reinterpret_cast<pfq_pkthdr *>(addr_), slot_size_, index_, packed_);
         }
 
         //! Return a constant iterator past to the end of the queue.
@@ -312,7 +324,7 @@ namespace pfq {
         cend() const
         {
             return const_iterator(reinterpret_cast<pfq_pkthdr *>(
-                        static_cast<char *>(addr_) + queue_len_ * slot_size_), slot_size_, index_);
+                        static_cast<char *>(addr_) + queue_len_ * slot_size_), slot_size_, index_, packed_);
         }
 
     private:
@@ -320,6 +332,7 @@ namespace pfq {
         size_t  slot_size_;
         size_t  queue_len_;
         size_t  index_;
+        bool    packed_;
     };
 
     //! Return the pointer to the packet.
@@ -38,6 +38,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 #include <errno.h>
 #include <signal.h>
 #include <ctype.h>
@@ -147,6 +149,22 @@ typedef struct pfq_data
 
 	size_t rx_slots;
 	size_t rx_slot_size;
+	int    rx_packed;
+	int    rx_segments;		/* number of rx segments (2 = double buffer) */
+	unsigned int rx_segment;	/* index of the next segment to read */
+
+	int    rx_rings;		/* per-cpu rx rings: number of sub-rings */
+	size_t rx_ring_size;
+	size_t rx_ring_mem;
+	int    rx_ring;			/* sub-ring of the last read */
+	unsigned int rx_ring_pending;	/* slots of the last read (released by the next one) */
+
+	int    rx_wait;			/* wait strategy */
+	long int rx_wait_spin;		/* spin budget (ns) */
+
+	char * rx_pool_addr;		/* zero-copy rx */
+	size_t rx_pool_frame_size;
+	uint32_t * rx_compl_addr;
 
         size_t tx_slots;
 	size_t tx_slot_size;
@@ -159,7 +177,6 @@ typedef struct pfq_data
 	const char * error;
 
 	int fd;
-	int hd;
 
 	int id;
 	int gid;
@@ -233,10 +250,11 @@ pfq_open_group(unsigned long class_mask, int group_policy, size_t caplen, size_t
 	memset(q, 0, sizeof(pfq_t));
 
 	q->fd 	    = fd;
-	q->hd 	    = -1;
 	q->id 	    = -1;
 	q->gid 	    = -1;
         q->tx_async =  1;
+        q->rx_wait  = Q_WAIT_DEFAULT;
+        q->rx_segments = 2;
 
         memset(&q->netq, 0, sizeof(q->netq));
 
@@ -296,9 +314,6 @@ int pfq_close(pfq_t *q)
 		if (close(q->fd) < 0)
 			return Q_ERROR(q, "PFQ: close error");
 
-		if (q->hd != -1)
-			close(q->hd);
-
 		free(q);
                 return Q_OK(q);
 	}
@@ -312,7 +327,7 @@ int
 pfq_enable(pfq_t *q)
 {
 	size_t tot_mem; socklen_t size = sizeof(tot_mem);
-	char filename[64];
+	void * null = NULL;
 
 	if (q->shm_addr != 0 &&
 	    q->shm_addr != MAP_FAILED) {
@@ -323,27 +338,14 @@ pfq_enable(pfq_t *q)
 		return Q_ERROR(q, "PFQ: queue memory error");
 	}
 
-	snprintf(filename, 64, "/dev/hugepages/pfq.%d", q->fd);
-
-	q->hd = open(filename, O_CREAT | O_RDWR, 0755);
-	if (q->hd != -1)
-		q->shm_addr = mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, q->hd, 0);
-
+	/* the memory is allocated by the kernel (huge pages, on the NUMA node of the socket) */
 
-	if (q->shm_addr == MAP_FAILED) {
-        	void * null = NULL;
-                if(setsockopt(q->fd, PF_Q, Q_SO_ENABLE, &null, sizeof(null)) == -1) {
-			return Q_ERROR(q, "PFQ: socket enable");
-                }
-
-                q->shm_addr = mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, q->fd, 0);
-	}
-	else {
-		if(setsockopt(q->fd, PF_Q, Q_SO_ENABLE, &q->shm_addr, sizeof(q->shm_addr)) == -1) {
-			return Q_ERROR(q, "PFQ: socket enable");
-		}
+	if(setsockopt(q->fd, PF_Q, Q_SO_ENABLE, &null, sizeof(null)) == -1) {
+		return Q_ERROR(q, "PFQ: socket enable");
 	}
 
+	q->shm_addr = mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, q->fd, 0);
+
 	if (q->shm_addr == MAP_FAILED) {
 		return Q_ERROR(q, "PFQ: socket enable (mmap)");
 	}
@@ -353,9 +355,28 @@ pfq_enable(pfq_t *q)
        	q->rx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_queue_hdr);
         q->rx_queue_size = q->rx_slots * q->rx_slot_size;
 
-        q->tx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_queue_hdr) + q->rx_queue_size * 2;
+        q->tx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_queue_hdr) + q->rx_queue_size * q->rx_segments;
         q->tx_queue_size = q->tx_slots * q->tx_slot_size;
 
+        if (q->rx_pool_addr)
+        	q->rx_compl_addr = (uint32_t *)((char *)(q->tx_queue_addr) + q->tx_queue_size * Q_MAX_TX_QUEUES);
+
+        if (q->rx_segments > 2) {
+		struct pfq_queue_hdr * qd = (struct pfq_queue_hdr *)(q->shm_addr);
+
+		q->rx_segment = MPDB_QUEUE_INDEX(qd->rx.data);
+	}
+
+        if (q->rx_rings) {
+		struct pfq_queue_hdr * qd = (struct pfq_queue_hdr *)(q->shm_addr);
+
+        	q->rx_rings        = (int)qd->rx.rings;
+        	q->rx_ring_size    = qd->rx.ring_size;
+        	q->rx_ring_mem     = qd->rx.ring_mem;
+        	q->rx_ring         = 0;
+        	q->rx_ring_pending = 0;
+	}
+
         return Q_OK(q);
 }
 
@@ -370,17 +391,11 @@ pfq_disable(pfq_t *q)
 
 		if (munmap(q->shm_addr,q->shm_size) == -1)
 			return Q_ERROR(q, "PFQ: munmap error");
-
-		if (q->hd != -1) {
-                	char filename[64];
-                	snprintf(filename, 64, "/dev/hugepages/pfq.%d", q->fd);
-                	unlink(filename);
-		}
-
 	}
 
 	q->shm_addr = NULL;
 	q->shm_size = 0;
+	q->rx_compl_addr = NULL;
 
 	if(setsockopt(q->fd, PF_Q, Q_SO_DISABLE, NULL, 0) == -1) {
 		return Q_ERROR(q, "PFQ: socket disable");
@@ -415,6 +430,18 @@ pfq_timestamp_enable(pfq_t *q, int value)
 }
 
 
+uint64_t
+pfq_tsc_to_ns(pfq_t const *q, uint64_t tsc)
+{
+	struct pfq_queue_hdr * qd = (struct pfq_queue_hdr *)(q->shm_addr);
+
+	if (qd == NULL || qd->rx.tsc_khz == 0)
+		return 0;
+
+	return pfq_rx_tsc_to_ns(&qd->rx, tsc);
+}
+
+
 int
 pfq_is_timestamp_enabled(pfq_t const *q)
 {
@@ -477,7 +504,8 @@ pfq_set_caplen(pfq_t *q, size_t value)
 		return Q_ERROR(q, "PFQ: set caplen error");
 	}
 
-	q->rx_slot_size = ALIGN(sizeof(struct pfq_pkthdr) + value, 64);
+	if (q->rx_pool_addr == NULL)
+		q->rx_slot_size = ALIGN(sizeof(struct pfq_pkthdr) + value, 64);
 	return Q_OK(q);
 }
 
@@ -568,6 +596,36 @@ pfq_get_tx_slots(pfq_t const *q)
 	return q->tx_slots;
 }
 
+
+int
+pfq_set_tx_zerocopy(pfq_t *q, int value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (Tx zero-copy could not be set)");
+	}
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_TX_ZEROCOPY, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Tx zero-copy error");
+	}
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_tx_engine(pfq_t *q, int value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (Tx engine could not be set)");
+	}
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_TX_ENGINE, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Tx engine error");
+	}
+
+	return Q_OK(q);
+}
+
 size_t
 pfq_get_rx_slot_size(pfq_t const *q)
 {
@@ -575,6 +633,190 @@ pfq_get_rx_slot_size(pfq_t const *q)
 }
 
 
+int
+pfq_set_rx_segments(pfq_t *q, int value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (rx segments could not be set)");
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_RX_SEGMENTS, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Rx segments error");
+	}
+
+	q->rx_segments = value;
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_rx_segments(pfq_t const *q)
+{
+	return q->rx_segments;
+}
+
+
+int
+pfq_set_shmem_node(pfq_t *q, int node)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (shared memory node could not be set)");
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_SHMEM_NODE, &node, sizeof(node)) == -1) {
+		return Q_ERROR(q, "PFQ: set shared memory node error");
+	}
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_shmem_node(pfq_t const *q)
+{
+	int node; socklen_t size = sizeof(node);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_SHMEM_NODE, &node, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get shared memory node error");
+	}
+	return Q_VALUE(q, node);
+}
+
+
+int
+pfq_set_rx_packed(pfq_t *q, int value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (packed queue could not be set)");
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_RX_PACKED, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Rx packed error");
+	}
+
+	q->rx_packed = !!value;
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_rx_rings(pfq_t *q, int value)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (rx rings could not be set)");
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_RX_RINGS, &value, sizeof(value)) == -1) {
+		return Q_ERROR(q, "PFQ: set Rx rings error");
+	}
+
+	q->rx_rings = !!value;
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_rx_wakeup(pfq_t *q, int packets, int usecs, int efd)
+{
+	struct pfq_rx_wakeup wakeup = { packets, usecs, efd };
+
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (rx wakeup could not be set)");
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_RX_WAKEUP, &wakeup, sizeof(wakeup)) == -1) {
+		return Q_ERROR(q, "PFQ: set Rx wakeup error");
+	}
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_rx_wait(pfq_t *q, int strategy, long int spin_ns)
+{
+	if (strategy < Q_WAIT_SPIN || strategy > Q_WAIT_NONE || spin_ns < 0) {
+		return Q_ERROR(q, "PFQ: bad wait strategy");
+	}
+
+	q->rx_wait = strategy;
+	q->rx_wait_spin = spin_ns;
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_rx_pool(pfq_t *q, void *addr, size_t size, size_t frame_size, const char *dev, int queue)
+{
+	struct pfq_rx_pool_descr descr = { addr, size, frame_size, Q_ANY_DEVICE, Q_ANY_QUEUE };
+
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (rx pool could not be set)");
+	}
+
+	if (dev) {
+		descr.if_index = pfq_ifindex(q, dev);
+		if (descr.if_index == -1)
+			return Q_ERROR(q, "PFQ: rx pool: device not found");
+		descr.hw_queue = queue;
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_RX_POOL, &descr, sizeof(descr)) == -1) {
+		return Q_ERROR(q, "PFQ: set rx pool error");
+	}
+
+	if (addr) {
+		q->rx_pool_addr = addr;
+		q->rx_pool_frame_size = frame_size;
+		q->rx_slot_size = MPDB_QUEUE_FRAME_SLOT_SIZE;
+	}
+	else {
+		ssize_t caplen = pfq_get_caplen(q);
+		q->rx_pool_addr = NULL;
+		q->rx_pool_frame_size = 0;
+		q->rx_slot_size = ALIGN(sizeof(struct pfq_pkthdr) + (size_t)caplen, 64);
+	}
+
+	return Q_OK(q);
+}
+
+
+const char *
+pfq_frame_data(pfq_t const *q, const struct pfq_pkthdr *h)
+{
+	struct pfq_pkthdr_frame const *fd = (struct pfq_pkthdr_frame const *)(h + 1);
+
+	return q->rx_pool_addr + (size_t)fd->index * q->rx_pool_frame_size + fd->offset;
+}
+
+
+int
+pfq_frame_release(pfq_t *q, const struct pfq_pkthdr *h)
+{
+	struct pfq_queue_hdr *qh = (struct pfq_queue_hdr *)(q->shm_addr);
+	struct pfq_pkthdr_frame const *fd = (struct pfq_pkthdr_frame const *)(h + 1);
+	int index;
+
+	if (q->rx_compl_addr == NULL)
+		return Q_ERROR(q, "PFQ: frame release: rx pool not enabled");
+
+	index = pfq_spsc_write_index(&qh->completion);
+	if (index == -1)
+		return Q_ERROR(q, "PFQ: frame release: completion ring full");
+
+	q->rx_compl_addr[index] = fd->index;
+
+	pfq_spsc_write_commit(&qh->completion);
+	return Q_OK(q);
+}
+
+
 int
 pfq_bind_group(pfq_t *q, int gid, const char *dev, int queue)
 {
@@ -712,6 +954,19 @@ pfq_set_group_computation(pfq_t *q, int gid, struct pfq_computation_descr *comp)
 }
 
 
+int
+pfq_set_group_computations(pfq_t *q, struct pfq_group_computation *comps, size_t n)
+{
+        struct pfq_group_computations p = { n, comps };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_GROUP_FUNCTIONS, &p, sizeof(p)) == -1) {
+		return Q_ERROR(q, "PFQ: group computations error");
+        }
+
+	return Q_OK(q);
+}
+
+
 int
 pfq_set_group_computation_from_string(pfq_t *q, int gid, const char *comp)
 {
@@ -880,6 +1135,19 @@ pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *cs)
 }
 
 
+int
+pfq_set_group_snaplen(pfq_t *q, int gid, unsigned long class_mask, int snaplen)
+{
+        struct pfq_group_snaplen value = { gid, class_mask, snaplen };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_GROUP_SNAPLEN, &value, sizeof(value)) == -1) {
+	        return Q_ERROR(q, "PFQ: group snaplen error");
+        }
+
+        return Q_OK(q);
+}
+
+
 int
 pfq_vlan_filters_enable(pfq_t *q, int gid, int toggle)
 {
@@ -916,6 +1184,226 @@ int pfq_vlan_reset_filter(pfq_t *q, int gid, int vid)
 }
 
 
+static inline struct pfq_tx_queue_hdr *
+pfq_rx_ring(pfq_t const *q, int ring)
+{
+	return (struct pfq_tx_queue_hdr *)((char *)(q->rx_queue_addr) + ring * q->rx_ring_mem);
+}
+
+
+static int
+pfq_rx_empty(pfq_t const *q)
+{
+	struct pfq_queue_hdr * qd = (struct pfq_queue_hdr *)(q->shm_addr);
+	int n;
+
+	if (!q->rx_rings) {
+		unsigned int data = qd->rx.data;
+		return MPDB_QUEUE_LEN(data) == 0 && (q->rx_segments == 2 || MPDB_QUEUE_INDEX(data) == q->rx_segment);
+	}
+
+	for(n = 0; n < q->rx_rings; n++)
+	{
+		struct pfq_tx_queue_hdr * ring = pfq_rx_ring(q, n);
+		if (ring->producer.index != ring->consumer.index)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+static inline long long
+pfq_clock_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* wait for packets (the rx queue is empty), according to the wait strategy */
+
+static int
+pfq_wait_rx(pfq_t *q, long int microseconds)
+{
+	if (microseconds == 0 || q->rx_wait == Q_WAIT_NONE)
+		return 0;
+
+	if (q->rx_wait != Q_WAIT_BLOCK) {
+
+		long long now = pfq_clock_ns(), deadline, spin_end;
+		unsigned int n = 0;
+
+		deadline = microseconds < 0 ? LLONG_MAX : now + microseconds * 1000LL;
+		spin_end = (q->rx_wait == Q_WAIT_SPIN || q->rx_wait_spin >= deadline - now) ? deadline : now + q->rx_wait_spin;
+
+		while (pfq_rx_empty(q))
+		{
+			pfq_relax();
+
+			/* the clock is read once every 64 rounds */
+
+			if ((++n & 63) == 0 && (now = pfq_clock_ns()) >= spin_end)
+				break;
+		}
+
+		if (q->rx_wait == Q_WAIT_SPIN || !pfq_rx_empty(q))
+			return 0;
+
+		if (microseconds > 0) {
+			microseconds = (long int)((deadline - now) / 1000);
+			if (microseconds <= 0)
+				return 0;
+		}
+	}
+
+	return pfq_poll(q, microseconds);
+}
+
+
+/* per-cpu rx rings: release the slots of the last read, and return the
+ * contiguous slots available in the next non-empty sub-ring (round-robin) */
+
+static int
+pfq_read_rings(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
+{
+	struct pfq_tx_queue_hdr * ring;
+	unsigned int index;
+	int n, avail = 0;
+
+	if (q->rx_ring_pending) {
+		pfq_spsc_read_commit_n(pfq_rx_ring(q, q->rx_ring), q->rx_ring_pending);
+		q->rx_ring_pending = 0;
+	}
+
+	for(n = 1; n <= q->rx_rings; n++)
+	{
+		ring  = pfq_rx_ring(q, (q->rx_ring + n) % q->rx_rings);
+		avail = pfq_spsc_read_avail(ring);
+		if (avail)
+			break;
+
+		if (n == q->rx_rings && microseconds != 0) {
+			if (pfq_wait_rx(q, microseconds) < 0)
+				return -1;
+			microseconds = 0;
+			n = 0;
+		}
+	}
+
+	nq->slot_size = q->rx_slot_size;
+	nq->packed    = 0;
+
+	if (avail == 0) {
+		nq->len = 0;
+		return Q_VALUE(q, 0);
+	}
+
+	/* the slots are published by the producer index */
+
+	smp_rmb();
+
+	q->rx_ring = (q->rx_ring + n) % q->rx_rings;
+
+	index = ring->consumer.index;
+	if ((size_t)avail > q->rx_ring_size - index)
+		avail = (int)(q->rx_ring_size - index);
+
+	q->rx_ring_pending = (unsigned int)avail;
+
+	nq->queue = (char *)(ring + 1) + index * q->rx_slot_size;
+	nq->index = (unsigned int)q->rx_ring;
+	nq->len   = (size_t)avail;
+
+	return Q_VALUE(q, avail);
+}
+
+
+/* rx segments: return the next segment, either closed by the kernel (full) or
+ * closed here, provided that the segment that follows has been released */
+
+static int
+pfq_read_segments(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
+{
+	struct pfq_queue_hdr * qd = (struct pfq_queue_hdr *)(q->shm_addr);
+	unsigned int index = q->rx_segment, data;
+	size_t queue_len;
+
+	nq->len       = 0;
+	nq->slot_size = q->rx_packed ? MPDB_QUEUE_BLOCK : q->rx_slot_size;
+	nq->packed    = q->rx_packed;
+
+	for(;;)
+	{
+		data = qd->rx.data;
+
+		if (MPDB_QUEUE_INDEX(data) != index) {
+
+			/* closed by the kernel: wait for its length to be published */
+
+			data = qd->rx.seg[index & (unsigned int)(q->rx_segments - 1)];
+			if (MPDB_QUEUE_INDEX(data) == index)
+				break;
+
+			pfq_relax();
+			continue;
+		}
+
+		if (MPDB_QUEUE_LEN(data) == 0) {
+			if (microseconds == 0)
+				return Q_VALUE(q, 0);
+			if (pfq_wait_rx(q, microseconds) < 0)
+				return -1;
+			microseconds = 0;
+			continue;
+		}
+
+		/* the segment that follows is still owned by user space */
+
+		if (((index + 1 - qd->rx.released) & 0xff) >= (unsigned int)q->rx_segments)
+			return Q_VALUE(q, 0);
+
+		if (__sync_bool_compare_and_swap(&qd->rx.data, data, ((index + 1) & 0xff) << 24))
+			break;
+	}
+
+	q->rx_segment = (index + 1) & 0xff;
+
+	queue_len = min(MPDB_QUEUE_LEN(data), q->rx_packed ? q->rx_queue_size / MPDB_QUEUE_BLOCK : q->rx_slots);
+
+	nq->queue = (char *)(q->rx_queue_addr) + (index & (unsigned int)(q->rx_segments - 1)) * q->rx_queue_size;
+	nq->index = index;
+	nq->len   = queue_len;
+
+	return Q_VALUE(q, (int)queue_len);
+}
+
+
+int
+pfq_release_queue(pfq_t *q, struct pfq_net_queue const *nq)
+{
+	struct pfq_queue_hdr * qd;
+
+	if (q->rx_segments == 2 || nq->len == 0)
+		return Q_OK(q);
+
+        if (q->shm_addr == NULL) {
+         	return Q_ERROR(q, "PFQ: release: socket not enabled");
+	}
+
+	qd = (struct pfq_queue_hdr *)(q->shm_addr);
+
+	if (nq->index != (qd->rx.released & 0xff))
+		return Q_ERROR(q, "PFQ: release: segment out of order");
+
+	/* full barrier: the segment is no longer accessed */
+
+	__sync_fetch_and_add(&qd->rx.released, 1);
+	return Q_OK(q);
+}
+
+
 int
 pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
 {
@@ -926,30 +1414,32 @@ pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
          	return Q_ERROR(q, "PFQ: read: socket not enabled");
 	}
 
+	if (q->rx_rings)
+		return pfq_read_rings(q, nq, microseconds);
+
+	if (q->rx_segments > 2)
+		return pfq_read_segments(q, nq, microseconds);
+
 	qd    = (struct pfq_queue_hdr *)(q->shm_addr);
 	data  = qd->rx.data;
 	index = MPDB_QUEUE_INDEX(data);
 
 	if( MPDB_QUEUE_LEN(data) == 0 ) {
-#ifdef PFQ_USE_POLL
-		if (pfq_poll(q, microseconds) < 0) {
-        		return Q_ERROR(q, "PFQ: poll error");
-		}
-#else
-		(void)microseconds;
-#endif
+		if (pfq_wait_rx(q, microseconds) < 0)
+			return -1;
 	}
 
 	/* reset the next buffer... */
 
 	data = __sync_lock_test_and_set(&qd->rx.data, ((index+1) << 24));
 
-	size_t queue_len = min(MPDB_QUEUE_LEN(data), q->rx_slots);
+	size_t queue_len = min(MPDB_QUEUE_LEN(data), q->rx_packed ? q->rx_queue_size / MPDB_QUEUE_BLOCK : q->rx_slots);
 
 	nq->queue = (char *)(q->rx_queue_addr) + (index & 1) * q->rx_queue_size;
 	nq->index = index;
 	nq->len   = queue_len;
-        nq->slot_size = q->rx_slot_size;
+        nq->slot_size = q->rx_packed ? MPDB_QUEUE_BLOCK : q->rx_slot_size;
+        nq->packed = q->rx_packed;
 
 	return Q_VALUE(q, (int)queue_len);
 }
@@ -962,11 +1452,13 @@ pfq_recv(pfq_t *q, void *buf, size_t buflen, struct pfq_net_queue *nq, long int
 		return -1;
 
 	if (buflen < (q->rx_slots * q->rx_slot_size)) {
+		pfq_release_queue(q, nq);
 		return Q_ERROR(q, "PFQ: buffer too small");
 	}
 
-	memcpy(buf, nq->queue, q->rx_slot_size * nq->len);
-	return Q_OK(q);
+	memcpy(buf, nq->queue, nq->slot_size * nq->len);
+
+	return pfq_release_queue(q, nq);
 }
 
 
@@ -974,22 +1466,41 @@ int
 pfq_dispatch(pfq_t *q, pfq_handler_t cb, long int microseconds, char *user)
 {
 	pfq_iterator_t it, it_end;
-	int n = 0;
+	int n = 0, r, rounds;
 
-	if (pfq_read(q, &q->netq, microseconds) < 0)
-		return -1;
+	/* per-cpu rx rings: the sub-rings are visited once per dispatch */
 
-	it = pfq_net_queue_begin(&q->netq);
-	it_end = pfq_net_queue_end(&q->netq);
+	rounds = q->rx_rings ? q->rx_rings : 1;
 
-	for(; it != it_end; it = pfq_net_queue_next(&q->netq, it))
+	for(r = 0; r < rounds; r++)
 	{
-		while (!pfq_iterator_ready(&q->netq, it))
-			pfq_yield();
+		if (pfq_read(q, &q->netq, r == 0 ? microseconds : 0) < 0)
+			return -1;
+
+		if (r > 0 && q->netq.len == 0)
+			break;
 
-		cb(user, pfq_iterator_header(it), pfq_iterator_data(it));
-		n++;
+		it = pfq_net_queue_begin(&q->netq);
+		it_end = pfq_net_queue_end(&q->netq);
+
+		for(; it != it_end; it = pfq_net_queue_next(&q->netq, it))
+		{
+			while (!pfq_iterator_ready(&q->netq, it))
+				pfq_relax();
+
+			if (q->rx_pool_addr) {
+				cb(user, pfq_iterator_header(it), pfq_frame_data(q, pfq_iterator_header(it)));
+				pfq_frame_release(q, pfq_iterator_header(it));
+			}
+			else
+				cb(user, pfq_iterator_header(it), pfq_iterator_data(it));
+			n++;
+		}
+
+		if (pfq_release_queue(q, &q->netq) < 0)
+			return -1;
 	}
+
         return Q_VALUE(q, n);
 }
 
@@ -1034,6 +1545,13 @@ pfq_unbind_tx(pfq_t *q)
 
 int
 pfq_inject(pfq_t *q, const void *buf, size_t len, int queue)
+{
+	return pfq_inject_at(q, buf, len, queue, 0);
+}
+
+
+int
+pfq_inject_at(pfq_t *q, const void *buf, size_t len, int queue, uint64_t nsec)
 {
         struct pfq_queue_hdr *qh = (struct pfq_queue_hdr *)(q->shm_addr);
         struct pfq_tx_queue_hdr *tx;
@@ -1065,15 +1583,56 @@ pfq_inject(pfq_t *q, const void *buf, size_t len, int queue)
         pkt = (char *)(hdr + 1);
 
 	hdr->len = min((uint16_t)len, (uint16_t)(tx->max_len));
+	hdr->tstamp = nsec;
 
         memcpy(pkt, buf, hdr->len);
 
         pfq_spsc_write_commit(tx);
 
+	/* ring the doorbell if the Tx kernel thread is asleep */
+
+	if (q->tx_async) {
+		__sync_synchronize();
+		if (tx->thread.asleep)
+			pfq_tx_queue_flush(q, tss);
+	}
+
         return Q_VALUE(q, len);
 }
 
 
+int
+pfq_get_tx_thread_stats(pfq_t const *q, int queue, struct pfq_tx_thread_stats *stats)
+{
+        struct pfq_queue_hdr *qh = (struct pfq_queue_hdr *)(q->shm_addr);
+
+	if (q->shm_addr == NULL)
+         	return Q_ERROR(q, "PFQ: Tx thread stats: socket not enabled");
+
+	if (queue < 0 || queue >= Q_MAX_TX_QUEUES)
+         	return Q_ERROR(q, "PFQ: Tx thread stats: bad queue");
+
+	*stats = qh->tx[queue].thread.stats;
+        return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_pace_stats(pfq_t const *q, int queue, struct pfq_tx_pace_stats *stats)
+{
+        struct pfq_queue_hdr *qh = (struct pfq_queue_hdr *)(q->shm_addr);
+
+	if (q->shm_addr == NULL)
+         	return Q_ERROR(q, "PFQ: Tx pace stats: socket not enabled");
+
+	if (queue < 0 || queue >= Q_MAX_TX_QUEUES)
+         	return Q_ERROR(q, "PFQ: Tx pace stats: bad queue");
+
+	*stats = qh->tx[queue].pace.stats;
+        return Q_OK(q);
+}
+
+
 int
 pfq_tx_queue_flush(pfq_t *q, int queue)
 {
@@ -1084,6 +1643,32 @@ pfq_tx_queue_flush(pfq_t *q, int queue)
 }
 
 
+int
+pfq_tx_loop(pfq_t *q, struct pfq_tx_loop const *loop)
+{
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_LOOP, loop, sizeof(*loop)) == -1)
+		return Q_ERROR(q, "PFQ: Tx loop error");
+
+        return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_loop(pfq_t const *q, int queue, unsigned long long *iter)
+{
+        struct pfq_queue_hdr *qh = (struct pfq_queue_hdr *)(q->shm_addr);
+
+	if (q->shm_addr == NULL)
+         	return Q_ERROR(q, "PFQ: Tx loop: socket not enabled");
+
+	if (queue < 0 || queue >= Q_MAX_TX_QUEUES)
+         	return Q_ERROR(q, "PFQ: Tx loop: bad queue");
+
+	*iter = qh->tx[queue].loop.iter;
+	return Q_VALUE(q, qh->tx[queue].loop.active ? 1 : 0);
+}
+
+
 int
 pfq_send(pfq_t *q, const void *ptr, size_t len)
 {
@@ -51,9 +51,10 @@ typedef char * pfq_iterator_t;
 struct pfq_net_queue
 {
         pfq_iterator_t queue; 	  		/* net queue */
-        size_t         len;       		/* number of packets in the queue */
-        size_t         slot_size;
+        size_t         len;       		/* number of packets in the queue (blocks, if packed) */
+        size_t         slot_size;               /* slot size (block size, if packed) */
         unsigned int   index; 	  		/* current queue index */
+        unsigned int   packed;                  /* variable-length slots */
 };
 
 
@@ -81,10 +82,12 @@ static inline
 pfq_iterator_t
 pfq_net_queue_next(struct pfq_net_queue const *nq, pfq_iterator_t iter)
 {
+        if (nq->packed)
+                return iter + MPDB_QUEUE_PACKED_SLOT_SIZE(((const struct pfq_pkthdr *)iter)->caplen);
         return iter + nq->slot_size;
 }
 
-/*! Return an iterator to the previous slot. */
+/*! Return an iterator to the previous slot (not available for packed queues). */
 
 static inline
 pfq_iterator_t
@@ -138,6 +141,15 @@ pfq_yield()
 #endif
 }
 
+/*! Hint the CPU that the calling thread is busy-waiting. */
+
+static inline
+void
+pfq_relax()
+{
+        cpu_relax();
+}
+
 /*! pfq handler: function prototype. */
 
 typedef void (*pfq_handler_t)(char *user, const struct pfq_pkthdr *h, const char *data);
@@ -303,6 +315,12 @@ extern int pfq_is_enabled(pfq_t const *q);
 
 
 /*! Set the timestamping for packets. */
+/*!
+ * The value is the timestamp mode: Q_TSTAMP_OFF, Q_TSTAMP_ON (precise, realtime),
+ * Q_TSTAMP_TSC (raw tsc per packet) or Q_TSTAMP_TSC_BATCH (raw tsc per batch).
+ * Raw tsc timestamps are converted into realtime ns by pfq_tsc_to_ns.
+ * Packets are timestamped only when some socket requires it.
+ */
 
 extern int pfq_timestamp_enable(pfq_t *q, int value);
 
@@ -312,6 +330,14 @@ extern int pfq_timestamp_enable(pfq_t *q, int value);
 extern int pfq_is_timestamp_enabled(pfq_t const *q);
 
 
+/*! Convert a raw tsc timestamp into realtime nanoseconds. */
+/*!
+ * The calibration is taken when the socket is enabled.
+ */
+
+extern uint64_t pfq_tsc_to_ns(pfq_t const *q, uint64_t tsc);
+
+
 /*! Specify the capture length of packets, in bytes. */
 /*!
  * Capture length must be set before the socket is enabled.
@@ -354,6 +380,109 @@ extern size_t pfq_get_rx_slots(pfq_t const *q);
 extern size_t pfq_get_rx_slot_size(pfq_t const *q);
 
 
+/*! Specify the number of Rx segments (a power of two, up to Q_MAX_RX_SEGMENTS). */
+/*!
+ * With 2 segments (default) the Rx queue is a double buffer: each read hands
+ * the previous segment back to the kernel. With more segments, the consumer
+ * keeps the segments returned by read until it releases them (in order) by
+ * pfq_release_queue, while the kernel fills the others. When a segment is full,
+ * the kernel moves to the next one released. Not available with per-cpu Rx rings.
+ */
+
+extern int pfq_set_rx_segments(pfq_t *q, int value);
+
+
+/*! Return the number of Rx segments. */
+
+extern int pfq_get_rx_segments(pfq_t const *q);
+
+
+/*!
+ * Specify the NUMA node of the shared memory (-1 = automatic).
+ * The memory of the queues is allocated by the kernel from huge pages when the
+ * socket is enabled. By default it is taken on the node of the device bound to
+ * the socket (Rx first, then Tx) or, lacking a device, on the node of the cpu
+ * that enables the socket.
+ */
+
+extern int pfq_set_shmem_node(pfq_t *q, int node);
+
+
+/*!
+ * Return the NUMA node of the shared memory.
+ * Before the socket is enabled, the node specified (-1 = automatic).
+ */
+
+extern int pfq_get_shmem_node(pfq_t const *q);
+
+
+/*! Enable variable-length Rx slots. */
+/*!
+ * Each packet takes only the cache lines it needs, so that more packets fit
+ * the same Rx queue. The queue must be iterated forward, and the length of
+ * the net queue is expressed in blocks. Not available with a rx pool.
+ */
+
+extern int pfq_set_rx_packed(pfq_t *q, int value);
+
+
+/*! Enable per-cpu Rx rings. */
+/*!
+ * The Rx memory is split in one single-producer ring per online cpu, so that the
+ * cpus delivering packets to the socket do not contend for the queue.
+ * Each read returns the packets of the next non-empty ring, and releases
+ * those returned by the previous one; dispatch visits all the rings.
+ * Not available with packed Rx slots.
+ */
+
+extern int pfq_set_rx_rings(pfq_t *q, int value);
+
+
+/*! Set the wakeup coalescing of the socket. */
+/*!
+ * Waiters are notified when the Rx queue holds the given number of packets,
+ * or at most after the given microseconds (0 = no deadline). If efd is a valid
+ * eventfd, it is signaled as well, so that many sockets can be waited for in
+ * a single epoll loop. Default: packets = 1, usecs = 0, efd = -1.
+ */
+
+extern int pfq_set_rx_wakeup(pfq_t *q, int packets, int usecs, int efd);
+
+
+/*! Set the wait strategy of read, when the Rx queue is empty. */
+/*!
+ * Q_WAIT_SPIN busy-polls the queue up to the timeout, Q_WAIT_HYBRID busy-polls
+ * for spin_ns nanoseconds and then blocks in ppoll, Q_WAIT_BLOCK blocks in ppoll,
+ * Q_WAIT_NONE returns at once. The default is Q_WAIT_NONE (Q_WAIT_BLOCK if
+ * compiled with PFQ_USE_POLL).
+ */
+
+extern int pfq_set_rx_wait(pfq_t *q, int strategy, long int spin_ns);
+
+
+/*! Register a page pool for zero-copy receive. */
+/*!
+ * The pool (page aligned) is split in frames of frame_size bytes (power of two,
+ * 2048 up to the page size) and must be set before the socket is enabled. The Rx
+ * slots then carry the position of the packets in the pool (see pfq_frame_data),
+ * and the frames must be given back to the kernel with pfq_frame_release.
+ * If dev is not NULL, a direct-capture driver of the given device/queue receives
+ * packets straight into the frames. A NULL addr restores the copy mode.
+ */
+
+extern int pfq_set_rx_pool(pfq_t *q, void *addr, size_t size, size_t frame_size, const char *dev, int queue);
+
+
+/*! Return a pointer to the packet data, in the rx pool. */
+
+extern const char * pfq_frame_data(pfq_t const *q, const struct pfq_pkthdr *h);
+
+
+/*! Give back the frame of the packet to the kernel (zero-copy receive). */
+
+extern int pfq_frame_release(pfq_t *q, const struct pfq_pkthdr *h);
+
+
 /*! Specify the length of the Tx queue, in number of packets. */
 /*!
  * The number of Tx slots can't exceed the value specified by
@@ -368,6 +497,25 @@ extern int pfq_set_tx_slots(pfq_t *q, size_t value);
 extern size_t pfq_get_tx_slots(pfq_t const *q);
 
 
+/*!
+ * Enable the zero-copy transmission.
+ * The packets are transmitted straight from the slots of the Tx queues, and
+ * a slot is released only when the driver completes the packet.
+ */
+
+extern int pfq_set_tx_zerocopy(pfq_t *q, int value);
+
+
+/*!
+ * Attach the Tx queues to the shared per-core Tx engines.
+ * Instead of starting a kernel thread per queue, the queues bound to a core
+ * are serviced by the engine of that core, along with those of the other
+ * sockets (Q_ANY_CPU selects the engine with fewer queues).
+ */
+
+extern int pfq_set_tx_engine(pfq_t *q, int value);
+
+
 /*! Bind the main group of the socket to the given device/queue. */
 /*!
  * The first argument is the name of the device;
@@ -444,6 +592,15 @@ extern int pfq_groups_mask(pfq_t const *q, unsigned long *_mask);
 extern int pfq_set_group_computation(pfq_t *q, int gid, struct pfq_computation_descr *prg);
 
 
+/*! Specify the functional computations of multiple groups. */
+/*!
+ * The computations are loaded with a single call: they are installed in order
+ * and the loading stops at the first error.
+ */
+
+extern int pfq_set_group_computations(pfq_t *q, struct pfq_group_computation *comps, size_t n);
+
+
 /*! Specify a functional computation for the given group, from string. */
 /*!
  * This function is limited to simple PFQ/lang functional computations.
@@ -467,6 +624,16 @@ extern int pfq_group_fprog(pfq_t *q, int gid, struct sock_fprog *);
 extern int pfq_group_fprog_reset(pfq_t *q, int gid);
 
 
+/*! Specify the capture length for the given classes of a group. */
+/*!
+ * Packets delivered by the group to sockets of the given classes are
+ * truncated to snaplen bytes (0 = caplen of the socket). Within a
+ * computation, the snap function sets the capture length of a packet.
+ */
+
+extern int pfq_set_group_snaplen(pfq_t *q, int gid, unsigned long class_mask, int snaplen);
+
+
 /*! Set vlan filtering for the given group. */
 
 extern int pfq_vlan_filters_enable(pfq_t *q, int gid, int toggle);
@@ -512,6 +679,15 @@ extern int pfq_poll(pfq_t *q, long int microseconds /* = -1 -> infinite */);
 extern int pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds);
 
 
+/*! Return the segment of a net queue to the kernel. */
+/*!
+ * Required with more than two Rx segments: the non-empty net queues returned
+ * by read must be released in the same order. Otherwise it does nothing.
+ */
+
+extern int pfq_release_queue(pfq_t *q, struct pfq_net_queue const *nq);
+
+
 /*! Receive packets in the given mutable buffer. */
 /*!
  * Wait for packets and return the number of packets available.
@@ -562,6 +738,26 @@ extern int pfq_get_group_stats(pfq_t const *q, int gid, struct pfq_stats *stats)
 extern int pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *cs);
 
 
+/*!
+ * Return the counters of the Tx kernel thread of the given queue.
+ * Loops with packets to transmit (busy), loops on an empty queue (idle) and
+ * sleeps ended by the doorbell (wakeup). An idle thread goes to sleep after
+ * tx_idle usec (module parameter) and is woken up by the next inject.
+ */
+
+extern int pfq_get_tx_thread_stats(pfq_t const *q, int queue, struct pfq_tx_thread_stats *stats);
+
+
+/*!
+ * Return the counters of the paced transmission of the given queue.
+ * Packets transmitted at a departure time (paced), and the sum and the max
+ * of the errors of the inter-departure times (nsec) with respect to those
+ * of the timestamps.
+ */
+
+extern int pfq_get_tx_pace_stats(pfq_t const *q, int queue, struct pfq_tx_pace_stats *stats);
+
+
 /*! Flush the Tx queue(s). */
 /*!
  * Transmit the packets in the queues associated with the socket.
@@ -571,6 +767,26 @@ extern int pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *
 extern int pfq_tx_queue_flush(pfq_t *q, int queue);
 
 
+/*! Transmit the next slots of a Tx queue repeatedly. */
+/*!
+ * The next loop->slots packets injected into loop->queue are transmitted
+ * loop->count times (-1 = forever) without further copies from user space,
+ * then released. A count of 0 stops the loop. The IPv4/UDP fields selected
+ * by loop->flags (Q_TX_LOOP_) are rewritten in the kernel, per packet,
+ * and the checksums updated. Not available with zero-copy Tx.
+ */
+
+extern int pfq_tx_loop(pfq_t *q, struct pfq_tx_loop const *loop);
+
+
+/*!
+ * Return the state of the loop of the given queue: 1 if running, 0 if ended
+ * (-1 on error). The iterations completed are stored in iter.
+ */
+
+extern int pfq_get_tx_loop(pfq_t const *q, int queue, unsigned long long *iter);
+
+
 /*! Schedule the packet for transmission. */
 /*!
  * The packet is copied into a Tx queue (according to a symmetric hash)
@@ -580,6 +796,16 @@ extern int pfq_tx_queue_flush(pfq_t *q, int queue);
 extern int pfq_inject(pfq_t *q, const void *ptr, size_t len, int queue);
 
 
+/*! Schedule the packet for transmission at the given time. */
+/*!
+ * The departure time is in nanoseconds of CLOCK_MONOTONIC (0 = as soon as
+ * possible). The packet is held in the Tx queue until then, along with the
+ * packets that follow it.
+ */
+
+extern int pfq_inject_at(pfq_t *q, const void *ptr, size_t len, int queue, uint64_t nsec);
+
+
 /*! Store the packet and transmit the packets in the queue, synchronously. */
 /*!
  * The queue is flushed (if required) and the transmission takes place.
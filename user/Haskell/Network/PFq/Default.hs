@@ -194,6 +194,7 @@ module Network.PFq.Default
         inc        ,
         dec        ,
         mark       ,
+        snap       ,
 
     ) where
 
@@ -625,6 +626,13 @@ dec n = MFunction "dec" n () () () () () () ()
 mark :: CULong -> NetFunction
 mark n = MFunction "mark" n () () () () () () ()
 
+-- | Set the capture length of the packet (0 = caplen of the socket).
+-- Only the first bytes of the packet are copied to the sockets of the group.
+--
+-- > when' is_tcp (snap 96)
+snap :: CInt -> NetFunction
+snap n = MFunction "snap" n () () () () () () ()
+
 -- | Monadic version of 'is_l3_proto' predicate.
 --
 -- Predicates are used in conditional expressions, while monadic functions
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+//
+// Benchmark: latency of computation install, as a function of the program size.
+//
+
+namespace
+{
+    std::vector<MFunction<>>
+    make_computation(size_t size)
+    {
+        std::vector<MFunction<>> comp;
+        for(size_t n = 0; n < size; n++)
+            comp.push_back(mfunction("unit"));
+        return comp;
+    }
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    size_t max_size = argc > 1 ? std::stoul(argv[1]) : 256;
+    size_t rounds   = argc > 2 ? std::stoul(argv[2]) : 100;
+    size_t groups   = argc > 3 ? std::stoul(argv[3]) : 8;
+
+    if (max_size == 0 || rounds == 0 || groups == 0)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" [max_size] [rounds] [groups]"));
+
+    pfq::socket q(64);
+
+    std::vector<int> gids;
+    for(size_t g = 0; g < groups; g++)
+        gids.push_back(g == 0 ? q.group_id() : q.join_group(pfq::any_group, pfq::group_policy::restricted));
+
+    std::cout << "size     single (usec)   batch of " << groups << " (usec/comp)" << std::endl;
+
+    for(size_t size = 1; size <= max_size; size <<= 1)
+    {
+        auto comp = make_computation(size);
+
+        // one computation per call...
+
+        auto start = std::chrono::steady_clock::now();
+
+        for(size_t n = 0; n < rounds; n++)
+            q.set_group_computation(gids[0], comp);
+
+        auto single = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        // all the groups in a single call...
+
+        std::vector<std::pair<int, std::vector<MFunction<>>>> comps;
+        for(auto gid : gids)
+            comps.push_back(std::make_pair(gid, comp));
+
+        start = std::chrono::steady_clock::now();
+
+        for(size_t n = 0; n < rounds; n++)
+            q.set_group_computations(comps);
+
+        auto batch = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::setw(4) << size << "     "
+                  << std::setw(10) << std::fixed << std::setprecision(2) << double(single)/(rounds * 1000) << "      "
+                  << std::setw(10) << std::fixed << std::setprecision(2) << double(batch)/(rounds * groups * 1000) << std::endl;
+    }
+
+    return 0;
+}
+
@@ -1,8 +1,11 @@
 #include <future>
+#include <thread>
+#include <chrono>
 #include <system_error>
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
 
 #include <pfq/pfq.hpp>
 
@@ -119,6 +122,41 @@ Context(PFQ)
     }
 
 
+    Test(timestamp_mode)
+    {
+        pfq::socket x;
+        AssertThrow(x.timestamp_enable(pfq::tstamp_mode::tsc));
+
+        x.open(pfq::group_policy::undefined, 64);
+        AssertThrow(x.timestamp_enable(static_cast<pfq::tstamp_mode>(4)));
+        AssertThrow(x.tsc_to_ns(0));
+
+        // raw tsc timestamps are refused where the tsc is not available (no tsc_khz)
+
+        bool tsc = true;
+        try
+        {
+            x.timestamp_enable(pfq::tstamp_mode::tsc_batch);
+        }
+        catch(pfq::pfq_error &)
+        {
+            tsc = false;
+        }
+
+        if (tsc)
+        {
+            Assert(x.timestamp_mode() == pfq::tstamp_mode::tsc_batch);
+
+            x.enable();
+            Assert(x.tsc_to_ns(0) <= x.tsc_to_ns(1));
+            x.disable();
+        }
+
+        x.timestamp_enable(pfq::tstamp_mode::off);
+        Assert(x.timestamp_enabled(), is_equal_to(false));
+    }
+
+
     Test(caplen)
     {
         pfq::socket x;
@@ -259,6 +297,103 @@ Context(PFQ)
     }
 
 
+    Test(rx_rings)
+    {
+        pfq::socket x;
+        AssertThrow(x.rx_rings(true));
+
+        x.open(pfq::group_policy::undefined, 64);
+        x.rx_rings(true);
+
+        x.enable();
+        AssertThrow(x.rx_rings(false));
+
+        Assert(x.rx_rings() > 0);
+        Assert(x.read(10).empty());
+        Assert(x.read(10).empty());
+        x.disable();
+
+        x.rx_rings(false);
+        Assert(x.rx_rings(), is_equal_to(0));
+    }
+
+
+    Test(rx_segments)
+    {
+        pfq::socket x;
+        AssertThrow(x.rx_segments(4));
+
+        x.open(pfq::group_policy::undefined, 64);
+        Assert(x.rx_segments(), is_equal_to(2));
+
+        AssertThrow(x.rx_segments(1));
+        AssertThrow(x.rx_segments(3));
+        AssertThrow(x.rx_segments(Q_MAX_RX_SEGMENTS * 2));
+
+        x.rx_segments(4);
+        AssertThrow(x.rx_rings(true));
+
+        x.enable();
+        AssertThrow(x.rx_segments(2));
+
+        auto q = x.read(10);
+        Assert(q.empty());
+        x.release(q);
+        x.disable();
+
+        x.rx_segments(2);
+        Assert(x.rx_segments(), is_equal_to(2));
+    }
+
+
+    Test(shmem_node)
+    {
+        pfq::socket x;
+        AssertThrow(x.shmem_node(0));
+
+        x.open(pfq::group_policy::undefined, 64);
+        Assert(x.shmem_node(), is_equal_to(-1));
+
+        AssertThrow(x.shmem_node(-2));
+        AssertThrow(x.shmem_node(1 << 20));
+
+        x.shmem_node(0);
+        Assert(x.shmem_node(), is_equal_to(0));
+
+        x.enable();
+        AssertThrow(x.shmem_node(-1));
+        Assert(x.shmem_node(), is_equal_to(0));
+        x.disable();
+
+        x.shmem_node(-1);
+        x.enable();
+        Assert(x.shmem_node(), is_not_equal_to(-1));
+    }
+
+
+    Test(rx_wakeup)
+    {
+        pfq::socket x;
+        AssertThrow(x.rx_wakeup(1, 0));
+
+        x.open(pfq::group_policy::undefined, 64);
+        AssertThrow(x.rx_wakeup(0, 0));
+        AssertThrow(x.rx_wakeup(1, -1));
+        AssertThrow(x.rx_wakeup(1, 0, 1000));
+
+        int efd = ::eventfd(0, 0);
+        x.rx_wakeup(32, 100, efd);
+
+        x.enable();
+        AssertThrow(x.rx_wakeup(1, 0));
+        Assert(x.read(10).empty());
+        x.disable();
+
+        x.rx_wakeup(1, 0);
+        ::close(efd);
+    }
+
+
     Test(stats)
     {
         pfq::socket x;
@@ -535,6 +670,18 @@ Context(PFQ)
     }
 
 
+    Test(group_snaplen)
+    {
+        pfq::socket x(64);
+        AssertNoThrow(x.group_snaplen(x.group_id(), 96));
+        AssertNoThrow(x.group_snaplen(x.group_id(), 1514, pfq::class_mask::control_plane));
+        AssertNoThrow(x.group_snaplen(x.group_id(), 0));
+
+        AssertThrow(x.group_snaplen(x.group_id(), -1));
+        AssertThrow(x.group_snaplen(1000, 96));
+    }
+
+
     Test(bind_tx)
     {
         pfq::socket q(64);
@@ -553,6 +700,179 @@ Context(PFQ)
     }
 
 
+    Test(tx_thread_stats)
+    {
+        pfq::socket q(64);
+
+        q.bind_tx("lo", -1, 0);
+        AssertThrow(q.tx_thread_stats(0));
+
+        q.enable();
+        AssertThrow(q.tx_thread_stats(-1));
+        AssertThrow(q.tx_thread_stats(Q_MAX_TX_QUEUES));
+
+        // the idle thread goes to sleep...
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        auto before = q.tx_thread_stats(0);
+        Assert(before.idle, is_greater(0ULL));
+
+        // ...and is woken up by the doorbell
+
+        char packet[64] = { };
+        Assert(q.send(pfq::const_buffer(packet, sizeof(packet))));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        auto after = q.tx_thread_stats(0);
+        Assert(after.wakeup, is_greater(before.wakeup));
+        Assert(after.busy, is_greater(before.busy));
+    }
+
+
+    Test(tx_zerocopy)
+    {
+        pfq::socket q(64, 1024, 1514);
+
+        q.bind_tx("lo", -1);
+        q.tx_zerocopy(true);
+
+        q.enable();
+        AssertThrow(q.tx_zerocopy(false));
+
+        char packet[1500] = { };
+        for(int n = 0; n < 100; n++)
+            Assert(q.send(pfq::const_buffer(packet, sizeof(packet))));
+
+        q.disable();
+        q.tx_zerocopy(false);
+    }
+
+
+    Test(tx_engine)
+    {
+        pfq::socket q1(64), q2(64);
+
+        // two sockets serviced by the engine of core 0
+
+        for(auto q : { &q1, &q2 })
+        {
+            q->bind_tx("lo", 0, 0);
+            q->tx_engine(true);
+            q->enable();
+            AssertThrow(q->tx_engine(false));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        auto before1 = q1.tx_thread_stats(0);
+        auto before2 = q2.tx_thread_stats(0);
+
+        char packet[64] = { };
+        Assert(q1.send(pfq::const_buffer(packet, sizeof(packet))));
+        Assert(q2.send(pfq::const_buffer(packet, sizeof(packet))));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Assert(q1.tx_thread_stats(0).busy, is_greater(before1.busy));
+        Assert(q2.tx_thread_stats(0).busy, is_greater(before2.busy));
+
+        q1.disable();
+        q2.disable();
+
+        q1.tx_engine(false);
+    }
+
+
+    Test(tx_pace)
+    {
+        pfq::socket q(64);
+
+        q.bind_tx("lo", -1, 0);
+        q.enable();
+
+        AssertThrow(q.tx_pace_stats(-1));
+
+        auto now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count());
+
+        char packet[64] = { };
+
+        // 10 packets, 1 msec apart...
+
+        for(uint64_t n = 0; n < 10; n++)
+            Assert(q.send_at(pfq::const_buffer(packet, sizeof(packet)), now + n * 1000000));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Assert(q.tx_pace_stats(0).paced, is_equal_to(10ULL));
+
+        // ...and one held in the queue
+
+        Assert(q.send_at(pfq::const_buffer(packet, sizeof(packet)), now + 60000000000ULL));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Assert(q.tx_pace_stats(0).paced, is_equal_to(10ULL));
+    }
+
+
+    Test(tx_loop)
+    {
+        pfq::socket q(64);
+
+        pfq_tx_loop loop = { };
+
+        loop.queue = 0;
+        loop.count = 3;
+        loop.slots = 4;
+        loop.flags = Q_TX_LOOP_IP_ID;
+
+        AssertThrow(q.tx_loop(loop));
+
+        q.bind_tx("lo", -1, 0);
+        q.enable();
+
+        AssertNoThrow(q.tx_loop(loop));
+        AssertThrow(q.tx_loop(loop));
+
+        char packet[64] = { };
+
+        for(int n = 0; n < 4; n++)
+            Assert(q.inject(pfq::const_buffer(packet, sizeof(packet)), 0));
+
+        q.tx_queue_flush(0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Assert(q.tx_loop_state(0).first, is_equal_to(3ULL));
+        Assert(q.tx_loop_state(0).second, is_equal_to(false));
+        Assert(q.stats().sent, is_equal_to(12UL));
+
+        // forever, until stopped...
+
+        loop.count = -1;
+        loop.slots = 1;
+
+        AssertNoThrow(q.tx_loop(loop));
+        Assert(q.inject(pfq::const_buffer(packet, sizeof(packet)), 0));
+
+        q.tx_queue_flush(0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Assert(q.tx_loop_state(0).second, is_equal_to(true));
+
+        q.tx_loop_stop(0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Assert(q.tx_loop_state(0).second, is_equal_to(false));
+        Assert(q.tx_loop_state(0).first, is_greater(0ULL));
+    }
+
+
     Test(tx_queue_flush)
     {
         pfq::socket q(64);
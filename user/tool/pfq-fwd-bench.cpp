@@ -0,0 +1,213 @@
+/***************************************************************
+ *
+ * (C) 2014 - Nicola Bonelli <nicola@pfq.io>
+ *
+ ****************************************************************/
+
+/*
+ * Forwarding rate of a group whose computation fans out every packet to
+ * 1, 4 and 16 egress devices (forward >> forward >> ...).
+ *
+ * The traffic is received from the input device (e.g. generated by pfq-gen
+ * on a peer host); the egress devices are taken from the given list, in a
+ * round-robin fashion when the fan-out is larger than the list.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+#include <thread>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/lang.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq;
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    std::string dev;
+    std::vector<std::string> egress;
+
+    long int duration = 2;          // seconds
+
+    int queue = any_queue;
+    int gid   = 42;
+}
+
+
+namespace
+{
+    // forward every packet to N egress devices
+
+    template <size_t N>
+    struct fan_out
+    {
+        static auto make(std::vector<std::string> const &devs, size_t i)
+        -> decltype(forward(std::string()) >> fan_out<N-1>::make(devs, i))
+        {
+            return forward(devs[i % devs.size()]) >> fan_out<N-1>::make(devs, i+1);
+        }
+    };
+
+    template <>
+    struct fan_out<1>
+    {
+        static auto make(std::vector<std::string> const &devs, size_t i)
+        -> decltype(forward(std::string()))
+        {
+            return forward(devs[i % devs.size()]);
+        }
+    };
+}
+
+
+template <typename Comp>
+std::tuple<double, double>
+run(Comp const &comp)
+{
+    pfq::socket q(param::list, param::policy{group_policy::undefined});
+
+    q.join_group(opt::gid, group_policy::shared, class_mask::control);
+    q.bind_group(opt::gid, opt::dev.c_str(), opt::queue);
+    q.set_group_computation(opt::gid, comp);
+
+    auto begin = q.group_stats(opt::gid);
+    auto wall_begin = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds(opt::duration));
+
+    auto end  = q.group_stats(opt::gid);
+    auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wall_begin).count();
+
+    q.leave_group(opt::gid);
+
+    return std::make_tuple(static_cast<double>(end.recv - begin.recv) * 1000 / wall,
+                           static_cast<double>(end.frwd - begin.frwd) * 1000 / wall);
+}
+
+
+bool any_strcmp(const char *arg, const char *opt)
+{
+    return strcmp(arg,opt) == 0;
+}
+template <typename ...Ts>
+bool any_strcmp(const char *arg, const char *opt, Ts&&...args)
+{
+    return (strcmp(arg,opt) == 0 ? true : any_strcmp(arg, std::forward<Ts>(args)...));
+}
+
+
+void usage(std::string name)
+{
+    throw std::runtime_error
+    (
+        "usage: " + std::move(name) + " [OPTIONS]\n\n"
+        " -h --help                     Display this help\n"
+        " -i --input DEV                Receive packets from DEV\n"
+        " -q --queue QUEUE              Hardware queue of DEV (default = any)\n"
+        " -o --output DEV[,DEV...]      Egress devices\n"
+        " -g --group GID                Group id (default = 42)\n"
+        " -d --duration SEC             Duration of each run (default = 2)\n"
+    );
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 2)
+        usage(argv[0]);
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if (any_strcmp(argv[i], "-i", "--input"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("input device missing");
+
+            opt::dev.assign(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-q", "--queue"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("queue missing");
+
+            opt::queue = std::atoi(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-o", "--output"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("egress devices missing");
+
+            std::istringstream in(argv[i]);
+            std::string dev;
+
+            while (std::getline(in, dev, ','))
+                opt::egress.push_back(dev);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-g", "--group"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("group missing");
+
+            opt::gid = std::atoi(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-d", "--duration"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("duration missing");
+
+            opt::duration = std::atol(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-h", "-?", "--help"))
+            usage(argv[0]);
+
+        throw std::runtime_error(std::string(argv[i]) + " unknown option!");
+    }
+
+    if (opt::dev.empty())
+        throw std::runtime_error("input device unspecified");
+
+    if (opt::egress.empty())
+        throw std::runtime_error("egress devices unspecified");
+
+    std::cout << "input: " << opt::dev << " egress: " << opt::egress.size() << " device(s), duration: " << opt::duration << " sec" << std::endl;
+
+    std::cout << std::setw(8)  << "fan-out"
+              << std::setw(12) << "rx Mpps"
+              << std::setw(12) << "fwd Mpps" << std::endl;
+
+    auto report = [](size_t n, std::tuple<double, double> const &r)
+    {
+        std::cout << std::setw(8)  << n
+                  << std::setw(12) << std::fixed << std::setprecision(3) << std::get<0>(r)
+                  << std::setw(12) << std::get<1>(r) << std::endl;
+    };
+
+    report(1,  run(fan_out<1>::make(opt::egress, 0)));
+    report(4,  run(fan_out<4>::make(opt::egress, 0)));
+    report(16, run(fan_out<16>::make(opt::egress, 0)));
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+}
@@ -20,6 +20,7 @@
 #include <tuple>
 #include <unordered_set>
 #include <random>
+#include <chrono>
 
 #include <binding.hpp>
 #include <affinity.hpp>
@@ -79,11 +80,35 @@ namespace opt
     bool   rand_ip = false;
     char *packet   = nullptr;
 
+    double replay_speed = 0;    // pcap timing multiplier (0 = as fast as possible)
+    double rate         = 0;    // fixed rate (0 = as fast as possible)
+    bool   rate_bps     = false;
+
+    long long loop      = 0;    // Tx loop in the kernel: iterations (-1 = forever, 0 = off)
+
     std::string file;
     char errbuf[PCAP_ERRBUF_SIZE];
 }
 
 
+// departure times: nanoseconds of CLOCK_MONOTONIC
+
+inline uint64_t now_ns()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+// the interval between packets of len bytes, at the fixed rate
+
+inline double interval_ns(size_t len)
+{
+    return opt::rate_bps ? static_cast<double>(len * 8) * 1000000000 / opt::rate
+                         : 1000000000 / opt::rate;
+}
+
+
 namespace thread
 {
     struct context
@@ -133,7 +158,9 @@ namespace thread
 
         void operator()()
         {
-            if (opt::file.empty())
+            if (opt::loop)
+                loop_generator();
+            else if (opt::file.empty())
                 synt_generator();
             else
                 pcap_generator();
@@ -151,12 +178,58 @@ namespace thread
                                         m_fail->load(std::memory_order_relaxed));
         }
 
+        pfq_tx_pace_stats
+        pace_stats() const
+        {
+            pfq_tx_pace_stats ret = {0, 0, 0};
+
+            for(size_t n = 0; n < std::max<size_t>(m_bind.queue.size(), 1); n++)
+            {
+                auto s = m_pfq.tx_pace_stats(static_cast<int>(n));
+
+                ret.paced += s.paced;
+                ret.jitter += s.jitter;
+                ret.jitter_max = std::max(ret.jitter_max, s.jitter_max);
+            }
+
+            return ret;
+        }
+
     private:
 
+        // send the packet at the given time (0 = as soon as possible)
+
+        bool send(const char *buf, size_t len, uint64_t nsec)
+        {
+            if (!nsec)
+                return m_pfq.send_async(pfq::const_buffer(buf, len), opt::flush);
+
+            // synchronous transmission: the packet waits for its time here...
+
+            if (!opt::async)
+                while (now_ns() < nsec)
+                { }
+
+            // ...otherwise it is held in the Tx queue by the kernel (a full queue
+            // is not a failure: the producer is ahead of time, unless the queue
+            // does not drain within a second past the departure time)
+
+            while (!m_pfq.send_at(pfq::const_buffer(buf, len), nsec, opt::flush))
+            {
+                if (now_ns() > nsec + 1000000000)
+                    return false;
+            }
+
+            return true;
+        }
+
+
         void synt_generator()
         {
             auto ip = reinterpret_cast<iphdr *>(opt::packet + 14);
 
+            double next = static_cast<double>(now_ns());
+
             for(;;)
             {
                 if (opt::rand_ip)
@@ -165,7 +238,14 @@ namespace thread
                     ip->daddr = static_cast<uint32_t>(m_gen());
                 }
 
-                if (m_pfq.send_async(pfq::const_buffer(reinterpret_cast<const char *>(opt::packet), opt::len), opt::flush))
+                uint64_t nsec = 0;
+
+                if (opt::rate) {
+                    nsec = static_cast<uint64_t>(next);
+                    next += interval_ns(opt::len);
+                }
+
+                if (send(reinterpret_cast<const char *>(opt::packet), opt::len, nsec))
                 {
                     m_sent->fetch_add(1, std::memory_order_relaxed);
                     m_band->fetch_add(opt::len, std::memory_order_relaxed);
@@ -185,6 +265,10 @@ namespace thread
             if (p == nullptr)
                 throw std::runtime_error("pcap_open_offline:" + std::string(opt::errbuf));
 
+            // replay: the departure times follow those of the trace
+
+            double next = static_cast<double>(now_ns());
+            uint64_t start = 0, first = 0, last = 0;
 
             for(;;)
             {
@@ -205,7 +289,26 @@ namespace thread
 
                     auto len = std::min<size_t>(hdr->caplen, opt::len);
 
-                    if (m_pfq.send_async(pfq::const_buffer(reinterpret_cast<const char *>(data), len), opt::flush))
+                    uint64_t nsec = 0;
+
+                    if (opt::rate) {
+                        nsec = static_cast<uint64_t>(next);
+                        next += interval_ns(len);
+                    }
+                    else if (opt::replay_speed) {
+                        auto ts = static_cast<uint64_t>(hdr->ts.tv_sec) * 1000000000 + static_cast<uint64_t>(hdr->ts.tv_usec) * 1000;
+                        if (!start) {
+                            start = now_ns();
+                            first = ts;
+                        }
+
+                        // non-monotonic traces: a packet never departs before the previous one
+
+                        ts = last = std::max(ts, last);
+                        nsec = start + static_cast<uint64_t>(static_cast<double>(ts - first) / opt::replay_speed);
+                    }
+
+                    if (send(reinterpret_cast<const char *>(data), len, nsec))
                     {
                         m_sent->fetch_add(1, std::memory_order_relaxed);
                         m_band->fetch_add(len, std::memory_order_relaxed);
@@ -217,6 +320,76 @@ namespace thread
         }
 
 
+        // loop: the packets are enqueued once and transmitted by the kernel,
+        // the IP id (and the addresses, with -R) rewritten per packet
+
+        void loop_generator()
+        {
+            std::vector<std::string> frames;
+
+            if (opt::file.empty())
+                frames.emplace_back(opt::packet, opt::len);
+            else
+            {
+                struct pcap_pkthdr *hdr;
+                u_char *data;
+
+                auto p = pcap_open_offline(opt::file.c_str(), opt::errbuf);
+                if (p == nullptr)
+                    throw std::runtime_error("pcap_open_offline:" + std::string(opt::errbuf));
+
+                while (frames.size() < opt::slots - 1 && pcap_next_ex(p, &hdr, (u_char const **)&data) == 1)
+                    frames.emplace_back(reinterpret_cast<const char *>(data), std::min<size_t>(hdr->caplen, opt::len));
+
+                pcap_close(p);
+            }
+
+            auto queues = static_cast<int>(std::max<size_t>(m_bind.queue.size(), 1));
+
+            for(int n = 0; n < queues; n++)
+            {
+                pfq_tx_loop loop = { };
+
+                loop.queue = n;
+                loop.count = opt::loop;
+                loop.slots = static_cast<unsigned int>(frames.size());
+                loop.flags = Q_TX_LOOP_IP_ID;
+
+                if (opt::rand_ip)
+                {
+                    loop.flags |= Q_TX_LOOP_SADDR | Q_TX_LOOP_DADDR;
+                    loop.saddr = static_cast<uint32_t>(m_gen());
+                    loop.daddr = static_cast<uint32_t>(m_gen());
+                    loop.saddr_range = loop.daddr_range = 0xffffffff;
+                }
+
+                m_pfq.tx_loop(loop);
+
+                for(auto const &f : frames)
+                {
+                    while (!m_pfq.inject(pfq::const_buffer(f.data(), f.size()), n))
+                    { }
+                }
+
+                m_pfq.tx_queue_flush(n);
+            }
+
+            // synchronous transmission: a pass of the loops for each flush
+
+            for(bool active = true; active; )
+            {
+                if (opt::async)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                else
+                    m_pfq.tx_queue_flush(any_queue);
+
+                active = false;
+                for(int n = 0; n < queues; n++)
+                    active |= m_pfq.tx_loop_state(n).second;
+            }
+        }
+
+
         int m_id;
         int m_kcpu;
 
@@ -289,6 +462,28 @@ pretty(T value)
 }
 
 
+// rate: number[K|M|G](pps|bps)
+
+std::pair<double, bool>
+parse_rate(std::string const &arg)
+{
+    size_t pos;
+    auto value = std::stod(arg, &pos);
+    auto unit  = arg.substr(pos);
+
+    if (!unit.empty() && (unit[0] == 'K' || unit[0] == 'M' || unit[0] == 'G'))
+    {
+        value *= unit[0] == 'K' ? 1e3 : unit[0] == 'M' ? 1e6 : 1e9;
+        unit = unit.substr(1);
+    }
+
+    if (value <= 0 || (unit != "pps" && unit != "bps"))
+        throw std::runtime_error("pfq-gen: " + arg + ": bad rate");
+
+    return std::make_pair(value, unit == "bps");
+}
+
+
 void usage(std::string name)
 {
     throw std::runtime_error
@@ -301,6 +496,10 @@ void usage(std::string name)
         " -r --read FILE                Read trace to send from pcap\n"
         " -R --rand-ip                  Randomize IP addresses\n"
         " -f --flush INT                Set flush len, used in async tx\n"
+        " -x --replay-speed X           Replay the trace at X times its original timing\n"
+        " -p --rate RATE                Transmit at a fixed rate (e.g. 1Mpps, 10Gbps)\n"
+        " -L --loop COUNT               Enqueue the packets once and let the kernel transmit them\n"
+        "                               COUNT times (-1 = forever); -R increments the addresses\n"
         " -t --thread BINDING\n\n"
         "      BINDING = " + pfq::binding_format
     );
@@ -342,6 +541,43 @@ try
             continue;
         }
 
+        if ( any_strcmp(argv[i], "-x", "--replay-speed") )
+        {
+            if (++i == argc)
+            {
+                throw std::runtime_error("replay speed missing");
+            }
+
+            opt::replay_speed = std::atof(argv[i]);
+            if (opt::replay_speed <= 0)
+                throw std::runtime_error("pfq-gen: bad replay speed");
+            continue;
+        }
+
+        if ( any_strcmp(argv[i], "-p", "--rate") )
+        {
+            if (++i == argc)
+            {
+                throw std::runtime_error("rate missing");
+            }
+
+            std::tie(opt::rate, opt::rate_bps) = parse_rate(argv[i]);
+            continue;
+        }
+
+        if ( any_strcmp(argv[i], "-L", "--loop") )
+        {
+            if (++i == argc)
+            {
+                throw std::runtime_error("loop count missing");
+            }
+
+            opt::loop = std::atoll(argv[i]);
+            if (opt::loop == 0 || opt::loop < -1)
+                throw std::runtime_error("pfq-gen: bad loop count");
+            continue;
+        }
+
         if ( any_strcmp(argv[i], "-l", "--len") )
         {
             if (++i == argc)
@@ -401,6 +637,21 @@ try
     if (!opt::async)
         std::cout << "flush-hint : "  << opt::flush << std::endl;
 
+    if (opt::loop && (opt::rate || opt::replay_speed))
+        throw std::runtime_error("pfq-gen: loop and paced transmission are exclusive");
+
+    if (opt::loop)
+        std::cout << "loop       : "  << opt::loop << std::endl;
+
+    if (opt::rate)
+        std::cout << "rate       : "  << pretty(opt::rate) << (opt::rate_bps ? "bps" : "pps") << std::endl;
+    else if (opt::replay_speed)
+    {
+        if (opt::file.empty())
+            throw std::runtime_error("pfq-gen: replay speed requires a pcap trace (-r)");
+        std::cout << "replay     : "  << opt::replay_speed << "x" << std::endl;
+    }
+
     if (opt::slots == 0)
         throw std::runtime_error("tx_slots set to 0!");
 
@@ -467,6 +718,8 @@ try
     uint64_t band, band_ = 0;
     uint64_t fail, fail_ = 0;
 
+    pfq_tx_pace_stats pace, pace_ = {0, 0, 0};
+
     std::cout << "------------ gen started ------------\n";
 
     auto begin = std::chrono::system_clock::now();
@@ -479,6 +732,7 @@ try
         sent = 0;
         band = 0;
         fail = 0;
+        pace = {0, 0, 0};
 
         std::for_each(thread_ctx.begin(), thread_ctx.end(), [&](const thread::context *c)
         {
@@ -488,6 +742,12 @@ try
             sent += std::get<1>(p);
             band += std::get<2>(p);
             fail += std::get<3>(p);
+
+            auto ps = c->pace_stats();
+
+            pace.paced += ps.paced;
+            pace.jitter += ps.jitter;
+            pace.jitter_max = std::max(pace.jitter_max, ps.jitter_max);
         });
 
         auto end   = std::chrono::system_clock::now();
@@ -500,12 +760,21 @@ try
                   << "band: " << pretty(persecond<double>((band-band_)*8, delta))  << "bit/sec "
                   << vt100::RESET << " } - "
                   << "sent: " << vt100::BOLD << persecond<int64_t>(cur.sent - prec.sent, delta) << vt100::RESET << " pkt/sec - "
-                  << "disc: " << vt100::BOLD << persecond<int64_t>(cur.disc - prec.disc, delta) << vt100::RESET << " pkt/sec" << std::endl;
+                  << "disc: " << vt100::BOLD << persecond<int64_t>(cur.disc - prec.disc, delta) << vt100::RESET << " pkt/sec";
+
+        // inter-departure jitter of the paced packets (average over the last second, max overall)
+
+        if (pace.paced > pace_.paced)
+            std::cout << " - jitter: avg " << vt100::BOLD << (pace.jitter - pace_.jitter) / (pace.paced - pace_.paced) << vt100::RESET
+                      << " nsec, max " << pace.jitter_max << " nsec";
+
+        std::cout << std::endl;
 
         prec = cur, begin = end;
         sent_ = sent;
         band_ = band;
         fail_ = fail;
+        pace_ = pace;
     }
 
 }
@@ -0,0 +1,495 @@
+/***************************************************************
+ *
+ * (C) 2014 - Nicola Bonelli <nicola@pfq.io>
+ *
+ ****************************************************************/
+
+/*
+ * Transmission rate and CPU cost per packet of the Tx kernel thread, with
+ * copy and zero-copy transmission, at several packet sizes.
+ *
+ * Packets are injected into the Tx queue by this process and transmitted
+ * by a kernel thread bound to the given core. The CPU cost is the busy time
+ * of that core (from /proc/stat) divided by the packets sent.
+ *
+ * With --flush, the cost of the Q_SO_TX_FLUSH syscall (no kernel thread,
+ * one packet transmitted per flush) is measured instead.
+ *
+ * With --sockets, the aggregate rate of many sockets (fed by the producer
+ * threads of this process) is measured, along with the cores used in kernel
+ * mode (system time of all the cpus / wall time): with a kernel thread per
+ * socket or, with --engine, with the shared per-core Tx engines.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+
+#include <thread>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <tuple>
+
+#include <unistd.h>
+
+#include <pfq/pfq.hpp>
+
+using namespace pfq;
+
+
+namespace opt
+{
+    std::string dev;
+
+    std::vector<size_t> sizes = { 64, 512, 1500 };
+
+    long int duration = 2;          // seconds
+    size_t   slots    = 4096;
+
+    int queue = any_queue;
+    int core  = 0;
+
+    bool flush = false;
+
+    std::vector<size_t> sockets;
+    std::vector<int> cores;         // cores of the kernel threads (--sockets)
+    size_t producers = 1;
+    bool engine = false;
+}
+
+
+namespace
+{
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // busy time of the given cpu (ns), from /proc/stat
+
+    int64_t cpu_busy_ns(int cpu)
+    {
+        std::ifstream in("/proc/stat");
+        std::string line, name = "cpu" + std::to_string(cpu);
+
+        while (std::getline(in, line))
+        {
+            std::istringstream ss(line);
+            std::string tag;
+            int64_t user, nice, system, idle, iowait, irq, softirq;
+
+            ss >> tag;
+            if (tag != name)
+                continue;
+
+            ss >> user >> nice >> system >> idle >> iowait >> irq >> softirq;
+
+            return (user + nice + system + irq + softirq) * (1000000000LL / sysconf(_SC_CLK_TCK));
+        }
+
+        throw std::runtime_error("cpu" + std::to_string(cpu) + ": not found in /proc/stat");
+    }
+
+    // system time of all the cpus (ns), from /proc/stat
+
+    int64_t cpus_system_ns()
+    {
+        std::ifstream in("/proc/stat");
+        std::string line;
+        int64_t ret = 0;
+
+        while (std::getline(in, line))
+        {
+            std::istringstream ss(line);
+            std::string tag;
+            int64_t user, nice, system, idle, iowait, irq, softirq;
+
+            ss >> tag;
+            if (tag.compare(0, 3, "cpu") != 0 || tag == "cpu")
+                continue;
+
+            ss >> user >> nice >> system >> idle >> iowait >> irq >> softirq;
+
+            ret += (system + irq + softirq) * (1000000000LL / sysconf(_SC_CLK_TCK));
+        }
+
+        return ret;
+    }
+
+    std::vector<int> parse_list(const char *arg)
+    {
+        std::istringstream in(arg);
+        std::string item;
+        std::vector<int> ret;
+
+        while (std::getline(in, item, ','))
+            ret.push_back(std::stoi(item));
+        return ret;
+    }
+}
+
+
+std::tuple<double, double>
+run(bool zerocopy, size_t size)
+{
+    pfq::socket q(param::list, param::maxlen{size}, param::tx_slots{opt::slots});
+
+    q.bind_tx(opt::dev.c_str(), opt::queue, opt::core);
+    q.tx_zerocopy(zerocopy);
+    q.enable();
+
+    std::vector<char> packet(size, 0);
+
+    memset(packet.data(), 0xff, 6);                     // broadcast
+    packet[12] = '\x88'; packet[13] = '\xb5';           // local experimental ethertype
+
+    auto sent_begin = q.stats().sent;
+    auto cpu_begin  = cpu_busy_ns(opt::core);
+    auto wall_begin = now_ns();
+    auto wall_end   = wall_begin + opt::duration * 1000000000LL;
+
+    while (now_ns() < wall_end)
+    {
+        for(int n = 0; n < 1024; n++)
+        {
+            if (!q.send_async(const_buffer(packet.data(), packet.size())))
+                break;
+        }
+    }
+
+    auto sent = q.stats().sent - sent_begin;
+    auto cpu  = cpu_busy_ns(opt::core) - cpu_begin;
+    auto wall = now_ns() - wall_begin;
+
+    q.disable();
+
+    if (sent == 0)
+        return std::make_tuple(0.0, 0.0);
+
+    return std::make_tuple(static_cast<double>(sent) * 1000 / wall,
+                           static_cast<double>(cpu) / sent);
+}
+
+
+// aggregate rate (Mpps) and cores used by the kernel, with many sockets
+
+std::tuple<double, double>
+run_sockets(size_t num, size_t size)
+{
+    std::vector<std::unique_ptr<pfq::socket>> qs;
+
+    for(size_t n = 0; n < num; n++)
+    {
+        qs.emplace_back(new pfq::socket(param::list, param::maxlen{size}, param::tx_slots{opt::slots}));
+
+        qs.back()->bind_tx(opt::dev.c_str(), opt::queue, opt::cores[n % opt::cores.size()]);
+        qs.back()->tx_engine(opt::engine);
+        qs.back()->enable();
+    }
+
+    std::vector<char> packet(size, 0);
+
+    memset(packet.data(), 0xff, 6);                     // broadcast
+    packet[12] = '\x88'; packet[13] = '\xb5';           // local experimental ethertype
+
+    auto sent = [&]() {
+        unsigned long ret = 0;
+        for(auto & q : qs)
+            ret += q->stats().sent;
+        return ret;
+    };
+
+    auto sent_begin = sent();
+    auto cpu_begin  = cpus_system_ns();
+    auto wall_begin = now_ns();
+    auto wall_end   = wall_begin + opt::duration * 1000000000LL;
+
+    // the sockets are partitioned among the producers
+
+    std::vector<std::thread> producers;
+
+    for(size_t p = 0; p < std::min(opt::producers, num); p++)
+    {
+        producers.emplace_back([&, p]() {
+            while (now_ns() < wall_end)
+            {
+                for(size_t n = p; n < num; n += opt::producers)
+                    for(int i = 0; i < 64; i++)
+                        if (!qs[n]->send_async(const_buffer(packet.data(), packet.size())))
+                            break;
+            }
+        });
+    }
+
+    for(auto & t : producers)
+        t.join();
+
+    auto pkts = sent() - sent_begin;
+    auto cpu  = cpus_system_ns() - cpu_begin;
+    auto wall = now_ns() - wall_begin;
+
+    for(auto & q : qs)
+        q->disable();
+
+    return std::make_tuple(static_cast<double>(pkts) * 1000 / wall,
+                           static_cast<double>(cpu) / wall);
+}
+
+
+// average cost of a flush syscall (ns), one packet per flush
+
+double
+run_flush(size_t size)
+{
+    pfq::socket q(param::list, param::maxlen{size}, param::tx_slots{opt::slots});
+
+    q.bind_tx(opt::dev.c_str(), opt::queue, -1);
+    q.enable();
+
+    std::vector<char> packet(size, 0);
+
+    memset(packet.data(), 0xff, 6);                     // broadcast
+    packet[12] = '\x88'; packet[13] = '\xb5';           // local experimental ethertype
+
+    auto wall_end = now_ns() + opt::duration * 1000000000LL;
+    int64_t cost = 0, flushes = 0;
+
+    while (now_ns() < wall_end)
+    {
+        if (!q.inject(const_buffer(packet.data(), packet.size()), 0))
+            continue;
+
+        auto begin = now_ns();
+        q.tx_queue_flush(0);
+        cost += now_ns() - begin;
+        flushes++;
+    }
+
+    q.disable();
+
+    return flushes ? static_cast<double>(cost) / flushes : 0.0;
+}
+
+
+bool any_strcmp(const char *arg, const char *opt)
+{
+    return strcmp(arg,opt) == 0;
+}
+template <typename ...Ts>
+bool any_strcmp(const char *arg, const char *opt, Ts&&...args)
+{
+    return (strcmp(arg,opt) == 0 ? true : any_strcmp(arg, std::forward<Ts>(args)...));
+}
+
+
+void usage(std::string name)
+{
+    throw std::runtime_error
+    (
+        "usage: " + std::move(name) + " [OPTIONS]\n\n"
+        " -h --help                     Display this help\n"
+        " -t --tx DEV                   Send packets to DEV\n"
+        " -q --queue QUEUE              Hardware queue (default = any)\n"
+        " -k --core CORE                Core of the Tx kernel thread (default = 0)\n"
+        " -S --sizes LEN[,LEN...]       Packet sizes (default = 64,512,1500)\n"
+        " -s --slots SLOTS              Slots of the Tx queue (default = 4096)\n"
+        " -d --duration SEC             Duration of each run (default = 2)\n"
+        " -f --flush                    Measure the cost of the flush syscall\n"
+        " -n --sockets N[,N...]         Measure the aggregate rate of N sockets\n"
+        " -K --cores CORE[,CORE...]     Cores of the kernel threads of the sockets (default = core)\n"
+        " -p --producers NUM            Producer threads feeding the sockets (default = 1)\n"
+        " -e --engine                   Attach the sockets to the shared Tx engines\n"
+    );
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 2)
+        usage(argv[0]);
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if (any_strcmp(argv[i], "-t", "--tx"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("Tx device missing");
+
+            opt::dev.assign(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-q", "--queue"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("queue missing");
+
+            opt::queue = std::atoi(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-k", "--core"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("core missing");
+
+            opt::core = std::atoi(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-S", "--sizes"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("sizes missing");
+
+            std::istringstream in(argv[i]);
+            std::string size;
+
+            opt::sizes.clear();
+            while (std::getline(in, size, ','))
+                opt::sizes.push_back(std::stoul(size));
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-s", "--slots"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("slots missing");
+
+            opt::slots = std::stoul(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-d", "--duration"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("duration missing");
+
+            opt::duration = std::atol(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-f", "--flush"))
+        {
+            opt::flush = true;
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-n", "--sockets"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("sockets missing");
+
+            for(auto n : parse_list(argv[i]))
+                opt::sockets.push_back(static_cast<size_t>(n));
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-K", "--cores"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("cores missing");
+
+            opt::cores = parse_list(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-p", "--producers"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("producers missing");
+
+            opt::producers = std::max(1UL, std::stoul(argv[i]));
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-e", "--engine"))
+        {
+            opt::engine = true;
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-h", "-?", "--help"))
+            usage(argv[0]);
+
+        throw std::runtime_error(std::string(argv[i]) + " unknown option!");
+    }
+
+    if (opt::dev.empty())
+        throw std::runtime_error("Tx device unspecified");
+
+    if (opt::sizes.empty() || std::find_if(opt::sizes.begin(), opt::sizes.end(), [](size_t s) { return s < 60; }) != opt::sizes.end())
+        throw std::runtime_error("bad sizes (min 60 bytes)");
+
+    if (!opt::sockets.empty())
+    {
+        if (opt::cores.empty())
+            opt::cores.push_back(opt::core);
+
+        std::cout << "tx: " << opt::dev << (opt::engine ? " engines" : " threads") << " on " << opt::cores.size() << " core(s), "
+                  << opt::producers << " producer(s), duration: " << opt::duration << " sec" << std::endl;
+
+        std::cout << std::setw(8)  << "sockets"
+                  << std::setw(8)  << "size"
+                  << std::setw(10) << "Mpps"
+                  << std::setw(8)  << "cores" << std::endl;
+
+        for(auto num : opt::sockets)
+        {
+            for(auto size : opt::sizes)
+            {
+                auto r = run_sockets(num, size);
+
+                std::cout << std::setw(8)  << num
+                          << std::setw(8)  << size
+                          << std::setw(10) << std::fixed << std::setprecision(3) << std::get<0>(r)
+                          << std::setw(8)  << std::setprecision(2) << std::get<1>(r) << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    if (opt::flush)
+    {
+        std::cout << "tx: " << opt::dev << " flush syscall (1 packet per flush), duration: " << opt::duration << " sec" << std::endl;
+
+        std::cout << std::setw(8)  << "size"
+                  << std::setw(12) << "ns/flush" << std::endl;
+
+        for(auto size : opt::sizes)
+            std::cout << std::setw(8)  << size
+                      << std::setw(12) << std::fixed << std::setprecision(1) << run_flush(size) << std::endl;
+        return 0;
+    }
+
+    std::cout << "tx: " << opt::dev << " core: " << opt::core << " slots: " << opt::slots << " duration: " << opt::duration << " sec" << std::endl;
+
+    std::cout << std::setw(10) << "mode"
+              << std::setw(8)  << "size"
+              << std::setw(10) << "Mpps"
+              << std::setw(12) << "ns/pkt" << std::endl;
+
+    for(auto zerocopy : { false, true })
+    {
+        for(auto size : opt::sizes)
+        {
+            auto r = run(zerocopy, size);
+
+            std::cout << std::setw(10) << (zerocopy ? "zero-copy" : "copy")
+                      << std::setw(8)  << size
+                      << std::setw(10) << std::fixed << std::setprecision(3) << std::get<0>(r)
+                      << std::setw(12) << std::setprecision(1) << std::get<1>(r) << std::endl;
+        }
+    }
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+}
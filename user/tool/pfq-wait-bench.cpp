@@ -0,0 +1,329 @@
+/***************************************************************
+ *
+ * (C) 2014 - Nicola Bonelli <nicola@pfq.io>
+ *
+ ****************************************************************/
+
+/*
+ * Delivery latency and CPU usage of the reader for each wait strategy of
+ * read (spin, hybrid, block), at several packet rates.
+ *
+ * Packets are sent by a PFQ socket on the Tx device, with the send time in
+ * the payload, and captured on the Rx device (e.g. the two ends of a veth
+ * pair). The latency is measured when the packet is delivered to the
+ * dispatch callback.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+#include <thread>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <pfq/pfq.hpp>
+
+#include <affinity.hpp>
+
+using namespace pfq;
+
+
+namespace opt
+{
+    std::string tx_dev;
+    std::string rx_dev;
+
+    std::vector<unsigned long> rates = { 1000, 10000, 100000, 1000000 };
+
+    long int duration = 2;          // seconds
+    long int spin_ns  = 50000;
+
+    int tx_core = -1;
+    int rx_core = -1;
+}
+
+
+namespace
+{
+    const uint32_t magic = 0x5046510a;
+
+    struct payload
+    {
+        uint32_t magic;
+        uint64_t tstamp;
+    } __attribute__((packed));
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int64_t thread_cpu_us()
+    {
+        struct rusage ru;
+        getrusage(RUSAGE_THREAD, &ru);
+        return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    }
+
+    const char *
+    strategy_name(wait_strategy s)
+    {
+        switch(s)
+        {
+        case wait_strategy::spin:   return "spin";
+        case wait_strategy::hybrid: return "hybrid";
+        case wait_strategy::block:  return "block";
+        case wait_strategy::none:   return "none";
+        }
+        return "unknown";
+    }
+}
+
+
+void sender(unsigned long rate, std::atomic_bool &stop)
+{
+    pfq::socket q(param::list, param::maxlen{64}, param::tx_slots{4096});
+
+    q.bind_tx(opt::tx_dev.c_str());
+    q.enable();
+
+    char packet[64] = { };
+
+    memset(packet, 0xff, 6);                    // broadcast
+    packet[12] = '\x88'; packet[13] = '\xb5';   // local experimental ethertype
+
+    auto pl = reinterpret_cast<payload *>(packet + 14);
+    pl->magic = magic;
+
+    auto period = 1000000000LL / static_cast<int64_t>(rate);
+    auto next   = now_ns();
+
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        int64_t now;
+
+        while ((now = now_ns()) < next)
+        {
+            if (next - now > 100000)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(next - now - 50000));
+            else
+                cpu_relax();
+        }
+
+        pl->tstamp = static_cast<uint64_t>(now);
+        q.send(const_buffer(packet, sizeof(packet)));
+
+        next += period;
+    }
+}
+
+
+std::tuple<size_t, double, double, double>
+run(wait_strategy strategy, unsigned long rate)
+{
+    pfq::socket q(param::list, param::caplen{64}, param::rx_slots{8192});
+
+    q.rx_wait(strategy, opt::spin_ns);
+    q.timestamp_enable(false);
+    q.bind(opt::rx_dev.c_str());
+    q.enable();
+
+    std::vector<int64_t> lat;
+    lat.reserve(rate * static_cast<unsigned long>(opt::duration) + 1024);
+
+    std::atomic_bool stop(false);
+
+    std::thread tx(sender, rate, std::ref(stop));
+    if (opt::tx_core != -1)
+        extra::set_affinity(tx, opt::tx_core);
+
+    auto cpu_begin  = thread_cpu_us();
+    auto wall_begin = now_ns();
+    auto wall_end   = wall_begin + opt::duration * 1000000000LL;
+
+    while (now_ns() < wall_end)
+    {
+        q.dispatch([&](char *, const pfq_pkthdr *h, const char *data) {
+
+            if (h->caplen < 14 + sizeof(payload))
+                return;
+
+            auto pl = reinterpret_cast<const payload *>(data + 14);
+            if (pl->magic == magic)
+                lat.push_back(now_ns() - static_cast<int64_t>(pl->tstamp));
+
+        }, 100000);
+    }
+
+    auto cpu  = thread_cpu_us() - cpu_begin;
+    auto wall = (now_ns() - wall_begin) / 1000;
+
+    stop.store(true);
+    tx.join();
+
+    if (lat.empty())
+        return std::make_tuple(0, 100.0 * cpu / wall, 0.0, 0.0);
+
+    std::sort(lat.begin(), lat.end());
+
+    return std::make_tuple(lat.size(), 100.0 * cpu / wall,
+                           lat[lat.size() * 50 / 100] / 1000.0,
+                           lat[lat.size() * 99 / 100] / 1000.0);
+}
+
+
+bool any_strcmp(const char *arg, const char *opt)
+{
+    return strcmp(arg,opt) == 0;
+}
+template <typename ...Ts>
+bool any_strcmp(const char *arg, const char *opt, Ts&&...args)
+{
+    return (strcmp(arg,opt) == 0 ? true : any_strcmp(arg, std::forward<Ts>(args)...));
+}
+
+
+void usage(std::string name)
+{
+    throw std::runtime_error
+    (
+        "usage: " + std::move(name) + " [OPTIONS]\n\n"
+        " -h --help                     Display this help\n"
+        " -t --tx DEV                   Send packets to DEV\n"
+        " -r --rx DEV                   Capture packets from DEV (default = Tx device)\n"
+        " -R --rates PPS[,PPS...]       Packet rates (default = 1000,10000,100000,1000000)\n"
+        " -d --duration SEC             Duration of each run (default = 2)\n"
+        " -s --spin NS                  Spin budget of the hybrid strategy (default = 50000)\n"
+        " -c --core TX_CORE,RX_CORE     Bind the sender and the reader to the given cores\n"
+    );
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 2)
+        usage(argv[0]);
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if (any_strcmp(argv[i], "-t", "--tx"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("Tx device missing");
+
+            opt::tx_dev.assign(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-r", "--rx"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("Rx device missing");
+
+            opt::rx_dev.assign(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-R", "--rates"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("rates missing");
+
+            std::istringstream in(argv[i]);
+            std::string rate;
+
+            opt::rates.clear();
+            while (std::getline(in, rate, ','))
+                opt::rates.push_back(std::stoul(rate));
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-d", "--duration"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("duration missing");
+
+            opt::duration = std::atol(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-s", "--spin"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("spin budget missing");
+
+            opt::spin_ns = std::atol(argv[i]);
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-c", "--core"))
+        {
+            if (++i == argc)
+                throw std::runtime_error("cores missing");
+
+            if (sscanf(argv[i], "%d,%d", &opt::tx_core, &opt::rx_core) != 2)
+                throw std::runtime_error("cores: TX_CORE,RX_CORE expected");
+            continue;
+        }
+
+        if (any_strcmp(argv[i], "-h", "-?", "--help"))
+            usage(argv[0]);
+
+        throw std::runtime_error(std::string(argv[i]) + " unknown option!");
+    }
+
+    if (opt::tx_dev.empty())
+        throw std::runtime_error("Tx device unspecified");
+
+    if (opt::rx_dev.empty())
+        opt::rx_dev = opt::tx_dev;
+
+    if (opt::rates.empty() || std::find(opt::rates.begin(), opt::rates.end(), 0) != opt::rates.end())
+        throw std::runtime_error("bad rates");
+
+    if (opt::rx_core != -1)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(opt::rx_core, &cpuset);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    }
+
+    std::cout << "tx: " << opt::tx_dev << " rx: " << opt::rx_dev << " duration: " << opt::duration << " sec, spin: " << opt::spin_ns << " ns" << std::endl;
+
+    std::cout << std::setw(8)  << "wait"
+              << std::setw(10) << "rate"
+              << std::setw(10) << "recv"
+              << std::setw(8)  << "cpu%"
+              << std::setw(12) << "p50(us)"
+              << std::setw(12) << "p99(us)" << std::endl;
+
+    for(auto strategy : { wait_strategy::spin, wait_strategy::hybrid, wait_strategy::block })
+    {
+        for(auto rate : opt::rates)
+        {
+            auto r = run(strategy, rate);
+
+            std::cout << std::setw(8)  << strategy_name(strategy)
+                      << std::setw(10) << rate
+                      << std::setw(10) << std::get<0>(r)
+                      << std::setw(8)  << std::fixed << std::setprecision(1) << std::get<1>(r)
+                      << std::setw(12) << std::setprecision(2) << std::get<2>(r)
+                      << std::setw(12) << std::get<3>(r) << std::endl;
+        }
+    }
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+}